@@ -3,32 +3,726 @@
 #include <stdio.h>
 #include "assert.h"
 #include "compress40.h"
+#include "compressed_geometry.h"
+#include "compressed_stats.h"
+#include "compressed_adjust.h"
+#include "compressed_changes.h"
+#include "downscale.h"
+#include "io.h"
+#include "phash_index.h"
+#include "comp40_image.h"
+#include "parallel_decode.h"
+#include "pyramid.h"
+#include "progressive.h"
+#include "sequence.h"
+#include "reencode.h"
+#include "rate_control.h"
+#include "codeword_layout.h"
+#include "grayscale.h"
+#include "compress40_edges.h"
+#include "batch.h"
+#include "memory_report.h"
+#include "tuning.h"
+#include "calibrate.h"
+
+static Geometry_Transform transform;
+static int crop_x, crop_y, crop_width, crop_height;
+
+static void transform_input(FILE *input)
+{
+        transform40(input, stdout, transform);
+}
+
+static Adjustment adjustment = ADJUSTMENT_NONE;
+static Overlay overlay;
+
+static void adjust_input(FILE *input)
+{
+        adjust40(input, stdout, &adjustment,
+                 overlay.image != NULL ? &overlay : NULL);
+}
+
+static const Codeword_Array *read_overlay(const char *path)
+{
+        FILE *fp = fopen(path, "r");
+        Codeword_Array *codeword_array = fp != NULL
+                                         ? read_codeword_array(fp) : NULL;
+        if (codeword_array == NULL) {
+                fprintf(stderr, "Error: Could not read overlay %s.\n", path);
+                exit(EXIT_FAILURE);
+        }
+        fclose(fp);
+        return codeword_array;
+}
+
+static int downscale_steps;
+
+static void downscale_input(FILE *input)
+{
+        downscale40(input, stdout, downscale_steps);
+}
+
+static void stats_input(FILE *input)
+{
+        stats40(input, stdout);
+}
+
+static void phash_input(FILE *input)
+{
+        uint64_t hash;
+        if (!read_image_phash(input, &hash)) {
+                exit(EXIT_FAILURE);
+        }
+        printf("%016llx\n", (unsigned long long)hash);
+}
+
+static uint64_t phash_of_file(const char *path)
+{
+        uint64_t hash;
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL || !read_image_phash(fp, &hash)) {
+                fprintf(stderr, "Error: Could not hash %s.\n", path);
+                exit(EXIT_FAILURE);
+        }
+        fclose(fp);
+        return hash;
+}
+
+static int phash_add(const char *index_path, int count, char *paths[])
+{
+        uint64_t *hashes = malloc(count * sizeof(uint64_t));
+        assert(hashes != NULL);
+
+        for (int i = 0; i < count; i++) {
+                hashes[i] = phash_of_file(paths[i]);
+        }
+        bool ok = phash_index_append(index_path, (const char **)paths,
+                                     hashes, count);
+        free(hashes);
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int phash_query(const char *index_path, int max_distance, int count,
+                       char *paths[])
+{
+        Phash_Index index = phash_index_open(index_path);
+        if (index == NULL) {
+                return EXIT_FAILURE;
+        }
+
+        for (int i = 0; i < count; i++) {
+                uint64_t match_count;
+                Phash_Match *matches = phash_index_query(index,
+                                                         phash_of_file(paths[i]),
+                                                         max_distance,
+                                                         &match_count);
+                for (uint64_t m = 0; m < match_count; m++) {
+                        size_t length;
+                        const char *name = phash_index_name(index,
+                                                            matches[m].entry,
+                                                            &length);
+                        printf("%s\t%.*s\t%d\n", paths[i], (int)length,
+                               name, matches[m].distance);
+                }
+                free(matches);
+        }
+
+        phash_index_close(&index);
+        return EXIT_SUCCESS;
+}
+
+static int print_changes(const char *before_path, const char *after_path,
+                         const Change_Tolerance *tolerance,
+                         const char *mask_path)
+{
+        FILE *before = fopen(before_path, "r");
+        FILE *after = fopen(after_path, "r");
+        FILE *mask = mask_path != NULL ? fopen(mask_path, "w") : NULL;
+        assert(before != NULL && after != NULL &&
+               (mask_path == NULL || mask != NULL));
+
+        bool ok = changes40(before, after, tolerance, stdout, mask);
+
+        fclose(before);
+        fclose(after);
+        if (mask != NULL) {
+                fclose(mask);
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int print_pixel(const char *position, const char *path)
+{
+        int x, y;
+        char extra;
+        if (sscanf(position, "%d,%d%c", &x, &y, &extra) != 2) {
+                fprintf(stderr, "Error: --pixel expects X,Y\n");
+                return EXIT_FAILURE;
+        }
+
+        Comp40_Image image = Comp40_Image_open(path);
+        if (image == NULL) {
+                return EXIT_FAILURE;
+        }
+        if (x < 0 || x >= Comp40_Image_width(image) ||
+            y < 0 || y >= Comp40_Image_height(image)) {
+                fprintf(stderr, "Error: Pixel is outside the image.\n");
+                Comp40_Image_close(&image);
+                return EXIT_FAILURE;
+        }
+
+        Pixel pixel = Comp40_Image_get_pixel(image, x, y);
+        printf("%u %u %u\n", pixel.red, pixel.green, pixel.blue);
+        Comp40_Image_close(&image);
+
+        return EXIT_SUCCESS;
+}
+
+static void decompress_parallel_input(FILE *input)
+{
+        decompress40_parallel(input, stdout, tuning_threads(),
+                              tuning_profile()->decode_rows_per_write);
+}
+
+static void compress_pyramid_input(FILE *input)
+{
+        compress40_pyramid(input, stdout);
+}
+
+static void pyramid_info_input(FILE *input)
+{
+        Pyramid pyramid = pyramid_open(input);
+        if (pyramid == NULL) {
+                exit(EXIT_FAILURE);
+        }
+        for (int level = 0; level < pyramid_levels(pyramid); level++) {
+                int width, height, tiles_x, tiles_y;
+                pyramid_level_size(pyramid, level, &width, &height,
+                                   &tiles_x, &tiles_y);
+                printf("level %d: %dx%d pixels, %dx%d tiles\n", level,
+                       width, height, tiles_x, tiles_y);
+        }
+        pyramid_free(&pyramid);
+}
+
+static void compress_progressive_input(FILE *input)
+{
+        compress40_progressive(input, stdout);
+}
+
+static void decompress_progressive_input(FILE *input)
+{
+        decompress40_progressive(input, stdout, false);
+}
+
+static void preview_input(FILE *input)
+{
+        decompress40_progressive(input, stdout, true);
+}
+
+static void unsequence_input(FILE *input)
+{
+        unsequence40(input, stdout);
+}
+
+static Rate_Target rate_target;
+
+static void compress_adaptive_input(FILE *input)
+{
+        compress40_adaptive(input, stdout, rate_target);
+}
+
+static void decompress_adaptive_input(FILE *input)
+{
+        decompress40_adaptive(input, stdout);
+}
+
+static const Codeword_Layout *layout;
+
+static void compress_layout_input(FILE *input)
+{
+        compress40_layout(input, stdout, layout);
+}
+
+static void decompress_layout_input(FILE *input)
+{
+        decompress40_layout(input, stdout);
+}
+
+static void compress_padded_input(FILE *input)
+{
+        compress40_edges(input, stdout, EDGE_REPLICATE);
+}
+
+static void compress_gray_input(FILE *input)
+{
+        compress40_gray(input, stdout);
+}
+
+static void decompress_gray_input(FILE *input)
+{
+        decompress40_gray(input, stdout);
+}
+
+static int tile_level, tile_x, tile_y;
+
+static void tile_input(FILE *input)
+{
+        Pyramid pyramid = pyramid_open(input);
+        if (pyramid == NULL ||
+            !pyramid_write_tile(pyramid, tile_level, tile_x, tile_y, stdout)) {
+                exit(EXIT_FAILURE);
+        }
+        pyramid_free(&pyramid);
+}
+
+static void crop_input(FILE *input)
+{
+        crop40(input, stdout, crop_x, crop_y, crop_width, crop_height);
+}
+
+static int join_files(int count, char *paths[], Join_Direction direction)
+{
+        FILE **inputs = malloc(count * sizeof(FILE *));
+        assert(inputs != NULL);
+
+        for (int i = 0; i < count; i++) {
+                inputs[i] = fopen(paths[i], "r");
+                assert(inputs[i] != NULL);
+        }
+        join40(inputs, count, stdout, direction);
+        for (int i = 0; i < count; i++) {
+                fclose(inputs[i]);
+        }
+        free(inputs);
+
+        return EXIT_SUCCESS;
+}
+
+static int reencode(char *previous_path, char *path, int count, char *extra[])
+{
+        /* The extra arguments are either rectangles or the old image */
+        Dirty_Rect *rects = NULL;
+        char *old_path = NULL;
+        if (count > 0) {
+                char trailing;
+                Dirty_Rect rect;
+                if (sscanf(extra[0], "%dx%d+%d+%d%c", &rect.width,
+                           &rect.height, &rect.x, &rect.y, &trailing) == 4) {
+                        rects = malloc(count * sizeof(Dirty_Rect));
+                        assert(rects != NULL);
+                        for (int i = 0; i < count; i++) {
+                                if (sscanf(extra[i], "%dx%d+%d+%d%c",
+                                           &rects[i].width, &rects[i].height,
+                                           &rects[i].x, &rects[i].y,
+                                           &trailing) != 4) {
+                                        fprintf(stderr, "Error: Bad "
+                                                "rectangle '%s'\n", extra[i]);
+                                        free(rects);
+                                        return EXIT_FAILURE;
+                                }
+                        }
+                } else if (count == 1) {
+                        old_path = extra[0];
+                } else {
+                        fprintf(stderr, "Error: --reencode takes either "
+                                "rectangles or one old image\n");
+                        return EXIT_FAILURE;
+                }
+        }
+
+        FILE *previous = fopen(previous_path, "r");
+        FILE *input = fopen(path, "r");
+        FILE *old_input = old_path != NULL ? fopen(old_path, "r") : NULL;
+        assert(previous != NULL && input != NULL &&
+               (old_path == NULL || old_input != NULL));
+
+        bool ok = reencode40(previous, input, old_input, rects,
+                             rects != NULL ? count : 0, stdout);
+
+        fclose(previous);
+        fclose(input);
+        if (old_input != NULL) {
+                fclose(old_input);
+        }
+        free(rects);
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 static void (*compress_or_decompress)(FILE *input) = compress40;
 
 int main(int argc, char *argv[])
 {
         int i;
+        bool parallel = false;
+        bool pyramid = false;
+        bool progressive = false;
+        bool adaptive = false;
+        bool layouts = false;
+        bool gray = false;
+        bool pad = false;
+        bool memory = false;
+        Change_Tolerance tolerance = { 0, 0, 0 };
+        const char *mask_path = NULL;
 
         for (i = 1; i < argc; i++) {
                 if (strcmp(argv[i], "-c") == 0) {
                         compress_or_decompress = compress40;
                 } else if (strcmp(argv[i], "-d") == 0) {
                         compress_or_decompress = decompress40;
+                } else if (strcmp(argv[i], "--parallel") == 0) {
+                        parallel = true;
+                } else if (strcmp(argv[i], "--pyramid") == 0) {
+                        pyramid = true;
+                } else if (strcmp(argv[i], "--progressive") == 0) {
+                        progressive = true;
+                } else if (strcmp(argv[i], "--target-bytes") == 0 ||
+                           strcmp(argv[i], "--target-psnr") == 0) {
+                        char extra;
+                        if (i + 1 >= argc ||
+                            sscanf(argv[i + 1], "%lf%c", &rate_target.value,
+                                   &extra) != 1 || rate_target.value <= 0) {
+                                fprintf(stderr, "%s: %s expects a positive "
+                                        "number\n", argv[0], argv[i]);
+                                exit(1);
+                        }
+                        rate_target.kind = argv[i][9] == 'b'
+                                           ? RATE_TARGET_BYTES
+                                           : RATE_TARGET_PSNR;
+                        adaptive = true;
+                        i++;
+                } else if (strcmp(argv[i], "--adaptive") == 0) {
+                        adaptive = true;
+                } else if (strcmp(argv[i], "--gray") == 0) {
+                        gray = true;
+                } else if (strcmp(argv[i], "--pad") == 0) {
+                        pad = true;
+                } else if (strcmp(argv[i], "--memory-report") == 0) {
+                        memory = true;
+                } else if (strcmp(argv[i], "--layout") == 0) {
+                        /* The name is only needed to compress; the
+                           decompressor reads it from the header */
+                        if (i + 1 < argc &&
+                            codeword_layout_named(argv[i + 1]) != NULL) {
+                                layout = codeword_layout_named(argv[++i]);
+                        }
+                        layouts = true;
+                } else if (strcmp(argv[i], "--preview") == 0) {
+                        compress_or_decompress = preview_input;
+                } else if (strcmp(argv[i], "--sequence") == 0) {
+                        if (i + 1 >= argc) {
+                                fprintf(stderr, "%s: --sequence expects one "
+                                        "or more frames\n", argv[0]);
+                                exit(1);
+                        }
+                        return sequence40(argv + i + 1, argc - i - 1, stdout)
+                               ? EXIT_SUCCESS : EXIT_FAILURE;
+                } else if (strcmp(argv[i], "--batch") == 0) {
+                        if (argc - i < 3) {
+                                fprintf(stderr, "%s: --batch expects a "
+                                        "directory and one or more "
+                                        "images\n", argv[0]);
+                                exit(1);
+                        }
+                        return batch40(argv[i + 1], argv + i + 2,
+                                       argc - i - 2)
+                               ? EXIT_SUCCESS : EXIT_FAILURE;
+                } else if (strcmp(argv[i], "--calibrate") == 0) {
+                        if (argc - i > 2) {
+                                fprintf(stderr, "%s: --calibrate expects at "
+                                        "most a profile\n", argv[0]);
+                                exit(1);
+                        }
+                        return calibrate40(i + 1 < argc ? argv[i + 1] : NULL,
+                                           stdout)
+                               ? EXIT_SUCCESS : EXIT_FAILURE;
+                } else if (strcmp(argv[i], "--reencode") == 0) {
+                        if (argc - i < 3) {
+                                fprintf(stderr, "%s: --reencode expects the "
+                                        "previous compressed image and the "
+                                        "edited image\n", argv[0]);
+                                exit(1);
+                        }
+                        return reencode(argv[i + 1], argv[i + 2],
+                                        argc - i - 3, argv + i + 3);
+                } else if (strcmp(argv[i], "--unsequence") == 0) {
+                        compress_or_decompress = unsequence_input;
+                } else if (strcmp(argv[i], "--pyramid-info") == 0) {
+                        compress_or_decompress = pyramid_info_input;
+                } else if (strcmp(argv[i], "--tile") == 0) {
+                        char extra;
+                        if (i + 1 >= argc ||
+                            sscanf(argv[i + 1], "%d,%d,%d%c", &tile_level,
+                                   &tile_x, &tile_y, &extra) != 3) {
+                                fprintf(stderr, "%s: --tile expects "
+                                        "LEVEL,X,Y\n", argv[0]);
+                                exit(1);
+                        }
+                        compress_or_decompress = tile_input;
+                        i++;
+                } else if (strcmp(argv[i], "--stats") == 0) {
+                        compress_or_decompress = stats_input;
+                } else if (strcmp(argv[i], "--phash") == 0) {
+                        compress_or_decompress = phash_input;
+                } else if (strcmp(argv[i], "--phash-add") == 0) {
+                        if (argc - i < 3) {
+                                fprintf(stderr, "%s: --phash-add expects an "
+                                        "index and one or more files\n",
+                                        argv[0]);
+                                exit(1);
+                        }
+                        return phash_add(argv[i + 1], argc - i - 2,
+                                         argv + i + 2);
+                } else if (strcmp(argv[i], "--phash-query") == 0) {
+                        int distance;
+                        char extra;
+                        if (argc - i < 4 ||
+                            sscanf(argv[i + 2], "%d%c", &distance,
+                                   &extra) != 1 || distance < 0) {
+                                fprintf(stderr, "%s: --phash-query expects an "
+                                        "index, a distance of 0 or more and "
+                                        "one or more files\n", argv[0]);
+                                exit(1);
+                        }
+                        return phash_query(argv[i + 1], distance,
+                                           argc - i - 3, argv + i + 3);
+                } else if (strcmp(argv[i], "--tolerance") == 0) {
+                        char extra;
+                        if (i + 1 >= argc ||
+                            sscanf(argv[i + 1], "%d,%d,%d%c", &tolerance.a,
+                                   &tolerance.bcd, &tolerance.chroma,
+                                   &extra) != 3) {
+                                fprintf(stderr, "%s: --tolerance expects "
+                                        "A,BCD,CHROMA\n", argv[0]);
+                                exit(1);
+                        }
+                        i++;
+                } else if (strcmp(argv[i], "--mask") == 0) {
+                        if (i + 1 >= argc) {
+                                fprintf(stderr, "%s: --mask expects a "
+                                        "filename\n", argv[0]);
+                                exit(1);
+                        }
+                        mask_path = argv[++i];
+                } else if (strcmp(argv[i], "--changes") == 0) {
+                        if (argc - i != 3) {
+                                fprintf(stderr, "%s: --changes expects two "
+                                        "compressed images\n", argv[0]);
+                                exit(1);
+                        }
+                        return print_changes(argv[i + 1], argv[i + 2],
+                                             &tolerance, mask_path);
+                } else if (strcmp(argv[i], "--pixel") == 0) {
+                        if (argc - i != 3) {
+                                fprintf(stderr, "%s: --pixel expects X,Y "
+                                        "and a filename\n", argv[0]);
+                                exit(1);
+                        }
+                        return print_pixel(argv[i + 1], argv[i + 2]);
+                } else if (strcmp(argv[i], "--transform") == 0) {
+                        if (i + 1 >= argc ||
+                            !parse_geometry_transform(argv[i + 1],
+                                                      &transform)) {
+                                fprintf(stderr, "%s: --transform expects "
+                                        "rotate90, rotate180, rotate270, "
+                                        "flip-h, flip-v or transpose\n",
+                                        argv[0]);
+                                exit(1);
+                        }
+                        compress_or_decompress = transform_input;
+                        i++;
+                } else if (strcmp(argv[i], "--brightness") == 0 ||
+                           strcmp(argv[i], "--contrast") == 0) {
+                        float value;
+                        char extra;
+                        if (i + 1 >= argc ||
+                            sscanf(argv[i + 1], "%f%c", &value, &extra) != 1) {
+                                fprintf(stderr, "%s: %s expects a number\n",
+                                        argv[0], argv[i]);
+                                exit(1);
+                        }
+                        if (argv[i][2] == 'b') {
+                                adjustment.brightness = value;
+                        } else {
+                                adjustment.contrast = value;
+                        }
+                        compress_or_decompress = adjust_input;
+                        i++;
+                } else if (strcmp(argv[i], "--tint") == 0) {
+                        char extra;
+                        if (i + 1 >= argc ||
+                            sscanf(argv[i + 1], "%f,%f%c",
+                                   &adjustment.pb_shift,
+                                   &adjustment.pr_shift, &extra) != 2) {
+                                fprintf(stderr, "%s: --tint expects PB,PR\n",
+                                        argv[0]);
+                                exit(1);
+                        }
+                        compress_or_decompress = adjust_input;
+                        i++;
+                } else if (strcmp(argv[i], "--overlay") == 0) {
+                        char extra;
+                        overlay.alpha = 1.0f;
+                        if (i + 2 >= argc ||
+                            (sscanf(argv[i + 2], "%d,%d%c", &overlay.x,
+                                    &overlay.y, &extra) != 2 &&
+                             sscanf(argv[i + 2], "%d,%d,%f%c", &overlay.x,
+                                    &overlay.y, &overlay.alpha,
+                                    &extra) != 3)) {
+                                fprintf(stderr, "%s: --overlay expects an "
+                                        "image and X,Y[,ALPHA]\n", argv[0]);
+                                exit(1);
+                        }
+                        overlay.image = read_overlay(argv[i + 1]);
+                        compress_or_decompress = adjust_input;
+                        i += 2;
+                } else if (strcmp(argv[i], "--downscale") == 0) {
+                        char extra;
+                        if (i + 1 >= argc ||
+                            sscanf(argv[i + 1], "%d%c", &downscale_steps,
+                                   &extra) != 1 ||
+                            downscale_steps < 1 ||
+                            downscale_steps > DOWNSCALE_MAX_STEPS) {
+                                fprintf(stderr, "%s: --downscale expects a "
+                                        "number of halvings from 1 to %d\n",
+                                        argv[0], DOWNSCALE_MAX_STEPS);
+                                exit(1);
+                        }
+                        compress_or_decompress = downscale_input;
+                        i++;
+                } else if (strcmp(argv[i], "--crop") == 0) {
+                        char extra;
+                        if (i + 1 >= argc ||
+                            sscanf(argv[i + 1], "%dx%d+%d+%d%c",
+                                   &crop_width, &crop_height,
+                                   &crop_x, &crop_y, &extra) != 4) {
+                                fprintf(stderr, "%s: --crop expects "
+                                        "WIDTHxHEIGHT+X+Y\n", argv[0]);
+                                exit(1);
+                        }
+                        compress_or_decompress = crop_input;
+                        i++;
+                } else if (strcmp(argv[i], "--hjoin") == 0 ||
+                           strcmp(argv[i], "--vjoin") == 0) {
+                        if (i + 1 >= argc) {
+                                fprintf(stderr, "%s: %s expects one or "
+                                        "more files\n", argv[0], argv[i]);
+                                exit(1);
+                        }
+                        return join_files(argc - i - 1, argv + i + 1,
+                                          argv[i][2] == 'h' ? JOIN_HORIZONTAL
+                                                            : JOIN_VERTICAL);
                 } else if (*argv[i] == '-') {
                         fprintf(stderr, "%s: unknown option '%s'\n",
                                 argv[0], argv[i]);
                         exit(1);
                 } else if (argc - i > 2) {
-                        fprintf(stderr, "Usage: %s -d [filename]\n"
-                                "       %s -c [filename]\n",
-                                argv[0], argv[0]);
+                        fprintf(stderr, "Usage: %s -d [--parallel|--progressive|"
+                                "--adaptive|--layout|--gray] [filename]\n"
+                                "       %s -c [--pyramid|--progressive|"
+                                "--gray|--pad] "
+                                "[filename]\n"
+                                "       %s -c --layout preview16|standard32|"
+                                "archival64 [filename]\n"
+                                "       %s -c --target-bytes N|--target-psnr "
+                                "DB [filename]\n"
+                                "       %s --preview [filename]\n"
+                                "       %s --transform <op> [filename]\n"
+                                "       %s --crop WxH+X+Y [filename]\n"
+                                "       %s --downscale K [filename]\n"
+                                "       %s [--brightness D] [--contrast K] "
+                                "[--tint PB,PR]\n"
+                                "          [--overlay image X,Y[,ALPHA]] "
+                                "[filename]\n"
+                                "       %s --hjoin|--vjoin filename...\n"
+                                "       %s --stats [filename]\n"
+                                "       %s --phash [filename]\n"
+                                "       %s --phash-add index filename...\n"
+                                "       %s --phash-query index distance "
+                                "filename...\n"
+                                "       %s --pixel X,Y filename\n"
+                                "       %s [--tolerance A,BCD,CHROMA] "
+                                "[--mask mask.pbm] --changes before "
+                                "after\n"
+                                "       %s --pyramid-info filename\n"
+                                "       %s --tile LEVEL,X,Y filename\n"
+                                "       %s --sequence frame...\n"
+                                "       %s --unsequence [filename]\n"
+                                "       %s --batch directory filename...\n"
+                                "       %s --memory-report -c|-d [...] "
+                                "[filename]\n"
+                                "       %s --calibrate [profile]\n"
+                                "       %s --reencode previous edited "
+                                "[old|WxH+X+Y...]\n",
+                                argv[0], argv[0], argv[0], argv[0], argv[0],
+                                argv[0], argv[0], argv[0], argv[0], argv[0],
+                                argv[0], argv[0], argv[0], argv[0], argv[0],
+                                argv[0], argv[0], argv[0], argv[0], argv[0],
+                                argv[0], argv[0], argv[0], argv[0]);
                         exit(1);
                 } else {
                         break;
                 }
         }
+        /* Each modifier picks a whole mode, so at most one may be given,
+           and only in a direction that has it */
+        int modifiers = parallel + pyramid + progressive + adaptive + pad +
+                        gray + layouts;
+        bool compressing = compress_or_decompress == compress40;
+        bool decompressing = compress_or_decompress == decompress40;
+        if (modifiers > 1 ||
+            (modifiers == 1 && !compressing && !decompressing) ||
+            (compressing && parallel) ||
+            (decompressing && (pyramid || pad))) {
+                fprintf(stderr, "%s: -c takes at most one of --pyramid, "
+                        "--progressive, --adaptive (or a target), --pad,\n"
+                        "    --gray and --layout; -d at most one of "
+                        "--parallel, --progressive, --adaptive,\n"
+                        "    --gray and --layout\n", argv[0]);
+                exit(1);
+        }
+        if (parallel && compress_or_decompress == decompress40) {
+                compress_or_decompress = decompress_parallel_input;
+        }
+        if (pyramid && compress_or_decompress == compress40) {
+                compress_or_decompress = compress_pyramid_input;
+        }
+        if (progressive && compress_or_decompress == compress40) {
+                compress_or_decompress = compress_progressive_input;
+        }
+        if (progressive && compress_or_decompress == decompress40) {
+                compress_or_decompress = decompress_progressive_input;
+        }
+        if (adaptive && compress_or_decompress == compress40) {
+                compress_or_decompress = compress_adaptive_input;
+        }
+        if (adaptive && compress_or_decompress == decompress40) {
+                compress_or_decompress = decompress_adaptive_input;
+        }
+        if (pad && compress_or_decompress == compress40) {
+                compress_or_decompress = compress_padded_input;
+        }
+        if (gray && compress_or_decompress == compress40) {
+                compress_or_decompress = compress_gray_input;
+        }
+        if (gray && compress_or_decompress == decompress40) {
+                compress_or_decompress = decompress_gray_input;
+        }
+        if (layouts && compress_or_decompress == compress40) {
+                if (layout == NULL) {
+                        fprintf(stderr, "%s: --layout expects preview16, "
+                                "standard32 or archival64\n", argv[0]);
+                        exit(1);
+                }
+                compress_or_decompress = compress_layout_input;
+        }
+        if (layouts && compress_or_decompress == decompress40) {
+                compress_or_decompress = decompress_layout_input;
+        }
         assert(argc - i <= 1);    /* at most one file on command line */
+        Memory_Report report = memory ? memory_report_start() : NULL;
         if (i < argc) {
                 FILE *fp = fopen(argv[i], "r");
                 assert(fp != NULL);
@@ -37,6 +731,10 @@ int main(int argc, char *argv[])
         } else {
                 compress_or_decompress(stdin);
         }
+        if (report != NULL) {
+                fflush(stdout);
+                memory_report_finish(&report, stderr);
+        }
 
         return EXIT_SUCCESS; 
 }
@@ -0,0 +1,115 @@
+/* 40imagec.c
+ *
+ * Command-line front end to 40imaged, a drop-in for "40image -c|-d"
+ * that avoids starting a compressor per image. A regular input file is
+ * handed to the daemon as is; other input is first copied into a memfd.
+ *
+ * -S prints the daemon's decode cache counters instead.
+ *
+ * Usage: 40imagec [-s socket] -c|-d [filename]
+ *        40imagec [-s socket] -S
+ */
+
+#define _GNU_SOURCE  // For memfd_create
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "comp40_client.h"
+
+int main(int argc, char *argv[])
+{
+    const char *socket_path = NULL;
+    int operation = 0;
+
+    int option;
+    while ((option = getopt(argc, argv, "cdSs:")) != -1) {
+        if (option == 'c') {
+            operation = COMP40_COMPRESS;
+        } else if (option == 'd') {
+            operation = COMP40_DECOMPRESS;
+        } else if (option == 'S') {
+            operation = COMP40_CACHE_STATS;
+        } else if (option == 's') {
+            socket_path = optarg;
+        } else {
+            operation = 0;
+            break;
+        }
+    }
+    if (operation == 0 || argc - optind > 1) {
+        fprintf(stderr, "Usage: %s [-s socket] -c|-d [filename]\n"
+                "       %s [-s socket] -S\n", argv[0], argv[0]);
+        exit(1);
+    }
+
+    FILE *input = stdin;
+    if (operation == COMP40_CACHE_STATS) {
+        input = fopen("/dev/null", "r");
+        assert(input != NULL);
+    } else if (optind < argc) {
+        input = fopen(argv[optind], "r");
+        if (input == NULL) {
+            fprintf(stderr, "Error: Could not open %s.\n", argv[optind]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* 1. Input: pass a regular file through, otherwise stage it in a memfd */
+    struct stat st;
+    int input_fd;
+    size_t input_length;
+    if (fstat(fileno(input), &st) == 0 && S_ISREG(st.st_mode) &&
+        lseek(fileno(input), 0, SEEK_CUR) == 0) {
+        input_fd = fileno(input);
+        input_length = st.st_size;
+    } else {
+        input_fd = comp40_client_memfd_from_stream(input, &input_length);
+    }
+
+    int output_fd = memfd_create("40image-output", MFD_CLOEXEC);
+    if (input_fd < 0 || output_fd < 0) {
+        fprintf(stderr, "Error: Could not prepare buffers: %s.\n",
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    /* 2. Request */
+    int connection = comp40_client_connect(socket_path);
+    size_t output_length;
+    if (connection < 0 ||
+        !comp40_client_request(connection, operation, input_fd, input_length,
+                               output_fd, &output_length)) {
+        exit(EXIT_FAILURE);
+    }
+    close(connection);
+
+    /* 3. Output: copy the result from the shared pages to stdout */
+    if (output_length > 0) {
+        void *map = mmap(NULL, output_length, PROT_READ, MAP_SHARED,
+                         output_fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Error: Could not map the result: %s.\n",
+                    strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        fwrite(map, 1, output_length, stdout);
+        munmap(map, output_length);
+    }
+
+    close(output_fd);
+    if (input_fd != fileno(input)) {
+        close(input_fd);
+    }
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,311 @@
+/* 40imaged.c
+ *
+ * Long-running compression daemon. Clients connect to a Unix domain
+ * socket and send requests with two descriptors attached: the input and
+ * the output (normally memfds). Workers map the input in place and
+ * write the result straight into the output, so pixels never travel
+ * through the socket and no process is started per image.
+ *
+ * Decoded images are kept in a decode cache keyed by the compressed
+ * stream, so serving the same file again costs one copy. -m sets its
+ * size in megabytes (0 turns it off) and -D names a directory in which
+ * decoded images are also kept across restarts.
+ *
+ * Usage: 40imaged [-s socket] [-t threads] [-m megabytes] [-D directory]
+ */
+
+#define _GNU_SOURCE  // For fmemopen and accept4
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "comp40_client.h"
+#include "compress40_edges.h"
+#include "decode_cache.h"
+#include "parallel.h"
+#include "parallel_decode.h"
+#include "tuning.h"
+#include "image_processing.h"
+#include "quantization.h"
+#include "io.h"
+
+/* Pending connections the kernel queues before accept */
+#define LISTEN_BACKLOG 128
+
+/* Each worker's output stream buffer, allocated once at startup */
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+/* Default decode cache size, in megabytes */
+#define DEFAULT_CACHE_MEGABYTES 256
+
+/* Largest value allowed in a PPM written here */
+#define MAX_COLOR_VALUE 255
+
+/* Shared by all workers; NULL when caching is off */
+static Decode_Cache decode_cache;
+
+/* Helper functions */
+static int listen_on(const char *path);
+static void serve(void *closure, int index, int thread_count);
+static void serve_connection(int connection, char *buffer);
+static int handle_request(const Comp40_Request *request, int input_fd,
+                          int output_fd, char *buffer, uint64_t *output_length);
+static bool compress_stream(FILE *input, FILE *output);
+static bool decompress_stream(FILE *input, FILE *output);
+static bool decompress_cached(const unsigned char *bytes, size_t length,
+                              FILE *output);
+
+int main(int argc, char *argv[])
+{
+    const char *path = comp40_socket_path();
+    int threads = parallel_default_threads();
+    long cache_megabytes = DEFAULT_CACHE_MEGABYTES;
+    const char *cache_directory = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "s:t:m:D:")) != -1) {
+        if (option == 's') {
+            path = optarg;
+        } else if (option == 't') {
+            threads = atoi(optarg);
+        } else if (option == 'm') {
+            cache_megabytes = atol(optarg);
+        } else if (option == 'D') {
+            cache_directory = optarg;
+        } else {
+            fprintf(stderr, "Usage: %s [-s socket] [-t threads] "
+                    "[-m megabytes] [-D directory]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    if (cache_megabytes > 0) {
+        decode_cache = decode_cache_new((size_t)cache_megabytes << 20,
+                                        threads * 4, cache_directory);
+    }
+
+    /* A client that hangs up early must not take the daemon with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = listen_on(path);
+    if (listener < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* The workers accept on the shared socket and never return */
+    parallel_run(threads, serve, &listener);
+
+    close(listener);
+    return EXIT_SUCCESS;
+}
+
+/* Creates the listening socket, replacing a stale one left at path */
+static int listen_on(const char *path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long.\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    unlink(path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0 ||
+        bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listener, LISTEN_BACKLOG) != 0) {
+        fprintf(stderr, "Error: Could not listen on %s: %s.\n", path,
+                strerror(errno));
+        if (listener >= 0) {
+            close(listener);
+        }
+        return -1;
+    }
+
+    return listener;
+}
+
+/* Worker loop: accepts connections and serves them one at a time */
+static void serve(void *closure, int index, int thread_count)
+{
+    (void)index;
+    (void)thread_count;
+    int listener = *(int *)closure;
+
+    char *buffer = malloc(OUTPUT_BUFFER_SIZE);
+    assert(buffer != NULL);
+
+    while (true) {
+        int connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+        if (connection < 0) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                fprintf(stderr, "Error: accept failed: %s.\n", strerror(errno));
+            }
+            continue;
+        }
+        serve_connection(connection, buffer);
+        close(connection);
+    }
+}
+
+/* Answers requests on one connection until the client hangs up */
+static void serve_connection(int connection, char *buffer)
+{
+    while (true) {
+        Comp40_Request request;
+        int fds[2];
+        bool received = comp40_receive_with_fds(connection, &request,
+                                                sizeof(request), fds, 2);
+        Comp40_Reply reply = { 0, 0, 0 };
+        if (received) {
+            reply.status = handle_request(&request, fds[0], fds[1], buffer,
+                                          &reply.output_length);
+        }
+        for (int i = 0; i < 2; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+        }
+        if (!received ||
+            !comp40_send_with_fds(connection, &reply, sizeof(reply), NULL, 0)) {
+            return;
+        }
+    }
+}
+
+/* Runs one request; returns 0 or an errno value for the reply */
+static int handle_request(const Comp40_Request *request, int input_fd,
+                          int output_fd, char *buffer, uint64_t *output_length)
+{
+    if (request->magic != COMP40_REQUEST_MAGIC ||
+        (request->operation != COMP40_COMPRESS &&
+         request->operation != COMP40_DECOMPRESS &&
+         request->operation != COMP40_CACHE_STATS)) {
+        return EPROTO;
+    }
+
+    /* The counters need no input */
+    if (request->operation == COMP40_CACHE_STATS) {
+        FILE *output = NULL;
+        int output_copy = dup(output_fd);
+        if (output_copy < 0 || ftruncate(output_fd, 0) != 0 ||
+            lseek(output_fd, 0, SEEK_SET) != 0 ||
+            (output = fdopen(output_copy, "w")) == NULL) {
+            int status = errno;
+            if (output_copy >= 0) {
+                close(output_copy);
+            }
+            return status;
+        }
+        if (decode_cache != NULL) {
+            print_decode_cache_stats(decode_cache, output);
+        }
+        *output_length = ftello(output);
+        return fclose(output) == 0 ? 0 : errno;
+    }
+
+    struct stat st;
+    if (fstat(input_fd, &st) != 0 || request->input_length == 0 ||
+        (uint64_t)st.st_size < request->input_length) {
+        return EINVAL;
+    }
+
+    /* Read the client's pages where they are */
+    void *map = mmap(NULL, request->input_length, PROT_READ, MAP_SHARED,
+                     input_fd, 0);
+    if (map == MAP_FAILED) {
+        return errno;
+    }
+    madvise(map, request->input_length, MADV_SEQUENTIAL);
+    FILE *input = fmemopen(map, request->input_length, "r");
+
+    /* Replace the output's contents; the duplicate shares its offset */
+    errno = 0;
+    int output_copy = -1;
+    FILE *output = NULL;
+    if (input != NULL && ftruncate(output_fd, 0) == 0 &&
+        lseek(output_fd, 0, SEEK_SET) == 0 &&
+        (output_copy = dup(output_fd)) >= 0) {
+        output = fdopen(output_copy, "w");
+    }
+
+    int status = 0;
+    if (input == NULL || output == NULL) {
+        status = errno != 0 ? errno : EIO;
+        if (output_copy >= 0 && output == NULL) {
+            close(output_copy);
+        }
+    } else {
+        setvbuf(output, buffer, _IOFBF, OUTPUT_BUFFER_SIZE);
+        bool ok;
+        if (request->operation == COMP40_COMPRESS) {
+            ok = compress_stream(input, output);
+        } else if (decode_cache != NULL) {
+            ok = decompress_cached(map, request->input_length, output);
+        } else {
+            ok = decompress_stream(input, output);
+        }
+        if (fflush(output) != 0) {
+            status = errno;
+        } else if (!ok) {
+            status = EINVAL;
+        }
+        *output_length = ftello(output);
+    }
+
+    if (output != NULL) {
+        fclose(output);
+    }
+    if (input != NULL) {
+        fclose(input);
+    }
+    munmap(map, request->input_length);
+
+    return status;
+}
+
+/* Compresses a PPM image from input to output */
+static bool compress_stream(FILE *input, FILE *output)
+{
+    Image *image = read_image(input);
+    if (image == NULL) {
+        return false;
+    }
+    compress40_image(image, output, EDGE_DROP, 1);   // One request per thread
+    return true;
+}
+
+/* Decompresses a compressed image from input to a PPM on output */
+static bool decompress_stream(FILE *input, FILE *output)
+{
+    return parallel_decode(input, output, 1,   // One request per thread
+                           tuning_profile()->decode_rows_per_write);
+}
+
+/* Writes a compressed image's pixels as a PPM, using the decode cache */
+static bool decompress_cached(const unsigned char *bytes, size_t length,
+                              FILE *output)
+{
+    const Decoded_Image *image = decode_cache_decode(decode_cache, bytes,
+                                                     length);
+    if (image == NULL) {
+        return false;
+    }
+
+    fprintf(output, "P6\n%d %d\n%d\n", image->width, image->height,
+            MAX_COLOR_VALUE);
+    fwrite(image->pixels, sizeof(Pixel),
+           (size_t)image->width * image->height, output);
+    decode_cache_release(decode_cache, image);
+    return true;
+}
@@ -0,0 +1,499 @@
+/* async_io.c */
+
+#include "async_io.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+/* Built without io_uring where the system headers do not know it, in
+   which case every backend is a pool of threads */
+#if defined(__linux__) && defined(__NR_io_uring_setup) && \
+    defined(__NR_io_uring_enter)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+/* Bounds on the depth, and on the threads of the fallback pool */
+#define MAX_DEPTH 4096
+#define MAX_POOL_THREADS 16
+
+typedef enum { OP_READ, OP_WRITE, OP_POST } Op;
+
+/* One request, from submission until its completion is handed out */
+typedef struct Request {
+    Op op;
+    int fd;
+    unsigned char *buffer;
+    size_t length;
+    off_t offset;
+    size_t done;           // Bytes moved so far
+    long long result;
+    void *tag;
+    struct iovec iovec;    // io_uring: the part still to move
+    struct Request *next;
+} Request;
+
+/* A first-in first-out list of requests */
+typedef struct {
+    Request *head;
+    Request *tail;
+} Queue;
+
+#ifdef HAVE_IO_URING
+/* The submission and completion rings shared with the kernel */
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+} Ring;
+#endif
+
+struct Async_IO {
+    bool uring;
+    pthread_mutex_t lock;    // Guards everything below
+    Queue waiting;           // Submitted but not yet started
+    Queue finished;          // Completed but not yet handed out
+#ifdef HAVE_IO_URING
+    Ring ring;
+    int in_flight;           // In the ring; never more than its entries
+#endif
+    pthread_cond_t work;     // Pool: a request is waiting, or stopping
+    pthread_cond_t done;     // Pool: a request has finished
+    bool stopping;
+    int thread_count;
+    pthread_t threads[MAX_POOL_THREADS];
+};
+
+/* Helper functions */
+static void submit(Async_IO io, Op op, int fd, void *buffer, size_t length,
+                   off_t offset, void *tag, long long result);
+static void push(Queue *queue, Request *request);
+static Request *pop(Queue *queue);
+static void *pool_main(void *arg);
+static void perform(Request *request);
+#ifdef HAVE_IO_URING
+static bool ring_setup(Ring *ring, unsigned entries);
+static void ring_free(Ring *ring);
+static int ring_enter(Ring *ring, unsigned to_submit, unsigned min_complete,
+                      unsigned flags);
+static void start_waiting(Async_IO io);
+static void reap(Async_IO io);
+#endif
+
+/* Starts a backend, on io_uring if the kernel allows it */
+Async_IO async_io_new(int depth)
+{
+    if (depth < 1) {
+        depth = 1;
+    }
+    if (depth > MAX_DEPTH) {
+        depth = MAX_DEPTH;
+    }
+
+    Async_IO io = calloc(1, sizeof(*io));
+    assert(io != NULL);
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->work, NULL);
+    pthread_cond_init(&io->done, NULL);
+
+    const char *setting = getenv("COMP40_IO");
+    bool pool_only = setting != NULL && strcmp(setting, "threads") == 0;
+#ifdef HAVE_IO_URING
+    /* Kernels and sandboxes that refuse io_uring fall through */
+    if (!pool_only && ring_setup(&io->ring, depth)) {
+        io->uring = true;
+        return io;
+    }
+#endif
+    (void)pool_only;
+
+    int threads = depth < MAX_POOL_THREADS ? depth : MAX_POOL_THREADS;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&io->threads[i], NULL, pool_main, io) != 0) {
+            break;
+        }
+        io->thread_count++;
+    }
+    assert(io->thread_count > 0);
+
+    return io;
+}
+
+/* Names the backend in use */
+const char *async_io_backend(Async_IO io)
+{
+    assert(io != NULL);
+    return io->uring ? "io_uring" : "threads";
+}
+
+/* Submits a read */
+void async_io_read(Async_IO io, int fd, void *buffer, size_t length,
+                   off_t offset, void *tag)
+{
+    submit(io, OP_READ, fd, buffer, length, offset, tag, 0);
+}
+
+/* Submits a write */
+void async_io_write(Async_IO io, int fd, const void *buffer, size_t length,
+                    off_t offset, void *tag)
+{
+    submit(io, OP_WRITE, fd, (void *)buffer, length, offset, tag, 0);
+}
+
+/* Submits a completion that does no I/O */
+void async_io_post(Async_IO io, void *tag, long long result)
+{
+    submit(io, OP_POST, -1, NULL, 0, 0, tag, result);
+}
+
+/* Waits for the next completion */
+void async_io_wait(Async_IO io, Async_Completion *completion)
+{
+    assert(io != NULL && completion != NULL);
+
+    pthread_mutex_lock(&io->lock);
+    while (io->finished.head == NULL) {
+#ifdef HAVE_IO_URING
+        if (io->uring) {
+            reap(io);
+            if (io->finished.head != NULL) {
+                break;
+            }
+
+            /* Completions that arrive after the reap still satisfy
+               the wait, so none can be missed by unlocking first */
+            pthread_mutex_unlock(&io->lock);
+            int entered = ring_enter(&io->ring, 0, 1,
+                                     IORING_ENTER_GETEVENTS);
+            assert(entered >= 0 || errno == EINTR);
+            (void)entered;
+            pthread_mutex_lock(&io->lock);
+            continue;
+        }
+#endif
+        pthread_cond_wait(&io->done, &io->lock);
+    }
+    Request *request = pop(&io->finished);
+    pthread_mutex_unlock(&io->lock);
+
+    completion->tag = request->tag;
+    completion->result = request->result;
+    free(request);
+}
+
+/* Stops a backend */
+void async_io_free(Async_IO *io)
+{
+    assert(io != NULL);
+
+    Async_IO self = *io;
+    if (self == NULL) {
+        return;
+    }
+    assert(self->waiting.head == NULL && self->finished.head == NULL);
+
+#ifdef HAVE_IO_URING
+    if (self->uring) {
+        assert(self->in_flight == 0);
+        ring_free(&self->ring);
+    }
+#endif
+
+    pthread_mutex_lock(&self->lock);
+    self->stopping = true;
+    pthread_cond_broadcast(&self->work);
+    pthread_mutex_unlock(&self->lock);
+    for (int i = 0; i < self->thread_count; i++) {
+        pthread_join(self->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&self->work);
+    pthread_cond_destroy(&self->done);
+    pthread_mutex_destroy(&self->lock);
+    free(self);
+    *io = NULL;
+}
+
+/* Queues a request and, if there is room, starts it */
+static void submit(Async_IO io, Op op, int fd, void *buffer, size_t length,
+                   off_t offset, void *tag, long long result)
+{
+    assert(io != NULL);
+    assert(op == OP_POST || (fd >= 0 && (buffer != NULL || length == 0)));
+
+    Request *request = malloc(sizeof(*request));
+    assert(request != NULL);
+    *request = (Request){
+        op, fd, buffer, length, offset, 0, result, tag, { NULL, 0 }, NULL
+    };
+
+    pthread_mutex_lock(&io->lock);
+    push(&io->waiting, request);
+#ifdef HAVE_IO_URING
+    if (io->uring) {
+        start_waiting(io);
+    }
+#endif
+    pthread_cond_signal(&io->work);
+    pthread_mutex_unlock(&io->lock);
+}
+
+/* Appends a request to a queue */
+static void push(Queue *queue, Request *request)
+{
+    request->next = NULL;
+    if (queue->tail == NULL) {
+        queue->head = request;
+    } else {
+        queue->tail->next = request;
+    }
+    queue->tail = request;
+}
+
+/* Removes the first request of a queue, or returns NULL */
+static Request *pop(Queue *queue)
+{
+    Request *request = queue->head;
+    if (request != NULL) {
+        queue->head = request->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+    }
+    return request;
+}
+
+/* Pool thread: performs waiting requests until the backend stops */
+static void *pool_main(void *arg)
+{
+    Async_IO io = arg;
+
+    pthread_mutex_lock(&io->lock);
+    for (;;) {
+        while (io->waiting.head == NULL && !io->stopping) {
+            pthread_cond_wait(&io->work, &io->lock);
+        }
+        Request *request = pop(&io->waiting);
+        if (request == NULL) {
+            break;
+        }
+
+        pthread_mutex_unlock(&io->lock);
+        perform(request);
+        pthread_mutex_lock(&io->lock);
+
+        push(&io->finished, request);
+        pthread_cond_signal(&io->done);
+    }
+    pthread_mutex_unlock(&io->lock);
+
+    return NULL;
+}
+
+/* Moves every byte of a request with pread or pwrite */
+static void perform(Request *request)
+{
+    if (request->op == OP_POST) {
+        return;
+    }
+
+    while (request->done < request->length) {
+        unsigned char *at = request->buffer + request->done;
+        size_t left = request->length - request->done;
+        off_t offset = request->offset + request->done;
+        ssize_t moved = request->op == OP_READ
+                        ? pread(request->fd, at, left, offset)
+                        : pwrite(request->fd, at, left, offset);
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if (moved < 0) {
+            request->result = -errno;
+            return;
+        }
+        if (moved == 0) {
+            break;    // End of file
+        }
+        request->done += moved;
+    }
+    request->result = request->done;
+}
+
+#ifdef HAVE_IO_URING
+/* Creates a ring and maps its three regions */
+static bool ring_setup(Ring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        return false;
+    }
+
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+    ring->sq_map_size = params.sq_off.array +
+                        params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes +
+                        params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, IORING_OFF_SQ_RING);
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED ||
+        sqes == MAP_FAILED) {
+        if (ring->sq_map != MAP_FAILED) {
+            munmap(ring->sq_map, ring->sq_map_size);
+        }
+        if (ring->cq_map != MAP_FAILED) {
+            munmap(ring->cq_map, ring->cq_map_size);
+        }
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, ring->sqes_size);
+        }
+        close(fd);
+        return false;
+    }
+
+    unsigned char *sq = ring->sq_map;
+    unsigned char *cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sqes = sqes;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+/* Unmaps and closes a ring */
+static void ring_free(Ring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->cq_map, ring->cq_map_size);
+    munmap(ring->sq_map, ring->sq_map_size);
+    close(ring->fd);
+}
+
+/* Submits queued entries and, if asked, waits for completions */
+static int ring_enter(Ring *ring, unsigned to_submit, unsigned min_complete,
+                      unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                   flags, NULL, 0);
+}
+
+/* Moves waiting requests into the ring while it has room, and submits
+   them; called with the lock held */
+static void start_waiting(Async_IO io)
+{
+    Ring *ring = &io->ring;
+    unsigned tail = *ring->sq_tail;
+    bool added = false;
+
+    /* Keeping no more in flight than the ring has entries also keeps
+       the completion ring, twice as large, from overflowing */
+    while (io->waiting.head != NULL && io->in_flight < (int)ring->entries) {
+        Request *request = pop(&io->waiting);
+        unsigned index = tail & *ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+
+        if (request->op == OP_POST) {
+            sqe->opcode = IORING_OP_NOP;
+        } else {
+            request->iovec.iov_base = request->buffer + request->done;
+            request->iovec.iov_len = request->length - request->done;
+            sqe->opcode = request->op == OP_READ ? IORING_OP_READV
+                                                 : IORING_OP_WRITEV;
+            sqe->fd = request->fd;
+            sqe->addr = (uintptr_t)&request->iovec;
+            sqe->len = 1;
+            sqe->off = request->offset + request->done;
+        }
+        sqe->user_data = (uintptr_t)request;
+
+        ring->sq_array[index] = index;
+        tail++;
+        io->in_flight++;
+        added = true;
+    }
+    if (!added) {
+        return;
+    }
+
+    /* The kernel must see the entries before the tail that covers them;
+       anything it did not take last time is submitted again */
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    unsigned pending = tail - __atomic_load_n(ring->sq_head,
+                                              __ATOMIC_ACQUIRE);
+    while (ring_enter(ring, pending, 0, 0) < 0 && errno == EINTR) {
+    }
+}
+
+/* Takes every entry off the completion ring; called with the lock held.
+   A request that moved only part of its bytes goes back to waiting for
+   the rest. */
+static void reap(Async_IO io)
+{
+    Ring *ring = &io->ring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        Request *request = (Request *)(uintptr_t)cqe->user_data;
+        int result = cqe->res;
+        io->in_flight--;
+
+        if (request->op == OP_POST) {
+            push(&io->finished, request);
+        } else if (result == -EINTR || result == -EAGAIN) {
+            push(&io->waiting, request);
+        } else if (result < 0) {
+            request->result = result;
+            push(&io->finished, request);
+        } else {
+            request->done += result;
+            if (result > 0 && request->done < request->length) {
+                push(&io->waiting, request);
+            } else {
+                request->result = request->done;
+                push(&io->finished, request);
+            }
+        }
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    start_waiting(io);
+}
+#endif
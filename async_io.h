@@ -0,0 +1,87 @@
+/* async_io.h */
+
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Keeps many reads and writes in flight and reports each one as it
+   completes. It is built on io_uring where the kernel allows it, and
+   otherwise on a pool of threads calling pread and pwrite; setting the
+   COMP40_IO environment variable to "threads" forces the pool. Any
+   thread may submit, but only one may wait. */
+typedef struct Async_IO *Async_IO;
+
+/* A finished request */
+typedef struct {
+    void *tag;         // As given when the request was submitted
+    long long result;  // Bytes moved, or a negative errno
+} Async_Completion;
+
+/* Function Prototypes */
+
+/**
+ * Starts an asynchronous I/O backend.
+ * @param depth How many requests to keep in flight at once; more may be
+ * submitted, and wait their turn.
+ * @return The backend.
+ */
+Async_IO async_io_new(int depth);
+
+/**
+ * Names the backend in use.
+ * @param io The backend.
+ * @return "io_uring" or "threads".
+ */
+const char *async_io_backend(Async_IO io);
+
+/**
+ * Submits a read, which completes once length bytes have been read or
+ * the file ends. The buffer must stay valid until then.
+ * @param io The backend.
+ * @param fd The file to read.
+ * @param buffer Where to read to.
+ * @param length The number of bytes to read.
+ * @param offset Where in the file to start.
+ * @param tag Handed back with the completion.
+ */
+void async_io_read(Async_IO io, int fd, void *buffer, size_t length,
+                   off_t offset, void *tag);
+
+/**
+ * Submits a write, which completes once every byte has been written.
+ * The buffer must stay valid until then.
+ * @param io The backend.
+ * @param fd The file to write.
+ * @param buffer What to write.
+ * @param length The number of bytes to write.
+ * @param offset Where in the file to start.
+ * @param tag Handed back with the completion.
+ */
+void async_io_write(Async_IO io, int fd, const void *buffer, size_t length,
+                    off_t offset, void *tag);
+
+/**
+ * Submits a completion that does no I/O, to wake the waiting thread.
+ * @param io The backend.
+ * @param tag Handed back with the completion.
+ * @param result Handed back with the completion.
+ */
+void async_io_post(Async_IO io, void *tag, long long result);
+
+/**
+ * Waits for the next request to complete. Only one thread may wait.
+ * @param io The backend.
+ * @param completion Pointer to store the finished request.
+ */
+void async_io_wait(Async_IO io, Async_Completion *completion);
+
+/**
+ * Stops a backend and sets *io to NULL. Every request must have
+ * completed.
+ * @param io Pointer to the backend.
+ */
+void async_io_free(Async_IO *io);
+
+#endif /* ASYNC_IO_H */
@@ -0,0 +1,394 @@
+/* batch.c */
+
+#include "batch.h"
+#include "async_io.h"
+#include "compress40_edges.h"
+#include "tuning.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* Input buffers per compressing thread, so that the next file is being
+   read while one is compressed */
+#define BUFFERS_PER_THREAD 2
+
+/* Where a file is in the pipeline, which says what its next completion
+   means */
+typedef enum {
+    STAGE_READING,
+    STAGE_COMPRESSING,   // Completes only if compressing fails
+    STAGE_WRITING
+} Stage;
+
+/* An input buffer from the pool. Buffers are reused from file to file,
+   growing to the largest file each has held, rather than allocated for
+   every file. */
+typedef struct Buffer {
+    unsigned char *data;
+    size_t capacity;
+    struct Buffer *next;
+} Buffer;
+
+/* One image on its way through the pipeline */
+typedef struct File {
+    const char *path;
+    char *output_path;
+    Stage stage;
+    int fd;
+    Buffer *buffer;
+    size_t length;        // Of the input
+    char *output;         // The compressed image
+    size_t output_length;
+    struct File *next;    // In the ready queue
+} File;
+
+/* What the I/O thread and the compressing threads share */
+typedef struct {
+    Async_IO io;
+    pthread_mutex_t lock;     // Guards the queue, the pool and stopping
+    pthread_cond_t ready;     // A file was queued, or stopping was set
+    File *ready_head;         // Read and waiting to be compressed
+    File *ready_tail;
+    Buffer *free_buffers;
+    bool stopping;
+} Batch;
+
+/* Helper functions */
+static bool start_read(Batch *batch, File *file, Buffer *buffer);
+static bool finish_stage(Batch *batch, File *file, long long result,
+                         bool *done);
+static void *compress_main(void *arg);
+static void compress_file(Batch *batch, File *file);
+static Buffer *take_buffer(Batch *batch);
+static void give_back(Batch *batch, Buffer *buffer);
+static char *output_path(const char *directory, const char *path);
+static bool distinct_outputs(File *files, int count);
+static int compare_paths(const void *a, const void *b);
+
+/* Compresses many images, overlapping their I/O with compression */
+bool batch40(const char *directory, char *paths[], int count)
+{
+    assert(directory != NULL && (paths != NULL || count == 0));
+
+    /* Two inputs with the same name would be written to one file at
+       once, so refuse the whole batch before anything is written */
+    File *files = calloc(count > 0 ? count : 1, sizeof(File));
+    assert(files != NULL);
+    for (int i = 0; i < count; i++) {
+        files[i].path = paths[i];
+        files[i].output_path = output_path(directory, paths[i]);
+    }
+    int file_count = count;
+    if (!distinct_outputs(files, count)) {
+        for (int i = 0; i < file_count; i++) {
+            free(files[i].output_path);
+        }
+        free(files);
+        return false;
+    }
+
+    int thread_count = tuning_threads();
+    int buffer_count = BUFFERS_PER_THREAD * thread_count;
+
+    /* Every buffer may be read into while as many outputs are written */
+    Batch batch;
+    batch.io = async_io_new(2 * buffer_count);
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.ready, NULL);
+    batch.ready_head = NULL;
+    batch.ready_tail = NULL;
+    batch.stopping = false;
+
+    Buffer *buffers = calloc(buffer_count, sizeof(Buffer));
+    pthread_t *threads = malloc(thread_count * sizeof(pthread_t));
+    assert(buffers != NULL && threads != NULL);
+    batch.free_buffers = NULL;
+    for (int i = 0; i < buffer_count; i++) {
+        buffers[i].next = batch.free_buffers;
+        batch.free_buffers = &buffers[i];
+    }
+
+    int spawned = 0;
+    while (spawned < thread_count &&
+           pthread_create(&threads[spawned], NULL, compress_main,
+                          &batch) == 0) {
+        spawned++;
+    }
+    bool ok = spawned > 0;
+    if (!ok) {
+        fprintf(stderr, "Error: Could not start compressing threads.\n");
+        count = 0;
+    }
+
+    /* This thread only does I/O: it starts a read whenever a buffer is
+       free, and handles each completion as it arrives. A file that
+       fails is reported and the rest carry on. */
+    int next = 0;
+    int active = 0;
+    while (next < count || active > 0) {
+        Buffer *buffer;
+        while (next < count && (buffer = take_buffer(&batch)) != NULL) {
+            File *file = &files[next++];
+            if (start_read(&batch, file, buffer)) {
+                active++;
+            } else {
+                give_back(&batch, buffer);
+                ok = false;
+            }
+        }
+        if (active == 0) {
+            continue;
+        }
+
+        Async_Completion completion;
+        async_io_wait(batch.io, &completion);
+        bool done;
+        if (!finish_stage(&batch, completion.tag, completion.result,
+                          &done)) {
+            ok = false;
+        }
+        if (done) {
+            active--;
+        }
+    }
+
+    pthread_mutex_lock(&batch.lock);
+    batch.stopping = true;
+    pthread_cond_broadcast(&batch.ready);
+    pthread_mutex_unlock(&batch.lock);
+    for (int i = 0; i < spawned; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < buffer_count; i++) {
+        free(buffers[i].data);
+    }
+    for (int i = 0; i < file_count; i++) {
+        free(files[i].output_path);
+    }
+    free(buffers);
+    free(files);
+    free(threads);
+    async_io_free(&batch.io);
+    pthread_cond_destroy(&batch.ready);
+    pthread_mutex_destroy(&batch.lock);
+
+    return ok;
+}
+
+/* Opens an input and submits a read of all of it into a buffer */
+static bool start_read(Batch *batch, File *file, Buffer *buffer)
+{
+    file->fd = open(file->path, O_RDONLY);
+    struct stat st;
+    if (file->fd < 0 || fstat(file->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "Error: Could not open %s.\n", file->path);
+        if (file->fd >= 0) {
+            close(file->fd);
+        }
+        return false;
+    }
+
+    file->length = st.st_size;
+    if (file->length > buffer->capacity) {
+        free(buffer->data);
+        buffer->data = malloc(file->length);
+        assert(buffer->data != NULL);
+        buffer->capacity = file->length;
+    }
+
+    file->buffer = buffer;
+    file->stage = STAGE_READING;
+    async_io_read(batch->io, file->fd, buffer->data, file->length, 0, file);
+    return true;
+}
+
+/* Handles a file's completion: a finished read is queued to be
+   compressed, and a finished write or a failure ends the file */
+static bool finish_stage(Batch *batch, File *file, long long result,
+                         bool *done)
+{
+    *done = true;
+
+    switch (file->stage) {
+    case STAGE_READING:
+        close(file->fd);
+        if (result != (long long)file->length) {
+            fprintf(stderr, "Error: Could not read %s.\n", file->path);
+            give_back(batch, file->buffer);
+            return false;
+        }
+        file->stage = STAGE_COMPRESSING;
+        pthread_mutex_lock(&batch->lock);
+        file->next = NULL;
+        if (batch->ready_tail == NULL) {
+            batch->ready_head = file;
+        } else {
+            batch->ready_tail->next = file;
+        }
+        batch->ready_tail = file;
+        pthread_cond_signal(&batch->ready);
+        pthread_mutex_unlock(&batch->lock);
+        *done = false;
+        return true;
+
+    case STAGE_COMPRESSING:
+        return false;    // The compressing thread printed the error
+
+    case STAGE_WRITING:
+        close(file->fd);
+        free(file->output);
+        if (result != (long long)file->output_length) {
+            fprintf(stderr, "Error: Could not write %s.\n",
+                    file->output_path);
+            return false;
+        }
+        return true;
+    }
+
+    return false;
+}
+
+/* Compressing thread: compresses queued files until told to stop */
+static void *compress_main(void *arg)
+{
+    Batch *batch = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        while (batch->ready_head == NULL && !batch->stopping) {
+            pthread_cond_wait(&batch->ready, &batch->lock);
+        }
+        File *file = batch->ready_head;
+        if (file != NULL) {
+            batch->ready_head = file->next;
+            if (batch->ready_head == NULL) {
+                batch->ready_tail = NULL;
+            }
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        if (file == NULL) {
+            return NULL;
+        }
+        compress_file(batch, file);
+    }
+}
+
+/* Compresses one file from its buffer into memory and submits the write.
+   On failure the file's completion is posted instead, so the I/O thread
+   still hears about it. */
+static void compress_file(Batch *batch, File *file)
+{
+    Image *image = NULL;
+    FILE *input = file->length > 0
+                  ? fmemopen(file->buffer->data, file->length, "r")
+                  : NULL;
+    if (input != NULL) {
+        image = read_image(input);
+        fclose(input);
+    }
+    give_back(batch, file->buffer);
+    file->buffer = NULL;
+    if (image == NULL) {
+        fprintf(stderr, "Error: Failed to read image %s.\n", file->path);
+        async_io_post(batch->io, file, -1);
+        return;
+    }
+
+    FILE *output = open_memstream(&file->output, &file->output_length);
+    assert(output != NULL);
+    compress40_image(image, output, EDGE_DROP, 1);   // One image per thread
+    fclose(output);
+
+    file->fd = open(file->output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (file->fd < 0) {
+        fprintf(stderr, "Error: Could not open %s.\n", file->output_path);
+        free(file->output);
+        async_io_post(batch->io, file, -1);
+        return;
+    }
+
+    file->stage = STAGE_WRITING;
+    async_io_write(batch->io, file->fd, file->output, file->output_length,
+                   0, file);
+}
+
+/* Takes a buffer from the pool, or returns NULL if none is free */
+static Buffer *take_buffer(Batch *batch)
+{
+    pthread_mutex_lock(&batch->lock);
+    Buffer *buffer = batch->free_buffers;
+    if (buffer != NULL) {
+        batch->free_buffers = buffer->next;
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return buffer;
+}
+
+/* Returns a buffer to the pool */
+static void give_back(Batch *batch, Buffer *buffer)
+{
+    pthread_mutex_lock(&batch->lock);
+    buffer->next = batch->free_buffers;
+    batch->free_buffers = buffer;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/* Returns directory/name.c40, where name is the input's file name
+   without its extension */
+static char *output_path(const char *directory, const char *path)
+{
+    const char *name = strrchr(path, '/');
+    name = name != NULL ? name + 1 : path;
+    const char *dot = strrchr(name, '.');
+    int stem = dot != NULL && dot != name ? (int)(dot - name)
+                                          : (int)strlen(name);
+
+    size_t size = strlen(directory) + stem + sizeof("/.c40");
+    char *result = malloc(size);
+    assert(result != NULL);
+    snprintf(result, size, "%s/%.*s.c40", directory, stem, name);
+    return result;
+}
+
+/* Checks no two files would be written to the same output, printing an
+   error for each clash */
+static bool distinct_outputs(File *files, int count)
+{
+    if (count < 2) {
+        return true;
+    }
+
+    File **sorted = malloc(count * sizeof(File *));
+    assert(sorted != NULL);
+    for (int i = 0; i < count; i++) {
+        sorted[i] = &files[i];
+    }
+    qsort(sorted, count, sizeof(File *), compare_paths);
+
+    bool distinct = true;
+    for (int i = 1; i < count; i++) {
+        if (strcmp(sorted[i - 1]->output_path, sorted[i]->output_path) == 0) {
+            fprintf(stderr, "Error: %s and %s would both be written to %s.\n",
+                    sorted[i - 1]->path, sorted[i]->path,
+                    sorted[i]->output_path);
+            distinct = false;
+        }
+    }
+    free(sorted);
+    return distinct;
+}
+
+/* Orders files by output path for qsort */
+static int compare_paths(const void *a, const void *b)
+{
+    const File *left = *(File * const *)a;
+    const File *right = *(File * const *)b;
+    return strcmp(left->output_path, right->output_path);
+}
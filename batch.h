@@ -0,0 +1,24 @@
+/* batch.h */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+
+/* Function Prototypes */
+
+/**
+ * Compresses many PPM images, each to a file in directory named after
+ * it with a .c40 extension in place of its own. One thread keeps reads
+ * and writes in flight through async_io while the others compress, so
+ * the threads do not stall on storage.
+ * @param directory Where to write the compressed images.
+ * @param paths The images.
+ * @param count The number of images.
+ * @return true if every image was compressed, false (after printing an
+ * error for each one that was not) otherwise. Nothing is written if two
+ * images would share an output name.
+ */
+bool batch40(const char *directory, char *paths[], int count);
+
+#endif /* BATCH_H */
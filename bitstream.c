@@ -0,0 +1,45 @@
+/* bitstream.c */
+
+#include "bitstream.h"
+#include <assert.h>
+
+/* Appends the low width bits of value to the stream */
+void put_bits(Bit_Writer *writer, uint32_t value, int width)
+{
+    assert(width > 0 && width <= 24);
+
+    writer->buffer = writer->buffer << width | (value & ((1u << width) - 1));
+    writer->bits += width;
+    while (writer->bits >= 8) {
+        writer->bits -= 8;
+        writer->bytes[writer->length++] = writer->buffer >> writer->bits;
+    }
+}
+
+/* Pads the stream to a whole byte */
+void flush_bits(Bit_Writer *writer)
+{
+    if (writer->bits > 0) {
+        put_bits(writer, 0, 8 - writer->bits);
+    }
+    writer->buffer = 0;
+}
+
+/* Takes the next width bits from the stream */
+uint32_t get_bits(Bit_Reader *reader, int width)
+{
+    assert(width > 0 && width <= 24);
+
+    while (reader->bits < width) {
+        reader->buffer = reader->buffer << 8 | *reader->bytes++;
+        reader->bits += 8;
+    }
+    reader->bits -= width;
+    return (reader->buffer >> reader->bits) & ((1u << width) - 1);
+}
+
+/* Returns the padded length of count fields */
+size_t packed_length(size_t count, int field_bits)
+{
+    return (count * field_bits + 7) / 8;
+}
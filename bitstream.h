@@ -0,0 +1,59 @@
+/* bitstream.h */
+
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Accumulates fields into a big-endian bit stream. The caller supplies
+   a buffer large enough for everything that will be written. */
+typedef struct {
+    unsigned char *bytes;
+    size_t length;      // Bytes completed so far
+    uint64_t buffer;
+    int bits;           // Number of pending bits in buffer
+} Bit_Writer;
+
+/* Reads fields back out of a big-endian bit stream. Reads may look up
+   to three bytes past the last field, so the buffer must allow that. */
+typedef struct {
+    const unsigned char *bytes;
+    uint64_t buffer;
+    int bits;
+} Bit_Reader;
+
+/* Function Prototypes */
+
+/**
+ * Appends the low width bits of value to the stream.
+ * @param writer The writer.
+ * @param value The field.
+ * @param width The field width, from 1 to 24.
+ */
+void put_bits(Bit_Writer *writer, uint32_t value, int width);
+
+/**
+ * Pads the stream with zero bits to a whole byte.
+ * @param writer The writer.
+ */
+void flush_bits(Bit_Writer *writer);
+
+/**
+ * Takes the next width bits from the stream.
+ * @param reader The reader.
+ * @param width The field width, from 1 to 24.
+ * @return The field.
+ */
+uint32_t get_bits(Bit_Reader *reader, int width);
+
+/**
+ * Returns the number of bytes that count fields of field_bits bits
+ * occupy once padded to a whole byte.
+ * @param count The number of fields.
+ * @param field_bits The width of each field.
+ * @return The length in bytes.
+ */
+size_t packed_length(size_t count, int field_bits);
+
+#endif /* BITSTREAM_H */
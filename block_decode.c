@@ -0,0 +1,32 @@
+/* block_decode.c */
+
+#include "block_decode.h"
+#include "quantization.h"
+#include "transform.h"
+#include "color_conversion.h"
+#include "io.h"
+#include <assert.h>
+
+/* Decodes a run of codewords into two rows of pixels */
+void decode_block_run(const unsigned char *bytes, const uint32_t *words,
+                      int count, Pixel *top, Pixel *bottom)
+{
+    assert(bytes != NULL || words != NULL || count == 0);
+    assert(top != NULL && bottom != NULL);
+
+    for (int i = 0; i < count; i++) {
+        uint32_t codeword = bytes != NULL ? load_codeword(bytes + 4 * i)
+                                          : words[i];
+        DCT_Block dct_block;
+        Block block;
+        unpack_codeword(codeword, &dct_block);
+        idct_block(&dct_block, &block);
+
+        float pb = block.pb_avg;
+        float pr = block.pr_avg;
+        top[2 * i] = ypbpr_pixel_to_rgb((YPbPr_pixel){ block.y1, pb, pr });
+        top[2 * i + 1] = ypbpr_pixel_to_rgb((YPbPr_pixel){ block.y2, pb, pr });
+        bottom[2 * i] = ypbpr_pixel_to_rgb((YPbPr_pixel){ block.y3, pb, pr });
+        bottom[2 * i + 1] = ypbpr_pixel_to_rgb((YPbPr_pixel){ block.y4, pb, pr });
+    }
+}
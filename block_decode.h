@@ -0,0 +1,25 @@
+/* block_decode.h */
+
+#ifndef BLOCK_DECODE_H
+#define BLOCK_DECODE_H
+
+#include <stdint.h>
+#include "image_processing.h"  // For Pixel
+
+/* Function Prototypes */
+
+/**
+ * Decodes a run of codewords from one block row into the two pixel rows
+ * they cover, using the same unpack, IDCT and colour conversion as
+ * decompress40. Codewords are read from bytes (big-endian, as in a
+ * mapped file) when it is not NULL, and from words otherwise.
+ * @param bytes The first codeword as stored in the file, or NULL.
+ * @param words The first codeword in host order, used if bytes is NULL.
+ * @param count The number of codewords.
+ * @param top Where to store the 2 * count pixels of the upper row.
+ * @param bottom Where to store the 2 * count pixels of the lower row.
+ */
+void decode_block_run(const unsigned char *bytes, const uint32_t *words,
+                      int count, Pixel *top, Pixel *bottom);
+
+#endif /* BLOCK_DECODE_H */
@@ -0,0 +1,284 @@
+/* calibrate.c */
+
+#include "calibrate.h"
+#include "tuning.h"
+#include "parallel.h"
+#include "parallel_decode.h"
+#include "compress40_edges.h"
+#include "color_conversion.h"
+#include "chroma_processing.h"
+#include "transform.h"
+#include "quantization.h"
+#include "io.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+/* Size of the synthetic image: a full HD frame */
+#define IMAGE_WIDTH 1920
+#define IMAGE_HEIGHT 1080
+
+/* Each setting is timed this many times and its fastest run kept */
+#define REPEATS 3
+
+/* A larger setting must beat the best so far by this fraction, so that
+   noise does not pick more threads or memory for no gain */
+#define MIN_GAIN 0.03
+
+/* Width of the labels in the report */
+#define LABEL_WIDTH 22
+
+/* Compression stages, in pipeline order */
+enum {
+    STAGE_TO_YPBPR,
+    STAGE_BLOCKS,
+    STAGE_DCT,
+    STAGE_QUANTIZE,
+    STAGE_COUNT
+};
+
+static const char *const stage_names[STAGE_COUNT] = {
+    "rgb_to_ypbpr", "create_blocks", "perform_dct", "quantize_and_pack"
+};
+
+/* Settings tried, smallest first */
+static const int band_rows_tried[] = { 16, 32, 64, 128, 256, 512 };
+static const int rows_per_write_tried[] = { 4, 8, 16, 32, 64 };
+
+/* Helper functions */
+static Image *synthetic_image(int width, int height);
+static double now(void);
+static void time_stages(const Image_View *view, double seconds[STAGE_COUNT]);
+static double time_encode(const Image_View *view, int band_rows,
+                          int thread_count);
+static double time_decode(FILE *compressed, FILE *output, int thread_count,
+                          int rows_per_write);
+static void report_time(FILE *report, const char *setting, int value,
+                        double seconds);
+
+/* Measures the codec and saves the fastest settings */
+bool calibrate40(const char *path, FILE *report)
+{
+    assert(report != NULL);
+
+    if (path == NULL) {
+        path = tuning_profile_path();
+        if (path == NULL) {
+            fprintf(stderr, "Error: Set COMP40_PROFILE or HOME to say where "
+                    "the profile goes.\n");
+            return false;
+        }
+    }
+
+    Image *image = synthetic_image(IMAGE_WIDTH, IMAGE_HEIGHT);
+    Image_View view = image_view(image);
+    Tuning_Profile best = {
+        TUNING_DEFAULT_THREADS,
+        TUNING_DEFAULT_BAND_ROWS,
+        TUNING_DEFAULT_ROWS_PER_WRITE
+    };
+
+    /* 1. Each stage over the whole image, for the report */
+    double stage_seconds[STAGE_COUNT];
+    time_stages(&view, stage_seconds);
+    char notes[STAGE_COUNT * 64];
+    int length = 0;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        double per_pixel = stage_seconds[i] * 1e9 /
+                           ((double)IMAGE_WIDTH * IMAGE_HEIGHT);
+        fprintf(report, "%-*s %.2f ns/pixel\n", LABEL_WIDTH, stage_names[i],
+                per_pixel);
+        length += snprintf(notes + length, sizeof(notes) - length,
+                           "# %s %.2f ns/pixel\n", stage_names[i], per_pixel);
+    }
+
+    /* 2. Band height on one thread, where only the cache matters */
+    double best_seconds = 0;
+    int count = sizeof(band_rows_tried) / sizeof(band_rows_tried[0]);
+    for (int i = 0; i < count; i++) {
+        double seconds = time_encode(&view, band_rows_tried[i], 1);
+        report_time(report, "band rows", band_rows_tried[i], seconds);
+        if (i == 0 || seconds < best_seconds * (1 - MIN_GAIN)) {
+            best.compress_band_rows = band_rows_tried[i];
+            best_seconds = seconds;
+        }
+    }
+
+    /* 3. Thread count, doubling up to the default */
+    int max_threads = parallel_default_threads();
+    for (int threads = 1; ; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+        double seconds = time_encode(&view, best.compress_band_rows, threads);
+        report_time(report, "threads", threads, seconds);
+        if (threads == 1 || seconds < best_seconds * (1 - MIN_GAIN)) {
+            best.threads = threads;
+            best_seconds = seconds;
+        }
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    /* 4. Rows per write, decoding to a regular file as -d --parallel
+       does */
+    FILE *compressed = tmpfile();
+    FILE *output = tmpfile();
+    if (compressed == NULL || output == NULL) {
+        fprintf(stderr, "Error: Could not create temporary files.\n");
+        if (compressed != NULL) {
+            fclose(compressed);
+        }
+        if (output != NULL) {
+            fclose(output);
+        }
+        free_image(image);
+        return false;
+    }
+    Codeword_Array *codeword_array =
+        compress40_encode(&view, best.compress_band_rows, best.threads);
+    write_compressed_image(compressed, codeword_array, IMAGE_WIDTH,
+                           IMAGE_HEIGHT);
+    free_codeword_array(codeword_array);
+    free_image(image);
+
+    count = sizeof(rows_per_write_tried) / sizeof(rows_per_write_tried[0]);
+    for (int i = 0; i < count; i++) {
+        double seconds = time_decode(compressed, output, best.threads,
+                                     rows_per_write_tried[i]);
+        report_time(report, "rows per write", rows_per_write_tried[i],
+                    seconds);
+        if (i == 0 || seconds < best_seconds * (1 - MIN_GAIN)) {
+            best.decode_rows_per_write = rows_per_write_tried[i];
+            best_seconds = seconds;
+        }
+    }
+    fclose(compressed);
+    fclose(output);
+
+    /* 5. The profile */
+    if (!tuning_save(&best, path, notes)) {
+        return false;
+    }
+    fprintf(report, "%-*s %d threads, %d band rows, %d rows per write\n",
+            LABEL_WIDTH, "saved to profile", best.threads,
+            best.compress_band_rows, best.decode_rows_per_write);
+    fprintf(report, "%-*s %s\n", LABEL_WIDTH, "profile", path);
+    return true;
+}
+
+/* Helper function implementations */
+
+/* Makes an image of smooth gradients with a little noise, so that the
+   transform and quantizer see the mix of flat and detailed blocks a
+   photograph gives them */
+static Image *synthetic_image(int width, int height)
+{
+    Image *image = malloc(sizeof(Image));
+    assert(image != NULL);
+    image->width = width;
+    image->height = height;
+    image->pixels = malloc(height * sizeof(Pixel *));
+    assert(image->pixels != NULL);
+
+    unsigned seed = 40;
+    for (int y = 0; y < height; y++) {
+        image->pixels[y] = malloc(width * sizeof(Pixel));
+        assert(image->pixels[y] != NULL);
+        for (int x = 0; x < width; x++) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (seed >> 16) % 32;
+            image->pixels[y][x].red = (x * 223 / width + noise) % 256;
+            image->pixels[y][x].green = (y * 223 / height + noise) % 256;
+            image->pixels[y][x].blue = ((x + y) * 111 / (width + height) +
+                                        noise * 4) % 256;
+        }
+    }
+    return image;
+}
+
+/* Returns a monotonic time in seconds */
+static double now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/* Times each stage of compressing the whole view at once */
+static void time_stages(const Image_View *view, double seconds[STAGE_COUNT])
+{
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        double times[STAGE_COUNT + 1];
+        times[0] = now();
+        YPbPr_image *ypbpr_image = rgb_view_to_ypbpr(view);
+        times[1] = now();
+        Block_Array *block_array = create_blocks(ypbpr_image);
+        times[2] = now();
+        DCT_Array *dct_array = perform_dct(block_array);
+        times[3] = now();
+        Codeword_Array *codeword_array = quantize_and_pack(dct_array);
+        times[4] = now();
+
+        free_ypbpr_image(ypbpr_image);
+        free_block_array(block_array);
+        free_dct_array(dct_array);
+        free_codeword_array(codeword_array);
+
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            double elapsed = times[i + 1] - times[i];
+            if (repeat == 0 || elapsed < seconds[i]) {
+                seconds[i] = elapsed;
+            }
+        }
+    }
+}
+
+/* Returns the fastest time to encode the view with one setting */
+static double time_encode(const Image_View *view, int band_rows,
+                          int thread_count)
+{
+    double best = 0;
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        double start = now();
+        Codeword_Array *codeword_array = compress40_encode(view, band_rows,
+                                                           thread_count);
+        double elapsed = now() - start;
+        free_codeword_array(codeword_array);
+        if (repeat == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+/* Returns the fastest time to decode the compressed file with one
+   setting, overwriting the output each time */
+static double time_decode(FILE *compressed, FILE *output, int thread_count,
+                          int rows_per_write)
+{
+    double best = 0;
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        rewind(compressed);
+        rewind(output);
+        double start = now();
+        decompress40_parallel(compressed, output, thread_count,
+                              rows_per_write);
+        fflush(output);
+        double elapsed = now() - start;
+        if (repeat == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+/* Prints the time one setting took */
+static void report_time(FILE *report, const char *setting, int value,
+                        double seconds)
+{
+    char label[LABEL_WIDTH + 1];
+    snprintf(label, sizeof(label), "%s %d", setting, value);
+    fprintf(report, "%-*s %.2f ms\n", LABEL_WIDTH, label, seconds * 1e3);
+}
@@ -0,0 +1,23 @@
+/* calibrate.h */
+
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* Function Prototypes */
+
+/**
+ * Measures the codec on this machine and saves the fastest settings as
+ * the tuning profile. On a synthetic image it times each compression
+ * stage, then the compressor over a range of band heights and thread
+ * counts, then the parallel decoder over a range of rows per write.
+ * @param path The profile to write, or NULL for tuning_profile_path().
+ * @param report Where to print the timings.
+ * @return true if the profile was saved, false (after printing an error)
+ * otherwise.
+ */
+bool calibrate40(const char *path, FILE *report);
+
+#endif /* CALIBRATE_H */
@@ -1,6 +1,7 @@
 /* chroma_processing.c */
 
 #include "chroma_processing.h"
+#include "huge_alloc.h"
 #include <stdlib.h>
 #include <assert.h>
 
@@ -23,13 +24,8 @@ Block_Array *create_blocks(YPbPr_image *ypbpr_image)
     block_array->width = block_width;
     block_array->height = block_height;
 
-    block_array->blocks = malloc(block_height * sizeof(Block *));
-    assert(block_array->blocks != NULL);
-
-    for (int i = 0; i < block_height; i++) {
-        block_array->blocks[i] = malloc(block_width * sizeof(Block));
-        assert(block_array->blocks[i] != NULL);
-    }
+    block_array->blocks = huge_alloc_rows(block_height,
+                                          block_width * sizeof(Block));
 
     /* Process each 2x2 block */
     for (int block_y = 0; block_y < block_height; block_y++) {
@@ -80,13 +76,8 @@ YPbPr_image *reassemble_blocks(Block_Array *block_array)
     ypbpr_image->width = image_width;
     ypbpr_image->height = image_height;
 
-    ypbpr_image->pixels = malloc(image_height * sizeof(YPbPr_pixel *));
-    assert(ypbpr_image->pixels != NULL);
-
-    for (int i = 0; i < image_height; i++) {
-        ypbpr_image->pixels[i] = malloc(image_width * sizeof(YPbPr_pixel));
-        assert(ypbpr_image->pixels[i] != NULL);
-    }
+    ypbpr_image->pixels = huge_alloc_rows(image_height,
+                                          image_width * sizeof(YPbPr_pixel));
 
     /* Process each block to reconstruct the image */
     for (int block_y = 0; block_y < block_height; block_y++) {
@@ -130,9 +121,6 @@ void free_block_array(Block_Array *block_array)
         return;
     }
 
-    for (int i = 0; i < block_array->height; i++) {
-        free(block_array->blocks[i]);
-    }
-    free(block_array->blocks);
+    huge_free_rows(block_array->blocks);
     free(block_array);
 }
@@ -0,0 +1,359 @@
+/* codeword_layout.c */
+
+#include "codeword_layout.h"
+#include "color_conversion.h"
+#include "chroma_processing.h"
+#include "io.h"
+#include "huge_alloc.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <pnmrdr.h>
+
+/* Format 2 holds only the standard layout on 8-bit sources; format 3
+   adds the layout's name and the source's maxval:
+ *
+ *     "COMP40 Compressed image format 3\n"
+ *     "<layout> <maxval>\n"
+ *     "<width> <height>\n"
+ *     codewords, big-endian, word_bytes each
+ */
+#define FORMAT_2_MAGIC_NUMBER "COMP40 Compressed image format 2\n"
+#define FORMAT_3_MAGIC_NUMBER "COMP40 Compressed image format 3\n"
+
+#define MAX_MAXVAL 65535
+
+/* Quantizers shared by every layout. The kernels below pass them
+   constant widths and ranges, so each kernel is compiled with its own
+   shifts, masks and scales folded in. They use the same expressions as
+   quantization.c, which keeps the standard layout's codewords identical
+   to quantize_and_pack's. */
+
+/* Quantizes a value clamped to [0, 1] over 0 .. max */
+static inline unsigned quantize_unit(float value, unsigned max)
+{
+    if (value < 0.0) value = 0.0;
+    if (value > 1.0) value = 1.0;
+    return (unsigned)round(value * (double)max);
+}
+
+/* Quantizes a value clamped to +/-range with the given levels per unit */
+static inline int quantize_signed(float value, double range, double scale)
+{
+    if (value < -range) value = -range;
+    if (value > range) value = range;
+    return (int)round(value * scale);
+}
+
+/* Maps a value clamped to +/-range to an index from 0 to steps */
+static inline unsigned quantize_index(float value, double range,
+                                      unsigned steps)
+{
+    if (value < -range) value = -range;
+    if (value > range) value = range;
+    unsigned index = (unsigned)round(((value - -range) / (range - -range)) *
+                                     steps);
+    return index > steps ? steps : index;
+}
+
+/* Maps an index from 0 to steps back to a value over +/-range */
+static inline float dequantize_index(unsigned index, double range, int steps)
+{
+    return -range + ((float)index / steps) * (range - -range);
+}
+
+/* Defines pack_NAME and unpack_NAME for a layout with these widths and
+   ranges in a WORD. A layout whose fields do not fill its word exactly
+   fails to compile. */
+#define DEFINE_LAYOUT_KERNELS(NAME, WORD, A_W, BCD_W, CHROMA_W,              \
+                              BCD_RANGE, CHROMA_RANGE)                       \
+enum {                                                                       \
+    NAME##_PR_AT = 0,                                                        \
+    NAME##_PB_AT = CHROMA_W,                                                 \
+    NAME##_D_AT = 2 * (CHROMA_W),                                            \
+    NAME##_C_AT = NAME##_D_AT + (BCD_W),                                     \
+    NAME##_B_AT = NAME##_C_AT + (BCD_W),                                     \
+    NAME##_A_AT = NAME##_B_AT + (BCD_W),                                     \
+    NAME##_FILLS_WORD =                                                      \
+        1 / (NAME##_A_AT + (A_W) == 8 * (int)sizeof(WORD))                   \
+};                                                                           \
+                                                                             \
+static void pack_##NAME(const DCT_Block *blocks, int count,                  \
+                        unsigned char *bytes)                                \
+{                                                                            \
+    const WORD bcd_mask = ((WORD)1 << (BCD_W)) - 1;                          \
+    const double bcd_scale = ((1 << ((BCD_W) - 1)) - 1) / (BCD_RANGE);       \
+    const unsigned steps = (1u << (CHROMA_W)) - 1;                           \
+                                                                             \
+    for (int i = 0; i < count; i++) {                                        \
+        const DCT_Block *block = &blocks[i];                                 \
+        WORD word =                                                          \
+            (WORD)quantize_unit(block->a, (1u << (A_W)) - 1)                 \
+                << NAME##_A_AT |                                             \
+            ((WORD)quantize_signed(block->b, BCD_RANGE, bcd_scale) &         \
+             bcd_mask) << NAME##_B_AT |                                      \
+            ((WORD)quantize_signed(block->c, BCD_RANGE, bcd_scale) &         \
+             bcd_mask) << NAME##_C_AT |                                      \
+            ((WORD)quantize_signed(block->d, BCD_RANGE, bcd_scale) &         \
+             bcd_mask) << NAME##_D_AT |                                      \
+            (WORD)quantize_index(block->pb_avg, CHROMA_RANGE, steps)         \
+                << NAME##_PB_AT |                                            \
+            (WORD)quantize_index(block->pr_avg, CHROMA_RANGE, steps)         \
+                << NAME##_PR_AT;                                             \
+                                                                             \
+        for (int byte = 0; byte < (int)sizeof(WORD); byte++) {               \
+            bytes[byte] = word >> (8 * ((int)sizeof(WORD) - 1 - byte));      \
+        }                                                                    \
+        bytes += sizeof(WORD);                                               \
+    }                                                                        \
+}                                                                            \
+                                                                             \
+static void unpack_##NAME(const unsigned char *bytes, int count,             \
+                          DCT_Block *blocks)                                 \
+{                                                                            \
+    const WORD a_mask = ((WORD)1 << (A_W)) - 1;                              \
+    const WORD bcd_mask = ((WORD)1 << (BCD_W)) - 1;                          \
+    const WORD chroma_mask = ((WORD)1 << (CHROMA_W)) - 1;                    \
+    const int bcd_sign = 1 << ((BCD_W) - 1);                                 \
+    const double bcd_scale = (bcd_sign - 1) / (BCD_RANGE);                   \
+    const int steps = (1 << (CHROMA_W)) - 1;                                 \
+                                                                             \
+    for (int i = 0; i < count; i++) {                                        \
+        WORD word = 0;                                                       \
+        for (int byte = 0; byte < (int)sizeof(WORD); byte++) {               \
+            word = word << 8 | bytes[byte];                                  \
+        }                                                                    \
+        bytes += sizeof(WORD);                                               \
+                                                                             \
+        /* Sign-extend b, c and d by flipping and subtracting the sign */    \
+        int b = ((int)(word >> NAME##_B_AT & bcd_mask) ^ bcd_sign) - bcd_sign; \
+        int c = ((int)(word >> NAME##_C_AT & bcd_mask) ^ bcd_sign) - bcd_sign; \
+        int d = ((int)(word >> NAME##_D_AT & bcd_mask) ^ bcd_sign) - bcd_sign; \
+                                                                             \
+        DCT_Block *block = &blocks[i];                                       \
+        block->a = (float)(unsigned)(word >> NAME##_A_AT & a_mask) /         \
+                   (double)((1u << (A_W)) - 1);                              \
+        block->b = (float)b / bcd_scale;                                     \
+        block->c = (float)c / bcd_scale;                                     \
+        block->d = (float)d / bcd_scale;                                     \
+        block->pb_avg = dequantize_index(word >> NAME##_PB_AT & chroma_mask, \
+                                         CHROMA_RANGE, steps);               \
+        block->pr_avg = dequantize_index(word >> NAME##_PR_AT & chroma_mask, \
+                                         CHROMA_RANGE, steps);               \
+    }                                                                        \
+}
+
+/* 6 + 3 * 2 + 2 * 2: enough for thumbnails at half the standard size */
+DEFINE_LAYOUT_KERNELS(preview16, uint16_t, 6, 2, 2, 0.15, 0.2)
+
+/* 9 + 3 * 5 + 2 * 4: the codeword of format 2 */
+DEFINE_LAYOUT_KERNELS(standard32, uint32_t, 9, 5, 4, 0.3, 0.3)
+
+/* 13 + 3 * 11 + 2 * 9: b, c, d and chroma over their whole range */
+DEFINE_LAYOUT_KERNELS(archival64, uint64_t, 13, 11, 9, 0.5, 0.5)
+
+static const Codeword_Layout layouts[] = {
+    { "preview16", 2, 6, 2, 2, 0.15, 0.2, pack_preview16, unpack_preview16 },
+    { "standard32", 4, 9, 5, 4, 0.3, 0.3, pack_standard32, unpack_standard32 },
+    { "archival64", 8, 13, 11, 9, 0.5, 0.5, pack_archival64,
+      unpack_archival64 },
+};
+
+#define LAYOUT_COUNT (int)(sizeof(layouts) / sizeof(layouts[0]))
+#define STANDARD_LAYOUT (&layouts[1])
+
+/* Helper functions */
+static YPbPr_image *read_deep_image(FILE *input, unsigned *maxval);
+static void put_sample(unsigned char **out, float value, unsigned maxval);
+
+/* Looks up a layout by name */
+const Codeword_Layout *codeword_layout_named(const char *name)
+{
+    assert(name != NULL);
+
+    for (int i = 0; i < LAYOUT_COUNT; i++) {
+        if (strcmp(layouts[i].name, name) == 0) {
+            return &layouts[i];
+        }
+    }
+    return NULL;
+}
+
+/* Compresses a PPM image of any depth with the given layout */
+void compress40_layout(FILE *input, FILE *output,
+                       const Codeword_Layout *layout)
+{
+    assert(input != NULL && output != NULL && layout != NULL);
+
+    /* 1. Image Reader and RGB to YPbPr Conversion at full precision */
+    unsigned maxval;
+    YPbPr_image *ypbpr_image = read_deep_image(input, &maxval);
+    if (ypbpr_image == NULL) {
+        fprintf(stderr, "Error: Failed to read image.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* 2. Blocks and DCT */
+    Block_Array *block_array = create_blocks(ypbpr_image);
+    free_ypbpr_image(ypbpr_image);
+    DCT_Array *dct_array = perform_dct(block_array);
+    free_block_array(block_array);
+
+    /* 3. Header, then each block row through the layout's kernel */
+    int width = dct_array->width;
+    if (layout == STANDARD_LAYOUT && maxval == 255) {
+        write_compressed_header(output, width * 2, dct_array->height * 2);
+    } else {
+        fprintf(output, "%s%s %u\n%d %d\n", FORMAT_3_MAGIC_NUMBER,
+                layout->name, maxval, width * 2, dct_array->height * 2);
+    }
+
+    unsigned char *row = malloc((size_t)width * layout->word_bytes + 1);
+    assert(row != NULL);
+    for (int y = 0; y < dct_array->height; y++) {
+        layout->pack(dct_array->blocks[y], width, row);
+        fwrite(row, layout->word_bytes, width, output);
+    }
+    free(row);
+    free_dct_array(dct_array);
+}
+
+/* Decompresses a format 2 or 3 image to a PPM image of the source's depth */
+void decompress40_layout(FILE *input, FILE *output)
+{
+    assert(input != NULL && output != NULL);
+
+    /* 1. Header */
+    char magic_number[256];
+    const Codeword_Layout *layout = NULL;
+    unsigned maxval = 255;
+    if (fgets(magic_number, sizeof(magic_number), input) == NULL) {
+        fprintf(stderr, "Error: Could not read compressed image magic number.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(magic_number, FORMAT_2_MAGIC_NUMBER) == 0) {
+        layout = STANDARD_LAYOUT;
+    } else if (strcmp(magic_number, FORMAT_3_MAGIC_NUMBER) == 0) {
+        char name[32];
+        if (fscanf(input, "%31s %u", name, &maxval) != 2 ||
+            (layout = codeword_layout_named(name)) == NULL ||
+            maxval == 0 || maxval > MAX_MAXVAL) {
+            fprintf(stderr, "Error: Unknown codeword layout or maxval.\n");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        fprintf(stderr, "Error: Invalid compressed image format.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int width, height;
+    if (fscanf(input, "%d %d", &width, &height) != 2 || width < 0 ||
+        height < 0 || fgetc(input) != '\n') {
+        fprintf(stderr, "Error: Could not read compressed image dimensions.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* 2. Each block row: unpack, inverse DCT, two scanlines out */
+    int blocks_wide = width / 2;
+    int sample_bytes = maxval > 255 ? 2 : 1;
+    size_t line_length = (size_t)blocks_wide * 2 * 3 * sample_bytes;
+    unsigned char *row = malloc((size_t)blocks_wide * layout->word_bytes + 1);
+    DCT_Block *dct_blocks = malloc((blocks_wide + 1) * sizeof(DCT_Block));
+    unsigned char *lines = malloc(2 * line_length + 1);
+    assert(row != NULL && dct_blocks != NULL && lines != NULL);
+
+    fprintf(output, "P6\n%d %d\n%u\n", blocks_wide * 2, height / 2 * 2,
+            maxval);
+    for (int y = 0; y < height / 2; y++) {
+        if (fread(row, layout->word_bytes, blocks_wide, input) !=
+            (size_t)blocks_wide) {
+            fprintf(stderr, "Error: Unexpected end of file while reading "
+                    "codewords.\n");
+            exit(EXIT_FAILURE);
+        }
+        layout->unpack(row, blocks_wide, dct_blocks);
+
+        unsigned char *top = lines;
+        unsigned char *bottom = lines + line_length;
+        for (int x = 0; x < blocks_wide; x++) {
+            Block block;
+            idct_block(&dct_blocks[x], &block);
+
+            float pb = block.pb_avg;
+            float pr = block.pr_avg;
+            YPbPr_pixel pixels[4] = {
+                { block.y1, pb, pr }, { block.y2, pb, pr },
+                { block.y3, pb, pr }, { block.y4, pb, pr }
+            };
+            for (int i = 0; i < 4; i++) {
+                float rgb[3];
+                ypbpr_pixel_to_unit_rgb(pixels[i], rgb);
+                unsigned char **out = i < 2 ? &top : &bottom;
+                for (int channel = 0; channel < 3; channel++) {
+                    put_sample(out, rgb[channel], maxval);
+                }
+            }
+        }
+        fwrite(lines, 1, 2 * line_length, output);
+    }
+
+    free(lines);
+    free(dct_blocks);
+    free(row);
+}
+
+/* Reads a PPM image of any maxval straight into YPbPr, dropping the last
+   row and column if they are odd */
+static YPbPr_image *read_deep_image(FILE *input, unsigned *maxval)
+{
+    Pnmrdr_T reader = Pnmrdr_new(input);
+    if (reader == NULL) {
+        fprintf(stderr, "Error: Could not read PPM image.\n");
+        return NULL;
+    }
+
+    Pnmrdr_mapdata data = Pnmrdr_data(reader);
+    if (data.type != Pnmrdr_rgb || data.denominator == 0 ||
+        data.denominator > MAX_MAXVAL) {
+        fprintf(stderr, "Error: Input file is not a PPM image.\n");
+        Pnmrdr_free(&reader);
+        return NULL;
+    }
+    *maxval = data.denominator;
+
+    YPbPr_image *ypbpr_image = malloc(sizeof(YPbPr_image));
+    assert(ypbpr_image != NULL);
+    ypbpr_image->width = data.width / 2 * 2;
+    ypbpr_image->height = data.height / 2 * 2;
+    ypbpr_image->pixels = huge_alloc_rows(ypbpr_image->height,
+                                          ypbpr_image->width *
+                                          sizeof(YPbPr_pixel));
+
+    for (int y = 0; y < ypbpr_image->height; y++) {
+        YPbPr_pixel *line = ypbpr_image->pixels[y];
+
+        for (unsigned x = 0; x < data.width; x++) {
+            float r = Pnmrdr_get(reader) / (double)*maxval;
+            float g = Pnmrdr_get(reader) / (double)*maxval;
+            float b = Pnmrdr_get(reader) / (double)*maxval;
+            if (x < (unsigned)ypbpr_image->width) {
+                line[x] = unit_rgb_to_ypbpr(r, g, b);
+            }
+        }
+    }
+
+    Pnmrdr_free(&reader);
+    return ypbpr_image;
+}
+
+/* Appends one sample, scaled from [0, 1] to maxval, big-endian */
+static void put_sample(unsigned char **out, float value, unsigned maxval)
+{
+    unsigned sample = (unsigned)(value * (double)maxval);
+    if (maxval > 255) {
+        *(*out)++ = sample >> 8;
+    }
+    *(*out)++ = sample & 0xFF;
+}
@@ -0,0 +1,61 @@
+/* codeword_layout.h */
+
+#ifndef CODEWORD_LAYOUT_H
+#define CODEWORD_LAYOUT_H
+
+#include <stdio.h>
+#include "transform.h"  // For DCT_Block
+
+/* How a block's quantized coefficients are laid out in one codeword.
+   Every layout holds a, b, c, d, Pb and Pr in that order from the most
+   significant bit, and fills its word exactly. */
+typedef struct {
+    const char *name;      // As given on the command line and in the header
+    int word_bytes;        // 2, 4 or 8
+    int a_width;
+    int bcd_width;         // Each of b, c and d, signed
+    int chroma_width;      // Each of the Pb and Pr indices
+    float bcd_range;       // Largest magnitude of b, c and d represented
+    float chroma_range;    // Largest magnitude of Pb and Pr represented
+
+    /* Quantizes count blocks and stores their codewords big-endian */
+    void (*pack)(const DCT_Block *blocks, int count, unsigned char *bytes);
+
+    /* Loads count big-endian codewords and dequantizes them */
+    void (*unpack)(const unsigned char *bytes, int count, DCT_Block *blocks);
+} Codeword_Layout;
+
+/* Function Prototypes */
+
+/**
+ * Looks up a layout: "preview16" (16 bits, for thumbnails and proxies),
+ * "standard32" (the 32-bit codeword of format 2) or "archival64" (64 bits,
+ * fine enough for 16-bit sources).
+ * @param name The layout's name.
+ * @return The layout, or NULL if there is none by that name.
+ */
+const Codeword_Layout *codeword_layout_named(const char *name);
+
+/**
+ * Compresses a PPM image of any depth with the given layout. The source
+ * is converted at full precision rather than through 8-bit pixels, and
+ * its maxval is recorded so decompression gives back the same depth.
+ * The standard layout on an 8-bit source is written as format 2, byte
+ * for byte what compress40 writes; anything else is written as format 3,
+ * whose header names the layout.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ * @param layout The layout.
+ */
+void compress40_layout(FILE *input, FILE *output,
+                       const Codeword_Layout *layout);
+
+/**
+ * Decompresses a format 2 or format 3 image to a PPM image with the
+ * source's maxval, using the layout named in the header.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ */
+void decompress40_layout(FILE *input, FILE *output);
+
+#endif /* CODEWORD_LAYOUT_H */
@@ -0,0 +1,42 @@
+/* codeword_vector.h */
+
+#ifndef CODEWORD_VECTOR_H
+#define CODEWORD_VECTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Codeword grids smaller than this many blocks are worked on by one
+   thread; below it, starting threads costs more than it saves */
+#define MIN_PARALLEL_BLOCKS (1 << 18)
+
+/* Codewords handled at once by the vector kernels. Sixteen bytes keeps
+   the vectors in one SSE or NEON register. */
+#define WORD_LANES 4
+
+typedef uint32_t Word_Vector
+    __attribute__((vector_size(WORD_LANES * sizeof(uint32_t))));
+typedef int32_t Field_Vector
+    __attribute__((vector_size(WORD_LANES * sizeof(int32_t))));
+
+/**
+ * Extracts one field from each codeword of a vector. The field is
+ * shifted to the top of each lane and back down, arithmetically for
+ * signed fields, so it comes out sign-extended.
+ * @param words The codewords, in host order.
+ * @param width The width of the field in bits.
+ * @param lsb The least significant bit of the field.
+ * @param is_signed Whether the field holds a two's complement value.
+ * @return The field of each lane.
+ */
+static inline Field_Vector field_vector(Word_Vector words, unsigned width,
+                                        unsigned lsb, bool is_signed)
+{
+    unsigned top = 32 - width - lsb;
+    if (is_signed) {
+        return (Field_Vector)(words << top) >> (32 - width);
+    }
+    return (Field_Vector)((words << top) >> (32 - width));
+}
+
+#endif /* CODEWORD_VECTOR_H */
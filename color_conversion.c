@@ -1,6 +1,7 @@
 /* color_conversion.c */
 
 #include "color_conversion.h"
+#include "huge_alloc.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <math.h>
@@ -32,8 +33,17 @@ YPbPr_image *rgb_to_ypbpr(Image *image)
 {
     assert(image != NULL);
 
-    int width = image->width;
-    int height = image->height;
+    Image_View view = image_view(image);
+    return rgb_view_to_ypbpr(&view);
+}
+
+/* Converts a view of an RGB Image to a YPbPr Image */
+YPbPr_image *rgb_view_to_ypbpr(const Image_View *view)
+{
+    assert(view != NULL);
+
+    int width = view->width;
+    int height = view->height;
 
     /* Allocate memory for YPbPr_image */
     YPbPr_image *ypbpr_image = malloc(sizeof(YPbPr_image));
@@ -42,33 +52,24 @@ YPbPr_image *rgb_to_ypbpr(Image *image)
     ypbpr_image->width = width;
     ypbpr_image->height = height;
 
-    ypbpr_image->pixels = malloc(height * sizeof(YPbPr_pixel *));
-    assert(ypbpr_image->pixels != NULL);
+    ypbpr_image->pixels = huge_alloc_rows(height,
+                                          width * sizeof(YPbPr_pixel));
 
-    for (int i = 0; i < height; i++) {
-        ypbpr_image->pixels[i] = malloc(width * sizeof(YPbPr_pixel));
-        assert(ypbpr_image->pixels[i] != NULL);
-    }
-
-    /* Convert each pixel from RGB to YPbPr */
+    /* Convert each pixel from RGB to YPbPr; padding repeats the last
+       real row and column */
     for (int y = 0; y < height; y++) {
+        int source_y = y < view->pixels_high ? y : view->pixels_high - 1;
+        const Pixel *row = view->rows[source_y] + view->x;
         for (int x = 0; x < width; x++) {
-            Pixel rgb_pixel = image->pixels[y][x];
+            Pixel rgb_pixel = row[x < view->pixels_wide ? x
+                                                        : view->pixels_wide - 1];
 
             /* Normalize RGB values to [0,1] */
             float r = rgb_pixel.red / 255.0;
             float g = rgb_pixel.green / 255.0;
             float b = rgb_pixel.blue / 255.0;
 
-            /* Compute Y, Pb, Pr */
-            float y_value = R_COEFF * r + G_COEFF * g + B_COEFF * b;
-            float pb_value = PB_R_COEFF * r + PB_G_COEFF * g + PB_B_COEFF * b;
-            float pr_value = PR_R_COEFF * r + PR_G_COEFF * g + PR_B_COEFF * b;
-
-            /* Store the YPbPr values */
-            ypbpr_image->pixels[y][x].y = y_value;
-            ypbpr_image->pixels[y][x].pb = pb_value;
-            ypbpr_image->pixels[y][x].pr = pr_value;
+            ypbpr_image->pixels[y][x] = unit_rgb_to_ypbpr(r, g, b);
         }
     }
 
@@ -101,32 +102,56 @@ Image *ypbpr_to_rgb(YPbPr_image *ypbpr_image)
     /* Convert each pixel from YPbPr to RGB */
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
-            YPbPr_pixel ypbpr_pixel = ypbpr_image->pixels[y][x];
-
-            float y_value = ypbpr_pixel.y;
-            float pb_value = ypbpr_pixel.pb;
-            float pr_value = ypbpr_pixel.pr;
-
-            /* Compute R, G, B */
-            float r = y_value + PR_TO_R_COEFF * pr_value;
-            float g = y_value + PB_TO_G_COEFF * pb_value + PR_TO_G_COEFF * pr_value;
-            float b = y_value + PB_TO_B_COEFF * pb_value;
-
-            /* Clamp values to [0,1] */
-            r = clamp(r, 0.0, 1.0);
-            g = clamp(g, 0.0, 1.0);
-            b = clamp(b, 0.0, 1.0);
-
-            /* Convert to [0,255] and store in Pixel */
-            image->pixels[y][x].red = (uint8_t)(r * 255.0);
-            image->pixels[y][x].green = (uint8_t)(g * 255.0);
-            image->pixels[y][x].blue = (uint8_t)(b * 255.0);
+            image->pixels[y][x] = ypbpr_pixel_to_rgb(ypbpr_image->pixels[y][x]);
         }
     }
 
     return image;
 }
 
+/* Converts a single normalized RGB pixel to YPbPr */
+YPbPr_pixel unit_rgb_to_ypbpr(float r, float g, float b)
+{
+    /* Compute Y, Pb, Pr */
+    YPbPr_pixel ypbpr_pixel;
+    ypbpr_pixel.y = R_COEFF * r + G_COEFF * g + B_COEFF * b;
+    ypbpr_pixel.pb = PB_R_COEFF * r + PB_G_COEFF * g + PB_B_COEFF * b;
+    ypbpr_pixel.pr = PR_R_COEFF * r + PR_G_COEFF * g + PR_B_COEFF * b;
+    return ypbpr_pixel;
+}
+
+/* Converts a single YPbPr pixel to normalized, clamped RGB */
+void ypbpr_pixel_to_unit_rgb(YPbPr_pixel ypbpr_pixel, float rgb[3])
+{
+    float y_value = ypbpr_pixel.y;
+    float pb_value = ypbpr_pixel.pb;
+    float pr_value = ypbpr_pixel.pr;
+
+    /* Compute R, G, B */
+    float r = y_value + PR_TO_R_COEFF * pr_value;
+    float g = y_value + PB_TO_G_COEFF * pb_value + PR_TO_G_COEFF * pr_value;
+    float b = y_value + PB_TO_B_COEFF * pb_value;
+
+    /* Clamp values to [0,1] */
+    rgb[0] = clamp(r, 0.0, 1.0);
+    rgb[1] = clamp(g, 0.0, 1.0);
+    rgb[2] = clamp(b, 0.0, 1.0);
+}
+
+/* Converts a single YPbPr pixel to RGB */
+Pixel ypbpr_pixel_to_rgb(YPbPr_pixel ypbpr_pixel)
+{
+    float rgb[3];
+    ypbpr_pixel_to_unit_rgb(ypbpr_pixel, rgb);
+
+    /* Convert to [0,255] and store in Pixel */
+    Pixel pixel;
+    pixel.red = (uint8_t)(rgb[0] * 255.0);
+    pixel.green = (uint8_t)(rgb[1] * 255.0);
+    pixel.blue = (uint8_t)(rgb[2] * 255.0);
+    return pixel;
+}
+
 /* Frees the memory allocated for the YPbPr Image */
 void free_ypbpr_image(YPbPr_image *ypbpr_image)
 {
@@ -134,10 +159,7 @@ void free_ypbpr_image(YPbPr_image *ypbpr_image)
         return;
     }
 
-    for (int i = 0; i < ypbpr_image->height; i++) {
-        free(ypbpr_image->pixels[i]);
-    }
-    free(ypbpr_image->pixels);
+    huge_free_rows(ypbpr_image->pixels);
     free(ypbpr_image);
 }
 
@@ -28,6 +28,14 @@ typedef struct {
  */
 YPbPr_image *rgb_to_ypbpr(Image *image);
 
+/**
+ * Converts a view of an RGB Image to a YPbPr Image, reading the pixels
+ * in place and repeating the last row or column where the view pads.
+ * @param view The view.
+ * @return A pointer to the YPbPr Image, the size of the view.
+ */
+YPbPr_image *rgb_view_to_ypbpr(const Image_View *view);
+
 /**
  * Converts a YPbPr Image to an RGB Image.
  * @param ypbpr_image The input YPbPr Image.
@@ -35,6 +43,30 @@ YPbPr_image *rgb_to_ypbpr(Image *image);
  */
 Image *ypbpr_to_rgb(YPbPr_image *ypbpr_image);
 
+/**
+ * Converts a single YPbPr pixel to an RGB pixel, clamping each channel.
+ * @param ypbpr_pixel The input YPbPr pixel.
+ * @return The RGB pixel.
+ */
+Pixel ypbpr_pixel_to_rgb(YPbPr_pixel ypbpr_pixel);
+
+/**
+ * Converts one RGB pixel, with each channel scaled to [0, 1], to YPbPr.
+ * Images of any depth go through this.
+ * @param r The red channel.
+ * @param g The green channel.
+ * @param b The blue channel.
+ * @return The YPbPr pixel.
+ */
+YPbPr_pixel unit_rgb_to_ypbpr(float r, float g, float b);
+
+/**
+ * Converts a YPbPr pixel to RGB channels scaled to [0, 1], clamping each.
+ * @param ypbpr_pixel The input YPbPr pixel.
+ * @param rgb Where to store red, green and blue.
+ */
+void ypbpr_pixel_to_unit_rgb(YPbPr_pixel ypbpr_pixel, float rgb[3]);
+
 /**
  * Frees the memory allocated for the YPbPr Image.
  * @param ypbpr_image The YPbPr Image to be freed.
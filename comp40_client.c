@@ -0,0 +1,205 @@
+/* comp40_client.c */
+
+#define _GNU_SOURCE  // For memfd_create
+#include "comp40_client.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Most descriptors a message carries (input and output) */
+#define MAX_FDS 2
+
+/* Size of each read when copying a stream into a memfd */
+#define COPY_BUFFER_SIZE 65536
+
+/* Returns the daemon's socket path */
+const char *comp40_socket_path(void)
+{
+    const char *path = getenv("COMP40_SOCKET");
+    return path != NULL && *path != '\0' ? path : COMP40_DEFAULT_SOCKET;
+}
+
+/* Connects to a running 40imaged */
+int comp40_client_connect(const char *socket_path)
+{
+    if (socket_path == NULL) {
+        socket_path = comp40_socket_path();
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long.\n", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0 ||
+        connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Error: Could not connect to 40imaged at %s: %s.\n",
+                socket_path, strerror(errno));
+        if (connection >= 0) {
+            close(connection);
+        }
+        return -1;
+    }
+
+    return connection;
+}
+
+/* Sends one request and waits for its reply */
+bool comp40_client_request(int connection, Comp40_Operation operation,
+                           int input_fd, size_t input_length, int output_fd,
+                           size_t *output_length)
+{
+    assert(output_length != NULL);
+
+    Comp40_Request request = { COMP40_REQUEST_MAGIC, operation, input_length };
+    int fds[MAX_FDS] = { input_fd, output_fd };
+    if (!comp40_send_with_fds(connection, &request, sizeof(request), fds,
+                              MAX_FDS)) {
+        fprintf(stderr, "Error: Could not send request to 40imaged: %s.\n",
+                strerror(errno));
+        return false;
+    }
+
+    Comp40_Reply reply;
+    if (!comp40_receive_with_fds(connection, &reply, sizeof(reply), NULL, 0)) {
+        fprintf(stderr, "Error: 40imaged closed the connection.\n");
+        return false;
+    }
+    if (reply.status != 0) {
+        fprintf(stderr, "Error: 40imaged could not process the image: %s.\n",
+                strerror(reply.status));
+        return false;
+    }
+
+    *output_length = reply.output_length;
+    return true;
+}
+
+/* Copies a stream into a new memfd */
+int comp40_client_memfd_from_stream(FILE *input, size_t *length)
+{
+    assert(input != NULL);
+    assert(length != NULL);
+
+    int fd = memfd_create("40image-input", MFD_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not create memfd: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    char buffer[COPY_BUFFER_SIZE];
+    size_t total = 0;
+    size_t got;
+    while ((got = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+        size_t done = 0;
+        while (done < got) {
+            ssize_t written = write(fd, buffer + done, got - done);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "Error: Could not fill memfd: %s.\n",
+                        strerror(errno));
+                close(fd);
+                return -1;
+            }
+            done += written;
+        }
+        total += got;
+    }
+
+    *length = total;
+    return fd;
+}
+
+/* Sends a message with file descriptors attached */
+bool comp40_send_with_fds(int socket, const void *data, size_t length,
+                          const int *fds, int fd_count)
+{
+    assert(fd_count >= 0 && fd_count <= MAX_FDS);
+
+    union {
+        struct cmsghdr header;  // Forces alignment
+        char space[CMSG_SPACE(MAX_FDS * sizeof(int))];
+    } control;
+    struct iovec iov = { (void *)data, length };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+
+    if (fd_count > 0) {
+        message.msg_control = control.space;
+        message.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+
+    return sent == (ssize_t)length;
+}
+
+/* Receives a message with descriptors attached */
+bool comp40_receive_with_fds(int socket, void *data, size_t length, int *fds,
+                             int fd_count)
+{
+    assert(fd_count >= 0 && fd_count <= MAX_FDS);
+    for (int i = 0; i < fd_count; i++) {
+        fds[i] = -1;
+    }
+
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(MAX_FDS * sizeof(int))];
+    } control;
+    struct iovec iov = { data, length };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+
+    ssize_t got;
+    do {
+        got = recvmsg(socket, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    } while (got < 0 && errno == EINTR);
+
+    /* Take ownership of whatever descriptors arrived, even on failure */
+    int received = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *incoming = (int *)CMSG_DATA(cmsg);
+        for (int i = 0; i < count; i++) {
+            if (received < fd_count) {
+                fds[received++] = incoming[i];
+            } else {
+                close(incoming[i]);
+            }
+        }
+    }
+
+    return got == (ssize_t)length && received == fd_count &&
+           !(message.msg_flags & MSG_CTRUNC);
+}
@@ -0,0 +1,109 @@
+/* comp40_client.h */
+
+#ifndef COMP40_CLIENT_H
+#define COMP40_CLIENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Where 40imaged listens unless told otherwise; the COMP40_SOCKET
+   environment variable overrides it for both daemon and clients */
+#define COMP40_DEFAULT_SOCKET "/tmp/40imaged.sock"
+
+/* First word of every request, to catch clients speaking another protocol */
+#define COMP40_REQUEST_MAGIC 0x43343044u  // "C40D"
+
+/* What a request asks the daemon to do */
+typedef enum {
+    COMP40_COMPRESS = 1,    // PPM in, compressed image out
+    COMP40_DECOMPRESS = 2,  // Compressed image in, PPM out
+    COMP40_CACHE_STATS = 3  // Nothing in, decode cache counters out
+} Comp40_Operation;
+
+/* Sent with two descriptors attached (input, then output). The pixels
+   never pass through the socket; only this header does. */
+typedef struct {
+    uint32_t magic;
+    uint32_t operation;     // A Comp40_Operation
+    uint64_t input_length;  // Bytes of input, starting at offset 0
+} Comp40_Request;
+
+/* Sent back once the output descriptor holds the result */
+typedef struct {
+    int32_t status;         // 0 on success, otherwise an errno value
+    uint32_t reserved;
+    uint64_t output_length; // Bytes of output, starting at offset 0
+} Comp40_Reply;
+
+/* Function Prototypes */
+
+/**
+ * Returns the daemon's socket path: COMP40_SOCKET if set, otherwise
+ * COMP40_DEFAULT_SOCKET.
+ * @return The socket path.
+ */
+const char *comp40_socket_path(void);
+
+/**
+ * Connects to a running 40imaged. A connection may carry any number of
+ * requests, one at a time.
+ * @param socket_path The daemon's socket, or NULL for the default.
+ * @return The connected socket, or -1 (after printing an error).
+ */
+int comp40_client_connect(const char *socket_path);
+
+/**
+ * Sends one request and waits for its reply. The daemon reads the input
+ * descriptor from offset 0 and replaces the contents of the output
+ * descriptor, which must be writable and should be a memfd or regular
+ * file so the caller can map the result.
+ * @param connection A socket from comp40_client_connect.
+ * @param operation What to do.
+ * @param input_fd The input, e.g. a memfd or a regular file.
+ * @param input_length The number of input bytes.
+ * @param output_fd Where the daemon writes the result.
+ * @param output_length Pointer to store the number of output bytes.
+ * @return true on success, false (after printing an error) otherwise.
+ */
+bool comp40_client_request(int connection, Comp40_Operation operation,
+                           int input_fd, size_t input_length, int output_fd,
+                           size_t *output_length);
+
+/**
+ * Copies a stream into a new memfd, for input that is not already in a
+ * regular file.
+ * @param input The input file pointer.
+ * @param length Pointer to store the number of bytes copied.
+ * @return The memfd, or -1 (after printing an error).
+ */
+int comp40_client_memfd_from_stream(FILE *input, size_t *length);
+
+/**
+ * Sends a message with file descriptors attached.
+ * @param socket The socket.
+ * @param data The message.
+ * @param length The message length.
+ * @param fds The descriptors to attach.
+ * @param fd_count The number of descriptors.
+ * @return true if the whole message was sent.
+ */
+bool comp40_send_with_fds(int socket, const void *data, size_t length,
+                          const int *fds, int fd_count);
+
+/**
+ * Receives a message of exactly length bytes with up to fd_count
+ * descriptors attached. Unused entries of fds are set to -1; any that
+ * are not -1 belong to the caller even if the call fails.
+ * @param socket The socket.
+ * @param data Where to store the message.
+ * @param length The message length.
+ * @param fds Where to store the descriptors.
+ * @param fd_count The number of descriptors expected.
+ * @return true if a whole message arrived, false on end of stream or error.
+ */
+bool comp40_receive_with_fds(int socket, void *data, size_t length, int *fds,
+                             int fd_count);
+
+#endif /* COMP40_CLIENT_H */
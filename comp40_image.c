@@ -0,0 +1,206 @@
+/* comp40_image.c */
+
+#include "comp40_image.h"
+#include "block_decode.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+/* A tile is a run of TILE_BLOCKS blocks along one block row, decoded to
+   two rows of pixels; 4 blocks = 8 x 2 pixels, so a random read decodes
+   little more than the block it needs */
+#define TILE_BLOCKS 4
+#define TILE_PIXELS (2 * TILE_BLOCKS)
+
+/* Number of decoded tiles kept in the cache */
+#define CACHE_TILES 128
+
+/* Marks an unused cache slot */
+#define NO_TILE UINT64_MAX
+
+struct Comp40_Image {
+    Mapped_Compressed_Image mapped;
+    int block_width;          // Number of blocks horizontally
+    int block_height;         // Number of blocks vertically
+    int tiles_per_row;
+
+    /* Cache slots: which tile each holds, when it was last used, and
+       its two decoded pixel rows */
+    uint64_t keys[CACHE_TILES];
+    uint64_t last_used[CACHE_TILES];
+    uint64_t clock;
+    int recent;               // Slot of the most recent hit
+    Pixel (*tiles)[2][TILE_PIXELS];
+};
+
+/* Helper functions */
+static const Pixel *tile_row(Comp40_Image image, int block_x, int y);
+static int load_tile(Comp40_Image image, uint64_t key, int block_y, int tile);
+
+/* Opens a compressed image for random access */
+Comp40_Image Comp40_Image_open(const char *path)
+{
+    assert(path != NULL);
+
+    FILE *input = fopen(path, "r");
+    if (input == NULL) {
+        fprintf(stderr, "Error: Could not open %s.\n", path);
+        return NULL;
+    }
+
+    Comp40_Image image = malloc(sizeof(*image));
+    assert(image != NULL);
+
+    bool regular = is_regular_file(input);
+    if (!regular) {
+        fprintf(stderr, "Error: %s is not a regular file.\n", path);
+    }
+    bool mapped = regular && map_compressed_image(input, &image->mapped);
+    fclose(input);
+    if (!mapped) {
+        free(image);
+        return NULL;
+    }
+
+    /* Reads are scattered, so read-ahead would only fetch unused pages */
+    madvise(image->mapped.map, image->mapped.map_length, MADV_RANDOM);
+
+    image->block_width = image->mapped.width / 2;
+    image->block_height = image->mapped.height / 2;
+    image->tiles_per_row = (image->block_width + TILE_BLOCKS - 1) / TILE_BLOCKS;
+
+    for (int i = 0; i < CACHE_TILES; i++) {
+        image->keys[i] = NO_TILE;
+        image->last_used[i] = 0;
+    }
+    image->clock = 0;
+    image->recent = 0;
+    image->tiles = malloc(CACHE_TILES * sizeof(*image->tiles));
+    assert(image->tiles != NULL);
+
+    return image;
+}
+
+/* Closes a handle */
+void Comp40_Image_close(Comp40_Image *image)
+{
+    assert(image != NULL);
+
+    if (*image == NULL) {
+        return;
+    }
+    unmap_compressed_image(&(*image)->mapped);
+    free((*image)->tiles);
+    free(*image);
+    *image = NULL;
+}
+
+/* Returns the width of the image in pixels */
+int Comp40_Image_width(Comp40_Image image)
+{
+    assert(image != NULL);
+    return image->block_width * 2;
+}
+
+/* Returns the height of the image in pixels */
+int Comp40_Image_height(Comp40_Image image)
+{
+    assert(image != NULL);
+    return image->block_height * 2;
+}
+
+/* Decodes a single pixel */
+Pixel Comp40_Image_get_pixel(Comp40_Image image, int x, int y)
+{
+    assert(image != NULL);
+    assert(x >= 0 && x < image->block_width * 2);
+    assert(y >= 0 && y < image->block_height * 2);
+
+    const Pixel *row = tile_row(image, x / 2, y);
+    return row[x % TILE_PIXELS];
+}
+
+/* Decodes a rectangle of pixels */
+void Comp40_Image_get_rect(Comp40_Image image, int x, int y, int width,
+                           int height, Pixel *pixels, int stride)
+{
+    assert(image != NULL);
+    assert(pixels != NULL);
+    assert(x >= 0 && y >= 0 && width >= 0 && height >= 0);
+    assert(x + width <= image->block_width * 2);
+    assert(y + height <= image->block_height * 2);
+    assert(stride >= width);
+
+    /* Copy each row a tile-width span at a time */
+    for (int row = 0; row < height; row++) {
+        Pixel *out = pixels + (size_t)row * stride;
+        int column = x;
+        while (column < x + width) {
+            const Pixel *tile = tile_row(image, column / 2, y + row);
+            int offset = column % TILE_PIXELS;
+            int span = TILE_PIXELS - offset;
+            if (span > x + width - column) {
+                span = x + width - column;
+            }
+            memcpy(out, tile + offset, span * sizeof(Pixel));
+            out += span;
+            column += span;
+        }
+    }
+}
+
+/* Helper function implementations */
+
+/* Returns the decoded pixel row (of the tile holding block column
+   block_x) that contains pixel row y, decoding the tile if needed */
+static const Pixel *tile_row(Comp40_Image image, int block_x, int y)
+{
+    int block_y = y / 2;
+    int tile = block_x / TILE_BLOCKS;
+    uint64_t key = (uint64_t)block_y * image->tiles_per_row + tile;
+
+    int slot = image->recent;
+    if (image->keys[slot] != key) {
+        slot = -1;
+        for (int i = 0; i < CACHE_TILES; i++) {
+            if (image->keys[i] == key) {
+                slot = i;
+                break;
+            }
+        }
+        if (slot < 0) {
+            slot = load_tile(image, key, block_y, tile);
+        }
+        image->recent = slot;
+    }
+
+    image->last_used[slot] = ++image->clock;
+    return image->tiles[slot][y % 2];
+}
+
+/* Decodes a tile into the least recently used slot and returns the slot */
+static int load_tile(Comp40_Image image, uint64_t key, int block_y, int tile)
+{
+    int slot = 0;
+    for (int i = 1; i < CACHE_TILES; i++) {
+        if (image->last_used[i] < image->last_used[slot]) {
+            slot = i;
+        }
+    }
+
+    int first = tile * TILE_BLOCKS;
+    int last = first + TILE_BLOCKS;
+    if (last > image->block_width) {
+        last = image->block_width;
+    }
+
+    Pixel (*rows)[TILE_PIXELS] = image->tiles[slot];
+    const unsigned char *codewords = image->mapped.codewords +
+        ((size_t)block_y * image->block_width + first) * sizeof(uint32_t);
+    decode_block_run(codewords, NULL, last - first, rows[0], rows[1]);
+
+    image->keys[slot] = key;
+    return slot;
+}
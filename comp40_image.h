@@ -0,0 +1,65 @@
+/* comp40_image.h */
+
+#ifndef COMP40_IMAGE_H
+#define COMP40_IMAGE_H
+
+#include "image_processing.h"  // For Pixel
+
+/* A compressed image opened for random access.  The file is mapped and
+   only the codewords around the pixels asked for are decoded; decoded
+   tiles are kept in a small LRU cache.  A handle is not thread-safe. */
+typedef struct Comp40_Image *Comp40_Image;
+
+/* Function Prototypes */
+
+/**
+ * Opens a compressed image for random access.
+ * @param path The compressed image file.
+ * @return The handle, or NULL (after printing an error) if the file is
+ * not a valid compressed image.
+ */
+Comp40_Image Comp40_Image_open(const char *path);
+
+/**
+ * Closes a handle and sets *image to NULL.
+ * @param image Pointer to the handle.
+ */
+void Comp40_Image_close(Comp40_Image *image);
+
+/**
+ * Returns the width of the image in pixels.
+ * @param image The handle.
+ * @return The width.
+ */
+int Comp40_Image_width(Comp40_Image image);
+
+/**
+ * Returns the height of the image in pixels.
+ * @param image The handle.
+ * @return The height.
+ */
+int Comp40_Image_height(Comp40_Image image);
+
+/**
+ * Decodes a single pixel.
+ * @param image The handle.
+ * @param x The column, in [0, width).
+ * @param y The row, in [0, height).
+ * @return The pixel, exactly as decompress40 would produce it.
+ */
+Pixel Comp40_Image_get_pixel(Comp40_Image image, int x, int y);
+
+/**
+ * Decodes a rectangle of pixels.
+ * @param image The handle.
+ * @param x The left edge of the rectangle.
+ * @param y The top edge of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ * @param pixels Where to store the pixels, row by row.
+ * @param stride The number of Pixels between the starts of rows in pixels.
+ */
+void Comp40_Image_get_rect(Comp40_Image image, int x, int y, int width,
+                           int height, Pixel *pixels, int stride);
+
+#endif /* COMP40_IMAGE_H */
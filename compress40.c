@@ -2,7 +2,11 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "compress40.h"
+#include "compress40_edges.h"
+#include "parallel.h"
+#include "tuning.h"
 #include <assert.h>
 
 /* Include module headers */
@@ -13,63 +17,99 @@
 #include "quantization.h"
 #include "io.h"
 
+/* An encode split into bands of rows, shared by every thread */
+typedef struct {
+    const Image_View *view;
+    int band_rows;                   // Even
+    int band_count;
+    Codeword_Array *codeword_array;  // Each band fills its own rows
+} Encode_Job;
+
+/* Helper functions */
+static void encode_bands(void *closure, int index, int thread_count);
+
 /* Compress40_compress function */
 void compress40(FILE *input)
 {
-    /* 1. Image Reader and Preprocessor */
+    compress40_edges(input, stdout, EDGE_DROP);
+}
+
+/* Compresses, dropping or replicating an odd last row and column */
+void compress40_edges(FILE *input, FILE *output, Edge_Mode mode)
+{
+    /* 1. Image Reader */
     Image *image = read_image(input);
     if (image == NULL) {
         fprintf(stderr, "Error: Failed to read image.\n");
         exit(EXIT_FAILURE);
     }
-    Image *trimmed_image = trim_image(image);
-    if (trimmed_image != image) {
-        free_image(image);
-    }
-
-    /* 2. RGB to YPbPr Conversion */
-    YPbPr_image *ypbpr_image = rgb_to_ypbpr(trimmed_image);
-    free_image(trimmed_image);
+    compress40_image(image, output, mode, tuning_threads());
+}
 
-    /* 3. Chroma Averaging and 2x2 Block Generation */
-    Block_Array *block_array = create_blocks(ypbpr_image);
-    free_ypbpr_image(ypbpr_image);
+/* Compresses and frees an image already in memory */
+void compress40_image(Image *image, FILE *output, Edge_Mode mode,
+                      int thread_count)
+{
+    assert(image != NULL && output != NULL);
 
-    /* 4. Discrete Cosine Transform (DCT) */
-    DCT_Array *dct_array = perform_dct(block_array);
-    free_block_array(block_array);
+    /* 1. Preprocessor: the even-sized view shares the image's pixels, so
+       odd sizes cost no copy */
+    Image_View view = even_view(image_view(image), mode);
 
-    /* 5. Quantization and Codeword Packaging */
-    Codeword_Array *codeword_array = quantize_and_pack(dct_array);
-    free_dct_array(dct_array);
+    /* 2. RGB to YPbPr, chroma averaging, DCT and quantization, a band
+       at a time */
+    Codeword_Array *codeword_array =
+        compress40_encode(&view, tuning_profile()->compress_band_rows,
+                          thread_count);
+    free_image(image);
 
     /* Calculate original image dimensions */
-    int width = block_array->width * 2;    // Number of blocks horizontally * 2
-    int height = block_array->height * 2;  // Number of blocks vertically * 2
+    int width = codeword_array->width * 2;    // Number of blocks horizontally * 2
+    int height = codeword_array->height * 2;  // Number of blocks vertically * 2
 
-    /* 6. Compressed Image Writer */
-    write_compressed_image(stdout, codeword_array, width, height);
+    /* 3. Compressed Image Writer */
+    write_compressed_image(output, codeword_array, width, height);
     free_codeword_array(codeword_array);
 }
 
+/* Encodes a view in bands on several threads */
+Codeword_Array *compress40_encode(const Image_View *view, int band_rows,
+                                  int thread_count)
+{
+    assert(view != NULL);
+    assert(view->width % 2 == 0 && view->height % 2 == 0);
+
+    Codeword_Array *codeword_array = malloc(sizeof(Codeword_Array));
+    assert(codeword_array != NULL);
+    codeword_array->width = view->width / 2;
+    codeword_array->height = view->height / 2;
+    codeword_array->count = codeword_array->width * codeword_array->height;
+    codeword_array->words = malloc(codeword_array->count * sizeof(uint32_t));
+    assert(codeword_array->words != NULL);
+
+    Encode_Job job;
+    job.view = view;
+    job.band_rows = band_rows >= 2 ? band_rows & ~1 : 2;
+    job.band_count = (view->height + job.band_rows - 1) / job.band_rows;
+    job.codeword_array = codeword_array;
+
+    if (thread_count > job.band_count) {
+        thread_count = job.band_count;
+    }
+    parallel_run(thread_count, encode_bands, &job);
+
+    return codeword_array;
+}
 /* Decompress40_decompress function */
 void decompress40(FILE *input)
 {
-    int width, height, codeword_count;
-
      /* 1. Compressed Image Reader */
-    uint32_t *codewords = read_compressed_image(input, &width, &height, &codeword_count);
-    if (codewords == NULL) {
+    Codeword_Array *codeword_array = read_codeword_array(input);
+    if (codeword_array == NULL) {
         fprintf(stderr, "Error: Failed to read compressed image.\n");
         exit(EXIT_FAILURE);
     }
 
-      /* Create Codeword_Array structure */
-    Codeword_Array *codeword_array = malloc(sizeof(Codeword_Array));
-    assert(codeword_array != NULL);
-    codeword_array->count = codeword_count;
-    codeword_array->words = codewords;
-
     /* 2. Codeword Unpackaging and Dequantization */
     DCT_Array *dct_array = unpack_and_dequantize(codeword_array);
     free_codeword_array(codeword_array);
@@ -89,5 +129,38 @@ void decompress40(FILE *input)
     /* 6. Image Writer */
     write_image(stdout, image);
     free_image(image);
-    free_codeword_array(codeword_array);
+}
+
+/* Helper function implementations */
+
+/* Encodes one thread's run of bands through each stage in turn and
+   copies their codewords into place */
+static void encode_bands(void *closure, int index, int thread_count)
+{
+    Encode_Job *job = closure;
+    Codeword_Array *codeword_array = job->codeword_array;
+
+    long long first, last;
+    parallel_split(job->band_count, index, thread_count, &first, &last);
+
+    for (long long band = first; band < last; band++) {
+        int row = band * job->band_rows;
+        int rows = job->view->height - row < job->band_rows
+                   ? job->view->height - row : job->band_rows;
+        Image_View band_view = crop_view(*job->view, 0, row,
+                                         job->view->width, rows);
+
+        YPbPr_image *ypbpr_image = rgb_view_to_ypbpr(&band_view);
+        Block_Array *block_array = create_blocks(ypbpr_image);
+        free_ypbpr_image(ypbpr_image);
+        DCT_Array *dct_array = perform_dct(block_array);
+        free_block_array(block_array);
+        Codeword_Array *words = quantize_and_pack(dct_array);
+        free_dct_array(dct_array);
+
+        uint32_t *destination = codeword_array->words +
+                                (size_t)(row / 2) * codeword_array->width;
+        memcpy(destination, words->words, words->count * sizeof(uint32_t));
+        free_codeword_array(words);
+    }
 }
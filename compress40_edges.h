@@ -0,0 +1,43 @@
+/* compress40_edges.h */
+
+#ifndef COMPRESS40_EDGES_H
+#define COMPRESS40_EDGES_H
+
+#include <stdio.h>
+#include "image_processing.h"  // For Image and Edge_Mode
+#include "quantization.h"      // For Codeword_Array
+
+/**
+ * Compresses a PPM image as compress40 does, except that an odd last row
+ * or column may be kept, padded by replicating it, instead of dropped.
+ * Either way the image is read in place through a view, not copied.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ * @param mode What to do with an odd last row or column.
+ */
+void compress40_edges(FILE *input, FILE *output, Edge_Mode mode);
+
+/**
+ * Compresses an image already in memory, as compress40_edges does, and
+ * frees it. Bands are as tall as the tuning profile says.
+ * @param image The image.
+ * @param output The output file pointer.
+ * @param mode What to do with an odd last row or column.
+ * @param thread_count The number of threads to encode with.
+ */
+void compress40_image(Image *image, FILE *output, Edge_Mode mode,
+                      int thread_count);
+
+/**
+ * Encodes a view to codewords a band of rows at a time, with the bands
+ * split among threads. Every stage works on one 2x2 block at a time, so
+ * the codewords do not depend on the band height or thread count.
+ * @param view The view; its width and height must be even.
+ * @param band_rows Rows per band, rounded down to even and at least 2.
+ * @param thread_count The number of threads.
+ * @return The codewords; free them with free_codeword_array.
+ */
+Codeword_Array *compress40_encode(const Image_View *view, int band_rows,
+                                  int thread_count);
+
+#endif /* COMPRESS40_EDGES_H */
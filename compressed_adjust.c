@@ -0,0 +1,234 @@
+/* compressed_adjust.c */
+
+#include "compressed_adjust.h"
+#include "codeword_vector.h"
+#include "bitpack.h"
+#include "parallel.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+/* The Pb and Pr indices sit next to each other at the bottom */
+#define CHROMA_WIDTH (PB_INDEX_WIDTH + PR_INDEX_WIDTH)
+
+/* Overlay weights are in 256ths */
+#define WEIGHT_BITS 8
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+
+/* New field bits for every old value of each field. Every field is at
+   most 9 bits wide, so the tables are small enough to stay in L1. */
+typedef struct {
+    uint32_t a[1 << A_WIDTH];            // Shifted into place
+    uint32_t bcd[1 << B_WIDTH];          // Shared by b, c and d; unshifted
+    uint32_t chroma[1 << CHROMA_WIDTH];  // Pb and Pr together, in place
+} Adjust_Tables;
+
+/* What every adjusting thread shares */
+typedef struct {
+    uint32_t *words;
+    long long count;
+    const Adjust_Tables *tables;
+} Adjust_Job;
+
+/* Helper functions */
+static void build_tables(const Adjustment *adjustment, Adjust_Tables *tables);
+static void adjust_part(void *closure, int index, int thread_count);
+static inline uint32_t adjust_word(uint32_t word, const Adjust_Tables *tables);
+static void blend_span(uint32_t *under, const uint32_t *over, int count,
+                       int32_t weight);
+static inline Word_Vector blend_field_vector(Word_Vector under,
+                                             Word_Vector over, int32_t weight,
+                                             unsigned width, unsigned lsb,
+                                             bool is_signed);
+static inline Word_Vector blend_vector(Word_Vector under, Word_Vector over,
+                                       int32_t weight);
+static inline uint32_t blend_word(uint32_t under, uint32_t over,
+                                  int32_t weight);
+
+/* Adjusts every codeword through per-field tables */
+void adjust_codewords(Codeword_Array *codeword_array,
+                      const Adjustment *adjustment)
+{
+    assert(codeword_array != NULL && adjustment != NULL);
+
+    Adjust_Tables *tables = malloc(sizeof(Adjust_Tables));
+    assert(tables != NULL);
+    build_tables(adjustment, tables);
+
+    Adjust_Job job = { codeword_array->words, codeword_array->count, tables };
+    int thread_count = job.count < MIN_PARALLEL_BLOCKS
+                       ? 1 : parallel_default_threads();
+    parallel_run(thread_count, adjust_part, &job);
+
+    free(tables);
+}
+
+/* Blends the part of an overlay that falls on the image */
+bool overlay_codewords(Codeword_Array *codeword_array,
+                       const Overlay *overlay)
+{
+    assert(codeword_array != NULL && overlay != NULL);
+    assert(overlay->image != NULL);
+
+    if (overlay->x % 2 != 0 || overlay->y % 2 != 0) {
+        fprintf(stderr, "Error: An overlay must sit at even coordinates.\n");
+        return false;
+    }
+
+    float alpha = overlay->alpha;
+    if (alpha < 0.0f) alpha = 0.0f;
+    if (alpha > 1.0f) alpha = 1.0f;
+    int32_t weight = (int32_t)lroundf(alpha * WEIGHT_ONE);
+
+    const Codeword_Array *over = overlay->image;
+    int block_x = overlay->x / 2;
+    int block_y = overlay->y / 2;
+    int first_x = block_x > 0 ? block_x : 0;
+    int first_y = block_y > 0 ? block_y : 0;
+    int last_x = block_x + over->width < codeword_array->width
+                 ? block_x + over->width : codeword_array->width;
+    int last_y = block_y + over->height < codeword_array->height
+                 ? block_y + over->height : codeword_array->height;
+
+    for (int y = first_y; y < last_y; y++) {
+        blend_span(codeword_array->words +
+                   (size_t)y * codeword_array->width + first_x,
+                   over->words + (size_t)(y - block_y) * over->width +
+                   (first_x - block_x),
+                   last_x - first_x, weight);
+    }
+    return true;
+}
+
+/* Reads, adjusts, overlays and writes a compressed image */
+void adjust40(FILE *input, FILE *output, const Adjustment *adjustment,
+              const Overlay *overlay)
+{
+    Codeword_Array *codeword_array = read_codeword_array(input);
+    if (codeword_array == NULL) {
+        fprintf(stderr, "Error: Failed to read compressed image.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    adjust_codewords(codeword_array, adjustment);
+    if (overlay != NULL && !overlay_codewords(codeword_array, overlay)) {
+        free_codeword_array(codeword_array);
+        exit(EXIT_FAILURE);
+    }
+
+    write_compressed_image(output, codeword_array, codeword_array->width * 2,
+                           codeword_array->height * 2);
+    free_codeword_array(codeword_array);
+}
+
+/* Helper function implementations */
+
+/* Works out the new value of every possible field value, clamping with
+   the quantizers themselves */
+static void build_tables(const Adjustment *adjustment, Adjust_Tables *tables)
+{
+    assert(B_WIDTH == C_WIDTH && C_WIDTH == D_WIDTH);
+    assert(PR_LSB == 0 && PB_LSB == PR_INDEX_WIDTH);
+
+    for (unsigned a = 0; a < (1u << A_WIDTH); a++) {
+        float y = (dequantize_a(a) - 0.5f) * adjustment->contrast + 0.5f +
+                  adjustment->brightness;
+        tables->a[a] = (uint32_t)quantize_a(y) << A_LSB;
+    }
+
+    for (unsigned bits = 0; bits < (1u << B_WIDTH); bits++) {
+        int bcd = Bitpack_gets(bits, B_WIDTH, 0);
+        float coefficient = dequantize_bcd(bcd) * adjustment->contrast;
+        tables->bcd[bits] = Bitpack_news(0, B_WIDTH, 0,
+                                         quantize_bcd(coefficient));
+    }
+
+    for (unsigned bits = 0; bits < (1u << CHROMA_WIDTH); bits++) {
+        unsigned pb = Bitpack_getu(bits, PB_INDEX_WIDTH, PB_LSB);
+        unsigned pr = Bitpack_getu(bits, PR_INDEX_WIDTH, PR_LSB);
+        pb = index_of_chroma(chroma_of_index(pb) + adjustment->pb_shift);
+        pr = index_of_chroma(chroma_of_index(pr) + adjustment->pr_shift);
+        tables->chroma[bits] = pb << PB_LSB | pr << PR_LSB;
+    }
+}
+
+/* Adjusts one thread's share of the codewords */
+static void adjust_part(void *closure, int index, int thread_count)
+{
+    Adjust_Job *job = closure;
+    const Adjust_Tables *tables = job->tables;
+    uint32_t *words = job->words;
+
+    long long start, end;
+    parallel_split(job->count, index, thread_count, &start, &end);
+
+    for (long long i = start; i < end; i++) {
+        words[i] = adjust_word(words[i], tables);
+    }
+}
+
+/* Rebuilds one codeword from five table lookups */
+static inline uint32_t adjust_word(uint32_t word, const Adjust_Tables *tables)
+{
+    const uint32_t field_mask = (1u << B_WIDTH) - 1;
+    return tables->a[word >> A_LSB] |
+           tables->bcd[(word >> B_LSB) & field_mask] << B_LSB |
+           tables->bcd[(word >> C_LSB) & field_mask] << C_LSB |
+           tables->bcd[(word >> D_LSB) & field_mask] << D_LSB |
+           tables->chroma[word & ((1u << CHROMA_WIDTH) - 1)];
+}
+
+/* Blends a run of codewords, a vector at a time and then one at a time */
+static void blend_span(uint32_t *under, const uint32_t *over, int count,
+                       int32_t weight)
+{
+    int i = 0;
+    for (; i + WORD_LANES <= count; i += WORD_LANES) {
+        Word_Vector below, above;
+        memcpy(&below, under + i, sizeof(below));
+        memcpy(&above, over + i, sizeof(above));
+        Word_Vector blended = blend_vector(below, above, weight);
+        memcpy(under + i, &blended, sizeof(blended));
+    }
+    for (; i < count; i++) {
+        under[i] = blend_word(under[i], over[i], weight);
+    }
+}
+
+/* Blends one field of a vector of codewords, returning it in place */
+static inline Word_Vector blend_field_vector(Word_Vector under,
+                                             Word_Vector over, int32_t weight,
+                                             unsigned width, unsigned lsb,
+                                             bool is_signed)
+{
+    Field_Vector below = field_vector(under, width, lsb, is_signed);
+    Field_Vector above = field_vector(over, width, lsb, is_signed);
+
+    Field_Vector mixed = (below * (WEIGHT_ONE - weight) + above * weight +
+                          WEIGHT_ONE / 2) >> WEIGHT_BITS;
+    return ((Word_Vector)mixed & ((1u << width) - 1)) << lsb;
+}
+
+/* Blends every field of a vector of codewords */
+static inline Word_Vector blend_vector(Word_Vector under, Word_Vector over,
+                                       int32_t weight)
+{
+    return blend_field_vector(under, over, weight, A_WIDTH, A_LSB, false) |
+           blend_field_vector(under, over, weight, B_WIDTH, B_LSB, true) |
+           blend_field_vector(under, over, weight, C_WIDTH, C_LSB, true) |
+           blend_field_vector(under, over, weight, D_WIDTH, D_LSB, true) |
+           blend_field_vector(under, over, weight, PB_INDEX_WIDTH, PB_LSB,
+                              false) |
+           blend_field_vector(under, over, weight, PR_INDEX_WIDTH, PR_LSB,
+                              false);
+}
+
+/* Blends every field of one codeword, rounding as blend_vector does */
+static inline uint32_t blend_word(uint32_t under, uint32_t over,
+                                  int32_t weight)
+{
+    Word_Vector below = { under }, above = { over };
+    return blend_vector(below, above, weight)[0];
+}
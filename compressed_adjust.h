@@ -0,0 +1,67 @@
+/* compressed_adjust.h */
+
+#ifndef COMPRESSED_ADJUST_H
+#define COMPRESSED_ADJUST_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "quantization.h"  // For Codeword_Array
+
+/* Edits that are linear in YPbPr and so can be applied to the codewords
+   without decoding. Luma is Y in [0, 1]; Pb and Pr are in
+   [-0.3, 0.3], as the codewords hold them. */
+typedef struct {
+    float brightness;   // Added to Y
+    float contrast;     // Y scaled about 0.5, and b, c and d with it
+    float pb_shift;     // Added to Pb
+    float pr_shift;     // Added to Pr
+} Adjustment;
+
+/* The adjustment that leaves an image as it is */
+#define ADJUSTMENT_NONE { 0.0f, 1.0f, 0.0f, 0.0f }
+
+/* A compressed image blended over part of another */
+typedef struct {
+    const Codeword_Array *image;
+    int x;          // Left edge on the image beneath, in pixels; even
+    int y;          // Top edge on the image beneath, in pixels; even
+    float alpha;    // Weight of the overlay, in [0, 1]
+} Overlay;
+
+/* Function Prototypes */
+
+/**
+ * Applies an adjustment to every codeword in place. Each field is
+ * dequantized, adjusted, clamped and quantized again, exactly as the
+ * compressor would quantize the adjusted image's coefficients.
+ * @param codeword_array The codewords.
+ * @param adjustment The adjustment.
+ */
+void adjust_codewords(Codeword_Array *codeword_array,
+                      const Adjustment *adjustment);
+
+/**
+ * Blends an overlay into the codewords in place. Every field of a
+ * block is blended in its quantized units, which is the same as
+ * blending the two blocks' pixels and compressing the result, up to
+ * rounding. Parts of the overlay outside the image are left out.
+ * @param codeword_array The codewords beneath.
+ * @param overlay The overlay.
+ * @return true on success, false (after printing an error) if the
+ * overlay's position is odd.
+ */
+bool overlay_codewords(Codeword_Array *codeword_array,
+                       const Overlay *overlay);
+
+/**
+ * Reads a compressed image, applies an adjustment and then an overlay,
+ * and writes the resulting compressed image.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ * @param adjustment The adjustment.
+ * @param overlay The overlay, or NULL for none.
+ */
+void adjust40(FILE *input, FILE *output, const Adjustment *adjustment,
+              const Overlay *overlay);
+
+#endif /* COMPRESSED_ADJUST_H */
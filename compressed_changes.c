@@ -0,0 +1,493 @@
+/* compressed_changes.c */
+
+#include "compressed_changes.h"
+#include "codeword_vector.h"
+#include "parallel.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* Blocks per mask word */
+#define MASK_BITS 64
+
+/* A Word_Vector's bytes, for swapping them into host order */
+typedef uint8_t Byte_Vector
+    __attribute__((vector_size(WORD_LANES * sizeof(uint32_t))));
+
+/* One image's codewords: mapped big-endian bytes, or host-order words */
+typedef struct {
+    const unsigned char *bytes;
+    const uint32_t *words;
+} Codeword_Source;
+
+/* What every comparing thread shares */
+typedef struct {
+    Codeword_Source before;
+    Codeword_Source after;
+    Change_Tolerance tolerance;
+    bool exact;                // No tolerance, so any differing bit counts
+    Change_Map *map;
+    uint64_t *counts;          // Changed blocks found by each thread
+} Compare_Job;
+
+/* A run of changed blocks in one row, and the group it belongs to */
+typedef struct {
+    int first;
+    int end;
+    int group;
+} Run;
+
+/* The blocks a group covers; right and bottom are exclusive */
+typedef struct {
+    int left;
+    int top;
+    int right;
+    int bottom;
+} Box;
+
+/* Helper functions */
+static Change_Map *compare_sources(Codeword_Source before,
+                                   Codeword_Source after, int width,
+                                   int height,
+                                   const Change_Tolerance *tolerance);
+static void compare_rows(void *closure, int index, int thread_count);
+static inline Word_Vector load_words(const Codeword_Source *source,
+                                     size_t index);
+static inline uint32_t load_word(const Codeword_Source *source, size_t index);
+static inline Field_Vector changed_lanes(Word_Vector before,
+                                         Word_Vector after,
+                                         const Compare_Job *job);
+static inline Field_Vector field_moved(Word_Vector before, Word_Vector after,
+                                       unsigned width, unsigned lsb,
+                                       bool is_signed, int limit);
+static void find_regions(Change_Map *map);
+static int next_bit(const uint64_t *row, int width, int x, bool set);
+static int find_group(int *parent, int group);
+static void grow_box(Box *box, const Box *other);
+static int compare_regions(const void *first, const void *second);
+static uint8_t reverse_bits(uint8_t byte);
+
+/* Compares two codeword grids in memory */
+Change_Map *compare_codewords(const Codeword_Array *before,
+                              const Codeword_Array *after,
+                              const Change_Tolerance *tolerance)
+{
+    assert(before != NULL && after != NULL && tolerance != NULL);
+    assert(before->width == after->width && before->height == after->height);
+
+    Codeword_Source first = { NULL, before->words };
+    Codeword_Source second = { NULL, after->words };
+    return compare_sources(first, second, before->width, before->height,
+                           tolerance);
+}
+
+/* Compares two compressed images, mapping them where possible */
+Change_Map *read_changes(FILE *before, FILE *after,
+                         const Change_Tolerance *tolerance)
+{
+    assert(before != NULL && after != NULL && tolerance != NULL);
+
+    FILE *inputs[2] = { before, after };
+    Mapped_Compressed_Image mapped[2] = { { 0, 0, NULL, NULL, 0 },
+                                          { 0, 0, NULL, NULL, 0 } };
+    Codeword_Array *arrays[2] = { NULL, NULL };
+    Codeword_Source sources[2];
+    int widths[2], heights[2];
+
+    bool ok = true;
+    for (int i = 0; i < 2 && ok; i++) {
+        if (is_regular_file(inputs[i])) {
+            ok = map_compressed_image(inputs[i], &mapped[i]);
+            sources[i].bytes = mapped[i].codewords;
+            sources[i].words = NULL;
+            widths[i] = mapped[i].width / 2;
+            heights[i] = mapped[i].height / 2;
+        } else {
+            arrays[i] = read_codeword_array(inputs[i]);
+            if (arrays[i] == NULL) {
+                fprintf(stderr, "Error: Failed to read compressed image.\n");
+                ok = false;
+                break;
+            }
+            sources[i].bytes = NULL;
+            sources[i].words = arrays[i]->words;
+            widths[i] = arrays[i]->width;
+            heights[i] = arrays[i]->height;
+        }
+    }
+    if (ok && (widths[0] != widths[1] || heights[0] != heights[1])) {
+        fprintf(stderr, "Error: The images are not the same size.\n");
+        ok = false;
+    }
+
+    Change_Map *map = ok ? compare_sources(sources[0], sources[1], widths[0],
+                                           heights[0], tolerance)
+                         : NULL;
+
+    for (int i = 0; i < 2; i++) {
+        unmap_compressed_image(&mapped[i]);
+        free_codeword_array(arrays[i]);
+    }
+    return map;
+}
+
+/* Writes the mask as a PBM, one pixel per block */
+void write_change_mask(FILE *output, const Change_Map *map)
+{
+    assert(output != NULL && map != NULL);
+
+    fprintf(output, "P4\n%d %d\n", map->width, map->height);
+    int row_bytes = (map->width + 7) / 8;
+    for (int y = 0; y < map->height; y++) {
+        const uint64_t *row = map->mask + (size_t)y * map->words_per_row;
+        for (int i = 0; i < row_bytes; i++) {
+            uint8_t byte = row[i / 8] >> (8 * (i % 8));
+            fputc(reverse_bits(byte), output);   // PBM puts x = 0 first
+        }
+    }
+}
+
+/* Frees a Change_Map */
+void free_change_map(Change_Map *map)
+{
+    if (map == NULL) {
+        return;
+    }
+
+    free(map->mask);
+    free(map->regions);
+    free(map);
+}
+
+/* Compares two compressed images and prints what changed */
+bool changes40(FILE *before, FILE *after, const Change_Tolerance *tolerance,
+               FILE *output, FILE *mask_output)
+{
+    Change_Map *map = read_changes(before, after, tolerance);
+    if (map == NULL) {
+        return false;
+    }
+
+    fprintf(output, "width: %d\n", map->width * 2);
+    fprintf(output, "height: %d\n", map->height * 2);
+    fprintf(output, "changed_blocks: %llu\n",
+            (unsigned long long)map->changed_blocks);
+    fprintf(output, "changed_fraction: %.6f\n", map->changed_fraction);
+    fprintf(output, "regions: %d\n", map->region_count);
+    for (int i = 0; i < map->region_count; i++) {
+        const Change_Region *region = &map->regions[i];
+        fprintf(output, "region: %dx%d+%d+%d\n", region->width,
+                region->height, region->x, region->y);
+    }
+
+    if (mask_output != NULL) {
+        write_change_mask(mask_output, map);
+    }
+    free_change_map(map);
+    return true;
+}
+
+/* Helper function implementations */
+
+/* Builds the mask across threads, then groups the changed blocks */
+static Change_Map *compare_sources(Codeword_Source before,
+                                   Codeword_Source after, int width,
+                                   int height,
+                                   const Change_Tolerance *tolerance)
+{
+    Change_Map *map = malloc(sizeof(Change_Map));
+    assert(map != NULL);
+    map->width = width;
+    map->height = height;
+    map->words_per_row = (width + MASK_BITS - 1) / MASK_BITS;
+    size_t mask_words = (size_t)map->words_per_row * height;
+    map->mask = malloc((mask_words > 0 ? mask_words : 1) * sizeof(uint64_t));
+    assert(map->mask != NULL);
+
+    Compare_Job job;
+    job.before = before;
+    job.after = after;
+    job.tolerance.a = tolerance->a > 0 ? tolerance->a : 0;
+    job.tolerance.bcd = tolerance->bcd > 0 ? tolerance->bcd : 0;
+    job.tolerance.chroma = tolerance->chroma > 0 ? tolerance->chroma : 0;
+    job.exact = job.tolerance.a == 0 && job.tolerance.bcd == 0 &&
+                job.tolerance.chroma == 0;
+    job.map = map;
+
+    long long blocks = (long long)width * height;
+    int thread_count = blocks < MIN_PARALLEL_BLOCKS
+                       ? 1 : parallel_default_threads();
+    job.counts = calloc(thread_count, sizeof(uint64_t));
+    assert(job.counts != NULL);
+    parallel_run(thread_count, compare_rows, &job);
+
+    map->changed_blocks = 0;
+    for (int i = 0; i < thread_count; i++) {
+        map->changed_blocks += job.counts[i];
+    }
+    free(job.counts);
+    map->changed_fraction = blocks > 0
+                            ? (double)map->changed_blocks / blocks : 0.0;
+
+    find_regions(map);
+    return map;
+}
+
+/* Compares one thread's band of rows, a mask word at a time */
+static void compare_rows(void *closure, int index, int thread_count)
+{
+    Compare_Job *job = closure;
+    Change_Map *map = job->map;
+    int width = map->width;
+
+    long long first, last;
+    parallel_split(map->height, index, thread_count, &first, &last);
+
+    uint64_t count = 0;
+    for (long long y = first; y < last; y++) {
+        uint64_t *row = map->mask + y * map->words_per_row;
+        size_t base = (size_t)y * width;
+
+        for (int word = 0; word < map->words_per_row; word++) {
+            int x = word * MASK_BITS;
+            int end = x + MASK_BITS < width ? x + MASK_BITS : width;
+            uint64_t bits = 0;
+
+            for (; x + WORD_LANES <= end; x += WORD_LANES) {
+                Field_Vector changed =
+                    changed_lanes(load_words(&job->before, base + x),
+                                  load_words(&job->after, base + x), job);
+                for (int lane = 0; lane < WORD_LANES; lane++) {
+                    bits |= (uint64_t)(changed[lane] & 1)
+                            << (x + lane) % MASK_BITS;
+                }
+            }
+            for (; x < end; x++) {
+                Word_Vector before = { load_word(&job->before, base + x) };
+                Word_Vector after = { load_word(&job->after, base + x) };
+                bits |= (uint64_t)(changed_lanes(before, after, job)[0] & 1)
+                        << x % MASK_BITS;
+            }
+
+            row[word] = bits;
+            count += __builtin_popcountll(bits);
+        }
+    }
+    job->counts[index] = count;
+}
+
+/* Loads a vector of codewords in host order */
+static inline Word_Vector load_words(const Codeword_Source *source,
+                                     size_t index)
+{
+    if (source->words != NULL) {
+        Word_Vector words;
+        memcpy(&words, source->words + index, sizeof(words));
+        return words;
+    }
+
+    Byte_Vector bytes;
+    memcpy(&bytes, source->bytes + 4 * index, sizeof(bytes));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const Byte_Vector swap = { 3, 2, 1, 0, 7, 6, 5, 4,
+                               11, 10, 9, 8, 15, 14, 13, 12 };
+    bytes = __builtin_shuffle(bytes, swap);
+#endif
+    return (Word_Vector)bytes;
+}
+
+/* Loads one codeword in host order */
+static inline uint32_t load_word(const Codeword_Source *source, size_t index)
+{
+    return source->words != NULL ? source->words[index]
+                                 : load_codeword(source->bytes + 4 * index);
+}
+
+/* Returns -1 in each lane whose block changed and 0 elsewhere */
+static inline Field_Vector changed_lanes(Word_Vector before,
+                                         Word_Vector after,
+                                         const Compare_Job *job)
+{
+    if (job->exact) {
+        return (Field_Vector)((before ^ after) != 0);
+    }
+
+    const Change_Tolerance *tolerance = &job->tolerance;
+    return field_moved(before, after, A_WIDTH, A_LSB, false, tolerance->a) |
+           field_moved(before, after, B_WIDTH, B_LSB, true, tolerance->bcd) |
+           field_moved(before, after, C_WIDTH, C_LSB, true, tolerance->bcd) |
+           field_moved(before, after, D_WIDTH, D_LSB, true, tolerance->bcd) |
+           field_moved(before, after, PB_INDEX_WIDTH, PB_LSB, false,
+                       tolerance->chroma) |
+           field_moved(before, after, PR_INDEX_WIDTH, PR_LSB, false,
+                       tolerance->chroma);
+}
+
+/* Returns -1 in each lane where one field moved by more than limit */
+static inline Field_Vector field_moved(Word_Vector before, Word_Vector after,
+                                       unsigned width, unsigned lsb,
+                                       bool is_signed, int limit)
+{
+    Field_Vector difference = field_vector(after, width, lsb, is_signed) -
+                              field_vector(before, width, lsb, is_signed);
+    Field_Vector limits = (Field_Vector){ 0 } + limit;
+    return (difference > limits) | (difference < -limits);
+}
+
+/* Groups touching changed blocks, a row of runs at a time. Each run
+   joins every run it touches in the row above, and the groups are
+   merged with union-find, each root holding the box around its group. */
+static void find_regions(Change_Map *map)
+{
+    int width = map->width;
+    int max_runs = width / 2 + 1;
+    Run *previous = malloc(max_runs * sizeof(Run));
+    Run *current = malloc(max_runs * sizeof(Run));
+    assert(previous != NULL && current != NULL);
+    int previous_count = 0;
+
+    int capacity = 16;
+    int group_count = 0;
+    int *parent = malloc(capacity * sizeof(int));
+    Box *boxes = malloc(capacity * sizeof(Box));
+    assert(parent != NULL && boxes != NULL);
+
+    for (int y = 0; y < map->height; y++) {
+        const uint64_t *row = map->mask + (size_t)y * map->words_per_row;
+        int current_count = 0;
+        int above = 0;   // First run above that may touch this one
+
+        for (int x = next_bit(row, width, 0, true); x < width;
+             x = next_bit(row, width, x, true)) {
+            int end = next_bit(row, width, x, false);
+            Box box = { x, y, end, y + 1 };
+
+            /* A run above touches if it reaches column x - 1 through
+               column end, diagonals included */
+            while (above < previous_count && previous[above].end < x) {
+                above++;
+            }
+            int group = -1;
+            for (int i = above; i < previous_count &&
+                                previous[i].first <= end; i++) {
+                int root = find_group(parent, previous[i].group);
+                if (group < 0) {
+                    group = root;
+                } else if (root != group) {
+                    parent[root] = group;
+                    grow_box(&boxes[group], &boxes[root]);
+                }
+            }
+
+            if (group < 0) {
+                if (group_count == capacity) {
+                    capacity *= 2;
+                    parent = realloc(parent, capacity * sizeof(int));
+                    boxes = realloc(boxes, capacity * sizeof(Box));
+                    assert(parent != NULL && boxes != NULL);
+                }
+                group = group_count++;
+                parent[group] = group;
+                boxes[group] = box;
+            } else {
+                grow_box(&boxes[group], &box);
+            }
+
+            current[current_count].first = x;
+            current[current_count].end = end;
+            current[current_count].group = group;
+            current_count++;
+            x = end;
+        }
+
+        Run *swap = previous;
+        previous = current;
+        current = swap;
+        previous_count = current_count;
+    }
+
+    /* One region per root, in pixels */
+    map->region_count = 0;
+    map->regions = malloc((group_count > 0 ? group_count : 1) *
+                          sizeof(Change_Region));
+    assert(map->regions != NULL);
+    for (int group = 0; group < group_count; group++) {
+        if (parent[group] == group) {
+            Change_Region *region = &map->regions[map->region_count++];
+            region->x = boxes[group].left * 2;
+            region->y = boxes[group].top * 2;
+            region->width = (boxes[group].right - boxes[group].left) * 2;
+            region->height = (boxes[group].bottom - boxes[group].top) * 2;
+        }
+    }
+    qsort(map->regions, map->region_count, sizeof(Change_Region),
+          compare_regions);
+
+    free(previous);
+    free(current);
+    free(parent);
+    free(boxes);
+}
+
+/* Returns the first column at or after x whose bit is set (or clear),
+   or width if there is none */
+static int next_bit(const uint64_t *row, int width, int x, bool set)
+{
+    if (x >= width) {
+        return width;
+    }
+
+    int words = (width + MASK_BITS - 1) / MASK_BITS;
+    int word = x / MASK_BITS;
+    uint64_t bits = (set ? row[word] : ~row[word]) &
+                    (~(uint64_t)0 << x % MASK_BITS);
+    while (bits == 0) {
+        if (++word == words) {
+            return width;
+        }
+        bits = set ? row[word] : ~row[word];
+    }
+
+    int found = word * MASK_BITS + __builtin_ctzll(bits);
+    return found < width ? found : width;
+}
+
+/* Returns the root of a group, halving the path to it on the way */
+static int find_group(int *parent, int group)
+{
+    while (parent[group] != group) {
+        parent[group] = parent[parent[group]];
+        group = parent[group];
+    }
+    return group;
+}
+
+/* Widens a box to cover another */
+static void grow_box(Box *box, const Box *other)
+{
+    if (other->left < box->left) box->left = other->left;
+    if (other->top < box->top) box->top = other->top;
+    if (other->right > box->right) box->right = other->right;
+    if (other->bottom > box->bottom) box->bottom = other->bottom;
+}
+
+/* Orders regions top to bottom, then left to right */
+static int compare_regions(const void *first, const void *second)
+{
+    const Change_Region *a = first;
+    const Change_Region *b = second;
+    if (a->y != b->y) {
+        return a->y < b->y ? -1 : 1;
+    }
+    return (a->x > b->x) - (a->x < b->x);
+}
+
+/* Reverses the order of the bits in a byte */
+static uint8_t reverse_bits(uint8_t byte)
+{
+    byte = (byte & 0xF0) >> 4 | (byte & 0x0F) << 4;
+    byte = (byte & 0xCC) >> 2 | (byte & 0x33) << 2;
+    byte = (byte & 0xAA) >> 1 | (byte & 0x55) << 1;
+    return byte;
+}
@@ -0,0 +1,93 @@
+/* compressed_changes.h */
+
+#ifndef COMPRESSED_CHANGES_H
+#define COMPRESSED_CHANGES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "quantization.h"  // For Codeword_Array
+
+/* How far a field may move, in quantization steps, before its block
+   counts as changed. All zeros means any differing bit counts. */
+typedef struct {
+    int a;        // Block mean luma
+    int bcd;      // Each of b, c and d
+    int chroma;   // Each of the Pb and Pr indices
+} Change_Tolerance;
+
+/* A rectangle around one connected group of changed blocks, in pixels */
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} Change_Region;
+
+/* Which blocks differ between two compressed images of the same size */
+typedef struct {
+    int width;                 // Number of blocks horizontally
+    int height;                // Number of blocks vertically
+    int words_per_row;         // Mask words per block row
+    uint64_t *mask;            // Bit x % 64 of word x / 64 of a row is
+                               // set when block x of that row changed
+    uint64_t changed_blocks;
+    double changed_fraction;
+    Change_Region *regions;    // Touching blocks, diagonals included,
+                               // share a region; top to bottom
+    int region_count;
+} Change_Map;
+
+/* Function Prototypes */
+
+/**
+ * Compares two codeword grids block by block, without decoding.
+ * @param before The first grid.
+ * @param after The second grid, the same size as the first.
+ * @param tolerance How much each field may move.
+ * @return The changes; free them with free_change_map.
+ */
+Change_Map *compare_codewords(const Codeword_Array *before,
+                              const Codeword_Array *after,
+                              const Change_Tolerance *tolerance);
+
+/**
+ * Compares two compressed images read from files. Regular files are
+ * mapped and compared in place; other inputs are read in.
+ * @param before The first image.
+ * @param after The second image.
+ * @param tolerance How much each field may move.
+ * @return The changes, or NULL (after printing an error) if either
+ * input is invalid or the sizes differ.
+ */
+Change_Map *read_changes(FILE *before, FILE *after,
+                         const Change_Tolerance *tolerance);
+
+/**
+ * Writes the mask as a binary PBM with one pixel per block, black where
+ * the block changed.
+ * @param output The output file pointer.
+ * @param map The changes.
+ */
+void write_change_mask(FILE *output, const Change_Map *map);
+
+/**
+ * Frees a Change_Map.
+ * @param map The map, or NULL.
+ */
+void free_change_map(Change_Map *map);
+
+/**
+ * Compares two compressed images and prints the changed fraction and
+ * regions, and optionally writes the mask.
+ * @param before The first image.
+ * @param after The second image.
+ * @param tolerance How much each field may move.
+ * @param output Where to print.
+ * @param mask_output Where to write the mask, or NULL.
+ * @return true on success, false if the images could not be compared.
+ */
+bool changes40(FILE *before, FILE *after, const Change_Tolerance *tolerance,
+               FILE *output, FILE *mask_output);
+
+#endif /* COMPRESSED_CHANGES_H */
@@ -0,0 +1,614 @@
+/* compressed_geometry.c */
+
+#define _GNU_SOURCE  // For copy_file_range
+
+#include "compressed_geometry.h"
+#include "bitpack.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* The b, c and d fields sit next to each other below 'a' */
+#define BCD_LSB D_LSB
+#define BCD_WIDTH (B_WIDTH + C_WIDTH + D_WIDTH)
+#define BCD_MASK ((((uint32_t)1 << BCD_WIDTH) - 1) << BCD_LSB)
+
+/* Side of the square tiles used to walk the grid (64 x 64 words = 16KB) */
+#define TILE_SIZE 64
+
+/* How a transform acts on the coefficients of a single block */
+typedef struct {
+    bool swap_bc;  // b and c trade places
+    int b_sign;    // Sign applied to the new b
+    int c_sign;    // Sign applied to the new c
+    int d_sign;    // Sign applied to d
+} Coefficient_Map;
+
+/* Where source block (sx, sy) lands: origin + sx * step_x + sy * step_y */
+typedef struct {
+    ptrdiff_t origin;
+    ptrdiff_t step_x;
+    ptrdiff_t step_y;
+} Grid_Map;
+
+/* A compressed image file whose codewords are copied without loading */
+typedef struct {
+    FILE *file;
+    int width;           // Number of blocks horizontally
+    int height;          // Number of blocks vertically
+    off_t data_offset;   // Byte offset of the first codeword
+} Compressed_Source;
+
+/* Copies byte ranges of sources to the output, merging adjacent ranges */
+typedef struct {
+    FILE *output;
+    bool use_copy_file_range;
+    FILE *pending_file;   // Source of the range not yet copied, or NULL
+    off_t pending_offset;
+    size_t pending_length;
+} Span_Writer;
+
+/* Size of the bounce buffer used when copy_file_range is unavailable */
+#define COPY_BUFFER_SIZE 65536
+
+/* Bytes per codeword in the file */
+#define CODEWORD_BYTES 4
+
+static const struct {
+    const char *name;
+    Geometry_Transform transform;
+} transform_names[] = {
+    { "rotate90",  TRANSFORM_ROTATE90 },
+    { "rotate180", TRANSFORM_ROTATE180 },
+    { "rotate270", TRANSFORM_ROTATE270 },
+    { "flip-h",    TRANSFORM_FLIP_H },
+    { "flip-v",    TRANSFORM_FLIP_V },
+    { "transpose", TRANSFORM_TRANSPOSE },
+};
+
+/* Helper functions */
+static Coefficient_Map coefficient_map(Geometry_Transform transform);
+static Grid_Map grid_map(Geometry_Transform transform, int width, int height);
+static bool swaps_axes(Geometry_Transform transform);
+static uint16_t *build_bcd_table(Coefficient_Map map);
+static int64_t apply_sign(int64_t value, int sign, unsigned width);
+static bool valid_crop(Codeword_Array *codeword_array, int x, int y,
+                       int width, int height);
+static bool valid_join(Codeword_Array **parts, int count,
+                       Join_Direction direction);
+static bool open_source(FILE *file, Compressed_Source *source);
+static void queue_span(Span_Writer *writer, FILE *file, off_t offset,
+                       size_t length);
+static void flush_span(Span_Writer *writer);
+static void crop_from_memory(FILE *input, FILE *output, int x, int y,
+                             int width, int height);
+static void join_from_memory(FILE **inputs, int count, FILE *output,
+                             Join_Direction direction);
+
+/* Looks up a transform by its command-line name */
+bool parse_geometry_transform(const char *name, Geometry_Transform *transform)
+{
+    assert(name != NULL);
+    assert(transform != NULL);
+
+    size_t count = sizeof(transform_names) / sizeof(transform_names[0]);
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(name, transform_names[i].name) == 0) {
+            *transform = transform_names[i].transform;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Rotates or mirrors the codeword grid */
+Codeword_Array *transform_codewords(Codeword_Array *codeword_array,
+                                    Geometry_Transform transform)
+{
+    assert(codeword_array != NULL);
+    assert(codeword_array->count == codeword_array->width * codeword_array->height);
+
+    int width = codeword_array->width;
+    int height = codeword_array->height;
+
+    /* Allocate memory for the transformed Codeword_Array */
+    Codeword_Array *result = malloc(sizeof(Codeword_Array));
+    assert(result != NULL);
+
+    result->count = codeword_array->count;
+    result->width = swaps_axes(transform) ? height : width;
+    result->height = swaps_axes(transform) ? width : height;
+    result->words = malloc((size_t)result->count * sizeof(uint32_t));
+    assert(result->words != NULL || result->count == 0);
+
+    uint16_t *bcd_table = build_bcd_table(coefficient_map(transform));
+    Grid_Map map = grid_map(transform, width, height);
+
+    const uint32_t *src = codeword_array->words;
+    uint32_t *dst = result->words;
+
+    /* Walk the source in tiles so that both the rows being read and
+       the columns being written stay in cache for quarter turns and
+       transposes */
+    for (int tile_y = 0; tile_y < height; tile_y += TILE_SIZE) {
+        int end_y = tile_y + TILE_SIZE < height ? tile_y + TILE_SIZE : height;
+        for (int tile_x = 0; tile_x < width; tile_x += TILE_SIZE) {
+            int end_x = tile_x + TILE_SIZE < width ? tile_x + TILE_SIZE : width;
+            for (int y = tile_y; y < end_y; y++) {
+                const uint32_t *row = src + (size_t)y * width;
+                ptrdiff_t out = map.origin + y * map.step_y + tile_x * map.step_x;
+                for (int x = tile_x; x < end_x; x++) {
+                    uint32_t word = row[x];
+                    uint32_t bcd = bcd_table[(word & BCD_MASK) >> BCD_LSB];
+                    dst[out] = (word & ~BCD_MASK) | (bcd << BCD_LSB);
+                    out += map.step_x;
+                }
+            }
+        }
+    }
+
+    free(bcd_table);
+    return result;
+}
+
+/* Reads a compressed image, transforms it and writes it back out */
+void transform40(FILE *input, FILE *output, Geometry_Transform transform)
+{
+    Codeword_Array *codeword_array = read_codeword_array(input);
+    if (codeword_array == NULL) {
+        fprintf(stderr, "Error: Failed to read compressed image.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Codeword_Array *result = transform_codewords(codeword_array, transform);
+    free_codeword_array(codeword_array);
+
+    write_compressed_image(output, result, result->width * 2, result->height * 2);
+    free_codeword_array(result);
+}
+
+/* Cuts a block-aligned rectangle out of the codeword grid */
+Codeword_Array *crop_codewords(Codeword_Array *codeword_array,
+                               int x, int y, int width, int height)
+{
+    assert(codeword_array != NULL);
+    assert(valid_crop(codeword_array, x, y, width, height));
+
+    int block_x = x / 2;
+    int block_y = y / 2;
+
+    /* Allocate memory for the cropped Codeword_Array */
+    Codeword_Array *result = malloc(sizeof(Codeword_Array));
+    assert(result != NULL);
+
+    result->width = width / 2;
+    result->height = height / 2;
+    result->count = result->width * result->height;
+    result->words = malloc((size_t)result->count * sizeof(uint32_t));
+    assert(result->words != NULL || result->count == 0);
+
+    /* Each output row is one contiguous span of an input row */
+    size_t row_bytes = (size_t)result->width * sizeof(uint32_t);
+    for (int row = 0; row < result->height; row++) {
+        const uint32_t *src = codeword_array->words +
+            (size_t)(block_y + row) * codeword_array->width + block_x;
+        memcpy(result->words + (size_t)row * result->width, src, row_bytes);
+    }
+
+    return result;
+}
+
+/* Places codeword grids side by side or one above the other */
+Codeword_Array *join_codewords(Codeword_Array **parts, int count,
+                               Join_Direction direction)
+{
+    assert(parts != NULL);
+    assert(valid_join(parts, count, direction));
+
+    /* Allocate memory for the joined Codeword_Array */
+    Codeword_Array *result = malloc(sizeof(Codeword_Array));
+    assert(result != NULL);
+
+    result->width = direction == JOIN_HORIZONTAL ? 0 : parts[0]->width;
+    result->height = direction == JOIN_VERTICAL ? 0 : parts[0]->height;
+    for (int i = 0; i < count; i++) {
+        if (direction == JOIN_HORIZONTAL) {
+            result->width += parts[i]->width;
+        } else {
+            result->height += parts[i]->height;
+        }
+    }
+    result->count = result->width * result->height;
+    result->words = malloc((size_t)result->count * sizeof(uint32_t));
+    assert(result->words != NULL || result->count == 0);
+
+    if (direction == JOIN_VERTICAL) {
+        /* Vertically joined grids are simply concatenated */
+        uint32_t *out = result->words;
+        for (int i = 0; i < count; i++) {
+            memcpy(out, parts[i]->words, (size_t)parts[i]->count * sizeof(uint32_t));
+            out += parts[i]->count;
+        }
+        return result;
+    }
+
+    /* Each output row is the matching row of every part in turn */
+    uint32_t *out = result->words;
+    for (int row = 0; row < result->height; row++) {
+        for (int i = 0; i < count; i++) {
+            size_t part_width = parts[i]->width;
+            memcpy(out, parts[i]->words + row * part_width,
+                   part_width * sizeof(uint32_t));
+            out += part_width;
+        }
+    }
+
+    return result;
+}
+
+/* Writes a block-aligned crop of a compressed image */
+void crop40(FILE *input, FILE *output, int x, int y, int width, int height)
+{
+    Compressed_Source source;
+    if (!open_source(input, &source)) {
+        crop_from_memory(input, output, x, y, width, height);
+        return;
+    }
+
+    Codeword_Array shape = { source.width * source.height, source.width,
+                             source.height, NULL };
+    if (!valid_crop(&shape, x, y, width, height)) {
+        fprintf(stderr, "Error: Crop must be block-aligned and inside the image.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    write_compressed_header(output, width, height);
+
+    /* Rows of a full-width crop are adjacent in the file and get merged
+       into a single copy */
+    Span_Writer writer = { output, true, NULL, 0, 0 };
+    size_t row_bytes = (size_t)(width / 2) * CODEWORD_BYTES;
+    for (int row = y / 2; row < (y + height) / 2; row++) {
+        off_t offset = source.data_offset +
+            ((off_t)row * source.width + x / 2) * CODEWORD_BYTES;
+        queue_span(&writer, input, offset, row_bytes);
+    }
+    flush_span(&writer);
+}
+
+/* Writes several compressed images joined into one */
+void join40(FILE **inputs, int count, FILE *output, Join_Direction direction)
+{
+    assert(inputs != NULL);
+    assert(count > 0);
+
+    /* Decide before any header is consumed, so the fallback reads every
+       input from the start */
+    for (int i = 0; i < count; i++) {
+        if (!is_regular_file(inputs[i])) {
+            join_from_memory(inputs, count, output, direction);
+            return;
+        }
+    }
+
+    Compressed_Source *sources = malloc(count * sizeof(Compressed_Source));
+    assert(sources != NULL);
+
+    for (int i = 0; i < count; i++) {
+        bool opened = open_source(inputs[i], &sources[i]);
+        assert(opened);
+        (void)opened;
+    }
+
+    /* Check the shapes line up before writing anything */
+    int width = 0;
+    int height = 0;
+    for (int i = 0; i < count; i++) {
+        bool fits = direction == JOIN_HORIZONTAL
+                    ? sources[i].height == sources[0].height
+                    : sources[i].width == sources[0].width;
+        if (!fits) {
+            fprintf(stderr, "Error: Images to join must share an edge length.\n");
+            exit(EXIT_FAILURE);
+        }
+        width = direction == JOIN_HORIZONTAL ? width + sources[i].width
+                                             : sources[0].width;
+        height = direction == JOIN_VERTICAL ? height + sources[i].height
+                                            : sources[0].height;
+    }
+
+    write_compressed_header(output, width * 2, height * 2);
+
+    Span_Writer writer = { output, true, NULL, 0, 0 };
+    if (direction == JOIN_VERTICAL) {
+        for (int i = 0; i < count; i++) {
+            size_t bytes = (size_t)sources[i].width * sources[i].height *
+                           CODEWORD_BYTES;
+            queue_span(&writer, sources[i].file, sources[i].data_offset, bytes);
+        }
+    } else {
+        for (int row = 0; row < height; row++) {
+            for (int i = 0; i < count; i++) {
+                size_t row_bytes = (size_t)sources[i].width * CODEWORD_BYTES;
+                queue_span(&writer, sources[i].file,
+                           sources[i].data_offset + (off_t)row * row_bytes,
+                           row_bytes);
+            }
+        }
+    }
+    flush_span(&writer);
+
+    free(sources);
+}
+
+/* Helper function implementations */
+
+/* Describes how a transform rewrites b, c and d.  With y1..y4 the
+   top-left, top-right, bottom-left and bottom-right pixels, b is the
+   vertical gradient, c the horizontal gradient and d the diagonal */
+static Coefficient_Map coefficient_map(Geometry_Transform transform)
+{
+    switch (transform) {
+    case TRANSFORM_ROTATE90:  return (Coefficient_Map){ true,   1, -1, -1 };
+    case TRANSFORM_ROTATE180: return (Coefficient_Map){ false, -1, -1,  1 };
+    case TRANSFORM_ROTATE270: return (Coefficient_Map){ true,  -1,  1, -1 };
+    case TRANSFORM_FLIP_H:    return (Coefficient_Map){ false,  1, -1, -1 };
+    case TRANSFORM_FLIP_V:    return (Coefficient_Map){ false, -1,  1, -1 };
+    case TRANSFORM_TRANSPOSE: return (Coefficient_Map){ true,   1,  1,  1 };
+    }
+    assert(0);
+    return (Coefficient_Map){ false, 1, 1, 1 };
+}
+
+/* Describes where each source block lands in the output grid */
+static Grid_Map grid_map(Geometry_Transform transform, int width, int height)
+{
+    ptrdiff_t w = width;
+    ptrdiff_t h = height;
+
+    switch (transform) {
+    case TRANSFORM_ROTATE90:  return (Grid_Map){ h - 1,           h, -1 };
+    case TRANSFORM_ROTATE180: return (Grid_Map){ w * h - 1,      -1, -w };
+    case TRANSFORM_ROTATE270: return (Grid_Map){ (w - 1) * h,    -h,  1 };
+    case TRANSFORM_FLIP_H:    return (Grid_Map){ w - 1,          -1,  w };
+    case TRANSFORM_FLIP_V:    return (Grid_Map){ (h - 1) * w,     1, -w };
+    case TRANSFORM_TRANSPOSE: return (Grid_Map){ 0,               h,  1 };
+    }
+    assert(0);
+    return (Grid_Map){ 0, 1, w };
+}
+
+/* Returns true if the transform exchanges the width and height */
+static bool swaps_axes(Geometry_Transform transform)
+{
+    return transform == TRANSFORM_ROTATE90 ||
+           transform == TRANSFORM_ROTATE270 ||
+           transform == TRANSFORM_TRANSPOSE;
+}
+
+/* Builds a table mapping every possible b/c/d bit pattern to its
+   transformed pattern, so the per-block work is one lookup */
+static uint16_t *build_bcd_table(Coefficient_Map map)
+{
+    assert(C_LSB == D_LSB + D_WIDTH && B_LSB == C_LSB + C_WIDTH);
+    assert(B_WIDTH == C_WIDTH);
+
+    size_t entries = (size_t)1 << BCD_WIDTH;
+    uint16_t *table = malloc(entries * sizeof(uint16_t));
+    assert(table != NULL);
+
+    for (size_t i = 0; i < entries; i++) {
+        uint64_t word = (uint64_t)i << BCD_LSB;
+        int64_t b = Bitpack_gets(word, B_WIDTH, B_LSB);
+        int64_t c = Bitpack_gets(word, C_WIDTH, C_LSB);
+        int64_t d = Bitpack_gets(word, D_WIDTH, D_LSB);
+
+        int64_t new_b = apply_sign(map.swap_bc ? c : b, map.b_sign, B_WIDTH);
+        int64_t new_c = apply_sign(map.swap_bc ? b : c, map.c_sign, C_WIDTH);
+        int64_t new_d = apply_sign(d, map.d_sign, D_WIDTH);
+
+        uint64_t out = 0;
+        out = Bitpack_news(out, B_WIDTH, B_LSB, new_b);
+        out = Bitpack_news(out, C_WIDTH, C_LSB, new_c);
+        out = Bitpack_news(out, D_WIDTH, D_LSB, new_d);
+        table[i] = (uint16_t)(out >> BCD_LSB);
+    }
+
+    return table;
+}
+
+/* Negates a signed field value when asked, saturating at the field's
+   maximum since the most negative value has no positive counterpart */
+static int64_t apply_sign(int64_t value, int sign, unsigned width)
+{
+    if (sign > 0) {
+        return value;
+    }
+    int64_t max = ((int64_t)1 << (width - 1)) - 1;
+    return -value > max ? max : -value;
+}
+
+/* Checks that a crop rectangle is block-aligned and inside the grid */
+static bool valid_crop(Codeword_Array *codeword_array, int x, int y,
+                       int width, int height)
+{
+    if (x < 0 || y < 0 || width <= 0 || height <= 0) {
+        return false;
+    }
+    if (x % 2 != 0 || y % 2 != 0 || width % 2 != 0 || height % 2 != 0) {
+        return false;
+    }
+    return (x + width) / 2 <= codeword_array->width &&
+           (y + height) / 2 <= codeword_array->height;
+}
+
+/* Checks that the parts of a join share the edge they are joined along */
+static bool valid_join(Codeword_Array **parts, int count,
+                       Join_Direction direction)
+{
+    if (count <= 0) {
+        return false;
+    }
+    for (int i = 1; i < count; i++) {
+        if (direction == JOIN_HORIZONTAL && parts[i]->height != parts[0]->height) {
+            return false;
+        }
+        if (direction == JOIN_VERTICAL && parts[i]->width != parts[0]->width) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Reads the header of a compressed image that lives in a regular file and
+   records where its codewords start.  Returns false, before reading
+   anything, if the input cannot be read at arbitrary offsets; otherwise
+   the header has been consumed */
+static bool open_source(FILE *file, Compressed_Source *source)
+{
+    assert(file != NULL);
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+    int width, height;
+    if (!read_compressed_header(file, &width, &height)) {
+        exit(EXIT_FAILURE);
+    }
+
+    source->file = file;
+    source->width = width / 2;
+    source->height = height / 2;
+    source->data_offset = ftello(file);
+
+    off_t data_bytes = (off_t)source->width * source->height * CODEWORD_BYTES;
+    if (source->data_offset < 0 || st.st_size < source->data_offset + data_bytes) {
+        fprintf(stderr, "Error: Unexpected end of file while reading codewords.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    return true;
+}
+
+/* Adds a byte range to the copy queue, extending the pending range when
+   the new one follows on from it in the same file */
+static void queue_span(Span_Writer *writer, FILE *file, off_t offset,
+                       size_t length)
+{
+    if (writer->pending_file == file &&
+        writer->pending_offset + (off_t)writer->pending_length == offset) {
+        writer->pending_length += length;
+        return;
+    }
+
+    flush_span(writer);
+    writer->pending_file = file;
+    writer->pending_offset = offset;
+    writer->pending_length = length;
+}
+
+/* Copies the pending byte range to the output.  copy_file_range lets the
+   kernel move the data (or share extents) without it entering user space;
+   if the output cannot take it (a pipe or terminal, say) the range goes
+   through a small buffer instead */
+static void flush_span(Span_Writer *writer)
+{
+    if (writer->pending_file == NULL) {
+        return;
+    }
+
+    int in_fd = fileno(writer->pending_file);
+    off_t offset = writer->pending_offset;
+    size_t remaining = writer->pending_length;
+    writer->pending_file = NULL;
+
+    if (writer->use_copy_file_range) {
+        fflush(writer->output);
+        while (remaining > 0) {
+            ssize_t copied = copy_file_range(in_fd, &offset,
+                                             fileno(writer->output), NULL,
+                                             remaining, 0);
+            if (copied <= 0) {
+                if (copied < 0 && errno == EINTR) {
+                    continue;
+                }
+                writer->use_copy_file_range = false;
+                break;
+            }
+            remaining -= copied;
+        }
+    }
+
+    static unsigned char buffer[COPY_BUFFER_SIZE];
+    while (remaining > 0) {
+        size_t chunk = remaining < COPY_BUFFER_SIZE ? remaining : COPY_BUFFER_SIZE;
+        ssize_t got = pread(in_fd, buffer, chunk, offset);
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error: Unexpected end of file while reading codewords.\n");
+            exit(EXIT_FAILURE);
+        }
+        fwrite(buffer, 1, got, writer->output);
+        offset += got;
+        remaining -= got;
+    }
+}
+
+/* Crops an input that can only be read front to back */
+static void crop_from_memory(FILE *input, FILE *output, int x, int y,
+                             int width, int height)
+{
+    Codeword_Array *codeword_array = read_codeword_array(input);
+    if (codeword_array == NULL) {
+        fprintf(stderr, "Error: Failed to read compressed image.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!valid_crop(codeword_array, x, y, width, height)) {
+        fprintf(stderr, "Error: Crop must be block-aligned and inside the image.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Codeword_Array *result = crop_codewords(codeword_array, x, y, width, height);
+    free_codeword_array(codeword_array);
+
+    write_compressed_image(output, result, width, height);
+    free_codeword_array(result);
+}
+
+/* Joins inputs when at least one can only be read front to back */
+static void join_from_memory(FILE **inputs, int count, FILE *output,
+                             Join_Direction direction)
+{
+    Codeword_Array **parts = malloc(count * sizeof(Codeword_Array *));
+    assert(parts != NULL);
+
+    for (int i = 0; i < count; i++) {
+        parts[i] = read_codeword_array(inputs[i]);
+        if (parts[i] == NULL) {
+            fprintf(stderr, "Error: Failed to read compressed image.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (!valid_join(parts, count, direction)) {
+        fprintf(stderr, "Error: Images to join must share an edge length.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Codeword_Array *result = join_codewords(parts, count, direction);
+    for (int i = 0; i < count; i++) {
+        free_codeword_array(parts[i]);
+    }
+    free(parts);
+
+    write_compressed_image(output, result, result->width * 2, result->height * 2);
+    free_codeword_array(result);
+}
@@ -0,0 +1,104 @@
+/* compressed_geometry.h */
+
+#ifndef COMPRESSED_GEOMETRY_H
+#define COMPRESSED_GEOMETRY_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "quantization.h"  // For Codeword_Array
+
+/* Lossless geometric transforms applied directly to the codeword grid */
+typedef enum {
+    TRANSFORM_ROTATE90,   // Clockwise quarter turn
+    TRANSFORM_ROTATE180,
+    TRANSFORM_ROTATE270,  // Counter-clockwise quarter turn
+    TRANSFORM_FLIP_H,     // Mirror left to right
+    TRANSFORM_FLIP_V,     // Mirror top to bottom
+    TRANSFORM_TRANSPOSE   // Reflect across the main diagonal
+} Geometry_Transform;
+
+/* Direction in which images are placed next to each other */
+typedef enum {
+    JOIN_HORIZONTAL,  // Left to right; heights must match
+    JOIN_VERTICAL     // Top to bottom; widths must match
+} Join_Direction;
+
+/* Function Prototypes */
+
+/**
+ * Looks up a transform by its command-line name
+ * ("rotate90", "rotate180", "rotate270", "flip-h", "flip-v", "transpose").
+ * @param name The name to look up.
+ * @param transform Pointer to store the matching transform.
+ * @return true if the name was recognized, false otherwise.
+ */
+bool parse_geometry_transform(const char *name, Geometry_Transform *transform);
+
+/**
+ * Rotates or mirrors a compressed image without decoding it. The
+ * codeword grid is permuted and the b, c and d coefficients of every
+ * block are swapped or negated; a, Pb and Pr are carried over as-is,
+ * so the result is exactly the transformed image with no extra loss.
+ * @param codeword_array The input Codeword_Array.
+ * @param transform The transform to apply.
+ * @return A pointer to a new Codeword_Array holding the transformed grid.
+ */
+Codeword_Array *transform_codewords(Codeword_Array *codeword_array,
+                                    Geometry_Transform transform);
+
+/**
+ * Reads a compressed image, applies a transform and writes the
+ * resulting compressed image.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ * @param transform The transform to apply.
+ */
+void transform40(FILE *input, FILE *output, Geometry_Transform transform);
+
+/**
+ * Cuts a block-aligned rectangle out of a compressed image by copying
+ * row spans of codewords. All values are in pixels and must be even.
+ * @param codeword_array The input Codeword_Array.
+ * @param x The left edge of the rectangle.
+ * @param y The top edge of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ * @return A pointer to a new Codeword_Array holding the rectangle.
+ */
+Codeword_Array *crop_codewords(Codeword_Array *codeword_array,
+                               int x, int y, int width, int height);
+
+/**
+ * Places compressed images side by side or one above the other.
+ * @param parts The Codeword_Arrays to join, in order.
+ * @param count The number of parts.
+ * @param direction Whether to join horizontally or vertically.
+ * @return A pointer to a new Codeword_Array holding the mosaic.
+ */
+Codeword_Array *join_codewords(Codeword_Array **parts, int count,
+                               Join_Direction direction);
+
+/**
+ * Reads a compressed image and writes a block-aligned crop of it. When
+ * the input is a regular file, codeword spans are copied straight from
+ * the input to the output (with copy_file_range where possible) without
+ * loading the image.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ * @param x The left edge of the rectangle, in pixels.
+ * @param y The top edge of the rectangle, in pixels.
+ * @param width The width of the rectangle, in pixels.
+ * @param height The height of the rectangle, in pixels.
+ */
+void crop40(FILE *input, FILE *output, int x, int y, int width, int height);
+
+/**
+ * Reads several compressed images and writes them joined into one.
+ * @param inputs The input file pointers, in order.
+ * @param count The number of inputs.
+ * @param output The output file pointer.
+ * @param direction Whether to join horizontally or vertically.
+ */
+void join40(FILE **inputs, int count, FILE *output, Join_Direction direction);
+
+#endif /* COMPRESSED_GEOMETRY_H */
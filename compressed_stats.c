@@ -0,0 +1,247 @@
+/* compressed_stats.c */
+
+#include "compressed_stats.h"
+#include "codeword_vector.h"
+#include "bitpack.h"
+#include "parallel.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+/* The b, c and d fields sit next to each other below 'a' */
+#define BCD_LSB D_LSB
+#define BCD_WIDTH (B_WIDTH + C_WIDTH + D_WIDTH)
+
+/* Flatness threshold used by stats40: one quantization step (0.02) */
+#define DEFAULT_FLAT_THRESHOLD 1
+
+/* Bins of the luma histogram printed by stats40 */
+#define PRINTED_LUMA_BINS 256
+
+/* Everything a scanning thread needs; codewords come either from a
+   mapped file (big-endian bytes) or from a Codeword_Array */
+typedef struct {
+    const unsigned char *bytes;
+    const uint32_t *words;
+    long long count;
+    const uint8_t *detail_table;
+    int flat_threshold;
+    Image_Stats *partials;      // One per thread
+} Scan_Job;
+
+/* Helper functions */
+static void scan_codewords(const unsigned char *bytes, const uint32_t *words,
+                           long long count, int flat_threshold,
+                           Image_Stats *stats);
+static void scan_part(void *closure, int index, int thread_count);
+static inline unsigned tally(Image_Stats *partial, uint32_t word,
+                             const uint8_t *detail_table, unsigned threshold);
+static uint8_t *build_detail_table(void);
+static void summarize(Image_Stats *stats);
+
+/* Computes statistics of a codeword grid */
+void codeword_stats(Codeword_Array *codeword_array, int flat_threshold,
+                    Image_Stats *stats)
+{
+    assert(codeword_array != NULL);
+    assert(stats != NULL);
+
+    scan_codewords(NULL, codeword_array->words, codeword_array->count,
+                   flat_threshold, stats);
+    stats->width = codeword_array->width * 2;
+    stats->height = codeword_array->height * 2;
+}
+
+/* Computes statistics of a compressed image read from input */
+bool read_image_stats(FILE *input, int flat_threshold, Image_Stats *stats)
+{
+    assert(input != NULL);
+    assert(stats != NULL);
+
+    if (is_regular_file(input)) {
+        Mapped_Compressed_Image mapped;
+        if (!map_compressed_image(input, &mapped)) {
+            return false;
+        }
+        long long count = (long long)(mapped.width / 2) * (mapped.height / 2);
+        scan_codewords(mapped.codewords, NULL, count, flat_threshold, stats);
+        stats->width = mapped.width;
+        stats->height = mapped.height;
+        unmap_compressed_image(&mapped);
+        return true;
+    }
+
+    Codeword_Array *codeword_array = read_codeword_array(input);
+    if (codeword_array == NULL) {
+        return false;
+    }
+    codeword_stats(codeword_array, flat_threshold, stats);
+    free_codeword_array(codeword_array);
+    return true;
+}
+
+/* Reads a compressed image and prints its statistics */
+void stats40(FILE *input, FILE *output)
+{
+    Image_Stats *stats = malloc(sizeof(Image_Stats));
+    assert(stats != NULL);
+
+    if (!read_image_stats(input, DEFAULT_FLAT_THRESHOLD, stats)) {
+        fprintf(stderr, "Error: Failed to read compressed image.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(output, "width: %d\n", stats->width);
+    fprintf(output, "height: %d\n", stats->height);
+    fprintf(output, "blocks: %llu\n", (unsigned long long)stats->block_count);
+    fprintf(output, "mean_luma: %.6f\n", stats->mean_luma);
+    fprintf(output, "luma_stddev: %.6f\n", stats->luma_stddev);
+    fprintf(output, "mean_pb: %.6f\n", stats->mean_pb);
+    fprintf(output, "mean_pr: %.6f\n", stats->mean_pr);
+    fprintf(output, "flat_fraction: %.6f\n", stats->flat_fraction);
+
+    /* Fold the quantized 'a' values down to 8-bit luma bins */
+    int codes_per_bin = (1 << A_WIDTH) / PRINTED_LUMA_BINS;
+    fprintf(output, "luma_histogram:");
+    for (int bin = 0; bin < PRINTED_LUMA_BINS; bin++) {
+        uint64_t total = 0;
+        for (int code = 0; code < codes_per_bin; code++) {
+            total += stats->luma_histogram[bin * codes_per_bin + code];
+        }
+        fprintf(output, " %llu", (unsigned long long)total);
+    }
+    fprintf(output, "\n");
+
+    free(stats);
+}
+
+/* Helper function implementations */
+
+/* Tallies every codeword into per-thread partial counts, then merges
+   them and derives the summaries */
+static void scan_codewords(const unsigned char *bytes, const uint32_t *words,
+                           long long count, int flat_threshold,
+                           Image_Stats *stats)
+{
+    int thread_count = count < MIN_PARALLEL_BLOCKS ? 1 : parallel_default_threads();
+
+    Image_Stats *partials = calloc(thread_count, sizeof(Image_Stats));
+    assert(partials != NULL);
+    uint8_t *detail_table = build_detail_table();
+
+    Scan_Job job = { bytes, words, count, detail_table, flat_threshold, partials };
+    parallel_run(thread_count, scan_part, &job);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->block_count = count;
+    for (int t = 0; t < thread_count; t++) {
+        for (int i = 0; i < (1 << A_WIDTH); i++) {
+            stats->luma_histogram[i] += partials[t].luma_histogram[i];
+        }
+        for (int i = 0; i < (1 << PB_INDEX_WIDTH); i++) {
+            stats->pb_histogram[i] += partials[t].pb_histogram[i];
+        }
+        for (int i = 0; i < (1 << PR_INDEX_WIDTH); i++) {
+            stats->pr_histogram[i] += partials[t].pr_histogram[i];
+        }
+        stats->flat_blocks += partials[t].flat_blocks;
+    }
+    summarize(stats);
+
+    free(detail_table);
+    free(partials);
+}
+
+/* Scans one thread's share of the codewords.  Fields are pulled out with
+   fixed shifts and masks, and the flatness test is a single table lookup
+   on the b/c/d bits, so the loop has no branches beyond the counters */
+static void scan_part(void *closure, int index, int thread_count)
+{
+    Scan_Job *job = closure;
+    Image_Stats *partial = &job->partials[index];
+    const uint8_t *detail_table = job->detail_table;
+    unsigned threshold = job->flat_threshold < 0 ? 0 : job->flat_threshold;
+
+    long long start, end;
+    parallel_split(job->count, index, thread_count, &start, &end);
+
+    uint64_t flat = 0;
+    if (job->bytes != NULL) {
+        for (long long i = start; i < end; i++) {
+            flat += tally(partial, load_codeword(job->bytes + 4 * i),
+                          detail_table, threshold);
+        }
+    } else {
+        for (long long i = start; i < end; i++) {
+            flat += tally(partial, job->words[i], detail_table, threshold);
+        }
+    }
+    partial->flat_blocks = flat;
+}
+
+/* Counts one codeword's fields; returns 1 if the block is flat */
+static inline unsigned tally(Image_Stats *partial, uint32_t word,
+                             const uint8_t *detail_table, unsigned threshold)
+{
+    partial->luma_histogram[word >> A_LSB]++;
+    partial->pb_histogram[(word >> PB_LSB) & ((1 << PB_INDEX_WIDTH) - 1)]++;
+    partial->pr_histogram[(word >> PR_LSB) & ((1 << PR_INDEX_WIDTH) - 1)]++;
+    return detail_table[(word >> BCD_LSB) & ((1 << BCD_WIDTH) - 1)] <= threshold;
+}
+
+/* Builds a table giving max(|b|, |c|, |d|) for every b/c/d bit pattern */
+static uint8_t *build_detail_table(void)
+{
+    assert(A_LSB + A_WIDTH == 32);
+    assert(C_LSB == D_LSB + D_WIDTH && B_LSB == C_LSB + C_WIDTH);
+
+    size_t entries = (size_t)1 << BCD_WIDTH;
+    uint8_t *table = malloc(entries);
+    assert(table != NULL);
+
+    for (size_t i = 0; i < entries; i++) {
+        uint64_t word = (uint64_t)i << BCD_LSB;
+        int64_t b = llabs(Bitpack_gets(word, B_WIDTH, B_LSB));
+        int64_t c = llabs(Bitpack_gets(word, C_WIDTH, C_LSB));
+        int64_t d = llabs(Bitpack_gets(word, D_WIDTH, D_LSB));
+
+        int64_t detail = b > c ? b : c;
+        table[i] = (uint8_t)(detail > d ? detail : d);
+    }
+
+    return table;
+}
+
+/* Derives the means, spread and flat fraction from the histograms */
+static void summarize(Image_Stats *stats)
+{
+    if (stats->block_count == 0) {
+        return;
+    }
+    double n = (double)stats->block_count;
+
+    double sum = 0.0;
+    double sum_squares = 0.0;
+    for (int i = 0; i < (1 << A_WIDTH); i++) {
+        double luma = dequantize_a(i);
+        sum += stats->luma_histogram[i] * luma;
+        sum_squares += stats->luma_histogram[i] * luma * luma;
+    }
+    stats->mean_luma = sum / n;
+    double variance = sum_squares / n - stats->mean_luma * stats->mean_luma;
+    stats->luma_stddev = variance > 0.0 ? sqrt(variance) : 0.0;
+
+    double pb_sum = 0.0;
+    for (int i = 0; i < (1 << PB_INDEX_WIDTH); i++) {
+        pb_sum += stats->pb_histogram[i] * chroma_of_index(i);
+    }
+    double pr_sum = 0.0;
+    for (int i = 0; i < (1 << PR_INDEX_WIDTH); i++) {
+        pr_sum += stats->pr_histogram[i] * chroma_of_index(i);
+    }
+    stats->mean_pb = pb_sum / n;
+    stats->mean_pr = pr_sum / n;
+    stats->flat_fraction = stats->flat_blocks / n;
+}
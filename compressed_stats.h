@@ -0,0 +1,62 @@
+/* compressed_stats.h */
+
+#ifndef COMPRESSED_STATS_H
+#define COMPRESSED_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "quantization.h"  // For Codeword_Array and the field widths
+
+/* Statistics of a compressed image, computed from its codewords alone */
+typedef struct {
+    int width;                // Image width in pixels
+    int height;               // Image height in pixels
+    uint64_t block_count;     // Number of 2x2 blocks
+
+    /* Blocks per quantized value of each field */
+    uint64_t luma_histogram[1 << A_WIDTH];
+    uint64_t pb_histogram[1 << PB_INDEX_WIDTH];
+    uint64_t pr_histogram[1 << PR_INDEX_WIDTH];
+
+    /* Blocks whose b, c and d are all within the flatness threshold */
+    uint64_t flat_blocks;
+
+    /* Summaries derived from the counts above */
+    double mean_luma;         // Mean Y over all pixels, in [0, 1]
+    double luma_stddev;       // Standard deviation of the block means
+    double mean_pb;
+    double mean_pr;
+    double flat_fraction;
+} Image_Stats;
+
+/* Function Prototypes */
+
+/**
+ * Computes statistics of a codeword grid without decoding it.
+ * @param codeword_array The input Codeword_Array.
+ * @param flat_threshold A block is flat when |b|, |c| and |d| are all at
+ * most this many quantization steps.
+ * @param stats Pointer to the structure to fill in.
+ */
+void codeword_stats(Codeword_Array *codeword_array, int flat_threshold,
+                    Image_Stats *stats);
+
+/**
+ * Computes statistics of a compressed image read from input. Regular
+ * files are mapped and scanned in parallel; other inputs are read in.
+ * @param input The input file pointer.
+ * @param flat_threshold As for codeword_stats.
+ * @param stats Pointer to the structure to fill in.
+ * @return true on success, false if the input is not a valid image.
+ */
+bool read_image_stats(FILE *input, int flat_threshold, Image_Stats *stats);
+
+/**
+ * Reads a compressed image and prints its statistics.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ */
+void stats40(FILE *input, FILE *output);
+
+#endif /* COMPRESSED_STATS_H */
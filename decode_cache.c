@@ -0,0 +1,606 @@
+/* decode_cache.c */
+
+#define _GNU_SOURCE  // For fmemopen
+#include "decode_cache.h"
+#include "block_decode.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Upper bound on shards, and the bucket count each one starts with */
+#define MAX_SHARDS 256
+#define INITIAL_BUCKETS 64
+
+/* Shards are aligned to this so no two share a line */
+#define CACHE_LINE 64
+
+/* Layout of a file in the cache directory: this header, then the pixels */
+#define DISK_MAGIC_NUMBER "COMP40 Decoded image 1\n"
+#define DISK_HEADER_MAX 64
+
+/* Multipliers of the 64-bit hash (those of XXH64) */
+#define PRIME_1 0x9E3779B185EBCA87ULL
+#define PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME_3 0x165667B19E3779F9ULL
+#define PRIME_4 0x85EBCA77C2B2AE63ULL
+#define PRIME_5 0x27D4EB2F165667C5ULL
+
+typedef struct Entry {
+    Decoded_Image image;      // First, so a Decoded_Image * is an Entry *
+    uint64_t key;
+    size_t length;            // Length of the compressed stream
+    size_t bytes;             // Pixel bytes
+    int shard;
+    int refs;                 // Holders outside the cache
+    bool cached;              // In its shard's table and LRU list
+    Pixel *owned;             // Pixels from decoding, or NULL
+    void *map;                // Pixels from the cache directory, or NULL
+    size_t map_length;
+    struct Entry *next;       // Next in the bucket
+    struct Entry *newer;      // LRU neighbours
+    struct Entry *older;
+} Entry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    Entry **buckets;
+    size_t bucket_count;      // A power of two
+    size_t entries;
+    size_t bytes;
+    size_t capacity;
+    Entry *newest;
+    Entry *oldest;
+    uint64_t hits;
+    uint64_t disk_hits;
+    uint64_t misses;
+    uint64_t insertions;
+    uint64_t evictions;
+} __attribute__((aligned(CACHE_LINE))) Shard;  // So shards do not share
+                                                // lines between threads
+
+struct Decode_Cache {
+    int shard_count;
+    char *directory;
+    Shard *shards;
+};
+
+/* Helper functions */
+static uint64_t rotate_left(uint64_t value, int bits);
+static uint64_t hash_round(uint64_t accumulator, uint64_t input);
+static uint64_t load_64(const unsigned char *bytes);
+static uint32_t load_32(const unsigned char *bytes);
+static Entry *find(Shard *shard, uint64_t key, size_t length);
+static void unlink_lru(Shard *shard, Entry *entry);
+static void push_newest(Shard *shard, Entry *entry);
+static void insert(Shard *shard, Entry *entry);
+static Entry *evict(Shard *shard);
+static void free_entry(Entry *entry);
+static Entry *decode_stream(const unsigned char *bytes, size_t length);
+static void disk_path(const char *directory, uint64_t key, size_t length,
+                      char *path, size_t size);
+static Entry *load_from_disk(const char *directory, uint64_t key, size_t length);
+static void store_to_disk(const char *directory, const Entry *entry);
+
+/* Creates a cache */
+Decode_Cache decode_cache_new(size_t capacity, int shard_count,
+                              const char *directory)
+{
+    if (shard_count < 1) {
+        shard_count = 1;
+    }
+    if (shard_count > MAX_SHARDS) {
+        shard_count = MAX_SHARDS;
+    }
+
+    Decode_Cache cache = malloc(sizeof(*cache));
+    assert(cache != NULL);
+    cache->shard_count = shard_count;
+    cache->directory = directory != NULL ? strdup(directory) : NULL;
+    /* The alignment must be a power of two; sizeof(Shard) is a multiple
+       of it, as aligned_alloc requires of the size */
+    cache->shards = aligned_alloc(CACHE_LINE, shard_count * sizeof(Shard));
+    assert(cache->shards != NULL);
+
+    for (int i = 0; i < shard_count; i++) {
+        Shard *shard = &cache->shards[i];
+        memset(shard, 0, sizeof(*shard));
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->bucket_count = INITIAL_BUCKETS;
+        shard->buckets = calloc(INITIAL_BUCKETS, sizeof(Entry *));
+        assert(shard->buckets != NULL);
+        shard->capacity = capacity / shard_count;
+    }
+
+    return cache;
+}
+
+/* Frees a cache */
+void decode_cache_free(Decode_Cache *cache)
+{
+    assert(cache != NULL && *cache != NULL);
+
+    for (int i = 0; i < (*cache)->shard_count; i++) {
+        Shard *shard = &(*cache)->shards[i];
+        Entry *entry = shard->newest;
+        while (entry != NULL) {
+            assert(entry->refs == 0);
+            Entry *older = entry->older;
+            free_entry(entry);
+            entry = older;
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free((*cache)->shards);
+    free((*cache)->directory);
+    free(*cache);
+    *cache = NULL;
+}
+
+/* Hashes a compressed stream; this is XXH64 with a seed of 0 */
+uint64_t decode_cache_key(const unsigned char *bytes, size_t length)
+{
+    assert(bytes != NULL || length == 0);
+
+    const unsigned char *p = bytes;
+    const unsigned char *end = bytes + length;
+    uint64_t hash;
+
+    if (length >= 32) {
+        uint64_t v1 = PRIME_1 + PRIME_2;
+        uint64_t v2 = PRIME_2;
+        uint64_t v3 = 0;
+        uint64_t v4 = -PRIME_1;
+        do {
+            v1 = hash_round(v1, load_64(p));
+            v2 = hash_round(v2, load_64(p + 8));
+            v3 = hash_round(v3, load_64(p + 16));
+            v4 = hash_round(v4, load_64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        hash = rotate_left(v1, 1) + rotate_left(v2, 7) +
+               rotate_left(v3, 12) + rotate_left(v4, 18);
+        uint64_t lanes[4] = { v1, v2, v3, v4 };
+        for (int i = 0; i < 4; i++) {
+            hash ^= hash_round(0, lanes[i]);
+            hash = hash * PRIME_1 + PRIME_4;
+        }
+    } else {
+        hash = PRIME_5;
+    }
+    hash += length;
+
+    for (; p + 8 <= end; p += 8) {
+        hash ^= hash_round(0, load_64(p));
+        hash = rotate_left(hash, 27) * PRIME_1 + PRIME_4;
+    }
+    if (p + 4 <= end) {
+        hash ^= load_32(p) * PRIME_1;
+        hash = rotate_left(hash, 23) * PRIME_2 + PRIME_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= *p * PRIME_5;
+        hash = rotate_left(hash, 11) * PRIME_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+/* Returns the decoded image, from the cache if possible */
+const Decoded_Image *decode_cache_decode(Decode_Cache cache,
+                                         const unsigned char *bytes,
+                                         size_t length)
+{
+    assert(cache != NULL);
+    assert(bytes != NULL || length == 0);
+
+    uint64_t key = decode_cache_key(bytes, length);
+    int index = (key >> 32) % cache->shard_count;
+    Shard *shard = &cache->shards[index];
+
+    /* 1. Memory */
+    pthread_mutex_lock(&shard->lock);
+    Entry *entry = find(shard, key, length);
+    if (entry != NULL) {
+        shard->hits++;
+        entry->refs++;
+        unlink_lru(shard, entry);
+        push_newest(shard, entry);
+        pthread_mutex_unlock(&shard->lock);
+        return &entry->image;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    /* 2. The cache directory, then decoding; both without the lock */
+    bool from_disk = false;
+    if (cache->directory != NULL) {
+        entry = load_from_disk(cache->directory, key, length);
+        from_disk = entry != NULL;
+    }
+    if (entry == NULL) {
+        entry = decode_stream(bytes, length);
+        if (entry == NULL) {
+            return NULL;
+        }
+        entry->key = key;
+        if (cache->directory != NULL) {
+            store_to_disk(cache->directory, entry);
+        }
+    }
+    entry->shard = index;
+    entry->refs = 1;
+
+    /* 3. Insert, unless another thread got there first */
+    Entry *evicted = NULL;
+    pthread_mutex_lock(&shard->lock);
+    Entry *existing = find(shard, key, length);
+    if (existing != NULL) {
+        shard->hits++;
+        existing->refs++;
+        unlink_lru(shard, existing);
+        push_newest(shard, existing);
+    } else {
+        if (from_disk) {
+            shard->disk_hits++;
+        } else {
+            shard->misses++;
+        }
+        if (entry->bytes <= shard->capacity) {
+            insert(shard, entry);
+            evicted = evict(shard);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    /* Unmapping and freeing can be slow, so it happens outside the lock */
+    while (evicted != NULL) {
+        Entry *next = evicted->next;
+        free_entry(evicted);
+        evicted = next;
+    }
+    if (existing != NULL) {
+        free_entry(entry);
+        return &existing->image;
+    }
+    return &entry->image;
+}
+
+/* Hands back an image */
+void decode_cache_release(Decode_Cache cache, const Decoded_Image *image)
+{
+    assert(cache != NULL);
+    assert(image != NULL);
+
+    Entry *entry = (Entry *)image;
+    Shard *shard = &cache->shards[entry->shard];
+
+    pthread_mutex_lock(&shard->lock);
+    assert(entry->refs > 0);
+    bool orphaned = --entry->refs == 0 && !entry->cached;
+    pthread_mutex_unlock(&shard->lock);
+
+    if (orphaned) {
+        free_entry(entry);
+    }
+}
+
+/* Returns the counters summed over all shards */
+Decode_Cache_Stats decode_cache_stats(Decode_Cache cache)
+{
+    assert(cache != NULL);
+
+    Decode_Cache_Stats stats;
+    memset(&stats, 0, sizeof(stats));
+    for (int i = 0; i < cache->shard_count; i++) {
+        Shard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats.hits += shard->hits;
+        stats.disk_hits += shard->disk_hits;
+        stats.misses += shard->misses;
+        stats.insertions += shard->insertions;
+        stats.evictions += shard->evictions;
+        stats.entries += shard->entries;
+        stats.bytes += shard->bytes;
+        stats.capacity += shard->capacity;
+        pthread_mutex_unlock(&shard->lock);
+    }
+    return stats;
+}
+
+/* Prints the counters, one per line */
+void print_decode_cache_stats(Decode_Cache cache, FILE *output)
+{
+    Decode_Cache_Stats stats = decode_cache_stats(cache);
+    uint64_t lookups = stats.hits + stats.disk_hits + stats.misses;
+
+    fprintf(output, "hits %llu\n", (unsigned long long)stats.hits);
+    fprintf(output, "disk_hits %llu\n", (unsigned long long)stats.disk_hits);
+    fprintf(output, "misses %llu\n", (unsigned long long)stats.misses);
+    fprintf(output, "hit_rate %.4f\n",
+            lookups > 0 ? (double)stats.hits / lookups : 0.0);
+    fprintf(output, "insertions %llu\n", (unsigned long long)stats.insertions);
+    fprintf(output, "evictions %llu\n", (unsigned long long)stats.evictions);
+    fprintf(output, "entries %llu\n", (unsigned long long)stats.entries);
+    fprintf(output, "bytes %llu\n", (unsigned long long)stats.bytes);
+    fprintf(output, "capacity %llu\n", (unsigned long long)stats.capacity);
+}
+
+/* Rotates a 64-bit value left */
+static uint64_t rotate_left(uint64_t value, int bits)
+{
+    return value << bits | value >> (64 - bits);
+}
+
+/* Mixes one 8-byte word into a hash lane */
+static uint64_t hash_round(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * PRIME_2;
+    accumulator = rotate_left(accumulator, 31);
+    return accumulator * PRIME_1;
+}
+
+/* Loads 8 bytes in little-endian order */
+static uint64_t load_64(const unsigned char *bytes)
+{
+    return (uint64_t)load_32(bytes) | (uint64_t)load_32(bytes + 4) << 32;
+}
+
+/* Loads 4 bytes in little-endian order */
+static uint32_t load_32(const unsigned char *bytes)
+{
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+           (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+/* Looks up an entry; the shard must be locked */
+static Entry *find(Shard *shard, uint64_t key, size_t length)
+{
+    Entry *entry = shard->buckets[key & (shard->bucket_count - 1)];
+    while (entry != NULL && (entry->key != key || entry->length != length)) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+/* Takes an entry out of the LRU list */
+static void unlink_lru(Shard *shard, Entry *entry)
+{
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        shard->newest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        shard->oldest = entry->newer;
+    }
+    entry->newer = entry->older = NULL;
+}
+
+/* Puts an entry at the most recently used end of the list */
+static void push_newest(Shard *shard, Entry *entry)
+{
+    entry->older = shard->newest;
+    entry->newer = NULL;
+    if (shard->newest != NULL) {
+        shard->newest->newer = entry;
+    } else {
+        shard->oldest = entry;
+    }
+    shard->newest = entry;
+}
+
+/* Adds an entry to the table and the list, growing the table as needed */
+static void insert(Shard *shard, Entry *entry)
+{
+    if (shard->entries >= shard->bucket_count) {
+        size_t bucket_count = shard->bucket_count * 2;
+        Entry **buckets = calloc(bucket_count, sizeof(Entry *));
+        assert(buckets != NULL);
+        for (size_t b = 0; b < shard->bucket_count; b++) {
+            Entry *e = shard->buckets[b];
+            while (e != NULL) {
+                Entry *next = e->next;
+                e->next = buckets[e->key & (bucket_count - 1)];
+                buckets[e->key & (bucket_count - 1)] = e;
+                e = next;
+            }
+        }
+        free(shard->buckets);
+        shard->buckets = buckets;
+        shard->bucket_count = bucket_count;
+    }
+
+    Entry **bucket = &shard->buckets[entry->key & (shard->bucket_count - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    push_newest(shard, entry);
+    entry->cached = true;
+    shard->entries++;
+    shard->bytes += entry->bytes;
+    shard->insertions++;
+}
+
+/* Drops least recently used entries until the shard fits its capacity.
+   Returns those nobody holds, chained through next, for freeing. */
+static Entry *evict(Shard *shard)
+{
+    Entry *unheld = NULL;
+    while (shard->bytes > shard->capacity && shard->oldest != NULL) {
+        Entry *victim = shard->oldest;
+        unlink_lru(shard, victim);
+
+        Entry **link = &shard->buckets[victim->key & (shard->bucket_count - 1)];
+        while (*link != victim) {
+            link = &(*link)->next;
+        }
+        *link = victim->next;
+
+        victim->cached = false;
+        shard->entries--;
+        shard->bytes -= victim->bytes;
+        shard->evictions++;
+
+        /* Held entries are freed by their last release instead */
+        if (victim->refs == 0) {
+            victim->next = unheld;
+            unheld = victim;
+        }
+    }
+    return unheld;
+}
+
+/* Frees an entry and its pixels */
+static void free_entry(Entry *entry)
+{
+    free(entry->owned);
+    if (entry->map != NULL) {
+        munmap(entry->map, entry->map_length);
+    }
+    free(entry);
+}
+
+/* Decodes a compressed stream held in memory */
+static Entry *decode_stream(const unsigned char *bytes, size_t length)
+{
+    FILE *input = fmemopen((void *)bytes, length, "r");
+    if (input == NULL) {
+        fprintf(stderr, "Error: Empty compressed image.\n");
+        return NULL;
+    }
+    int width, height;
+    bool valid = read_compressed_header(input, &width, &height);
+    long offset = ftell(input);
+    fclose(input);
+    if (!valid) {
+        return NULL;
+    }
+
+    int block_width = width / 2;
+    int block_height = height / 2;
+    if ((uint64_t)length < (uint64_t)offset +
+                          4ULL * block_width * block_height) {
+        fprintf(stderr, "Error: Unexpected end of file while reading codewords.\n");
+        return NULL;
+    }
+
+    Entry *entry = calloc(1, sizeof(Entry));
+    assert(entry != NULL);
+    entry->bytes = (size_t)block_width * 2 * block_height * 2 * sizeof(Pixel);
+    entry->owned = malloc(entry->bytes + 1);
+    assert(entry->owned != NULL);
+    entry->length = length;
+    entry->image = (Decoded_Image){ block_width * 2, block_height * 2,
+                                    entry->owned };
+
+    const unsigned char *codewords = bytes + offset;
+    size_t row_pixels = (size_t)block_width * 2;
+    for (int row = 0; row < block_height; row++) {
+        Pixel *top = entry->owned + 2 * row * row_pixels;
+        decode_block_run(codewords + 4 * (size_t)row * block_width, NULL,
+                         block_width, top, top + row_pixels);
+    }
+
+    return entry;
+}
+
+/* Builds the path of a key's file in the cache directory */
+static void disk_path(const char *directory, uint64_t key, size_t length,
+                      char *path, size_t size)
+{
+    snprintf(path, size, "%s/%016llx-%zu.rgb", directory,
+             (unsigned long long)key, length);
+}
+
+/* Maps a previously decoded image from the cache directory */
+static Entry *load_from_disk(const char *directory, uint64_t key, size_t length)
+{
+    char path[PATH_MAX];
+    disk_path(directory, key, length, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    char header[DISK_HEADER_MAX + 1];
+    struct stat st;
+    ssize_t got = pread(fd, header, DISK_HEADER_MAX, 0);
+    int width = 0, height = 0, header_length = 0;
+    size_t magic_length = strlen(DISK_MAGIC_NUMBER);
+    bool valid = fstat(fd, &st) == 0 && got > 0;
+    if (valid) {
+        /* The pixels follow a single newline, so it is matched by hand */
+        header[got] = '\0';
+        valid = strncmp(header, DISK_MAGIC_NUMBER, magic_length) == 0 &&
+                sscanf(header + magic_length, "%d %d%n", &width, &height,
+                       &header_length) == 2 &&
+                width >= 0 && height >= 0 &&
+                header[magic_length + header_length] == '\n';
+        header_length += magic_length + 1;
+    }
+    size_t bytes = (size_t)width * height * sizeof(Pixel);
+    if (!valid || (uint64_t)st.st_size != header_length + bytes) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    Entry *entry = calloc(1, sizeof(Entry));
+    assert(entry != NULL);
+    entry->key = key;
+    entry->length = length;
+    entry->bytes = bytes;
+    entry->map = map;
+    entry->map_length = st.st_size;
+    entry->image = (Decoded_Image){ width, height,
+                                    (const Pixel *)((char *)map + header_length) };
+    return entry;
+}
+
+/* Writes a decoded image to the cache directory; failures only cost a
+   future decode, so they are ignored */
+static void store_to_disk(const char *directory, const Entry *entry)
+{
+    char path[PATH_MAX];
+    char temporary[PATH_MAX];
+    disk_path(directory, entry->key, entry->length, path, sizeof(path));
+    snprintf(temporary, sizeof(temporary), "%s/.tmp-XXXXXX", directory);
+
+    /* Write to a temporary name and rename, so readers never see part */
+    int fd = mkstemp(temporary);
+    if (fd < 0) {
+        return;
+    }
+    FILE *output = fdopen(fd, "w");
+    if (output == NULL) {
+        close(fd);
+        unlink(temporary);
+        return;
+    }
+    fprintf(output, "%s%d %d\n", DISK_MAGIC_NUMBER, entry->image.width,
+            entry->image.height);
+    fwrite(entry->image.pixels, 1, entry->bytes, output);
+    if (fclose(output) != 0 || rename(temporary, path) != 0) {
+        unlink(temporary);
+    }
+}
@@ -0,0 +1,104 @@
+/* decode_cache.h */
+
+#ifndef DECODE_CACHE_H
+#define DECODE_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "image_processing.h"  // For Pixel
+
+/* A decoded image held by the cache. Pixels are row-major with no
+   padding. The image stays valid until it is released, even if it is
+   evicted in the meantime. */
+typedef struct {
+    int width;
+    int height;
+    const Pixel *pixels;
+} Decoded_Image;
+
+/* Counters for sizing the cache; all are totals since it was created
+   except entries and bytes, which are current */
+typedef struct {
+    uint64_t hits;        // Found in memory
+    uint64_t disk_hits;   // Found in the cache directory
+    uint64_t misses;      // Decoded from scratch
+    uint64_t insertions;
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t bytes;       // Pixel bytes held in memory
+    uint64_t capacity;    // Limit on bytes
+} Decode_Cache_Stats;
+
+/* A size-bounded LRU of decoded images keyed by content */
+typedef struct Decode_Cache *Decode_Cache;
+
+/* Function Prototypes */
+
+/**
+ * Creates a cache. Entries are spread over shards by key, each with its
+ * own lock and LRU list, so threads rarely wait for each other. Each
+ * shard holds capacity / shard_count bytes; a larger image is still
+ * returned (and stored in the directory) but not kept in memory.
+ * @param capacity The most pixel bytes to hold in memory.
+ * @param shard_count The number of shards; values below 1 mean 1.
+ * @param directory A directory in which decoded images are also kept
+ * across restarts, or NULL for memory only. Files there are never
+ * removed by the cache.
+ * @return The new cache.
+ */
+Decode_Cache decode_cache_new(size_t capacity, int shard_count,
+                              const char *directory);
+
+/**
+ * Frees a cache and sets *cache to NULL. No images may still be held.
+ * @param cache Pointer to the cache.
+ */
+void decode_cache_free(Decode_Cache *cache);
+
+/**
+ * Returns the content key of a compressed image: a 64-bit hash of the
+ * whole stream, header included.
+ * @param bytes The compressed image as stored in a file.
+ * @param length The number of bytes.
+ * @return The key.
+ */
+uint64_t decode_cache_key(const unsigned char *bytes, size_t length);
+
+/**
+ * Returns the decoded form of a compressed image, from memory, from the
+ * cache directory or by decoding it, and caches it if it was not in
+ * memory.
+ * @param cache The cache.
+ * @param bytes The compressed image as stored in a file.
+ * @param length The number of bytes.
+ * @return The image, to be handed back with decode_cache_release, or
+ * NULL (after printing an error) if the stream is invalid.
+ */
+const Decoded_Image *decode_cache_decode(Decode_Cache cache,
+                                         const unsigned char *bytes,
+                                         size_t length);
+
+/**
+ * Hands back an image returned by decode_cache_decode.
+ * @param cache The cache.
+ * @param image The image.
+ */
+void decode_cache_release(Decode_Cache cache, const Decoded_Image *image);
+
+/**
+ * Returns the cache's counters.
+ * @param cache The cache.
+ * @return The counters summed over all shards.
+ */
+Decode_Cache_Stats decode_cache_stats(Decode_Cache cache);
+
+/**
+ * Prints the counters, with the hit rate, one per line.
+ * @param cache The cache.
+ * @param output The output file pointer.
+ */
+void print_decode_cache_stats(Decode_Cache cache, FILE *output);
+
+#endif /* DECODE_CACHE_H */
@@ -0,0 +1,174 @@
+/* downscale.c */
+
+#include "downscale.h"
+#include "codeword_vector.h"
+#include "color_conversion.h"
+#include "chroma_processing.h"
+#include "transform.h"
+#include "huge_alloc.h"
+#include "parallel.h"
+#include "io.h"
+#include <stdlib.h>
+#include <assert.h>
+
+/* Everything an averaging thread needs; codewords come either from a
+   mapped file (big-endian bytes) or from a Codeword_Array */
+typedef struct {
+    const unsigned char *bytes;
+    const uint32_t *words;
+    int block_width;             // Of the source
+    int group;                   // Source blocks per pixel along each side
+    double a_step;               // Luma of one quantized step of a
+    float chroma[1 << PB_INDEX_WIDTH];  // Pb or Pr of each index
+    YPbPr_image *ypbpr_image;
+} Mean_Job;
+
+/* Helper functions */
+static Codeword_Array *downscale_source(const unsigned char *bytes,
+                                        const uint32_t *words,
+                                        int block_width, int block_height,
+                                        int steps);
+static void mean_rows(void *closure, int index, int thread_count);
+
+/* Downscales codewords held in memory */
+Codeword_Array *downscale_codewords(const Codeword_Array *codeword_array,
+                                    int steps)
+{
+    assert(codeword_array != NULL);
+
+    return downscale_source(NULL, codeword_array->words,
+                            codeword_array->width, codeword_array->height,
+                            steps);
+}
+
+/* Reads, downscales and writes a compressed image */
+void downscale40(FILE *input, FILE *output, int steps)
+{
+    Codeword_Array *result;
+    if (is_regular_file(input)) {
+        Mapped_Compressed_Image mapped;
+        if (!map_compressed_image(input, &mapped)) {
+            exit(EXIT_FAILURE);
+        }
+        result = downscale_source(mapped.codewords, NULL, mapped.width / 2,
+                                  mapped.height / 2, steps);
+        unmap_compressed_image(&mapped);
+    } else {
+        Codeword_Array *codeword_array = read_codeword_array(input);
+        if (codeword_array == NULL) {
+            fprintf(stderr, "Error: Failed to read compressed image.\n");
+            exit(EXIT_FAILURE);
+        }
+        result = downscale_codewords(codeword_array, steps);
+        free_codeword_array(codeword_array);
+    }
+    if (result == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    write_compressed_image(output, result, result->width * 2,
+                           result->height * 2);
+    free_codeword_array(result);
+}
+
+/* Helper function implementations */
+
+/* Averages the source blocks into a small YPbPr image, one pixel per
+   group, then runs the last three compression stages on it */
+static Codeword_Array *downscale_source(const unsigned char *bytes,
+                                        const uint32_t *words,
+                                        int block_width, int block_height,
+                                        int steps)
+{
+    assert(steps >= 1 && steps <= DOWNSCALE_MAX_STEPS);
+
+    /* A block is already a 2x2 mean, so halving needs groups of one */
+    int group = 1 << (steps - 1);
+    int width = (block_width / group) & ~1;
+    int height = (block_height / group) & ~1;
+    if (width == 0 || height == 0) {
+        fprintf(stderr, "Error: The image is too small to halve %d "
+                "times.\n", steps);
+        return NULL;
+    }
+
+    /* 1. Block means */
+    YPbPr_image *ypbpr_image = malloc(sizeof(YPbPr_image));
+    assert(ypbpr_image != NULL);
+    ypbpr_image->width = width;
+    ypbpr_image->height = height;
+    ypbpr_image->pixels = huge_alloc_rows(height,
+                                          width * sizeof(YPbPr_pixel));
+
+    Mean_Job job;
+    job.bytes = bytes;
+    job.words = words;
+    job.block_width = block_width;
+    job.group = group;
+    job.a_step = dequantize_a(1);   // dequantize_a is linear
+    for (int i = 0; i < (1 << PB_INDEX_WIDTH); i++) {
+        job.chroma[i] = chroma_of_index(i);
+    }
+    job.ypbpr_image = ypbpr_image;
+
+    long long blocks = (long long)block_width * block_height;
+    int thread_count = blocks < MIN_PARALLEL_BLOCKS
+                       ? 1 : parallel_default_threads();
+    parallel_run(thread_count, mean_rows, &job);
+
+    /* 2. Chroma Averaging and 2x2 Block Generation */
+    Block_Array *block_array = create_blocks(ypbpr_image);
+    free_ypbpr_image(ypbpr_image);
+
+    /* 3. Discrete Cosine Transform (DCT) */
+    DCT_Array *dct_array = perform_dct(block_array);
+    free_block_array(block_array);
+
+    /* 4. Quantization and Codeword Packaging */
+    Codeword_Array *codeword_array = quantize_and_pack(dct_array);
+    free_dct_array(dct_array);
+    return codeword_array;
+}
+
+/* Fills one thread's band of rows of the small image. Luma is summed as
+   quantized integers and scaled once per pixel. */
+static void mean_rows(void *closure, int index, int thread_count)
+{
+    Mean_Job *job = closure;
+    YPbPr_image *ypbpr_image = job->ypbpr_image;
+    int group = job->group;
+    double scale = 1.0 / ((double)group * group);
+    double a_scale = job->a_step * scale;
+
+    long long first, last;
+    parallel_split(ypbpr_image->height, index, thread_count, &first, &last);
+
+    for (long long y = first; y < last; y++) {
+        for (int x = 0; x < ypbpr_image->width; x++) {
+            uint64_t a_sum = 0;
+            double pb_sum = 0.0;
+            double pr_sum = 0.0;
+
+            for (int gy = 0; gy < group; gy++) {
+                size_t start = (size_t)(y * group + gy) * job->block_width +
+                               (size_t)x * group;
+                for (int gx = 0; gx < group; gx++) {
+                    uint32_t word = job->words != NULL
+                                    ? job->words[start + gx]
+                                    : load_codeword(job->bytes +
+                                                    4 * (start + gx));
+                    a_sum += word >> A_LSB;
+                    pb_sum += job->chroma[(word >> PB_LSB) &
+                                          ((1 << PB_INDEX_WIDTH) - 1)];
+                    pr_sum += job->chroma[(word >> PR_LSB) &
+                                          ((1 << PR_INDEX_WIDTH) - 1)];
+                }
+            }
+
+            YPbPr_pixel *pixel = &ypbpr_image->pixels[y][x];
+            pixel->y = a_sum * a_scale;
+            pixel->pb = pb_sum * scale;
+            pixel->pr = pr_sum * scale;
+        }
+    }
+}
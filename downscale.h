@@ -0,0 +1,38 @@
+/* downscale.h */
+
+#ifndef DOWNSCALE_H
+#define DOWNSCALE_H
+
+#include <stdio.h>
+#include "quantization.h"  // For Codeword_Array
+
+/* Largest number of halvings downscale accepts */
+#define DOWNSCALE_MAX_STEPS 16
+
+/* Function Prototypes */
+
+/**
+ * Builds a compressed image 1/2^steps the size of another straight from
+ * its codewords. Each pixel of the smaller image takes the mean of the
+ * a, Pb and Pr of the blocks it covers, and only the block, DCT and
+ * quantization stages are run on the result. Blocks left over at the
+ * right and bottom edges are dropped, as the compressor drops an odd
+ * row or column.
+ * @param codeword_array The codewords of the larger image.
+ * @param steps How many times to halve, from 1 to DOWNSCALE_MAX_STEPS.
+ * @return The smaller image's codewords, or NULL (after printing an
+ * error) if it would have no blocks.
+ */
+Codeword_Array *downscale_codewords(const Codeword_Array *codeword_array,
+                                    int steps);
+
+/**
+ * Reads a compressed image and writes it downscaled. Regular files are
+ * mapped and read in place.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ * @param steps How many times to halve.
+ */
+void downscale40(FILE *input, FILE *output, int steps);
+
+#endif /* DOWNSCALE_H */
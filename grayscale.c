@@ -0,0 +1,165 @@
+/* grayscale.c */
+
+#include "grayscale.h"
+#include "quantization.h"
+#include "transform.h"
+#include "bitpack.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pnmrdr.h>
+
+/* Stream layout:
+ *
+ *     "COMP40 Grayscale format 1\n"
+ *     "<width> <height>\n"
+ *     one GRAY_CODEWORD_BYTES codeword per block, row-major
+ */
+#define GRAY_MAGIC_NUMBER "COMP40 Grayscale format 1\n"
+
+/* Helper functions */
+static uint8_t luma_to_sample(float y);
+
+/* Compresses a PGM image, a block row at a time */
+void compress40_gray(FILE *input, FILE *output)
+{
+    assert(input != NULL && output != NULL);
+
+    Pnmrdr_T reader = Pnmrdr_new(input);
+    if (reader == NULL) {
+        fprintf(stderr, "Error: Could not read PGM image.\n");
+        exit(EXIT_FAILURE);
+    }
+    Pnmrdr_mapdata data = Pnmrdr_data(reader);
+    if (data.type != Pnmrdr_gray || data.denominator == 0) {
+        fprintf(stderr, "Error: Input file is not a PGM image.\n");
+        Pnmrdr_free(&reader);
+        exit(EXIT_FAILURE);
+    }
+
+    int blocks_wide = data.width / 2;
+    int blocks_high = data.height / 2;
+    double maxval = data.denominator;
+
+    /* Two rows of luma, and one row of codewords */
+    float *lines = malloc((2 * (size_t)data.width + 1) * sizeof(float));
+    unsigned char *row = malloc((size_t)blocks_wide * GRAY_CODEWORD_BYTES + 1);
+    assert(lines != NULL && row != NULL);
+
+    fprintf(output, "%s%d %d\n", GRAY_MAGIC_NUMBER, blocks_wide * 2,
+            blocks_high * 2);
+    for (int y = 0; y < blocks_high; y++) {
+        for (unsigned x = 0; x < 2 * data.width; x++) {
+            lines[x] = Pnmrdr_get(reader) / maxval;
+        }
+
+        const float *top = lines;
+        const float *bottom = lines + data.width;
+        unsigned char *out = row;
+        for (int x = 0; x < blocks_wide; x++) {
+            Block block = { top[2 * x], top[2 * x + 1],
+                            bottom[2 * x], bottom[2 * x + 1], 0, 0 };
+            DCT_Block coefficients;
+            dct_block(&block, &coefficients);
+
+            uint32_t codeword = 0;
+            codeword = Bitpack_newu(codeword, A_WIDTH, GRAY_A_LSB,
+                                    quantize_a(coefficients.a));
+            codeword = Bitpack_news(codeword, B_WIDTH, GRAY_B_LSB,
+                                    quantize_bcd(coefficients.b));
+            codeword = Bitpack_news(codeword, C_WIDTH, GRAY_C_LSB,
+                                    quantize_bcd(coefficients.c));
+            codeword = Bitpack_news(codeword, D_WIDTH, GRAY_D_LSB,
+                                    quantize_bcd(coefficients.d));
+
+            *out++ = codeword >> 16;
+            *out++ = codeword >> 8;
+            *out++ = codeword;
+        }
+        fwrite(row, GRAY_CODEWORD_BYTES, blocks_wide, output);
+    }
+
+    /* An odd last row is read and dropped so the reader ends at the end */
+    if (data.height % 2 == 1) {
+        for (unsigned x = 0; x < data.width; x++) {
+            Pnmrdr_get(reader);
+        }
+    }
+
+    free(row);
+    free(lines);
+    Pnmrdr_free(&reader);
+}
+
+/* Decompresses a grayscale stream to a P5 PGM, a block row at a time */
+void decompress40_gray(FILE *input, FILE *output)
+{
+    assert(input != NULL && output != NULL);
+
+    char magic_number[256];
+    if (fgets(magic_number, sizeof(magic_number), input) == NULL ||
+        strcmp(magic_number, GRAY_MAGIC_NUMBER) != 0) {
+        fprintf(stderr, "Error: Invalid grayscale image format.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int width, height;
+    if (fscanf(input, "%d %d", &width, &height) != 2 || width < 0 ||
+        height < 0 || fgetc(input) != '\n') {
+        fprintf(stderr, "Error: Could not read grayscale image dimensions.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int blocks_wide = width / 2;
+    unsigned char *row = malloc((size_t)blocks_wide * GRAY_CODEWORD_BYTES + 1);
+    uint8_t *lines = malloc(4 * (size_t)blocks_wide + 1);
+    assert(row != NULL && lines != NULL);
+
+    fprintf(output, "P5\n%d %d\n255\n", blocks_wide * 2, height / 2 * 2);
+    for (int y = 0; y < height / 2; y++) {
+        if (fread(row, GRAY_CODEWORD_BYTES, blocks_wide, input) !=
+            (size_t)blocks_wide) {
+            fprintf(stderr, "Error: Unexpected end of file while reading "
+                    "codewords.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        uint8_t *top = lines;
+        uint8_t *bottom = lines + 2 * blocks_wide;
+        const unsigned char *in = row;
+        for (int x = 0; x < blocks_wide; x++) {
+            uint32_t codeword = (uint32_t)in[0] << 16 |
+                                (uint32_t)in[1] << 8 | in[2];
+            in += GRAY_CODEWORD_BYTES;
+
+            DCT_Block coefficients = {
+                dequantize_a(Bitpack_getu(codeword, A_WIDTH, GRAY_A_LSB)),
+                dequantize_bcd(Bitpack_gets(codeword, B_WIDTH, GRAY_B_LSB)),
+                dequantize_bcd(Bitpack_gets(codeword, C_WIDTH, GRAY_C_LSB)),
+                dequantize_bcd(Bitpack_gets(codeword, D_WIDTH, GRAY_D_LSB)),
+                0, 0
+            };
+            Block block;
+            idct_block(&coefficients, &block);
+
+            top[2 * x] = luma_to_sample(block.y1);
+            top[2 * x + 1] = luma_to_sample(block.y2);
+            bottom[2 * x] = luma_to_sample(block.y3);
+            bottom[2 * x + 1] = luma_to_sample(block.y4);
+        }
+        fwrite(lines, 1, 4 * (size_t)blocks_wide, output);
+    }
+
+    free(lines);
+    free(row);
+}
+
+/* Clamps a luma value to [0, 1] and scales it to a byte, as
+   ypbpr_pixel_to_rgb does for each channel */
+static uint8_t luma_to_sample(float y)
+{
+    if (y < 0.0) y = 0.0;
+    if (y > 1.0) y = 1.0;
+    return (uint8_t)(y * 255.0);
+}
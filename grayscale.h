@@ -0,0 +1,35 @@
+/* grayscale.h */
+
+#ifndef GRAYSCALE_H
+#define GRAYSCALE_H
+
+#include <stdio.h>
+
+/* A grayscale codeword is the luma part of the standard one: a, b, c and
+   d with the same widths and quantization, packed into 24 bits and
+   stored as three big-endian bytes */
+#define GRAY_CODEWORD_BYTES 3
+#define GRAY_A_LSB 15
+#define GRAY_B_LSB 10
+#define GRAY_C_LSB 5
+#define GRAY_D_LSB 0
+
+/* Function Prototypes */
+
+/**
+ * Compresses a PGM image (P2 or P5, any maxval) two rows at a time,
+ * without any colour conversion or chroma averaging. An odd last row or
+ * column is dropped, as for PPM images.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ */
+void compress40_gray(FILE *input, FILE *output);
+
+/**
+ * Decompresses an image written by compress40_gray to an 8-bit P5 PGM.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ */
+void decompress40_gray(FILE *input, FILE *output);
+
+#endif /* GRAYSCALE_H */
@@ -0,0 +1,159 @@
+/* huge_alloc.c */
+
+#include "huge_alloc.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+/* Every buffer starts with a header one cache line long, so what the
+   caller gets stays aligned */
+#define HEADER_SIZE 64
+
+typedef struct {
+    size_t length;    // Of the mapping, or 0 if the buffer is from malloc
+} Header;
+
+/* Counts shared by every thread, updated atomically */
+static size_t mapped_buffers;
+static size_t hugetlb_buffers;
+static size_t mapped_bytes;
+static size_t peak_bytes;
+
+/* Helper functions */
+static void *map_aligned(size_t length);
+
+/* Allocates a buffer, mapping large ones onto huge pages */
+void *huge_alloc(size_t size)
+{
+    if (size < HUGE_PAGE_SIZE - HEADER_SIZE) {
+        Header *header = malloc(HEADER_SIZE + size);
+        if (header == NULL) {
+            return NULL;
+        }
+        header->length = 0;
+        return (unsigned char *)header + HEADER_SIZE;
+    }
+
+    size_t length = (size + HEADER_SIZE + HUGE_PAGE_SIZE - 1) &
+                    ~(HUGE_PAGE_SIZE - 1);
+    bool hugetlb = false;
+    void *base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    /* Fails at once unless the administrator has reserved pages */
+    base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    hugetlb = base != MAP_FAILED;
+#endif
+    if (base == MAP_FAILED) {
+        base = map_aligned(length);
+        if (base == NULL) {
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(base, length, MADV_HUGEPAGE);
+#endif
+    }
+
+    Header *header = base;
+    header->length = length;
+
+    __atomic_add_fetch(&mapped_buffers, 1, __ATOMIC_RELAXED);
+    if (hugetlb) {
+        __atomic_add_fetch(&hugetlb_buffers, 1, __ATOMIC_RELAXED);
+    }
+    size_t now = __atomic_add_fetch(&mapped_bytes, length, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+    while (now > peak &&
+           !__atomic_compare_exchange_n(&peak_bytes, &peak, now, true,
+                                        __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+    }
+
+    return (unsigned char *)base + HEADER_SIZE;
+}
+
+/* Frees a buffer from huge_alloc */
+void huge_free(void *buffer)
+{
+    if (buffer == NULL) {
+        return;
+    }
+
+    Header *header = (Header *)((unsigned char *)buffer - HEADER_SIZE);
+    size_t length = header->length;
+    if (length == 0) {
+        free(header);
+    } else {
+        munmap(header, length);
+        __atomic_sub_fetch(&mapped_bytes, length, __ATOMIC_RELAXED);
+    }
+}
+
+/* Allocates rows as one buffer. The buffer's address is kept in the
+   slot before the first row pointer. */
+void *huge_alloc_rows(int height, size_t row_bytes)
+{
+    assert(height >= 0);
+
+    void **rows = malloc((height + 1) * sizeof(void *));
+    unsigned char *data = huge_alloc((size_t)height * row_bytes);
+    assert(rows != NULL && data != NULL);
+
+    rows[0] = data;
+    for (int y = 0; y < height; y++) {
+        rows[y + 1] = data + y * row_bytes;
+    }
+    return rows + 1;
+}
+
+/* Frees rows from huge_alloc_rows */
+void huge_free_rows(void *rows)
+{
+    if (rows == NULL) {
+        return;
+    }
+
+    void **slots = (void **)rows - 1;
+    huge_free(slots[0]);
+    free(slots);
+}
+
+/* Reports what has been mapped */
+void huge_alloc_stats(Huge_Alloc_Stats *stats)
+{
+    assert(stats != NULL);
+
+    stats->buffers = __atomic_load_n(&mapped_buffers, __ATOMIC_RELAXED);
+    stats->hugetlb_buffers = __atomic_load_n(&hugetlb_buffers,
+                                             __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&peak_bytes, __ATOMIC_RELAXED);
+}
+
+/* Maps length bytes at an address aligned to HUGE_PAGE_SIZE, so that
+   transparent huge pages can back all of it: map more than needed and
+   unmap the ends */
+static void *map_aligned(size_t length)
+{
+    size_t padded = length + HUGE_PAGE_SIZE;
+    unsigned char *raw = mmap(NULL, padded, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+
+    uintptr_t address = (uintptr_t)raw;
+    unsigned char *aligned = raw + ((HUGE_PAGE_SIZE -
+                                     address % HUGE_PAGE_SIZE) %
+                                    HUGE_PAGE_SIZE);
+    size_t head = aligned - raw;
+    size_t tail = padded - head - length;
+    if (head > 0) {
+        munmap(raw, head);
+    }
+    if (tail > 0) {
+        munmap(aligned + length, tail);
+    }
+    return aligned;
+}
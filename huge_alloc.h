@@ -0,0 +1,60 @@
+/* huge_alloc.h */
+
+#ifndef HUGE_ALLOC_H
+#define HUGE_ALLOC_H
+
+#include <stddef.h>
+
+/* Buffers this large or larger are mapped on their own, aligned to and
+   backed by pages of this size where the kernel allows it; smaller ones
+   come from malloc */
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+/* What huge_alloc has mapped, for memory_report */
+typedef struct {
+    size_t buffers;          // Mapped since the program started
+    size_t hugetlb_buffers;  // Of those, on reserved huge pages; the rest
+                             // are advised to use transparent ones
+    size_t peak_bytes;       // Most mapped at once
+} Huge_Alloc_Stats;
+
+/* Function Prototypes */
+
+/**
+ * Allocates a buffer. Large buffers are mapped with MAP_HUGETLB when
+ * huge pages are reserved, and otherwise advised with MADV_HUGEPAGE.
+ * Only the first page is written here, so each of the others is placed
+ * on the NUMA node of the thread that first touches it.
+ * @param size The size in bytes.
+ * @return The buffer, or NULL if there is no memory.
+ */
+void *huge_alloc(size_t size);
+
+/**
+ * Frees a buffer from huge_alloc.
+ * @param buffer The buffer, or NULL.
+ */
+void huge_free(void *buffer);
+
+/**
+ * Allocates rows of equal size as one buffer from huge_alloc, for the
+ * row-pointer arrays of YPbPr_image, Block_Array and DCT_Array.
+ * @param height The number of rows.
+ * @param row_bytes The size of each row.
+ * @return An array of height row pointers; free it with huge_free_rows.
+ */
+void *huge_alloc_rows(int height, size_t row_bytes);
+
+/**
+ * Frees rows from huge_alloc_rows.
+ * @param rows The row pointers, or NULL.
+ */
+void huge_free_rows(void *rows);
+
+/**
+ * Reports what has been mapped so far.
+ * @param stats Pointer to store the counts.
+ */
+void huge_alloc_stats(Huge_Alloc_Stats *stats);
+
+#endif /* HUGE_ALLOC_H */
@@ -0,0 +1,371 @@
+/* image_diff.c */
+
+#include "image_diff.h"
+#include "ppm_reader.h"
+#include "parallel.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+/* Rows read from each image per band; a whole number of SSIM windows */
+#define BAND_ROWS (16 * SSIM_WINDOW)
+
+/* The kernels work on this many floats at a time */
+#define VECTOR_LANES 8
+typedef float Float_Vector
+    __attribute__((vector_size(VECTOR_LANES * sizeof(float))));
+
+/* SSIM stabilizing constants for samples in [0, 1] */
+#define SSIM_C1 (0.01 * 0.01)
+#define SSIM_C2 (0.03 * 0.03)
+
+/* Luma weights, as in color_conversion */
+#define R_WEIGHT 0.299f
+#define G_WEIGHT 0.587f
+#define B_WEIGHT 0.114f
+
+/* One band of both images, and where each thread leaves its sums. Sums
+   are kept per row and per window row and added up in order afterwards,
+   so the result does not depend on the number of threads. */
+typedef struct {
+    const Diff_Options *options;
+    int width;                 // Compared, in pixels
+    int tiles_x;
+    const uint16_t *first;     // rows * 3 * first_width samples
+    const uint16_t *second;
+    int first_width;
+    int second_width;
+    float first_scale;         // 1 / maxval
+    float second_scale;
+    int rows;
+    double *row_error;         // Per row: squared error over the row
+    double *row_tile_error;    // Per row and tile, if there is a map
+    double *window_ssim;       // Per window row: sum of its windows' SSIM
+} Band_Job;
+
+/* Helper functions */
+static void diff_band(void *closure, int index, int thread_count);
+static double squared_error(const float *first, const float *second,
+                            int count);
+static double window_ssim(const float *const *first,
+                          const float *const *second, int x, int width,
+                          int height);
+
+/* Compares two PPM images band by band */
+bool diff_images(FILE *first, FILE *second, const Diff_Options *options,
+                 Image_Diff *diff)
+{
+    assert(first != NULL && second != NULL);
+    assert(options != NULL && diff != NULL && options->tile_size >= 0);
+
+    memset(diff, 0, sizeof(*diff));
+
+    Ppm_Header first_header, second_header;
+    Ppm_Reader first_reader = ppm_reader_new(first, &first_header);
+    Ppm_Reader second_reader = first_reader == NULL
+                               ? NULL
+                               : ppm_reader_new(second, &second_header);
+    if (second_reader == NULL) {
+        ppm_reader_free(&first_reader);
+        return false;
+    }
+    if (abs(first_header.width - second_header.width) > 1 ||
+        abs(first_header.height - second_header.height) > 1) {
+        fprintf(stderr, "Error: Image sizes differ by more than one "
+                "pixel.\n");
+        ppm_reader_free(&first_reader);
+        ppm_reader_free(&second_reader);
+        return false;
+    }
+
+    int width = first_header.width < second_header.width
+                ? first_header.width : second_header.width;
+    int height = first_header.height < second_header.height
+                 ? first_header.height : second_header.height;
+    int tile_size = options->tile_size;
+    diff->width = width;
+    diff->height = height;
+    if (tile_size > 0) {
+        diff->tiles_x = (width + tile_size - 1) / tile_size;
+        diff->tiles_y = (height + tile_size - 1) / tile_size;
+    }
+
+    /* Band buffers, and the per-row sums the threads fill in */
+    int window_rows = BAND_ROWS / SSIM_WINDOW;
+    uint16_t *first_band = malloc((size_t)BAND_ROWS * 3 *
+                                  first_header.width * sizeof(uint16_t) + 1);
+    uint16_t *second_band = malloc((size_t)BAND_ROWS * 3 *
+                                   second_header.width * sizeof(uint16_t) + 1);
+    double *row_error = malloc(BAND_ROWS * sizeof(double));
+    double *row_tile_error = malloc((size_t)BAND_ROWS * (diff->tiles_x + 1) *
+                                    sizeof(double));
+    double *window_sums = malloc(window_rows * sizeof(double));
+    double *tile_error = calloc((size_t)diff->tiles_x * diff->tiles_y + 1,
+                                sizeof(double));
+    assert(first_band != NULL && second_band != NULL && row_error != NULL &&
+           row_tile_error != NULL && window_sums != NULL &&
+           tile_error != NULL);
+
+    Band_Job job = {
+        options, width, diff->tiles_x, first_band, second_band,
+        first_header.width, second_header.width,
+        1.0f / first_header.maxval, 1.0f / second_header.maxval,
+        0, row_error, row_tile_error, window_sums
+    };
+
+    double error = 0;
+    double ssim = 0;
+    bool ok = true;
+    for (int y = 0; y < height && ok; y += BAND_ROWS) {
+        job.rows = height - y < BAND_ROWS ? height - y : BAND_ROWS;
+        ok = ppm_reader_get_rows(first_reader, job.rows, first_band) &&
+             ppm_reader_get_rows(second_reader, job.rows, second_band);
+        if (!ok) {
+            break;
+        }
+
+        int band_window_rows = (job.rows + SSIM_WINDOW - 1) / SSIM_WINDOW;
+        int threads = options->thread_count < band_window_rows
+                      ? options->thread_count : band_window_rows;
+        parallel_run(threads, diff_band, &job);
+
+        for (int row = 0; row < job.rows; row++) {
+            error += row_error[row];
+            for (int tile = 0; tile < diff->tiles_x; tile++) {
+                tile_error[(y + row) / tile_size * diff->tiles_x + tile] +=
+                    row_tile_error[row * diff->tiles_x + tile];
+            }
+        }
+        for (int window_row = 0; window_row < band_window_rows;
+             window_row++) {
+            ssim += window_sums[window_row];
+        }
+    }
+
+    if (ok) {
+        double samples = 3.0 * width * height;
+        diff->rms = samples > 0 ? sqrt(error / samples) : 0;
+        diff->psnr = diff->rms > 0 ? -20 * log10(diff->rms) : INFINITY;
+
+        long long windows = (long long)((width + SSIM_WINDOW - 1) /
+                                        SSIM_WINDOW) *
+                            ((height + SSIM_WINDOW - 1) / SSIM_WINDOW);
+        diff->ssim = windows > 0 ? ssim / windows : 1;
+
+        if (tile_size > 0) {
+            diff->tile_rms = tile_error;
+            tile_error = NULL;
+            for (int ty = 0; ty < diff->tiles_y; ty++) {
+                int tile_height = height - ty * tile_size < tile_size
+                                  ? height - ty * tile_size : tile_size;
+                for (int tx = 0; tx < diff->tiles_x; tx++) {
+                    int tile_width = width - tx * tile_size < tile_size
+                                     ? width - tx * tile_size : tile_size;
+                    double *tile = &diff->tile_rms[ty * diff->tiles_x + tx];
+                    *tile = sqrt(*tile / (3.0 * tile_width * tile_height));
+                }
+            }
+        }
+    }
+
+    free(tile_error);
+    free(window_sums);
+    free(row_tile_error);
+    free(row_error);
+    free(second_band);
+    free(first_band);
+    ppm_reader_free(&first_reader);
+    ppm_reader_free(&second_reader);
+    return ok;
+}
+
+/* Frees a result */
+void free_image_diff(Image_Diff *diff)
+{
+    assert(diff != NULL);
+
+    free(diff->tile_rms);
+    diff->tile_rms = NULL;
+}
+
+/* Writes the error map as a 16-bit PGM */
+void write_error_map(FILE *output, const Image_Diff *diff)
+{
+    assert(output != NULL && diff != NULL);
+    assert(diff->tile_rms != NULL || diff->tiles_x * diff->tiles_y == 0);
+
+    fprintf(output, "P5\n%d %d\n65535\n", diff->tiles_x, diff->tiles_y);
+    for (int i = 0; i < diff->tiles_x * diff->tiles_y; i++) {
+        double rms = diff->tile_rms[i] < 1 ? diff->tile_rms[i] : 1;
+        unsigned value = (unsigned)round(rms * 65535);
+        putc(value >> 8, output);
+        putc(value & 0xFF, output);
+    }
+}
+
+/* Computes the sums for this thread's share of a band's window rows */
+static void diff_band(void *closure, int index, int thread_count)
+{
+    Band_Job *job = closure;
+    int width = job->width;
+    int tile_size = job->options->tile_size;
+    bool ssim = job->options->ssim;
+
+    long long start, end;
+    int window_rows = (job->rows + SSIM_WINDOW - 1) / SSIM_WINDOW;
+    parallel_split(window_rows, index, thread_count, &start, &end);
+
+    /* Scaled samples of the current row, and luma of a window row */
+    float *first = malloc((3 * (size_t)width + 1) * sizeof(float));
+    float *second = malloc((3 * (size_t)width + 1) * sizeof(float));
+    float *luma = malloc((2 * SSIM_WINDOW * (size_t)width + 1) *
+                         sizeof(float));
+    assert(first != NULL && second != NULL && luma != NULL);
+
+    const float *first_luma[SSIM_WINDOW];
+    const float *second_luma[SSIM_WINDOW];
+
+    for (long long window_row = start; window_row < end; window_row++) {
+        int top = window_row * SSIM_WINDOW;
+        int height = job->rows - top < SSIM_WINDOW ? job->rows - top
+                                                   : SSIM_WINDOW;
+
+        for (int i = 0; i < height; i++) {
+            int row = top + i;
+            const uint16_t *first_in = job->first +
+                                       (size_t)row * 3 * job->first_width;
+            const uint16_t *second_in = job->second +
+                                        (size_t)row * 3 * job->second_width;
+            for (int s = 0; s < 3 * width; s++) {
+                first[s] = first_in[s] * job->first_scale;
+                second[s] = second_in[s] * job->second_scale;
+            }
+
+            /* Squared error, split by tile if there is a map */
+            if (tile_size > 0) {
+                double *tiles = job->row_tile_error + (size_t)row * job->tiles_x;
+                double total = 0;
+                for (int tile = 0; tile < job->tiles_x; tile++) {
+                    int x = tile * tile_size;
+                    int count = width - x < tile_size ? width - x : tile_size;
+                    tiles[tile] = squared_error(first + 3 * x, second + 3 * x,
+                                                3 * count);
+                    total += tiles[tile];
+                }
+                job->row_error[row] = total;
+            } else {
+                job->row_error[row] = squared_error(first, second, 3 * width);
+            }
+
+            if (ssim) {
+                float *first_row = luma + (size_t)(2 * i) * width;
+                float *second_row = first_row + width;
+                for (int x = 0; x < width; x++) {
+                    first_row[x] = R_WEIGHT * first[3 * x] +
+                                   G_WEIGHT * first[3 * x + 1] +
+                                   B_WEIGHT * first[3 * x + 2];
+                    second_row[x] = R_WEIGHT * second[3 * x] +
+                                    G_WEIGHT * second[3 * x + 1] +
+                                    B_WEIGHT * second[3 * x + 2];
+                }
+                first_luma[i] = first_row;
+                second_luma[i] = second_row;
+            }
+        }
+
+        double sum = 0;
+        if (ssim) {
+            for (int x = 0; x < width; x += SSIM_WINDOW) {
+                int window_width = width - x < SSIM_WINDOW ? width - x
+                                                           : SSIM_WINDOW;
+                sum += window_ssim(first_luma, second_luma, x, window_width,
+                                   height);
+            }
+        }
+        job->window_ssim[window_row] = sum;
+    }
+
+    free(luma);
+    free(second);
+    free(first);
+}
+
+/* Returns the sum of squared differences of two runs of samples */
+static double squared_error(const float *first, const float *second,
+                            int count)
+{
+    Float_Vector sum = { 0 };
+    int i = 0;
+    for (; i + VECTOR_LANES <= count; i += VECTOR_LANES) {
+        Float_Vector a, b;
+        memcpy(&a, first + i, sizeof(a));
+        memcpy(&b, second + i, sizeof(b));
+        Float_Vector difference = a - b;
+        sum += difference * difference;
+    }
+
+    double total = 0;
+    for (int lane = 0; lane < VECTOR_LANES; lane++) {
+        total += sum[lane];
+    }
+    for (; i < count; i++) {
+        double difference = first[i] - second[i];
+        total += difference * difference;
+    }
+    return total;
+}
+
+/* Returns the SSIM of the window of luma starting at column x */
+static double window_ssim(const float *const *first,
+                          const float *const *second, int x, int width,
+                          int height)
+{
+    double sum_a = 0, sum_b = 0, sum_aa = 0, sum_bb = 0, sum_ab = 0;
+
+    if (width == VECTOR_LANES) {
+        Float_Vector a_sum = { 0 }, b_sum = { 0 };
+        Float_Vector aa_sum = { 0 }, bb_sum = { 0 }, ab_sum = { 0 };
+        for (int row = 0; row < height; row++) {
+            Float_Vector a, b;
+            memcpy(&a, first[row] + x, sizeof(a));
+            memcpy(&b, second[row] + x, sizeof(b));
+            a_sum += a;
+            b_sum += b;
+            aa_sum += a * a;
+            bb_sum += b * b;
+            ab_sum += a * b;
+        }
+        for (int lane = 0; lane < VECTOR_LANES; lane++) {
+            sum_a += a_sum[lane];
+            sum_b += b_sum[lane];
+            sum_aa += aa_sum[lane];
+            sum_bb += bb_sum[lane];
+            sum_ab += ab_sum[lane];
+        }
+    } else {
+        for (int row = 0; row < height; row++) {
+            for (int column = x; column < x + width; column++) {
+                double a = first[row][column];
+                double b = second[row][column];
+                sum_a += a;
+                sum_b += b;
+                sum_aa += a * a;
+                sum_bb += b * b;
+                sum_ab += a * b;
+            }
+        }
+    }
+
+    double n = (double)width * height;
+    double mean_a = sum_a / n;
+    double mean_b = sum_b / n;
+    double variance_a = sum_aa / n - mean_a * mean_a;
+    double variance_b = sum_bb / n - mean_b * mean_b;
+    double covariance = sum_ab / n - mean_a * mean_b;
+
+    return (2 * mean_a * mean_b + SSIM_C1) * (2 * covariance + SSIM_C2) /
+           ((mean_a * mean_a + mean_b * mean_b + SSIM_C1) *
+            (variance_a + variance_b + SSIM_C2));
+}
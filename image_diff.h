@@ -0,0 +1,63 @@
+/* image_diff.h */
+
+#ifndef IMAGE_DIFF_H
+#define IMAGE_DIFF_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Side of the windows SSIM is computed over, in pixels */
+#define SSIM_WINDOW 8
+
+/* What to compute besides the RMS difference */
+typedef struct {
+    bool ssim;         // Mean SSIM of luma over SSIM_WINDOW windows
+    int tile_size;     // Side of the tiles of the error map; 0 for none
+    int thread_count;
+} Diff_Options;
+
+/* How much two images differ. Samples are scaled to [0, 1] by each
+   image's maxval before they are compared. */
+typedef struct {
+    int width;         // Of the region compared: the smaller of the two
+    int height;
+    double rms;        // Root mean square over every sample
+    double psnr;       // In dB; infinite if the images are equal
+    double ssim;       // Only if asked for
+    int tiles_x;       // Error map, if asked for: RMS of each tile,
+    int tiles_y;       // row-major
+    double *tile_rms;
+} Image_Diff;
+
+/* Function Prototypes */
+
+/**
+ * Compares two PPM images, reading both a band of rows at a time and
+ * spreading each band over threads. Images whose sizes differ by one
+ * pixel, as dropping an odd edge leaves them, are compared over the
+ * region they share.
+ * @param first The first image.
+ * @param second The second image.
+ * @param options What to compute.
+ * @param diff Where to store the result; free it with free_image_diff.
+ * @return true on success, false (after printing an error) if either
+ * input is not a PPM image or the sizes differ by more than one.
+ */
+bool diff_images(FILE *first, FILE *second, const Diff_Options *options,
+                 Image_Diff *diff);
+
+/**
+ * Frees what diff_images allocated for a result.
+ * @param diff The result.
+ */
+void free_image_diff(Image_Diff *diff);
+
+/**
+ * Writes an error map as a 16-bit PGM, one pixel per tile, whose value
+ * is the tile's RMS scaled to 65535.
+ * @param output The output file pointer.
+ * @param diff A result computed with a tile size.
+ */
+void write_error_map(FILE *output, const Image_Diff *diff);
+
+#endif /* IMAGE_DIFF_H */
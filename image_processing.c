@@ -4,39 +4,40 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <pnm.h>
-#include <pnmrdr.h>
-#include <ctype.h>
+#include "ppm_reader.h"
+#include "parallel.h"
+#include "huge_alloc.h"
 
 /* Constants */
 #define MAX_COLOR_VALUE 255
 #define COMPRESSED_MAGIC_NUMBER "COMP40 Compressed image format 2\n"
 
-/* Function Prototypes */
-static void skip_whitespace(FILE *input);
-
 /* Reads a PPM image from the input file */
 Image *read_image(FILE *input)
 {
     assert(input != NULL);
 
-    /* Use the Pnmrdr library to read the PPM image */
-    Pnmrdr_T reader = Pnmrdr_new(input);
+    /* Read the whole raster at once so a plain one is parsed across
+       threads rather than a sample at a time */
+    Ppm_Header header;
+    Ppm_Reader reader = ppm_reader_new(input, &header);
     if (reader == NULL) {
-        fprintf(stderr, "Error: Could not read PPM image.\n");
         return NULL;
     }
 
-    Pnmrdr_mapdata data = Pnmrdr_data(reader);
-    if (data.type != Pnmrdr_rgb) {
-        fprintf(stderr, "Error: Input file is not a PPM image.\n");
-        Pnmrdr_free(&reader);
+    int width = header.width;
+    int height = header.height;
+    uint16_t *samples = huge_alloc((size_t)3 * width * height *
+                                   sizeof(uint16_t));
+    assert(samples != NULL);
+    bool read = ppm_reader_get_all(reader, samples,
+                                   parallel_default_threads());
+    ppm_reader_free(&reader);
+    if (!read) {
+        huge_free(samples);
         return NULL;
     }
 
-    int width = data.width;
-    int height = data.height;
-
     /* Allocate memory for the Image structure */
     Image *image = malloc(sizeof(Image));
     assert(image != NULL);
@@ -53,70 +54,78 @@ Image *read_image(FILE *input)
         assert(image->pixels[i] != NULL);
     }
 
-  /* Read pixel data */
+    /* Store pixel data, scaled to MAX_COLOR_VALUE if the image uses
+       another maxval */
+    unsigned maxval = header.maxval;
+    const uint16_t *sample = samples;
     for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            skip_whitespace(input);
-            unsigned int red = Pnmrdr_get(reader);
-            skip_whitespace(input);
-            unsigned int green = Pnmrdr_get(reader);
-            skip_whitespace(input);
-            unsigned int blue = Pnmrdr_get(reader);
-
-            image->pixels[y][x].red = red;
-            image->pixels[y][x].green = green;
-            image->pixels[y][x].blue = blue;
+        for (int x = 0; x < width; x++, sample += 3) {
+            Pixel *pixel = &image->pixels[y][x];
+            if (maxval == MAX_COLOR_VALUE) {
+                pixel->red = sample[0];
+                pixel->green = sample[1];
+                pixel->blue = sample[2];
+            } else {
+                pixel->red = (sample[0] * MAX_COLOR_VALUE + maxval / 2) /
+                             maxval;
+                pixel->green = (sample[1] * MAX_COLOR_VALUE + maxval / 2) /
+                               maxval;
+                pixel->blue = (sample[2] * MAX_COLOR_VALUE + maxval / 2) /
+                              maxval;
+            }
         }
     }
 
-    Pnmrdr_free(&reader);
+    huge_free(samples);
     return image;
 }
 
-/* Trims the image to have even dimensions */
-Image *trim_image(Image *image)
+/* Returns a view of a whole image */
+Image_View image_view(Image *image)
 {
     assert(image != NULL);
 
-    int width = image->width;
-    int height = image->height;
+    Image_View view = { image->pixels, 0, image->width, image->height,
+                        image->width, image->height };
+    return view;
+}
 
-    /* Calculate new dimensions */
-    int new_width = (width % 2 == 0) ? width : width - 1;
-    int new_height = (height % 2 == 0) ? height : height - 1;
+/* Returns a view of part of another view */
+Image_View crop_view(Image_View view, int x, int y, int width, int height)
+{
+    assert(x >= 0 && y >= 0 && width >= 0 && height >= 0);
+    assert(x + width <= view.width && y + height <= view.height);
 
-    if (new_width == width && new_height == height) {
-        /* Dimensions are already even, return the original image */
-        return image;
+    if (width == 0 || height == 0) {
+        Image_View empty = { view.rows, view.x, width, height, 0, 0 };
+        return empty;
     }
 
-    /* Create a new image with trimmed dimensions */
-    Image *trimmed_image = malloc(sizeof(Image));
-    assert(trimmed_image != NULL);
-
-    trimmed_image->width = new_width;
-    trimmed_image->height = new_height;
-
-    /* Allocate memory for the pixel array */
-    trimmed_image->pixels = malloc(new_height * sizeof(Pixel *));
-    assert(trimmed_image->pixels != NULL);
-
-    for (int i = 0; i < new_height; i++) {
-        trimmed_image->pixels[i] = malloc(new_width * sizeof(Pixel));
-        assert(trimmed_image->pixels[i] != NULL);
-    }
+    /* A crop that starts in the padding starts at the last real row or
+       column, which it then repeats */
+    int top = y < view.pixels_high ? y : view.pixels_high - 1;
+    int left = x < view.pixels_wide ? x : view.pixels_wide - 1;
+    int pixels_high = view.pixels_high - top;
+    int pixels_wide = view.pixels_wide - left;
+
+    Image_View cropped = {
+        view.rows + top, view.x + left, width, height,
+        pixels_wide < width ? pixels_wide : width,
+        pixels_high < height ? pixels_high : height
+    };
+    return cropped;
+}
 
-    /* Copy pixel data */
-    for (int y = 0; y < new_height; y++) {
-        for (int x = 0; x < new_width; x++) {
-            trimmed_image->pixels[y][x] = image->pixels[y][x];
-        }
+/* Returns a view with even dimensions */
+Image_View even_view(Image_View view, Edge_Mode mode)
+{
+    if (mode == EDGE_DROP) {
+        return crop_view(view, 0, 0, view.width & ~1, view.height & ~1);
     }
 
-    /* Free the original image */
-    free_image(image);
-
-    return trimmed_image;
+    view.width += view.width & 1;
+    view.height += view.height & 1;
+    return view;
 }
 
 /* Frees the memory allocated for the Image */
@@ -133,76 +142,72 @@ void free_image(Image *image)
     free(image);
 }
 
-/* Reads the compressed image header and codewords */
-uint32_t *read_compressed_image(FILE *input, int *width, int *height, int *codeword_count)
+/* Reads and validates the compressed image header */
+bool read_compressed_header(FILE *input, int *width, int *height)
 {
     assert(input != NULL);
     assert(width != NULL);
     assert(height != NULL);
-    assert(codeword_count != NULL);
 
     /* Read and validate the magic number */
     char magic_number[256];
     if (fgets(magic_number, sizeof(magic_number), input) == NULL) {
         fprintf(stderr, "Error: Could not read compressed image magic number.\n");
-        return NULL;
+        return false;
     }
 
     if (strcmp(magic_number, COMPRESSED_MAGIC_NUMBER) != 0) {
         fprintf(stderr, "Error: Invalid compressed image format.\n");
-        return NULL;
+        return false;
     }
 
     /* Read the image width and height */
     int read_items = fscanf(input, "%d %d", width, height);
-    if (read_items != 2) {
+    if (read_items != 2 || *width < 0 || *height < 0) {
         fprintf(stderr, "Error: Could not read compressed image dimensions.\n");
-        return NULL;
+        return false;
     }
 
-    /* Consume the newline character after dimensions */
+    /* Consume the newline character after dimensions; the codewords
+       follow immediately, so no further whitespace may be skipped */
     int c = fgetc(input);
     if (c != '\n') {
         ungetc(c, input);
     }
 
-    /* Skip any additional whitespace */
-    skip_whitespace(input);
+    return true;
+}
+
+/* Reads the compressed image header and codewords */
+uint32_t *read_compressed_image(FILE *input, int *width, int *height, int *codeword_count)
+{
+    assert(codeword_count != NULL);
+
+    if (!read_compressed_header(input, width, height)) {
+        return NULL;
+    }
 
     /* Calculate the number of codewords */
-    int num_codewords = (*width * *height) / 4;
+    int num_codewords = (*width / 2) * (*height / 2);
     *codeword_count = num_codewords;
 
     /* Allocate memory for the codewords */
     uint32_t *codewords = malloc(num_codewords * sizeof(uint32_t));
     assert(codewords != NULL);
 
-    /* Read codewords in big-endian order */
+    /* Read the codewords in one go, then convert from big-endian order */
+    size_t words_read = fread(codewords, sizeof(uint32_t), num_codewords, input);
+    if (words_read != (size_t)num_codewords) {
+        fprintf(stderr, "Error: Unexpected end of file while reading codewords.\n");
+        free(codewords);
+        return NULL;
+    }
+
     for (int i = 0; i < num_codewords; i++) {
-        uint32_t codeword = 0;
-        for (int j = 0; j < 4; j++) {
-            int byte = fgetc(input);
-            if (byte == EOF) {
-                fprintf(stderr, "Error: Unexpected end of file while reading codewords.\n");
-                free(codewords);
-                return NULL;
-            }
-            codeword = (codeword << 8) | (uint8_t)byte;
-        }
-        codewords[i] = codeword;
+        const uint8_t *bytes = (const uint8_t *)&codewords[i];
+        codewords[i] = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+                       (uint32_t)bytes[2] << 8 | (uint32_t)bytes[3];
     }
 
     return codewords;
 }
-
-/* Helper function to skip whitespace characters */
-static void skip_whitespace(FILE *input)
-{
-    int c;
-    while ((c = fgetc(input)) != EOF) {
-        if (!isspace(c)) {
-            ungetc(c, input);
-            break;
-        }
-    }
-}
@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 /* Structure to represent an RGB pixel */
 typedef struct {
@@ -20,22 +21,61 @@ typedef struct {
     Pixel **pixels;
 } Image;
 
+/* A rectangle of an image's pixels, read in place rather than copied.
+   Rows and columns past the pixels that exist repeat the last one, which
+   is how a view is padded without copying. */
+typedef struct {
+    Pixel *const *rows;  // Row pointers of the image, from the view's top
+    int x;               // Left column of the view within each row
+    int width;           // Size of the view, padding included
+    int height;
+    int pixels_wide;     // Columns that exist from x on
+    int pixels_high;     // Rows that exist from the top on
+} Image_View;
+
+/* What even_view does with an odd last row or column */
+typedef enum {
+    EDGE_DROP,       // Leave it out, as the course spec asks
+    EDGE_REPLICATE   // Keep it, and pad with a copy of it
+} Edge_Mode;
+
 /* Function Prototypes */
 
 /**
- * Reads a PPM image from the input file.
+ * Reads a P3 or P6 image from the input file, parsing a plain raster
+ * across threads. Samples are scaled to 255 if the maxval differs.
  * @param input The input file pointer.
- * @return A pointer to the Image struct containing image data.
+ * @return A pointer to the Image struct containing image data, or NULL
+ * (after printing an error) if the input is not a PPM image.
  */
 Image *read_image(FILE *input);
 
 /**
- * Trims the image to have even width and height by removing
- * the last row and/or column if necessary.
- * @param image The original Image pointer.
- * @return A new Image pointer with even dimensions.
+ * Returns a view of a whole image. The image must outlive the view.
+ * @param image The image.
+ * @return The view.
+ */
+Image_View image_view(Image *image);
+
+/**
+ * Returns a view of part of another view, in constant time.
+ * @param view The view.
+ * @param x The left column, within the view.
+ * @param y The top row, within the view.
+ * @param width The width, which must fit within the view.
+ * @param height The height, which must fit within the view.
+ * @return The smaller view.
+ */
+Image_View crop_view(Image_View view, int x, int y, int width, int height);
+
+/**
+ * Returns a view with even width and height, in constant time, by
+ * dropping or replicating an odd last row and column.
+ * @param view The view.
+ * @param mode What to do with an odd last row or column.
+ * @return The even view.
  */
-Image *trim_image(Image *image);
+Image_View even_view(Image_View view, Edge_Mode mode);
 
 /**
  * Frees the memory allocated for the Image.
@@ -43,6 +83,16 @@ Image *trim_image(Image *image);
  */
 void free_image(Image *image);
 
+/**
+ * Reads and validates the compressed image header, leaving the input
+ * positioned at the first codeword.
+ * @param input The input file pointer.
+ * @param width Pointer to store the image width.
+ * @param height Pointer to store the image height.
+ * @return true on success, false if the header is invalid.
+ */
+bool read_compressed_header(FILE *input, int *width, int *height);
+
 /**
  * Reads the compressed image from the input file, including the header and codewords.
  * @param input The input file pointer.
@@ -9,31 +9,146 @@
 #include <stdint.h>
 #include <string.h>
 #include <pnm.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* Magic number for the compressed image format */
 #define COMPRESSED_MAGIC_NUMBER "COMP40 Compressed image format 2\n"
 
-/* Writes the compressed image data to the output file */
-void write_compressed_image(FILE *output, Codeword_Array *codeword_array, int width, int height)
+/* Number of codewords staged before each fwrite */
+#define WRITE_BUFFER_WORDS 4096
+
+/* Helper functions */
+static void copy_pixel(int col, int row, UArray2_T array2, void *elem,
+                       void *cl);
+
+/* Writes the compressed image header */
+void write_compressed_header(FILE *output, int width, int height)
 {
     assert(output != NULL);
-    assert(codeword_array != NULL);
 
     /* Write the magic number */
     fprintf(output, "%s", COMPRESSED_MAGIC_NUMBER);
 
     /* Write the dimensions */
     fprintf(output, "%d %d\n", width, height);
+}
+
+/* Returns the number of bytes write_compressed_header writes */
+size_t compressed_header_length(int width, int height)
+{
+    return strlen(COMPRESSED_MAGIC_NUMBER) + snprintf(NULL, 0, "%d %d\n", width, height);
+}
+
+/* Writes the compressed image data to the output file */
+void write_compressed_image(FILE *output, Codeword_Array *codeword_array, int width, int height)
+{
+    assert(output != NULL);
+    assert(codeword_array != NULL);
+
+    write_compressed_header(output, width, height);
 
-    /* Write the codewords in big-endian order */
+    /* Write the codewords in big-endian order, a buffer at a time */
+    unsigned char buffer[WRITE_BUFFER_WORDS * 4];
     int num_codewords = codeword_array->count;
-    for (int i = 0; i < num_codewords; i++) {
-        uint32_t codeword = codeword_array->words[i];
+    for (int start = 0; start < num_codewords; start += WRITE_BUFFER_WORDS) {
+        int end = start + WRITE_BUFFER_WORDS;
+        if (end > num_codewords) {
+            end = num_codewords;
+        }
+
+        unsigned char *out = buffer;
+        for (int i = start; i < end; i++) {
+            uint32_t codeword = codeword_array->words[i];
 
-        /* Write each byte in big-endian order */
-        for (int byte = 3; byte >= 0; byte--) {
-            fputc((codeword >> (byte * 8)) & 0xFF, output);
+            /* Write each byte in big-endian order */
+            for (int byte = 3; byte >= 0; byte--) {
+                *out++ = (codeword >> (byte * 8)) & 0xFF;
+            }
         }
+        fwrite(buffer, 1, out - buffer, output);
+    }
+}
+
+/* Reads a compressed image into a Codeword_Array */
+Codeword_Array *read_codeword_array(FILE *input)
+{
+    int width, height, codeword_count;
+
+    uint32_t *codewords = read_compressed_image(input, &width, &height, &codeword_count);
+    if (codewords == NULL) {
+        return NULL;
+    }
+
+    Codeword_Array *codeword_array = malloc(sizeof(Codeword_Array));
+    assert(codeword_array != NULL);
+    codeword_array->count = codeword_count;
+    codeword_array->width = width / 2;
+    codeword_array->height = height / 2;
+    codeword_array->words = codewords;
+
+    return codeword_array;
+}
+
+/* Returns true if the file is a regular file */
+bool is_regular_file(FILE *input)
+{
+    assert(input != NULL);
+
+    struct stat st;
+    return fstat(fileno(input), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/* Maps a compressed image held in a regular file */
+bool map_compressed_image(FILE *input, Mapped_Compressed_Image *mapped)
+{
+    assert(input != NULL);
+    assert(mapped != NULL);
+
+    int width, height;
+    if (!read_compressed_header(input, &width, &height)) {
+        return false;
+    }
+
+    struct stat st;
+    off_t data_offset = ftello(input);
+    if (fstat(fileno(input), &st) != 0 || data_offset < 0) {
+        fprintf(stderr, "Error: Could not map compressed image.\n");
+        return false;
+    }
+
+    size_t data_bytes = (size_t)(width / 2) * (height / 2) * sizeof(uint32_t);
+    if ((size_t)st.st_size < (size_t)data_offset + data_bytes) {
+        fprintf(stderr, "Error: Unexpected end of file while reading codewords.\n");
+        return false;
+    }
+
+    /* Map the whole file so the mapping starts on a page boundary; an
+       empty image still maps its header */
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(input), 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Could not map compressed image.\n");
+        return false;
+    }
+
+    mapped->width = width;
+    mapped->height = height;
+    mapped->map = map;
+    mapped->map_length = st.st_size;
+    mapped->codewords = (const unsigned char *)map + data_offset;
+
+    return true;
+}
+
+/* Releases a mapping made by map_compressed_image */
+void unmap_compressed_image(Mapped_Compressed_Image *mapped)
+{
+    assert(mapped != NULL);
+
+    if (mapped->map != NULL) {
+        munmap(mapped->map, mapped->map_length);
+        mapped->map = NULL;
+        mapped->codewords = NULL;
     }
 }
 
@@ -55,17 +170,9 @@ void write_image(FILE *output, Image *image)
     pixmap->pixels = UArray2_new(pixmap->width, pixmap->height, sizeof(struct Pnm_rgb));
     assert(pixmap->pixels != NULL);
 
-    /* Copy pixel data */
-    for (size_t y = 0; y < pixmap->height; y++) {
-        for (size_t x = 0; x < pixmap->width; x++) {
-            struct Pnm_rgb *pixel = UArray2_at(pixmap->pixels, x, y);
-            Pixel img_pixel = image->pixels[y][x];
-
-            pixel->red = img_pixel.red;
-            pixel->green = img_pixel.green;
-            pixel->blue = img_pixel.blue;
-        }
-    }
+    /* Copy pixel data in storage order, so the copy needs no per-pixel
+       indexing or checks */
+    UArray2_map_row_major(pixmap->pixels, copy_pixel, image);
 
     /* Write the PPM image to the output file */
     Pnm_ppmwrite(output, pixmap);
@@ -73,3 +180,18 @@ void write_image(FILE *output, Image *image)
     /* Free the Pnm_ppm structure */
     Pnm_ppmfree(&pixmap);
 }
+
+/* Helper function implementations */
+
+/* Copies one pixel of an Image into its place in a Pnm_ppm */
+static void copy_pixel(int col, int row, UArray2_T array2, void *elem,
+                       void *cl)
+{
+    const Image *image = cl;
+    const Pixel *in = &image->pixels[row][col];
+    struct Pnm_rgb *out = elem;
+    (void)array2;
+    out->red = in->red;
+    out->green = in->green;
+    out->blue = in->blue;
+}
@@ -5,6 +5,45 @@
 
 #include "quantization.h"  // For Codeword_Array
 #include "image_processing.h"  // For Image
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A compressed image file mapped into memory so that its codewords can
+   be read in place */
+typedef struct {
+    int width;                       // Image width in pixels
+    int height;                      // Image height in pixels
+    const unsigned char *codewords;  // First codeword, big-endian
+    void *map;                       // Start of the mapping
+    size_t map_length;               // Length of the mapping
+} Mapped_Compressed_Image;
+
+/**
+ * Returns the codeword stored big-endian at bytes.
+ * @param bytes Pointer to the first of four bytes.
+ * @return The codeword.
+ */
+static inline uint32_t load_codeword(const unsigned char *bytes)
+{
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 |
+           (uint32_t)bytes[2] << 8 | (uint32_t)bytes[3];
+}
+
+/**
+ * Writes the compressed image header (magic number and dimensions).
+ * @param output The output file pointer.
+ * @param width The width of the original image.
+ * @param height The height of the original image.
+ */
+void write_compressed_header(FILE *output, int width, int height);
+
+/**
+ * Returns the number of bytes write_compressed_header writes.
+ * @param width The width of the original image.
+ * @param height The height of the original image.
+ * @return The header length.
+ */
+size_t compressed_header_length(int width, int height);
 
 /**
  * Writes the compressed image data to the output file.
@@ -15,6 +54,38 @@
  */
 void write_compressed_image(FILE *output, Codeword_Array *codeword_array, int width, int height);
 
+/**
+ * Reads a compressed image into a Codeword_Array whose width and height
+ * are given in blocks.
+ * @param input The input file pointer.
+ * @return A pointer to the Codeword_Array, or NULL if the input is invalid.
+ */
+Codeword_Array *read_codeword_array(FILE *input);
+
+/**
+ * Returns true if the file is a regular file, which can be mapped and
+ * read at arbitrary offsets (unlike a pipe or terminal).
+ * @param input The file pointer.
+ * @return true if the file is a regular file.
+ */
+bool is_regular_file(FILE *input);
+
+/**
+ * Maps a compressed image held in a regular file. The header is parsed
+ * through input, which must not have been read from yet.
+ * @param input The input file pointer.
+ * @param mapped Pointer to the structure to fill in.
+ * @return true on success, false (after printing an error) if the file
+ * is not a valid compressed image.
+ */
+bool map_compressed_image(FILE *input, Mapped_Compressed_Image *mapped);
+
+/**
+ * Releases a mapping made by map_compressed_image.
+ * @param mapped The mapped image.
+ */
+void unmap_compressed_image(Mapped_Compressed_Image *mapped);
+
 /**
  * Writes the Image data to the output file in PPM format.
  * @param output The output file pointer.
@@ -0,0 +1,160 @@
+/* memory_report.c */
+
+#include "memory_report.h"
+#include "huge_alloc.h"
+#include "numa.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+/* Built without counters where the system headers do not know them */
+#if defined(__linux__) && defined(__NR_perf_event_open)
+#include <linux/perf_event.h>
+#define HAVE_PERF_EVENTS 1
+#endif
+
+/* What is counted, in the order it is printed. On the CPUs perf knows,
+   node loads are loads served from memory and node load misses are
+   those served from another node's. */
+enum {
+    DTLB_LOADS,
+    DTLB_LOAD_MISSES,
+    NODE_LOADS,
+    NODE_LOAD_MISSES,
+    COUNTER_COUNT
+};
+
+struct Memory_Report {
+    int fds[COUNTER_COUNT];     // -1 where a counter is unavailable
+};
+
+/* Helper functions */
+static int open_counter(int counter);
+static void print_counter(FILE *output, const char *name, int fd,
+                          long long *value);
+
+/* Starts counting */
+Memory_Report memory_report_start(void)
+{
+    Memory_Report report = malloc(sizeof(*report));
+    assert(report != NULL);
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        report->fds[i] = open_counter(i);
+    }
+#ifdef HAVE_PERF_EVENTS
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (report->fds[i] >= 0) {
+            ioctl(report->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+
+    return report;
+}
+
+/* Stops counting and prints the report */
+void memory_report_finish(Memory_Report *report, FILE *output)
+{
+    assert(report != NULL && *report != NULL && output != NULL);
+
+    Memory_Report self = *report;
+#ifdef HAVE_PERF_EVENTS
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (self->fds[i] >= 0) {
+            ioctl(self->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+#endif
+
+    fprintf(output, "%-17s %d, threads %s\n", "numa nodes",
+            numa_node_count(),
+            numa_pinning() ? "pinned to their node" : "not pinned");
+
+    Huge_Alloc_Stats stats;
+    huge_alloc_stats(&stats);
+    fprintf(output, "%-17s %zu, %zu on reserved huge pages, peak %.1f MB\n",
+            "large buffers", stats.buffers, stats.hugetlb_buffers,
+            stats.peak_bytes / (1024.0 * 1024.0));
+
+    long long values[COUNTER_COUNT];
+    print_counter(output, "dtlb loads", self->fds[DTLB_LOADS],
+                  &values[DTLB_LOADS]);
+    print_counter(output, "dtlb load misses", self->fds[DTLB_LOAD_MISSES],
+                  &values[DTLB_LOAD_MISSES]);
+    if (values[DTLB_LOADS] > 0 && values[DTLB_LOAD_MISSES] >= 0) {
+        fprintf(output, "%-17s %.3f%%\n", "dtlb miss rate",
+                100.0 * values[DTLB_LOAD_MISSES] / values[DTLB_LOADS]);
+    }
+    print_counter(output, "node loads", self->fds[NODE_LOADS],
+                  &values[NODE_LOADS]);
+    print_counter(output, "remote loads", self->fds[NODE_LOAD_MISSES],
+                  &values[NODE_LOAD_MISSES]);
+    if (values[NODE_LOADS] > 0 && values[NODE_LOAD_MISSES] >= 0) {
+        fprintf(output, "%-17s %.2f%%\n", "remote share",
+                100.0 * values[NODE_LOAD_MISSES] / values[NODE_LOADS]);
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (self->fds[i] >= 0) {
+            close(self->fds[i]);
+        }
+    }
+    free(self);
+    *report = NULL;
+}
+
+/* Opens one counter for this thread and the threads it starts later,
+   disabled until memory_report_start enables it; returns -1 if the
+   kernel or CPU does not offer it */
+static int open_counter(int counter)
+{
+#ifdef HAVE_PERF_EVENTS
+    static const uint64_t configs[COUNTER_COUNT] = {
+        [DTLB_LOADS] = PERF_COUNT_HW_CACHE_DTLB |
+                       PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                       PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16,
+        [DTLB_LOAD_MISSES] = PERF_COUNT_HW_CACHE_DTLB |
+                             PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                             PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+        [NODE_LOADS] = PERF_COUNT_HW_CACHE_NODE |
+                       PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                       PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16,
+        [NODE_LOAD_MISSES] = PERF_COUNT_HW_CACHE_NODE |
+                             PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                             PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+    };
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = configs[counter];
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;    // Allowed at the usual paranoid level
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    (void)counter;
+    return -1;
+#endif
+}
+
+/* Reads and prints one counter, storing -1 if it is unavailable */
+static void print_counter(FILE *output, const char *name, int fd,
+                          long long *value)
+{
+    uint64_t count;
+    if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) {
+        *value = -1;
+        fprintf(output, "%-17s unavailable\n", name);
+        return;
+    }
+    *value = count;
+    fprintf(output, "%-17s %llu\n", name, (unsigned long long)count);
+}
@@ -0,0 +1,31 @@
+/* memory_report.h */
+
+#ifndef MEMORY_REPORT_H
+#define MEMORY_REPORT_H
+
+#include <stdio.h>
+
+/* Hardware counters over part of a run, to show what NUMA placement and
+   huge pages gain: dTLB load misses, and loads served by the local and
+   by remote NUMA nodes. Counting covers every thread started after
+   memory_report_start. Counters the kernel or CPU does not offer are
+   reported as unavailable. */
+typedef struct Memory_Report *Memory_Report;
+
+/* Function Prototypes */
+
+/**
+ * Starts counting.
+ * @return The report.
+ */
+Memory_Report memory_report_start(void);
+
+/**
+ * Stops counting, prints what was counted along with the NUMA topology
+ * and the buffers huge_alloc mapped, and frees the report.
+ * @param report Pointer to the report; set to NULL.
+ * @param output Where to print.
+ */
+void memory_report_finish(Memory_Report *report, FILE *output);
+
+#endif /* MEMORY_REPORT_H */
@@ -0,0 +1,125 @@
+/* numa.c */
+
+#define _GNU_SOURCE  // For cpu_set_t and sched_setaffinity
+#include "numa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* Nodes looked for under /sys/devices/system/node */
+#define MAX_NODES 64
+
+/* The topology, read once by whichever thread needs it first */
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+static int node_count = 1;
+static bool pinning = false;
+static cpu_set_t node_cpus[MAX_NODES];   // Only CPUs we may use
+
+/* Helper functions */
+static void read_topology(void);
+static void read_cpulist(FILE *file, const cpu_set_t *allowed,
+                         cpu_set_t *cpus);
+
+/* Returns the number of nodes with usable CPUs */
+int numa_node_count(void)
+{
+    pthread_once(&topology_once, read_topology);
+    return node_count;
+}
+
+/* Returns whether threads are pinned */
+bool numa_pinning(void)
+{
+    pthread_once(&topology_once, read_topology);
+    return pinning;
+}
+
+/* Runs one part of a parallel_run on its node's CPUs */
+void numa_run_pinned(Parallel_Work work, void *closure, int index,
+                     int thread_count)
+{
+    pthread_once(&topology_once, read_topology);
+    if (!pinning) {
+        work(closure, index, thread_count);
+        return;
+    }
+
+    /* Parts are grouped onto nodes in order, as parallel_split groups
+       rows into bands */
+    int node = (int)((long long)index * node_count / thread_count);
+    cpu_set_t previous;
+    bool pinned = sched_getaffinity(0, sizeof(previous), &previous) == 0 &&
+                  sched_setaffinity(0, sizeof(cpu_set_t),
+                                    &node_cpus[node]) == 0;
+
+    work(closure, index, thread_count);
+
+    if (pinned) {
+        sched_setaffinity(0, sizeof(previous), &previous);
+    }
+}
+
+/* Reads which CPUs belong to each node, keeping only those this process
+   may run on. Without sysfs there is one node and nothing is pinned. */
+static void read_topology(void)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+
+    /* Node numbers may have gaps, so try each */
+    int count = 0;
+    for (int node = 0; node < MAX_NODES; node++) {
+        char path[64];
+        snprintf(path, sizeof(path),
+                 "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+
+        cpu_set_t cpus;
+        read_cpulist(file, &allowed, &cpus);
+        fclose(file);
+        if (CPU_COUNT(&cpus) > 0) {
+            node_cpus[count++] = cpus;
+        }
+    }
+    if (count > 0) {
+        node_count = count;
+    }
+
+    const char *setting = getenv("COMP40_NUMA");
+    pinning = node_count > 1 &&
+              (setting == NULL || strcmp(setting, "0") != 0);
+}
+
+/* Parses a list such as "0-3,8-11" into the allowed CPUs it names */
+static void read_cpulist(FILE *file, const cpu_set_t *allowed,
+                         cpu_set_t *cpus)
+{
+    CPU_ZERO(cpus);
+
+    int first;
+    while (fscanf(file, "%d", &first) == 1) {
+        int last = first;
+        int c = fgetc(file);
+        if (c == '-') {
+            if (fscanf(file, "%d", &last) != 1) {
+                return;
+            }
+            c = fgetc(file);
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            if (cpu >= 0 && CPU_ISSET(cpu, allowed)) {
+                CPU_SET(cpu, cpus);
+            }
+        }
+        if (c != ',') {
+            return;
+        }
+    }
+}
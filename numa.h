@@ -0,0 +1,41 @@
+/* numa.h */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdbool.h>
+#include "parallel.h"  // For Parallel_Work
+
+/* The threads of a parallel_run are spread over NUMA nodes in
+   contiguous groups, the way parallel_split hands out bands, so
+   neighbouring bands share a node and the pages each thread touches
+   first stay on it. The topology comes from /sys/devices/system/node.
+   Pinning is on when there is more than one node with CPUs this process
+   may use; setting COMP40_NUMA to 0 turns it off. */
+
+/* Function Prototypes */
+
+/**
+ * Returns the number of NUMA nodes with CPUs this process may use.
+ * @return At least 1.
+ */
+int numa_node_count(void);
+
+/**
+ * Returns whether threads are pinned.
+ * @return true if parallel_run pins its threads to nodes.
+ */
+bool numa_pinning(void);
+
+/**
+ * Runs one part of a parallel_run on the CPUs of the node it belongs
+ * to, then restores the calling thread's CPUs.
+ * @param work The part's work.
+ * @param closure Passed unchanged to work.
+ * @param index Which part this is.
+ * @param thread_count The number of parts.
+ */
+void numa_run_pinned(Parallel_Work work, void *closure, int index,
+                     int thread_count);
+
+#endif /* NUMA_H */
@@ -0,0 +1,96 @@
+/* parallel.c */
+
+#include "parallel.h"
+#include "numa.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Upper bound on threads, to keep a stray setting from exhausting memory */
+#define MAX_THREADS 256
+
+/* Arguments handed to each spawned thread */
+typedef struct {
+    Parallel_Work work;
+    void *closure;
+    int index;
+    int thread_count;
+} Thread_Args;
+
+static void *thread_main(void *arg);
+
+/* Returns the default number of threads */
+int parallel_default_threads(void)
+{
+    const char *setting = getenv("COMP40_THREADS");
+    if (setting != NULL) {
+        int threads = atoi(setting);
+        if (threads > 0) {
+            return threads < MAX_THREADS ? threads : MAX_THREADS;
+        }
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        return 1;
+    }
+    return cpus < MAX_THREADS ? (int)cpus : MAX_THREADS;
+}
+
+/* Runs work on thread_count threads and waits for all of them */
+void parallel_run(int thread_count, Parallel_Work work, void *closure)
+{
+    assert(work != NULL);
+
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+    if (thread_count > MAX_THREADS) {
+        thread_count = MAX_THREADS;
+    }
+
+    pthread_t threads[MAX_THREADS];
+    Thread_Args args[MAX_THREADS];
+
+    /* Spawn threads 1..n-1; the caller does part 0 itself */
+    int spawned = 1;
+    for (int i = 1; i < thread_count; i++) {
+        args[i] = (Thread_Args){ work, closure, i, thread_count };
+        if (pthread_create(&threads[i], NULL, thread_main, &args[i]) != 0) {
+            break;
+        }
+        spawned++;
+    }
+
+    /* If the system ran out of threads, the caller does the rest. Every
+       part runs on the CPUs of its NUMA node. */
+    numa_run_pinned(work, closure, 0, thread_count);
+    for (int i = spawned; i < thread_count; i++) {
+        numa_run_pinned(work, closure, i, thread_count);
+    }
+
+    for (int i = 1; i < spawned; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/* Returns the bounds of one of thread_count nearly equal parts */
+void parallel_split(long long count, int index, int thread_count,
+                    long long *start, long long *end)
+{
+    assert(start != NULL && end != NULL);
+    assert(thread_count > 0 && index >= 0 && index < thread_count);
+
+    *start = count * index / thread_count;
+    *end = count * (index + 1) / thread_count;
+}
+
+/* Entry point of each spawned thread */
+static void *thread_main(void *arg)
+{
+    Thread_Args *args = arg;
+    numa_run_pinned(args->work, args->closure, args->index,
+                    args->thread_count);
+    return NULL;
+}
@@ -0,0 +1,40 @@
+/* parallel.h */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/* Work done by one thread: index runs from 0 to thread_count - 1 */
+typedef void (*Parallel_Work)(void *closure, int index, int thread_count);
+
+/* Function Prototypes */
+
+/**
+ * Returns the number of threads to use by default: the COMP40_THREADS
+ * environment variable if set, otherwise the number of online CPUs.
+ * @return A thread count of at least 1.
+ */
+int parallel_default_threads(void);
+
+/**
+ * Runs work on thread_count threads (the caller's thread is one of them)
+ * and returns once all of them have finished. On a machine with several
+ * NUMA nodes each part runs on its node's CPUs, as numa.h describes.
+ * @param thread_count The number of threads; values below 1 mean 1.
+ * @param work The function each thread runs.
+ * @param closure Passed unchanged to every call of work.
+ */
+void parallel_run(int thread_count, Parallel_Work work, void *closure);
+
+/**
+ * Splits the range [0, count) into thread_count nearly equal parts and
+ * returns the bounds of part index.
+ * @param count The size of the range.
+ * @param index Which part to return.
+ * @param thread_count The number of parts.
+ * @param start Pointer to store the first element of the part.
+ * @param end Pointer to store one past the last element of the part.
+ */
+void parallel_split(long long count, int index, int thread_count,
+                    long long *start, long long *end);
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,203 @@
+/* parallel_decode.c */
+
+#include "parallel_decode.h"
+#include "block_decode.h"
+#include "parallel.h"
+#include "io.h"
+#include "huge_alloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Maximum value of a channel in the PPM output */
+#define MAX_COLOR_VALUE 255
+
+/* A decode in progress, shared by every thread */
+typedef struct {
+    const unsigned char *bytes;   // Mapped codewords, or NULL
+    const uint32_t *words;        // Codewords in host order, if not mapped
+    int block_width;
+    int block_height;
+
+    int rows_per_write;           // Block rows decoded before each pwrite
+    int fd;                       // Output for pwrite, or -1
+    off_t pixel_offset;           // Where the first scanline goes
+    Pixel *buffer;                // Whole image, when not using pwrite
+    bool failed;                  // Set by any thread whose pwrite fails
+} Decode_Job;
+
+/* Helper functions */
+static void decode_band(void *closure, int index, int thread_count);
+static bool can_pwrite(FILE *output);
+static bool pwrite_all(int fd, const void *data, size_t length, off_t offset);
+
+/* Decompresses a compressed image to a PPM on several threads */
+void decompress40_parallel(FILE *input, FILE *output, int thread_count,
+                           int rows_per_write)
+{
+    if (!parallel_decode(input, output, thread_count, rows_per_write)) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Decompresses as decompress40_parallel does, reporting failure */
+bool parallel_decode(FILE *input, FILE *output, int thread_count,
+                     int rows_per_write)
+{
+    assert(input != NULL);
+    assert(output != NULL);
+    assert(sizeof(Pixel) == 3);   // Pixels are written out as-is
+
+    Decode_Job job;
+    memset(&job, 0, sizeof(job));
+    job.fd = -1;
+    job.rows_per_write = rows_per_write > 0 ? rows_per_write : 1;
+
+    /* 1. Compressed Image Reader: map it when we can */
+    Mapped_Compressed_Image mapped = { 0, 0, NULL, NULL, 0 };
+    Codeword_Array *codeword_array = NULL;
+    if (is_regular_file(input)) {
+        if (!map_compressed_image(input, &mapped)) {
+            return false;
+        }
+        job.bytes = mapped.codewords;
+        job.block_width = mapped.width / 2;
+        job.block_height = mapped.height / 2;
+    } else {
+        codeword_array = read_codeword_array(input);
+        if (codeword_array == NULL) {
+            fprintf(stderr, "Error: Failed to read compressed image.\n");
+            return false;
+        }
+        job.words = codeword_array->words;
+        job.block_width = codeword_array->width;
+        job.block_height = codeword_array->height;
+    }
+
+    int width = job.block_width * 2;
+    int height = job.block_height * 2;
+    size_t pixel_bytes = (size_t)width * height * sizeof(Pixel);
+
+    /* 2. The header fixes every scanline's offset */
+    fprintf(output, "P6\n%d %d\n%d\n", width, height, MAX_COLOR_VALUE);
+    fflush(output);
+
+    if (can_pwrite(output)) {
+        job.fd = fileno(output);
+        job.pixel_offset = lseek(job.fd, 0, SEEK_CUR);
+        /* Size the file up front so writes land in any order */
+        if (ftruncate(job.fd, job.pixel_offset + pixel_bytes) != 0) {
+            job.fd = -1;
+        }
+    }
+    if (job.fd < 0) {
+        /* Left untouched here, so each band's pages are placed on the
+           node of the thread that decodes it */
+        job.buffer = huge_alloc(pixel_bytes);
+        assert(job.buffer != NULL);
+    }
+
+    /* 3. Decode (and write) the bands */
+    if (thread_count > job.block_height) {
+        thread_count = job.block_height;
+    }
+    parallel_run(thread_count, decode_band, &job);
+
+    if (job.fd >= 0) {
+        lseek(job.fd, job.pixel_offset + pixel_bytes, SEEK_SET);
+    } else {
+        fwrite(job.buffer, 1, pixel_bytes, output);
+        huge_free(job.buffer);
+    }
+
+    unmap_compressed_image(&mapped);
+    free_codeword_array(codeword_array);
+
+    if (job.failed) {
+        fprintf(stderr, "Error: Could not write decompressed image.\n");
+        return false;
+    }
+    return true;
+}
+
+/* Helper function implementations */
+
+/* Decodes one thread's band of block rows.  With pwrite, rows are decoded
+   into a small private buffer and written a few at a time; otherwise
+   they are decoded straight into the shared image buffer */
+static void decode_band(void *closure, int index, int thread_count)
+{
+    Decode_Job *job = closure;
+    int block_width = job->block_width;
+    size_t row_pixels = (size_t)block_width * 2;
+
+    long long first, last;
+    parallel_split(job->block_height, index, thread_count, &first, &last);
+
+    int rows_per_write = job->rows_per_write;
+    Pixel *scratch = NULL;
+    if (job->fd >= 0) {
+        size_t scratch_bytes = rows_per_write * 2 * row_pixels * sizeof(Pixel);
+        scratch = malloc(scratch_bytes > 0 ? scratch_bytes : 1);
+        assert(scratch != NULL);
+    }
+
+    for (long long start = first; start < last; start += rows_per_write) {
+        long long end = start + rows_per_write < last ? start + rows_per_write : last;
+        Pixel *out = scratch != NULL ? scratch : job->buffer + start * 2 * row_pixels;
+
+        for (long long block_y = start; block_y < end; block_y++) {
+            size_t first_word = (size_t)block_y * block_width;
+            Pixel *top = out + (block_y - start) * 2 * row_pixels;
+            decode_block_run(job->bytes != NULL ? job->bytes + 4 * first_word : NULL,
+                             job->words != NULL ? job->words + first_word : NULL,
+                             block_width, top, top + row_pixels);
+        }
+
+        if (scratch != NULL) {
+            size_t length = (end - start) * 2 * row_pixels * sizeof(Pixel);
+            off_t offset = job->pixel_offset +
+                           (off_t)start * 2 * row_pixels * sizeof(Pixel);
+            if (!pwrite_all(job->fd, scratch, length, offset)) {
+                __atomic_store_n(&job->failed, true, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+    }
+
+    free(scratch);
+}
+
+/* Returns true if scanlines can be written to the output by offset: it
+   must be a regular file not opened for appending, since pwrite on an
+   O_APPEND descriptor ignores the offset on Linux */
+static bool can_pwrite(FILE *output)
+{
+    if (!is_regular_file(output)) {
+        return false;
+    }
+    int flags = fcntl(fileno(output), F_GETFL);
+    return flags >= 0 && (flags & O_APPEND) == 0;
+}
+
+/* Writes length bytes at offset, retrying short writes */
+static bool pwrite_all(int fd, const void *data, size_t length, off_t offset)
+{
+    const char *bytes = data;
+    while (length > 0) {
+        ssize_t written = pwrite(fd, bytes, length, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += written;
+        offset += written;
+        length -= written;
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+/* parallel_decode.h */
+
+#ifndef PARALLEL_DECODE_H
+#define PARALLEL_DECODE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Function Prototypes */
+
+/**
+ * Decompresses a compressed image to a binary PPM on several threads.
+ * Each thread decodes a band of block rows. When the output is a regular
+ * file, each thread writes its scanlines straight to their final offsets
+ * with pwrite, so there is no central writer. Otherwise the bands are
+ * decoded into one buffer that is written once all threads finish.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ * @param thread_count The number of threads to use.
+ * @param rows_per_write Block rows each thread decodes before each pwrite.
+ */
+void decompress40_parallel(FILE *input, FILE *output, int thread_count,
+                           int rows_per_write);
+
+/**
+ * Decompresses as decompress40_parallel does, but returns instead of
+ * exiting when the input is invalid or the output cannot be written.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ * @param thread_count The number of threads to use.
+ * @param rows_per_write Block rows each thread decodes before each pwrite.
+ * @return true on success, false (after printing an error) otherwise.
+ */
+bool parallel_decode(FILE *input, FILE *output, int thread_count,
+                     int rows_per_write);
+
+#endif /* PARALLEL_DECODE_H */
@@ -0,0 +1,511 @@
+/* phash_index.c */
+
+#include "phash_index.h"
+#include "parallel.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Index file layout, in the byte order of the host that wrote it:
+ *
+ *     Index_Header                 (32 bytes)
+ *     uint64_t hashes[count]
+ *     uint64_t name_offsets[count + 1]   (into the name bytes)
+ *     char names[]                       (not NUL-terminated)
+ *
+ * The hashes are contiguous so a query streams through them alone.
+ */
+#define INDEX_MAGIC "C40PHASH"
+#define INDEX_BYTE_ORDER 0x01020304u
+#define HASH_BITS (PHASH_GRID * PHASH_GRID)
+
+typedef struct {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t hash_bits;
+    uint64_t count;
+    uint64_t names_offset;    // Byte offset of name_offsets
+} Index_Header;
+
+struct Phash_Index {
+    void *map;
+    size_t map_length;
+    uint64_t count;
+    const uint64_t *hashes;
+    const uint64_t *name_offsets;
+    const char *names;
+};
+
+/* Indexes with fewer entries than this are scanned on one thread */
+#define MIN_PARALLEL_ENTRIES (1 << 20)
+
+/* A query in progress; each thread collects its own matches */
+typedef struct {
+    const uint64_t *hashes;
+    uint64_t count;
+    uint64_t hash;
+    int max_distance;
+    Phash_Match **matches;      // One growable array per thread
+    uint64_t *match_counts;
+} Query_Job;
+
+/* Helper functions */
+static uint64_t hash_codewords(const unsigned char *bytes, const uint32_t *words,
+                               int width, int height);
+static void cell_range(int cell, int extent, int *start, int *end);
+static int compare_doubles(const void *a, const void *b);
+static void query_part(void *closure, int index, int thread_count);
+static uint64_t scan_hashes(const uint64_t *hashes, uint64_t start,
+                            uint64_t end, uint64_t hash, int max_distance,
+                            Phash_Match **matches);
+static bool write_all(FILE *output, const void *data, size_t length);
+static int lock_index(const char *path);
+
+/* Computes the perceptual hash of a codeword grid */
+uint64_t codeword_phash(Codeword_Array *codeword_array)
+{
+    assert(codeword_array != NULL);
+
+    return hash_codewords(NULL, codeword_array->words,
+                          codeword_array->width, codeword_array->height);
+}
+
+/* Computes the perceptual hash of a compressed image read from input */
+bool read_image_phash(FILE *input, uint64_t *hash)
+{
+    assert(input != NULL);
+    assert(hash != NULL);
+
+    if (is_regular_file(input)) {
+        Mapped_Compressed_Image mapped;
+        if (!map_compressed_image(input, &mapped)) {
+            return false;
+        }
+        *hash = hash_codewords(mapped.codewords, NULL,
+                               mapped.width / 2, mapped.height / 2);
+        unmap_compressed_image(&mapped);
+        return true;
+    }
+
+    Codeword_Array *codeword_array = read_codeword_array(input);
+    if (codeword_array == NULL) {
+        return false;
+    }
+    *hash = codeword_phash(codeword_array);
+    free_codeword_array(codeword_array);
+    return true;
+}
+
+/* Adds entries to an index file, creating it if needed */
+bool phash_index_append(const char *path, const char **names,
+                        const uint64_t *hashes, int count)
+{
+    assert(path != NULL);
+    assert(count >= 0);
+    assert(count == 0 || (names != NULL && hashes != NULL));
+
+    /* Appenders take turns through a lock file beside the index; the
+       index itself cannot be locked, as each append replaces it */
+    int lock_fd = lock_index(path);
+    if (lock_fd < 0) {
+        return false;
+    }
+
+    /* Start from the existing entries, if any */
+    Phash_Index old = NULL;
+    if (access(path, F_OK) == 0) {
+        old = phash_index_open(path);
+        if (old == NULL) {
+            close(lock_fd);
+            return false;
+        }
+    }
+    uint64_t old_count = old != NULL ? old->count : 0;
+    uint64_t old_name_bytes = old != NULL ? old->name_offsets[old_count] : 0;
+    uint64_t total = old_count + count;
+
+    size_t temp_length = strlen(path) + sizeof(".XXXXXX");
+    char *temp_path = malloc(temp_length);
+    assert(temp_path != NULL);
+    snprintf(temp_path, temp_length, "%s.XXXXXX", path);
+
+    /* mkstemp makes the file private; give it the usual permissions */
+    int temp_fd = mkstemp(temp_path);
+    mode_t mask = umask(0);
+    umask(mask);
+    FILE *output = NULL;
+    if (temp_fd >= 0 && fchmod(temp_fd, 0666 & ~mask) == 0) {
+        output = fdopen(temp_fd, "wb");
+    }
+    if (output == NULL) {
+        fprintf(stderr, "Error: Could not create a file beside %s.\n", path);
+        if (temp_fd >= 0) {
+            close(temp_fd);
+            remove(temp_path);
+        }
+        free(temp_path);
+        phash_index_close(&old);
+        close(lock_fd);
+        return false;
+    }
+
+    Index_Header header;
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.byte_order = INDEX_BYTE_ORDER;
+    header.hash_bits = HASH_BITS;
+    header.count = total;
+    header.names_offset = sizeof(Index_Header) + total * sizeof(uint64_t);
+
+    bool ok = write_all(output, &header, sizeof(header));
+
+    /* Hashes, old then new */
+    if (old != NULL) {
+        ok = ok && write_all(output, old->hashes, old_count * sizeof(uint64_t));
+    }
+    ok = ok && write_all(output, hashes, count * sizeof(uint64_t));
+
+    /* Name offsets, continuing on from the old names */
+    if (old != NULL) {
+        ok = ok && write_all(output, old->name_offsets, old_count * sizeof(uint64_t));
+    }
+    uint64_t offset = old_name_bytes;
+    for (int i = 0; i < count; i++) {
+        ok = ok && write_all(output, &offset, sizeof(offset));
+        offset += strlen(names[i]);
+    }
+    ok = ok && write_all(output, &offset, sizeof(offset));
+
+    /* Names */
+    if (old != NULL) {
+        ok = ok && write_all(output, old->names, old_name_bytes);
+    }
+    for (int i = 0; i < count; i++) {
+        ok = ok && write_all(output, names[i], strlen(names[i]));
+    }
+
+    ok = (fclose(output) == 0) && ok;
+    phash_index_close(&old);
+
+    if (ok && rename(temp_path, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Could not write %s.\n", path);
+        remove(temp_path);
+    }
+
+    free(temp_path);
+    close(lock_fd);    // Releases the lock
+    return ok;
+}
+
+/* Opens an index file by mapping it */
+Phash_Index phash_index_open(const char *path)
+{
+    assert(path != NULL);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: Could not open %s.\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Index_Header)) {
+        fprintf(stderr, "Error: %s is not a hash index.\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Error: Could not map %s.\n", path);
+        return NULL;
+    }
+
+    /* Check the header and that every table lies inside the file */
+    const Index_Header *header = map;
+    size_t length = st.st_size;
+    uint64_t count = header->count;
+    bool valid = memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->byte_order == INDEX_BYTE_ORDER &&
+                 header->hash_bits == HASH_BITS &&
+                 count <= (length - sizeof(Index_Header)) / (2 * sizeof(uint64_t)) &&
+                 header->names_offset == sizeof(Index_Header) + count * sizeof(uint64_t) &&
+                 header->names_offset + (count + 1) * sizeof(uint64_t) <= length;
+    if (!valid) {
+        fprintf(stderr, "Error: %s is not a hash index.\n", path);
+        munmap(map, length);
+        return NULL;
+    }
+
+    Phash_Index index = malloc(sizeof(*index));
+    assert(index != NULL);
+
+    index->map = map;
+    index->map_length = length;
+    index->count = count;
+    index->hashes = (const uint64_t *)((const char *)map + sizeof(Index_Header));
+    index->name_offsets = (const uint64_t *)((const char *)map + header->names_offset);
+    index->names = (const char *)(index->name_offsets + count + 1);
+
+    size_t names_start = header->names_offset + (count + 1) * sizeof(uint64_t);
+    if (index->name_offsets[count] > length - names_start) {
+        fprintf(stderr, "Error: %s is not a hash index.\n", path);
+        phash_index_close(&index);
+        return NULL;
+    }
+
+    return index;
+}
+
+/* Closes an index */
+void phash_index_close(Phash_Index *index)
+{
+    assert(index != NULL);
+
+    if (*index == NULL) {
+        return;
+    }
+    munmap((*index)->map, (*index)->map_length);
+    free(*index);
+    *index = NULL;
+}
+
+/* Returns the number of entries in an index */
+uint64_t phash_index_count(Phash_Index index)
+{
+    assert(index != NULL);
+    return index->count;
+}
+
+/* Returns the name stored with an entry */
+const char *phash_index_name(Phash_Index index, uint64_t entry, size_t *length)
+{
+    assert(index != NULL);
+    assert(entry < index->count);
+    assert(length != NULL);
+
+    uint64_t start = index->name_offsets[entry];
+    uint64_t end = index->name_offsets[entry + 1];
+    assert(start <= end && end <= index->name_offsets[index->count]);
+
+    *length = end - start;
+    return index->names + start;
+}
+
+/* Finds every entry within max_distance bits of hash */
+Phash_Match *phash_index_query(Phash_Index index, uint64_t hash,
+                               int max_distance, uint64_t *match_count)
+{
+    assert(index != NULL);
+    assert(match_count != NULL);
+
+    int thread_count = index->count < MIN_PARALLEL_ENTRIES
+                       ? 1 : parallel_default_threads();
+
+    Phash_Match **matches = calloc(thread_count, sizeof(Phash_Match *));
+    uint64_t *match_counts = calloc(thread_count, sizeof(uint64_t));
+    assert(matches != NULL && match_counts != NULL);
+
+    Query_Job job = { index->hashes, index->count, hash, max_distance,
+                      matches, match_counts };
+    parallel_run(thread_count, query_part, &job);
+
+    /* Stitch the per-thread results together in index order */
+    uint64_t total = 0;
+    for (int t = 0; t < thread_count; t++) {
+        total += match_counts[t];
+    }
+    Phash_Match *result = malloc((total > 0 ? total : 1) * sizeof(Phash_Match));
+    assert(result != NULL);
+
+    uint64_t position = 0;
+    for (int t = 0; t < thread_count; t++) {
+        if (match_counts[t] > 0) {
+            memcpy(result + position, matches[t],
+                   match_counts[t] * sizeof(Phash_Match));
+        }
+        position += match_counts[t];
+        free(matches[t]);
+    }
+
+    free(matches);
+    free(match_counts);
+    *match_count = total;
+    return result;
+}
+
+/* Helper function implementations */
+
+/* Box-averages 'a' over the hash grid and thresholds each cell at the
+   median.  Codewords come either from a mapped file (big-endian bytes)
+   or from a Codeword_Array; width and height are in blocks */
+static uint64_t hash_codewords(const unsigned char *bytes, const uint32_t *words,
+                               int width, int height)
+{
+    if (width == 0 || height == 0) {
+        return 0;
+    }
+
+    double means[HASH_BITS];
+    for (int cell_y = 0; cell_y < PHASH_GRID; cell_y++) {
+        int start_y, end_y;
+        cell_range(cell_y, height, &start_y, &end_y);
+
+        for (int cell_x = 0; cell_x < PHASH_GRID; cell_x++) {
+            int start_x, end_x;
+            cell_range(cell_x, width, &start_x, &end_x);
+
+            uint64_t sum = 0;
+            for (int y = start_y; y < end_y; y++) {
+                size_t row = (size_t)y * width;
+                if (bytes != NULL) {
+                    /* 'a' is the top nine bits of the first two bytes */
+                    for (int x = start_x; x < end_x; x++) {
+                        const unsigned char *word = bytes + 4 * (row + x);
+                        sum += (unsigned)word[0] << 1 | word[1] >> 7;
+                    }
+                } else {
+                    for (int x = start_x; x < end_x; x++) {
+                        sum += words[row + x] >> A_LSB;
+                    }
+                }
+            }
+
+            uint64_t area = (uint64_t)(end_y - start_y) * (end_x - start_x);
+            means[cell_y * PHASH_GRID + cell_x] = (double)sum / area;
+        }
+    }
+
+    double sorted[HASH_BITS];
+    memcpy(sorted, means, sizeof(means));
+    qsort(sorted, HASH_BITS, sizeof(double), compare_doubles);
+    double median = (sorted[HASH_BITS / 2 - 1] + sorted[HASH_BITS / 2]) / 2.0;
+
+    /* The first cell in reading order is the most significant bit */
+    uint64_t hash = 0;
+    for (int i = 0; i < HASH_BITS; i++) {
+        hash = (hash << 1) | (means[i] > median);
+    }
+    return hash;
+}
+
+/* Returns the blocks [start, end) that feed one cell along an axis of
+   extent blocks; every cell gets at least one block */
+static void cell_range(int cell, int extent, int *start, int *end)
+{
+    *start = (int)((long long)cell * extent / PHASH_GRID);
+    *end = (int)((long long)(cell + 1) * extent / PHASH_GRID);
+    if (*end <= *start) {
+        *end = *start + 1;
+    }
+}
+
+/* Orders doubles for qsort */
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Scans one thread's share of the index */
+static void query_part(void *closure, int index, int thread_count)
+{
+    Query_Job *job = closure;
+
+    long long start, end;
+    parallel_split(job->count, index, thread_count, &start, &end);
+
+    job->match_counts[index] = scan_hashes(job->hashes, start, end, job->hash,
+                                           job->max_distance,
+                                           &job->matches[index]);
+}
+
+/* The scan loop, written once and compiled both for the baseline target
+   and, on x86-64, with the POPCNT instruction enabled */
+static inline __attribute__((always_inline))
+uint64_t scan_hashes_body(const uint64_t *hashes, uint64_t start, uint64_t end,
+                          uint64_t hash, int max_distance,
+                          Phash_Match **matches)
+{
+    uint64_t found = 0;
+    uint64_t capacity = 0;
+    Phash_Match *list = NULL;
+
+    for (uint64_t i = start; i < end; i++) {
+        int distance = __builtin_popcountll(hashes[i] ^ hash);
+        if (distance <= max_distance) {
+            if (found == capacity) {
+                capacity = capacity > 0 ? 2 * capacity : 64;
+                list = realloc(list, capacity * sizeof(Phash_Match));
+                assert(list != NULL);
+            }
+            list[found].entry = i;
+            list[found].distance = distance;
+            found++;
+        }
+    }
+
+    *matches = list;
+    return found;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("popcnt")))
+static uint64_t scan_hashes_popcnt(const uint64_t *hashes, uint64_t start,
+                                   uint64_t end, uint64_t hash,
+                                   int max_distance, Phash_Match **matches)
+{
+    return scan_hashes_body(hashes, start, end, hash, max_distance, matches);
+}
+#endif
+
+/* Scans hashes[start, end) with the fastest popcount the CPU offers */
+static uint64_t scan_hashes(const uint64_t *hashes, uint64_t start,
+                            uint64_t end, uint64_t hash, int max_distance,
+                            Phash_Match **matches)
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("popcnt")) {
+        return scan_hashes_popcnt(hashes, start, end, hash, max_distance, matches);
+    }
+#endif
+    return scan_hashes_body(hashes, start, end, hash, max_distance, matches);
+}
+
+/* Writes length bytes, returning false on error */
+static bool write_all(FILE *output, const void *data, size_t length)
+{
+    return length == 0 || fwrite(data, 1, length, output) == length;
+}
+
+/* Opens path.lock and waits for an exclusive lock on it. Returns the
+   descriptor holding the lock, or -1 after printing an error. */
+static int lock_index(const char *path)
+{
+    size_t lock_length = strlen(path) + sizeof(".lock");
+    char *lock_path = malloc(lock_length);
+    assert(lock_path != NULL);
+    snprintf(lock_path, lock_length, "%s.lock", path);
+
+    int fd = open(lock_path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+        fprintf(stderr, "Error: Could not lock %s.\n", lock_path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        fd = -1;
+    }
+
+    free(lock_path);
+    return fd;
+}
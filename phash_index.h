@@ -0,0 +1,99 @@
+/* phash_index.h */
+
+#ifndef PHASH_INDEX_H
+#define PHASH_INDEX_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "quantization.h"  // For Codeword_Array
+
+/* Side of the grid over which 'a' is averaged; one hash bit per cell */
+#define PHASH_GRID 8
+
+/* An on-disk index of perceptual hashes, opened by mapping the file */
+typedef struct Phash_Index *Phash_Index;
+
+/* One near-duplicate found by a query */
+typedef struct {
+    uint64_t entry;   // Position of the entry in the index
+    int distance;     // Hamming distance from the query hash
+} Phash_Match;
+
+/* Function Prototypes */
+
+/**
+ * Computes the 64-bit perceptual hash of a codeword grid. The DC term
+ * 'a' is box-averaged over a PHASH_GRID x PHASH_GRID grid, and each bit
+ * records whether its cell is brighter than the median cell.
+ * @param codeword_array The input Codeword_Array.
+ * @return The hash.
+ */
+uint64_t codeword_phash(Codeword_Array *codeword_array);
+
+/**
+ * Computes the perceptual hash of a compressed image read from input,
+ * mapping the file instead of reading it in when it is a regular file.
+ * @param input The input file pointer.
+ * @param hash Pointer to store the hash.
+ * @return true on success, false if the input is not a valid image.
+ */
+bool read_image_phash(FILE *input, uint64_t *hash);
+
+/**
+ * Adds entries to an index file, creating it if it does not exist. The
+ * file is rewritten through a temporary file and renamed into place, so
+ * readers never see it half-written, while an exclusive lock on
+ * path.lock makes concurrent appenders wait their turn.
+ * @param path The index file.
+ * @param names The name stored with each new hash (usually a file path).
+ * @param hashes The new hashes.
+ * @param count The number of new entries.
+ * @return true on success, false (after printing an error) otherwise.
+ */
+bool phash_index_append(const char *path, const char **names,
+                        const uint64_t *hashes, int count);
+
+/**
+ * Opens an index file by mapping it read-only.
+ * @param path The index file.
+ * @return The index, or NULL (after printing an error) if it is invalid.
+ */
+Phash_Index phash_index_open(const char *path);
+
+/**
+ * Closes an index and sets *index to NULL.
+ * @param index Pointer to the index.
+ */
+void phash_index_close(Phash_Index *index);
+
+/**
+ * Returns the number of entries in an index.
+ * @param index The index.
+ * @return The number of entries.
+ */
+uint64_t phash_index_count(Phash_Index index);
+
+/**
+ * Returns the name stored with an entry.
+ * @param index The index.
+ * @param entry The position of the entry.
+ * @param length Pointer to store the length of the name.
+ * @return A pointer into the mapping; the name is not NUL-terminated.
+ */
+const char *phash_index_name(Phash_Index index, uint64_t entry, size_t *length);
+
+/**
+ * Finds every entry within max_distance bits of hash. The hash array is
+ * scanned on all cores with hardware popcount where available.
+ * @param index The index.
+ * @param hash The query hash.
+ * @param max_distance The largest Hamming distance to report.
+ * @param match_count Pointer to store the number of matches.
+ * @return A malloc'd array of matches in index order, to be freed by the
+ * caller.
+ */
+Phash_Match *phash_index_query(Phash_Index index, uint64_t hash,
+                               int max_distance, uint64_t *match_count);
+
+#endif /* PHASH_INDEX_H */
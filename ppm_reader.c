@@ -0,0 +1,457 @@
+/* ppm_reader.c */
+
+#include "ppm_reader.h"
+#include "parallel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Bytes of a plain raster parsed per fread */
+#define PLAIN_BUFFER_SIZE (1 << 16)
+
+/* Plain rasters shorter than this are parsed on one thread */
+#define PARALLEL_PLAIN_BYTES (1 << 20)
+
+/* Samples are counted this many bytes at a time */
+#define BYTE_LANES 16
+typedef unsigned char Byte_Vector
+    __attribute__((vector_size(BYTE_LANES)));
+typedef signed char Mask_Vector
+    __attribute__((vector_size(BYTE_LANES)));
+
+struct Ppm_Reader {
+    FILE *input;
+    Ppm_Header header;
+    int rows_left;
+
+    /* Plain rasters only: the unparsed part of the last fread */
+    unsigned char *buffer;
+    size_t position;
+    size_t length;
+};
+
+/* A whole plain raster, split into one chunk per thread. A chunk owns
+   the samples whose first digit lies in it, so a sample cut by the end
+   of a chunk is parsed by that chunk and skipped by the next. */
+typedef struct {
+    const unsigned char *text;
+    size_t length;
+    unsigned maxval;
+    size_t sample_count;     // Samples wanted
+    uint16_t *samples;
+    size_t *chunk_samples;   // Counted by the first pass, then replaced
+                             // by the index of each chunk's first sample
+    bool *chunk_ok;
+} Plain_Job;
+
+/* Helper functions */
+static bool read_header_number(FILE *input, unsigned *value);
+static bool get_raw_rows(Ppm_Reader reader, size_t count, uint16_t *samples);
+static bool get_plain_rows(Ppm_Reader reader, size_t count,
+                           uint16_t *samples);
+static unsigned char *read_rest(FILE *input, size_t *length);
+static bool parse_plain(Plain_Job *job, int thread_count);
+static void count_chunk(void *closure, int index, int thread_count);
+static void parse_chunk(void *closure, int index, int thread_count);
+
+/* Reads the header and prepares to read rows */
+Ppm_Reader ppm_reader_new(FILE *input, Ppm_Header *header)
+{
+    assert(input != NULL && header != NULL);
+
+    unsigned width, height, maxval;
+    int p = fgetc(input);
+    int kind = fgetc(input);
+    if (p != 'P' || (kind != '3' && kind != '6') ||
+        !read_header_number(input, &width) ||
+        !read_header_number(input, &height) ||
+        !read_header_number(input, &maxval) ||
+        width > INT32_MAX / 3 || height > INT32_MAX ||
+        maxval == 0 || maxval > 65535) {
+        fprintf(stderr, "Error: Input file is not a PPM image.\n");
+        return NULL;
+    }
+
+    /* Exactly one whitespace character separates the header from a raw
+       raster, and read_header_number has already consumed it */
+    Ppm_Reader reader = malloc(sizeof(*reader));
+    assert(reader != NULL);
+    reader->input = input;
+    reader->header = (Ppm_Header){ width, height, maxval, kind == '3' };
+    reader->rows_left = height;
+    reader->buffer = NULL;
+    reader->position = 0;
+    reader->length = 0;
+    if (reader->header.plain) {
+        reader->buffer = malloc(PLAIN_BUFFER_SIZE);
+        assert(reader->buffer != NULL);
+    }
+
+    *header = reader->header;
+    return reader;
+}
+
+/* Reads the next rows */
+bool ppm_reader_get_rows(Ppm_Reader reader, int count, uint16_t *samples)
+{
+    assert(reader != NULL && samples != NULL);
+    assert(count >= 0 && count <= reader->rows_left);
+
+    reader->rows_left -= count;
+    size_t sample_count = (size_t)3 * reader->header.width * count;
+    return reader->header.plain
+           ? get_plain_rows(reader, sample_count, samples)
+           : get_raw_rows(reader, sample_count, samples);
+}
+
+/* Reads every remaining row, parsing a plain raster across threads */
+bool ppm_reader_get_all(Ppm_Reader reader, uint16_t *samples,
+                        int thread_count)
+{
+    assert(reader != NULL && samples != NULL);
+
+    /* Raw rasters are already read at the speed of fread, and samples
+       left in the buffer by ppm_reader_get_rows have to come first */
+    int rows = reader->rows_left;
+    if (!reader->header.plain || reader->position < reader->length) {
+        return ppm_reader_get_rows(reader, rows, samples);
+    }
+    reader->rows_left = 0;
+
+    FILE *input = reader->input;
+    Plain_Job job = {
+        NULL, 0, reader->header.maxval,
+        (size_t)3 * reader->header.width * rows, samples, NULL, NULL
+    };
+
+    /* Map a regular file; the mapping starts at the beginning of the
+       file so that it is page aligned */
+    struct stat st;
+    off_t offset = ftello(input);
+    if (fstat(fileno(input), &st) == 0 && S_ISREG(st.st_mode) &&
+        offset >= 0 && st.st_size > offset) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                         fileno(input), 0);
+        if (map != MAP_FAILED) {
+            job.text = (const unsigned char *)map + offset;
+            job.length = st.st_size - offset;
+            bool parsed = parse_plain(&job, thread_count);
+            munmap(map, st.st_size);
+            fseeko(input, 0, SEEK_END);
+            return parsed;
+        }
+    }
+
+    /* Anything else, such as a pipe, is read whole first */
+    unsigned char *text = read_rest(input, &job.length);
+    job.text = text;
+    bool parsed = parse_plain(&job, thread_count);
+    free(text);
+    return parsed;
+}
+
+/* Frees a reader */
+void ppm_reader_free(Ppm_Reader *reader)
+{
+    assert(reader != NULL);
+
+    if (*reader != NULL) {
+        free((*reader)->buffer);
+        free(*reader);
+        *reader = NULL;
+    }
+}
+
+/* Reads an unsigned number from the header, skipping whitespace and
+   comments before it and consuming the one character after it */
+static bool read_header_number(FILE *input, unsigned *value)
+{
+    int c = fgetc(input);
+    while (isspace(c) || c == '#') {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) {
+                c = fgetc(input);
+            }
+        }
+        c = fgetc(input);
+    }
+    if (!isdigit(c)) {
+        return false;
+    }
+
+    unsigned long number = 0;
+    while (isdigit(c)) {
+        number = number * 10 + (c - '0');
+        if (number > UINT32_MAX) {
+            return false;
+        }
+        c = fgetc(input);
+    }
+    *value = number;
+
+    return isspace(c);
+}
+
+/* Reads raw samples: one byte each if maxval is below 256, else two,
+   most significant first */
+static bool get_raw_rows(Ppm_Reader reader, size_t count, uint16_t *samples)
+{
+    bool wide = reader->header.maxval > 255;
+    size_t bytes = wide ? 2 * count : count;
+
+    /* Read into the back of the output and widen front to back, so the
+       narrow bytes are consumed before they are overwritten */
+    unsigned char *raw = (unsigned char *)samples + 2 * count - bytes;
+    if (fread(raw, 1, bytes, reader->input) != bytes) {
+        fprintf(stderr, "Error: Unexpected end of file in PPM raster.\n");
+        return false;
+    }
+
+    if (wide) {
+        for (size_t i = 0; i < count; i++) {
+            uint16_t sample = raw[2 * i] << 8 | raw[2 * i + 1];
+            if (sample > reader->header.maxval) {
+                fprintf(stderr, "Error: PPM sample exceeds maxval.\n");
+                return false;
+            }
+            samples[i] = sample;
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            uint16_t sample = raw[i];
+            if (sample > reader->header.maxval) {
+                fprintf(stderr, "Error: PPM sample exceeds maxval.\n");
+                return false;
+            }
+            samples[i] = sample;
+        }
+    }
+
+    return true;
+}
+
+/* Parses plain samples out of the buffer, refilling it as needed */
+static bool get_plain_rows(Ppm_Reader reader, size_t count, uint16_t *samples)
+{
+    unsigned char *buffer = reader->buffer;
+    size_t position = reader->position;
+    size_t length = reader->length;
+
+    for (size_t i = 0; i < count; i++) {
+        unsigned long number = 0;
+        int digits = 0;
+
+        /* A number may straddle two reads, so refill inside the loop */
+        for (;;) {
+            if (position == length) {
+                length = fread(buffer, 1, PLAIN_BUFFER_SIZE, reader->input);
+                position = 0;
+                if (length == 0) {
+                    break;
+                }
+            }
+            unsigned char c = buffer[position];
+            if (c >= '0' && c <= '9') {
+                number = number * 10 + (c - '0');
+                if (number > 65535) {
+                    break;
+                }
+                digits++;
+            } else if (digits > 0) {
+                break;
+            } else if (!isspace(c)) {
+                break;
+            }
+            position++;
+        }
+
+        if (digits == 0 || number > reader->header.maxval) {
+            fprintf(stderr, "Error: Bad or missing sample in PPM raster.\n");
+            reader->position = position;
+            reader->length = length;
+            return false;
+        }
+        samples[i] = number;
+    }
+
+    reader->position = position;
+    reader->length = length;
+    return true;
+}
+
+/* Reads the rest of the input into one buffer */
+static unsigned char *read_rest(FILE *input, size_t *length)
+{
+    size_t capacity = PLAIN_BUFFER_SIZE;
+    size_t used = 0;
+    unsigned char *text = malloc(capacity);
+    assert(text != NULL);
+
+    size_t got;
+    while ((got = fread(text + used, 1, capacity - used, input)) > 0) {
+        used += got;
+        if (used == capacity) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+            assert(text != NULL);
+        }
+    }
+
+    *length = used;
+    return text;
+}
+
+/* Returns whether a byte is a decimal digit */
+static inline bool is_digit(unsigned char c)
+{
+    return (unsigned)(c - '0') < 10;
+}
+
+/* Parses a whole plain raster: the first pass counts the samples in
+   each chunk, which gives every chunk the index of its first sample,
+   and the second pass parses each chunk straight into place */
+static bool parse_plain(Plain_Job *job, int thread_count)
+{
+    if (thread_count < 1 || job->length < PARALLEL_PLAIN_BYTES) {
+        thread_count = 1;
+    }
+    job->chunk_samples = malloc(thread_count * sizeof(size_t));
+    job->chunk_ok = malloc(thread_count * sizeof(bool));
+    assert(job->chunk_samples != NULL && job->chunk_ok != NULL);
+
+    parallel_run(thread_count, count_chunk, job);
+
+    bool ok = true;
+    size_t total = 0;
+    for (int chunk = 0; chunk < thread_count; chunk++) {
+        size_t count = job->chunk_samples[chunk];
+        job->chunk_samples[chunk] = total;
+        total += count;
+        ok = ok && job->chunk_ok[chunk];
+    }
+
+    if (ok && total >= job->sample_count) {
+        parallel_run(thread_count, parse_chunk, job);
+        for (int chunk = 0; chunk < thread_count; chunk++) {
+            ok = ok && job->chunk_ok[chunk];
+        }
+    } else {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: Bad or missing sample in PPM raster.\n");
+    }
+
+    free(job->chunk_samples);
+    free(job->chunk_ok);
+    return ok;
+}
+
+/* First pass: counts the samples that start in a chunk, and checks that
+   it holds nothing but digits and whitespace */
+static void count_chunk(void *closure, int index, int thread_count)
+{
+    Plain_Job *job = closure;
+    long long first, last;
+    parallel_split(job->length, index, thread_count, &first, &last);
+    size_t start = first;
+    size_t end = last;
+
+    const unsigned char *text = job->text;
+    size_t count = 0;
+    size_t i = start;
+
+    /* A sample starts at a digit that does not follow one. Compare each
+       vector of bytes with the same bytes shifted by one, which needs a
+       byte before the first. */
+    Mask_Vector invalid = { 0 };
+    if (i == 0 && i < end) {
+        count += is_digit(text[0]);
+        invalid[0] = !is_digit(text[0]) && !isspace(text[0]);
+        i = 1;
+    }
+
+    Byte_Vector tally = { 0 };
+    int pending = 0;
+    for (; i + BYTE_LANES <= end; i += BYTE_LANES) {
+        Byte_Vector current, previous;
+        memcpy(&current, text + i, BYTE_LANES);
+        memcpy(&previous, text + i - 1, BYTE_LANES);
+
+        Mask_Vector digit = current - '0' < 10;
+        Mask_Vector after_digit = previous - '0' < 10;
+        Mask_Vector space = (current == ' ') | (current - '\t' < 5);
+        invalid |= ~(digit | space);
+
+        /* Each lane of a mask is 0 or -1, so subtracting adds one per
+           sample; empty the tally before a lane can overflow */
+        tally -= (Byte_Vector)(digit & ~after_digit);
+        if (++pending == 255) {
+            for (int lane = 0; lane < BYTE_LANES; lane++) {
+                count += tally[lane];
+            }
+            tally = (Byte_Vector){ 0 };
+            pending = 0;
+        }
+    }
+    for (int lane = 0; lane < BYTE_LANES; lane++) {
+        count += tally[lane];
+    }
+
+    for (; i < end; i++) {
+        count += is_digit(text[i]) && !is_digit(text[i - 1]);
+        invalid[0] |= !is_digit(text[i]) && !isspace(text[i]);
+    }
+
+    bool ok = true;
+    for (int lane = 0; lane < BYTE_LANES; lane++) {
+        ok = ok && invalid[lane] == 0;
+    }
+    job->chunk_samples[index] = count;
+    job->chunk_ok[index] = ok;
+}
+
+/* Second pass: parses the samples that start in a chunk, stopping once
+   every sample wanted is stored */
+static void parse_chunk(void *closure, int index, int thread_count)
+{
+    Plain_Job *job = closure;
+    long long first, last;
+    parallel_split(job->length, index, thread_count, &first, &last);
+    size_t i = first;
+    size_t end = last;
+
+    const unsigned char *text = job->text;
+    size_t next = job->chunk_samples[index];
+
+    /* A sample cut by the start of the chunk belongs to the chunk
+       before */
+    if (i > 0 && is_digit(text[i - 1])) {
+        while (i < end && is_digit(text[i])) {
+            i++;
+        }
+    }
+
+    while (i < end && next < job->sample_count) {
+        if (!is_digit(text[i])) {
+            i++;
+            continue;
+        }
+
+        /* Checking against maxval as digits arrive also keeps long runs
+           of digits from overflowing */
+        unsigned number = 0;
+        do {
+            number = number * 10 + (text[i] - '0');
+            if (number > job->maxval) {
+                job->chunk_ok[index] = false;
+                return;
+            }
+            i++;
+        } while (i < job->length && is_digit(text[i]));
+        job->samples[next++] = number;
+    }
+}
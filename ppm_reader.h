@@ -0,0 +1,67 @@
+/* ppm_reader.h */
+
+#ifndef PPM_READER_H
+#define PPM_READER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* What the header of a PPM image says */
+typedef struct {
+    int width;
+    int height;
+    unsigned maxval;  // 1 to 65535
+    bool plain;       // P3 rather than P6
+} Ppm_Header;
+
+/* Reads the raster of a P3 or P6 image a band of rows at a time. Raw
+   rasters are read with fread; plain ones are parsed from a large
+   buffer rather than a number at a time through stdio, or all at once
+   across threads. */
+typedef struct Ppm_Reader *Ppm_Reader;
+
+/* Function Prototypes */
+
+/**
+ * Reads the header of a PPM image and prepares to read its rows.
+ * @param input The input file pointer, positioned at the magic number.
+ * @param header Pointer to store what the header says.
+ * @return The reader, or NULL (after printing an error) if the input is
+ * not a PPM image.
+ */
+Ppm_Reader ppm_reader_new(FILE *input, Ppm_Header *header);
+
+/**
+ * Reads the next rows of the image.
+ * @param reader The reader.
+ * @param count The number of rows; no more than remain.
+ * @param samples Where to store 3 * width * count samples, red, green
+ * then blue for each pixel, row-major.
+ * @return true on success, false (after printing an error) if the input
+ * ends early or holds a sample above maxval.
+ */
+bool ppm_reader_get_rows(Ppm_Reader reader, int count, uint16_t *samples);
+
+/**
+ * Reads every remaining row of the image. A plain raster is mapped, or
+ * read whole if the input is not a regular file, and parsed in chunks
+ * across threads; raw rasters are read as ppm_reader_get_rows reads
+ * them. The input is left at its end.
+ * @param reader The reader.
+ * @param samples Where to store 3 * width samples per remaining row, as
+ * ppm_reader_get_rows stores them.
+ * @param thread_count The number of threads to parse with.
+ * @return true on success, false (after printing an error) if the input
+ * ends early or holds a bad sample.
+ */
+bool ppm_reader_get_all(Ppm_Reader reader, uint16_t *samples,
+                        int thread_count);
+
+/**
+ * Frees a reader and sets *reader to NULL. The file is not closed.
+ * @param reader Pointer to the reader.
+ */
+void ppm_reader_free(Ppm_Reader *reader);
+
+#endif /* PPM_READER_H */
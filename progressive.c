@@ -0,0 +1,237 @@
+/* progressive.c */
+
+#include "progressive.h"
+#include "compress40_edges.h"
+#include "tuning.h"
+#include "color_conversion.h"
+#include "chroma_processing.h"
+#include "transform.h"
+#include "block_decode.h"
+#include "bitstream.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* Stream layout:
+ *
+ *     "COMP40 Progressive format 1\n"
+ *     "<width> <height>\n"
+ *     first pass     per block, row-major: a, Pb, Pr (17 bits)
+ *     second pass    per block, row-major: b, c, d (15 bits)
+ *
+ * Each pass is a big-endian bit stream padded to a whole byte. The
+ * fields keep their quantized form, so joining the two halves of a
+ * block gives back its codeword exactly.
+ */
+#define PROGRESSIVE_MAGIC_NUMBER "COMP40 Progressive format 1\n"
+
+#define DC_BITS (A_WIDTH + PB_INDEX_WIDTH + PR_INDEX_WIDTH)
+#define DETAIL_BITS (B_WIDTH + C_WIDTH + D_WIDTH)
+
+/* The b, c and d fields sit next to each other, with d lowest */
+#define DETAIL_LSB D_LSB
+
+/* Helper functions */
+static Image *new_image(int width, int height);
+static Image *preview_image(const uint32_t *words, int width, int height);
+static Image *decode_codewords(Codeword_Array *codeword_array);
+
+/* Writes a compressed image in progressive order */
+void write_progressive_image(FILE *output, Codeword_Array *codeword_array)
+{
+    assert(output != NULL);
+    assert(codeword_array != NULL);
+
+    int count = codeword_array->count;
+    size_t dc_length = packed_length(count, DC_BITS);
+    size_t detail_length = packed_length(count, DETAIL_BITS);
+
+    Bit_Writer writer = { malloc(dc_length + detail_length + 1), 0, 0, 0 };
+    assert(writer.bytes != NULL);
+
+    for (int i = 0; i < count; i++) {
+        uint32_t codeword = codeword_array->words[i];
+        put_bits(&writer, codeword >> A_LSB, A_WIDTH);
+        put_bits(&writer, codeword & ((1u << (PB_LSB + PB_INDEX_WIDTH)) - 1),
+                 PB_INDEX_WIDTH + PR_INDEX_WIDTH);
+    }
+    flush_bits(&writer);
+    assert(writer.length == dc_length);
+
+    for (int i = 0; i < count; i++) {
+        uint32_t codeword = codeword_array->words[i];
+        put_bits(&writer, codeword >> DETAIL_LSB, DETAIL_BITS);
+    }
+    flush_bits(&writer);
+    assert(writer.length == dc_length + detail_length);
+
+    fprintf(output, "%s%d %d\n", PROGRESSIVE_MAGIC_NUMBER,
+            codeword_array->width * 2, codeword_array->height * 2);
+    fwrite(writer.bytes, 1, writer.length, output);
+    free(writer.bytes);
+}
+
+/* Reads a progressive stream, delivering the preview after the first pass */
+Codeword_Array *read_progressive_image(FILE *input, Preview_Callback preview,
+                                       void *closure)
+{
+    assert(input != NULL);
+
+    char magic_number[256];
+    if (fgets(magic_number, sizeof(magic_number), input) == NULL ||
+        strcmp(magic_number, PROGRESSIVE_MAGIC_NUMBER) != 0) {
+        fprintf(stderr, "Error: Invalid progressive image format.\n");
+        return NULL;
+    }
+
+    int width, height;
+    if (fscanf(input, "%d %d", &width, &height) != 2 || width < 0 ||
+        height < 0 || fgetc(input) != '\n') {
+        fprintf(stderr, "Error: Could not read progressive image dimensions.\n");
+        return NULL;
+    }
+
+    Codeword_Array *codeword_array = malloc(sizeof(Codeword_Array));
+    assert(codeword_array != NULL);
+    codeword_array->width = width / 2;
+    codeword_array->height = height / 2;
+    codeword_array->count = codeword_array->width * codeword_array->height;
+
+    int count = codeword_array->count;
+    size_t dc_length = packed_length(count, DC_BITS);
+    size_t detail_length = packed_length(count, DETAIL_BITS);
+
+    /* One buffer for both passes; the bit reader may look one word ahead */
+    unsigned char *bytes = calloc(dc_length + detail_length + 8, 1);
+    codeword_array->words = malloc((count + 1) * sizeof(uint32_t));
+    assert(bytes != NULL && codeword_array->words != NULL);
+
+    /* 1. First pass: a, Pb and Pr, which is all the preview needs */
+    if (fread(bytes, 1, dc_length, input) != dc_length) {
+        fprintf(stderr, "Error: Unexpected end of file in the first pass.\n");
+        free(bytes);
+        free_codeword_array(codeword_array);
+        return NULL;
+    }
+
+    Bit_Reader reader = { bytes, 0, 0 };
+    for (int i = 0; i < count; i++) {
+        uint32_t a = get_bits(&reader, A_WIDTH);
+        uint32_t chroma = get_bits(&reader, PB_INDEX_WIDTH + PR_INDEX_WIDTH);
+        codeword_array->words[i] = a << A_LSB | chroma;
+    }
+
+    if (preview != NULL) {
+        Image *image = preview_image(codeword_array->words,
+                                     codeword_array->width,
+                                     codeword_array->height);
+        preview(image, closure);
+        free_image(image);
+    }
+
+    /* 2. Second pass: b, c and d */
+    if (fread(bytes + dc_length, 1, detail_length, input) != detail_length) {
+        fprintf(stderr, "Error: Unexpected end of file in the second pass.\n");
+        free(bytes);
+        free_codeword_array(codeword_array);
+        return NULL;
+    }
+
+    reader = (Bit_Reader){ bytes + dc_length, 0, 0 };
+    for (int i = 0; i < count; i++) {
+        codeword_array->words[i] |= get_bits(&reader, DETAIL_BITS) << DETAIL_LSB;
+    }
+    free(bytes);
+
+    return codeword_array;
+}
+
+/* Compresses a PPM image and writes it in progressive order */
+void compress40_progressive(FILE *input, FILE *output)
+{
+    /* 1. Image Reader and Preprocessor */
+    Image *image = read_image(input);
+    if (image == NULL) {
+        fprintf(stderr, "Error: Failed to read image.\n");
+        exit(EXIT_FAILURE);
+    }
+    Image_View view = even_view(image_view(image), EDGE_DROP);
+
+    /* 2. The banded encode every compressor shares */
+    Codeword_Array *codeword_array =
+        compress40_encode(&view, tuning_profile()->compress_band_rows,
+                          tuning_threads());
+    free_image(image);
+
+    /* 3. Progressive Writer */
+    write_progressive_image(output, codeword_array);
+    free_codeword_array(codeword_array);
+}
+
+/* Writes a preview to the output as soon as it is ready */
+static void write_preview(const Image *preview, void *closure)
+{
+    FILE *output = closure;
+    write_image(output, (Image *)preview);
+    fflush(output);
+}
+
+/* Decompresses a progressive stream to a PPM image */
+void decompress40_progressive(FILE *input, FILE *output, bool preview)
+{
+    Codeword_Array *codeword_array =
+        read_progressive_image(input, preview ? write_preview : NULL, output);
+    if (codeword_array == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    Image *image = decode_codewords(codeword_array);
+    free_codeword_array(codeword_array);
+    write_image(output, image);
+    free_image(image);
+}
+
+/* Allocates an image with uninitialized pixels */
+static Image *new_image(int width, int height)
+{
+    Image *image = malloc(sizeof(Image));
+    assert(image != NULL);
+    image->width = width;
+    image->height = height;
+    image->pixels = malloc(height * sizeof(Pixel *));
+    assert(image->pixels != NULL || height == 0);
+    for (int y = 0; y < height; y++) {
+        image->pixels[y] = malloc(width * sizeof(Pixel));
+        assert(image->pixels[y] != NULL || width == 0);
+    }
+    return image;
+}
+
+/* Builds the half-resolution preview: one pixel per block, whose
+   luminance is the block mean a */
+static Image *preview_image(const uint32_t *words, int width, int height)
+{
+    Image *image = new_image(width, height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            DCT_Block dct_block;
+            unpack_codeword(words[y * width + x], &dct_block);
+            image->pixels[y][x] = ypbpr_pixel_to_rgb((YPbPr_pixel){
+                dct_block.a, dct_block.pb_avg, dct_block.pr_avg });
+        }
+    }
+    return image;
+}
+
+/* Decodes every block of a Codeword_Array into a full-size image */
+static Image *decode_codewords(Codeword_Array *codeword_array)
+{
+    int width = codeword_array->width;
+    Image *image = new_image(width * 2, codeword_array->height * 2);
+    for (int row = 0; row < codeword_array->height; row++) {
+        decode_block_run(NULL, codeword_array->words + row * width, width,
+                         image->pixels[2 * row], image->pixels[2 * row + 1]);
+    }
+    return image;
+}
@@ -0,0 +1,58 @@
+/* progressive.h */
+
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <stdio.h>
+#include "image_processing.h"  // For Image
+#include "quantization.h"  // For Codeword_Array
+
+/* Called once the first pass of a progressive stream has arrived. The
+   preview is half the size of the image (one pixel per block) and is
+   freed by the decoder when the callback returns. */
+typedef void (*Preview_Callback)(const Image *preview, void *closure);
+
+/* Function Prototypes */
+
+/**
+ * Writes a compressed image in progressive order. The first pass holds
+ * the a, Pb and Pr fields of every block, which is enough for a
+ * half-resolution preview; the second pass holds the b, c and d fields.
+ * Both passes are bit-packed, so the stream is the same size as the
+ * row-major one apart from at most two bytes of padding.
+ * @param output The output file pointer.
+ * @param codeword_array The Codeword_Array containing codewords.
+ */
+void write_progressive_image(FILE *output, Codeword_Array *codeword_array);
+
+/**
+ * Reads a progressive stream back into a Codeword_Array. If preview is
+ * not NULL it is called as soon as the first pass has been read, before
+ * any of the second pass is waited for.
+ * @param input The input file pointer.
+ * @param preview The callback to deliver the preview to, or NULL.
+ * @param closure Passed through to the callback.
+ * @return A pointer to the Codeword_Array, or NULL (after printing an
+ * error) if the input is invalid.
+ */
+Codeword_Array *read_progressive_image(FILE *input, Preview_Callback preview,
+                                       void *closure);
+
+/**
+ * Compresses a PPM image and writes it in progressive order.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ */
+void compress40_progressive(FILE *input, FILE *output);
+
+/**
+ * Decompresses a progressive stream to a PPM image. If preview is true
+ * the half-resolution preview is written and flushed first, so the
+ * output is two PPM images, the second being the full image.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ * @param preview Whether to write the preview as well.
+ */
+void decompress40_progressive(FILE *input, FILE *output, bool preview);
+
+#endif /* PROGRESSIVE_H */
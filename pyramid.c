@@ -0,0 +1,487 @@
+/* pyramid.c */
+
+#include "pyramid.h"
+#include "image_processing.h"
+#include "color_conversion.h"
+#include "chroma_processing.h"
+#include "transform.h"
+#include "io.h"
+#include "huge_alloc.h"
+#include "uarray2b.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+/* Container layout:
+ *
+ *     "COMP40 Pyramid format 1\n"
+ *     "<levels> <tile side in blocks>\n"
+ *     "<width> <height>\n"                  one line per level, in pixels
+ *     directory                             per level, tiles row-major:
+ *                                           8-byte offset, 4-byte length,
+ *                                           both big-endian
+ *     tiles                                 each a complete compressed image
+ */
+#define PYRAMID_MAGIC_NUMBER "COMP40 Pyramid format 1\n"
+#define DIRECTORY_ENTRY_BYTES 12
+#define MAX_LEVELS 32
+
+/* Size of the buffer used to copy a tile out */
+#define COPY_BUFFER_SIZE 65536
+
+/* Geometry of one level */
+typedef struct {
+    int width;          // In pixels
+    int height;
+    int tiles_x;
+    int tiles_y;
+    int first_tile;     // Index of the level's first directory entry
+} Level;
+
+struct Pyramid {
+    FILE *file;
+    int level_count;
+    int tile_blocks;
+    Level levels[MAX_LEVELS];
+    int tile_count;
+    uint64_t *offsets;
+    uint32_t *lengths;
+};
+
+/* Writes the tiles of one level as UArray2b_map walks it */
+typedef struct {
+    FILE *output;
+    const Level *level;
+    size_t used;
+    unsigned char buffer[COPY_BUFFER_SIZE];
+} Tile_Writer;
+
+/* Helper functions */
+static YPbPr_image *block_means(DCT_Array *dct_array);
+static void plan_levels(int width, int height, int tile_blocks, Level *levels,
+                        int level_count);
+static void tile_size(const Level *level, int tile_blocks, int tile_x,
+                      int tile_y, int *width, int *height);
+static void put_big_endian(unsigned char *bytes, uint64_t value, int length);
+static uint64_t get_big_endian(const unsigned char *bytes, int length);
+static bool find_tile(Pyramid pyramid, int level, int tile_x, int tile_y,
+                      int *entry);
+static void write_level(FILE *output, const Level *level,
+                        Codeword_Array *codeword_array);
+static void store_codeword(int col, int row, UArray2b_T tiles, void *elem,
+                           void *cl);
+static void write_tile_codeword(int col, int row, UArray2b_T tiles,
+                                void *elem, void *cl);
+static void flush_tiles(Tile_Writer *writer);
+
+/* Compresses a PPM image into a pyramid container */
+void compress40_pyramid(FILE *input, FILE *output)
+{
+    /* 1. Image Reader, Preprocessor and RGB to YPbPr Conversion */
+    Image *image = read_image(input);
+    if (image == NULL) {
+        fprintf(stderr, "Error: Failed to read image.\n");
+        exit(EXIT_FAILURE);
+    }
+    Image_View view = even_view(image_view(image), EDGE_DROP);
+    YPbPr_image *ypbpr_image = rgb_view_to_ypbpr(&view);
+    free_image(image);
+
+    /* 2. Encode each level, deriving the next from its block means */
+    Codeword_Array *codewords[MAX_LEVELS];
+    int level_count = 0;
+    while (true) {
+        Block_Array *block_array = create_blocks(ypbpr_image);
+        free_ypbpr_image(ypbpr_image);
+        DCT_Array *dct_array = perform_dct(block_array);
+        free_block_array(block_array);
+
+        codewords[level_count++] = quantize_and_pack(dct_array);
+
+        bool fits_one_tile = dct_array->width <= PYRAMID_TILE_BLOCKS &&
+                             dct_array->height <= PYRAMID_TILE_BLOCKS;
+        bool can_halve = dct_array->width >= 2 && dct_array->height >= 2;
+        if (fits_one_tile || !can_halve || level_count == MAX_LEVELS) {
+            free_dct_array(dct_array);
+            break;
+        }
+        ypbpr_image = block_means(dct_array);
+        free_dct_array(dct_array);
+    }
+
+    /* 3. Lay out the directory; tile sizes follow from the level sizes */
+    Level levels[MAX_LEVELS];
+    plan_levels(codewords[0]->width * 2, codewords[0]->height * 2,
+                PYRAMID_TILE_BLOCKS, levels, level_count);
+
+    int tile_count = levels[level_count - 1].first_tile +
+                     levels[level_count - 1].tiles_x * levels[level_count - 1].tiles_y;
+
+    size_t header_length = strlen(PYRAMID_MAGIC_NUMBER) +
+        snprintf(NULL, 0, "%d %d\n", level_count, PYRAMID_TILE_BLOCKS);
+    for (int l = 0; l < level_count; l++) {
+        header_length += snprintf(NULL, 0, "%d %d\n", levels[l].width,
+                                  levels[l].height);
+    }
+
+    unsigned char *directory = malloc((size_t)tile_count * DIRECTORY_ENTRY_BYTES + 1);
+    assert(directory != NULL);
+
+    uint64_t offset = header_length + (uint64_t)tile_count * DIRECTORY_ENTRY_BYTES;
+    for (int l = 0; l < level_count; l++) {
+        for (int ty = 0; ty < levels[l].tiles_y; ty++) {
+            for (int tx = 0; tx < levels[l].tiles_x; tx++) {
+                int width, height;
+                tile_size(&levels[l], PYRAMID_TILE_BLOCKS, tx, ty, &width, &height);
+                uint32_t length = compressed_header_length(width, height) +
+                                  (width / 2) * (height / 2) * sizeof(uint32_t);
+
+                unsigned char *entry = directory + DIRECTORY_ENTRY_BYTES *
+                    (levels[l].first_tile + ty * levels[l].tiles_x + tx);
+                put_big_endian(entry, offset, 8);
+                put_big_endian(entry + 8, length, 4);
+                offset += length;
+            }
+        }
+    }
+
+    /* 4. Write the header, the directory and the tiles */
+    fprintf(output, "%s%d %d\n", PYRAMID_MAGIC_NUMBER, level_count,
+            PYRAMID_TILE_BLOCKS);
+    for (int l = 0; l < level_count; l++) {
+        fprintf(output, "%d %d\n", levels[l].width, levels[l].height);
+    }
+    fwrite(directory, DIRECTORY_ENTRY_BYTES, tile_count, output);
+    free(directory);
+
+    for (int l = 0; l < level_count; l++) {
+        write_level(output, &levels[l], codewords[l]);
+        free_codeword_array(codewords[l]);
+    }
+}
+
+/* Opens a pyramid container */
+Pyramid pyramid_open(FILE *input)
+{
+    assert(input != NULL);
+
+    if (!is_regular_file(input)) {
+        fprintf(stderr, "Error: A pyramid must be read from a regular file.\n");
+        return NULL;
+    }
+
+    char magic_number[256];
+    if (fgets(magic_number, sizeof(magic_number), input) == NULL ||
+        strcmp(magic_number, PYRAMID_MAGIC_NUMBER) != 0) {
+        fprintf(stderr, "Error: Invalid pyramid format.\n");
+        return NULL;
+    }
+
+    Pyramid pyramid = malloc(sizeof(*pyramid));
+    assert(pyramid != NULL);
+    pyramid->file = input;
+    pyramid->offsets = NULL;
+    pyramid->lengths = NULL;
+
+    /* The level sizes must be the ones compress40_pyramid would derive */
+    int width, height;
+    bool valid = fscanf(input, "%d %d", &pyramid->level_count,
+                        &pyramid->tile_blocks) == 2 &&
+                 pyramid->level_count > 0 && pyramid->level_count <= MAX_LEVELS &&
+                 pyramid->tile_blocks > 0 &&
+                 fscanf(input, "%d %d", &width, &height) == 2 &&
+                 width >= 0 && height >= 0 && width % 2 == 0 && height % 2 == 0;
+    if (valid) {
+        plan_levels(width, height, pyramid->tile_blocks, pyramid->levels,
+                    pyramid->level_count);
+        for (int l = 1; l < pyramid->level_count && valid; l++) {
+            valid = fscanf(input, "%d %d", &width, &height) == 2 &&
+                    width == pyramid->levels[l].width &&
+                    height == pyramid->levels[l].height;
+        }
+    }
+    if (!valid || fgetc(input) != '\n') {
+        fprintf(stderr, "Error: Invalid pyramid header.\n");
+        pyramid_free(&pyramid);
+        return NULL;
+    }
+
+    Level *last = &pyramid->levels[pyramid->level_count - 1];
+    pyramid->tile_count = last->first_tile + last->tiles_x * last->tiles_y;
+
+    size_t directory_bytes = (size_t)pyramid->tile_count * DIRECTORY_ENTRY_BYTES;
+    unsigned char *directory = malloc(directory_bytes + 1);
+    pyramid->offsets = malloc((pyramid->tile_count + 1) * sizeof(uint64_t));
+    pyramid->lengths = malloc((pyramid->tile_count + 1) * sizeof(uint32_t));
+    assert(directory != NULL && pyramid->offsets != NULL && pyramid->lengths != NULL);
+
+    if (fread(directory, 1, directory_bytes, input) != directory_bytes) {
+        fprintf(stderr, "Error: Truncated pyramid directory.\n");
+        free(directory);
+        pyramid_free(&pyramid);
+        return NULL;
+    }
+    for (int i = 0; i < pyramid->tile_count; i++) {
+        pyramid->offsets[i] = get_big_endian(directory + DIRECTORY_ENTRY_BYTES * i, 8);
+        pyramid->lengths[i] = get_big_endian(directory + DIRECTORY_ENTRY_BYTES * i + 8, 4);
+    }
+    free(directory);
+
+    return pyramid;
+}
+
+/* Frees a pyramid */
+void pyramid_free(Pyramid *pyramid)
+{
+    assert(pyramid != NULL);
+
+    if (*pyramid == NULL) {
+        return;
+    }
+    free((*pyramid)->offsets);
+    free((*pyramid)->lengths);
+    free(*pyramid);
+    *pyramid = NULL;
+}
+
+/* Returns the number of levels in a pyramid */
+int pyramid_levels(Pyramid pyramid)
+{
+    assert(pyramid != NULL);
+    return pyramid->level_count;
+}
+
+/* Returns the size of a level */
+void pyramid_level_size(Pyramid pyramid, int level, int *width, int *height,
+                        int *tiles_x, int *tiles_y)
+{
+    assert(pyramid != NULL);
+    assert(level >= 0 && level < pyramid->level_count);
+
+    const Level *l = &pyramid->levels[level];
+    if (width != NULL) {
+        *width = l->width;
+    }
+    if (height != NULL) {
+        *height = l->height;
+    }
+    if (tiles_x != NULL) {
+        *tiles_x = l->tiles_x;
+    }
+    if (tiles_y != NULL) {
+        *tiles_y = l->tiles_y;
+    }
+}
+
+/* Reads one tile with a single seek */
+Codeword_Array *pyramid_read_tile(Pyramid pyramid, int level, int tile_x,
+                                  int tile_y)
+{
+    int entry;
+    if (!find_tile(pyramid, level, tile_x, tile_y, &entry)) {
+        return NULL;
+    }
+    if (fseeko(pyramid->file, pyramid->offsets[entry], SEEK_SET) != 0) {
+        fprintf(stderr, "Error: Could not seek to tile.\n");
+        return NULL;
+    }
+    return read_codeword_array(pyramid->file);
+}
+
+/* Copies one tile to output */
+bool pyramid_write_tile(Pyramid pyramid, int level, int tile_x, int tile_y,
+                        FILE *output)
+{
+    assert(output != NULL);
+
+    int entry;
+    if (!find_tile(pyramid, level, tile_x, tile_y, &entry)) {
+        return false;
+    }
+
+    unsigned char buffer[COPY_BUFFER_SIZE];
+    off_t offset = pyramid->offsets[entry];
+    size_t remaining = pyramid->lengths[entry];
+    while (remaining > 0) {
+        size_t chunk = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+        ssize_t got = pread(fileno(pyramid->file), buffer, chunk, offset);
+        if (got <= 0) {
+            fprintf(stderr, "Error: Truncated pyramid tile.\n");
+            return false;
+        }
+        fwrite(buffer, 1, got, output);
+        offset += got;
+        remaining -= got;
+    }
+    return true;
+}
+
+/* Helper function implementations */
+
+/* Builds the next level's image: one pixel per block, holding the block's
+   mean luma and its averaged chroma, trimmed to even dimensions */
+static YPbPr_image *block_means(DCT_Array *dct_array)
+{
+    int width = dct_array->width & ~1;
+    int height = dct_array->height & ~1;
+
+    YPbPr_image *ypbpr_image = malloc(sizeof(YPbPr_image));
+    assert(ypbpr_image != NULL);
+
+    ypbpr_image->width = width;
+    ypbpr_image->height = height;
+
+    ypbpr_image->pixels = huge_alloc_rows(height,
+                                          width * sizeof(YPbPr_pixel));
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            DCT_Block *dct_block = &dct_array->blocks[y][x];
+            ypbpr_image->pixels[y][x].y = dct_block->a;
+            ypbpr_image->pixels[y][x].pb = dct_block->pb_avg;
+            ypbpr_image->pixels[y][x].pr = dct_block->pr_avg;
+        }
+    }
+
+    return ypbpr_image;
+}
+
+/* Works out every level's size and tiling from level 0's size */
+static void plan_levels(int width, int height, int tile_blocks, Level *levels,
+                        int level_count)
+{
+    int first_tile = 0;
+    for (int l = 0; l < level_count; l++) {
+        int tile_pixels = 2 * tile_blocks;
+        levels[l].width = width;
+        levels[l].height = height;
+        levels[l].tiles_x = (width + tile_pixels - 1) / tile_pixels;
+        levels[l].tiles_y = (height + tile_pixels - 1) / tile_pixels;
+        levels[l].first_tile = first_tile;
+        first_tile += levels[l].tiles_x * levels[l].tiles_y;
+
+        /* The next level has one pixel per block, trimmed to even */
+        width = (width / 2) & ~1;
+        height = (height / 2) & ~1;
+    }
+}
+
+/* Returns the size in pixels of a tile; edge tiles may be smaller */
+static void tile_size(const Level *level, int tile_blocks, int tile_x,
+                      int tile_y, int *width, int *height)
+{
+    int tile_pixels = 2 * tile_blocks;
+    *width = level->width - tile_x * tile_pixels;
+    *height = level->height - tile_y * tile_pixels;
+    if (*width > tile_pixels) {
+        *width = tile_pixels;
+    }
+    if (*height > tile_pixels) {
+        *height = tile_pixels;
+    }
+}
+
+/* Stores value in length bytes, most significant first */
+static void put_big_endian(unsigned char *bytes, uint64_t value, int length)
+{
+    for (int i = length - 1; i >= 0; i--) {
+        bytes[i] = value & 0xFF;
+        value >>= 8;
+    }
+}
+
+/* Loads a length-byte value stored most significant first */
+static uint64_t get_big_endian(const unsigned char *bytes, int length)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < length; i++) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+/* Finds the directory entry of a tile, printing an error if there is none */
+static bool find_tile(Pyramid pyramid, int level, int tile_x, int tile_y,
+                      int *entry)
+{
+    assert(pyramid != NULL);
+
+    if (level < 0 || level >= pyramid->level_count ||
+        tile_x < 0 || tile_x >= pyramid->levels[level].tiles_x ||
+        tile_y < 0 || tile_y >= pyramid->levels[level].tiles_y) {
+        fprintf(stderr, "Error: No such tile.\n");
+        return false;
+    }
+
+    const Level *l = &pyramid->levels[level];
+    *entry = l->first_tile + tile_y * l->tiles_x + tile_x;
+    return true;
+}
+
+/* Writes every tile of a level. With one tile per block of a UArray2b,
+   the block-major walk visits the codewords in file order: tiles
+   row-major, and each tile's codewords row-major within it. */
+static void write_level(FILE *output, const Level *level,
+                        Codeword_Array *codeword_array)
+{
+    UArray2b_T tiles = UArray2b_new(codeword_array->width,
+                                    codeword_array->height,
+                                    sizeof(uint32_t), PYRAMID_TILE_BLOCKS);
+    UArray2b_map_row_major(tiles, store_codeword, codeword_array);
+
+    Tile_Writer *writer = malloc(sizeof(Tile_Writer));
+    assert(writer != NULL);
+    writer->output = output;
+    writer->level = level;
+    writer->used = 0;
+    UArray2b_map(tiles, write_tile_codeword, writer);
+    flush_tiles(writer);
+
+    free(writer);
+    UArray2b_free(&tiles);
+}
+
+/* Copies a codeword into the tiled array, walking the source in order */
+static void store_codeword(int col, int row, UArray2b_T tiles, void *elem,
+                           void *cl)
+{
+    const Codeword_Array *codeword_array = cl;
+    (void)tiles;
+    *(uint32_t *)elem = codeword_array->words[(size_t)row *
+                                              codeword_array->width + col];
+}
+
+/* Appends one codeword, big-endian, starting a tile with its header when
+   the codeword is the tile's top-left one */
+static void write_tile_codeword(int col, int row, UArray2b_T tiles,
+                                void *elem, void *cl)
+{
+    Tile_Writer *writer = cl;
+    int blocksize = UArray2b_blocksize(tiles);
+
+    if (col % blocksize == 0 && row % blocksize == 0) {
+        int width, height;
+        tile_size(writer->level, blocksize, col / blocksize, row / blocksize,
+                  &width, &height);
+        flush_tiles(writer);
+        write_compressed_header(writer->output, width, height);
+    }
+    if (writer->used + 4 > sizeof(writer->buffer)) {
+        flush_tiles(writer);
+    }
+
+    uint32_t codeword = *(uint32_t *)elem;
+    unsigned char *out = writer->buffer + writer->used;
+    for (int byte = 3; byte >= 0; byte--) {
+        *out++ = (codeword >> (byte * 8)) & 0xFF;
+    }
+    writer->used += 4;
+}
+
+/* Writes out the codewords buffered so far */
+static void flush_tiles(Tile_Writer *writer)
+{
+    fwrite(writer->buffer, 1, writer->used, writer->output);
+    writer->used = 0;
+}
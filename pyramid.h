@@ -0,0 +1,86 @@
+/* pyramid.h */
+
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "quantization.h"  // For Codeword_Array
+
+/* Side of a pyramid tile, in blocks (256 x 256 pixels) */
+#define PYRAMID_TILE_BLOCKS 128
+
+/* A multi-resolution container opened for reading */
+typedef struct Pyramid *Pyramid;
+
+/* Function Prototypes */
+
+/**
+ * Compresses a PPM image into a pyramid container. Level 0 is the full
+ * image; each further level is half the size of the one before, built
+ * from that level's block means (a, Pb, Pr) during the same pass, so
+ * the pixels are read and colour-converted only once. Levels stop when
+ * one fits in a single tile or cannot be halved again.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ */
+void compress40_pyramid(FILE *input, FILE *output);
+
+/**
+ * Opens a pyramid container. The file must be a regular file, since
+ * tiles are read by seeking.
+ * @param input The input file pointer; it stays owned by the caller.
+ * @return The pyramid, or NULL (after printing an error) if invalid.
+ */
+Pyramid pyramid_open(FILE *input);
+
+/**
+ * Frees a pyramid opened with pyramid_open and sets *pyramid to NULL.
+ * @param pyramid Pointer to the pyramid.
+ */
+void pyramid_free(Pyramid *pyramid);
+
+/**
+ * Returns the number of levels in a pyramid.
+ * @param pyramid The pyramid.
+ * @return The number of levels.
+ */
+int pyramid_levels(Pyramid pyramid);
+
+/**
+ * Returns the size of a level in pixels and in tiles.
+ * @param pyramid The pyramid.
+ * @param level The level, 0 being full resolution.
+ * @param width Pointer to store the width in pixels, or NULL.
+ * @param height Pointer to store the height in pixels, or NULL.
+ * @param tiles_x Pointer to store the number of tile columns, or NULL.
+ * @param tiles_y Pointer to store the number of tile rows, or NULL.
+ */
+void pyramid_level_size(Pyramid pyramid, int level, int *width, int *height,
+                        int *tiles_x, int *tiles_y);
+
+/**
+ * Reads one tile with a single seek. Each tile is stored as a complete
+ * compressed image.
+ * @param pyramid The pyramid.
+ * @param level The level.
+ * @param tile_x The tile column.
+ * @param tile_y The tile row.
+ * @return A pointer to the tile's Codeword_Array, or NULL on error.
+ */
+Codeword_Array *pyramid_read_tile(Pyramid pyramid, int level, int tile_x,
+                                  int tile_y);
+
+/**
+ * Copies one tile, as a compressed image, to output.
+ * @param pyramid The pyramid.
+ * @param level The level.
+ * @param tile_x The tile column.
+ * @param tile_y The tile row.
+ * @param output The output file pointer.
+ * @return true on success, false (after printing an error) otherwise.
+ */
+bool pyramid_write_tile(Pyramid pyramid, int level, int tile_x, int tile_y,
+                        FILE *output);
+
+#endif /* PYRAMID_H */
@@ -2,6 +2,7 @@
 
 #include "quantization.h"
 #include "bitpack.h"
+#include "huge_alloc.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <math.h>
@@ -11,37 +12,14 @@
 #define A_SCALE_FACTOR 511.0    // For 'a' coefficient (9 bits unsigned)
 #define BCD_SCALE_FACTOR 50.0   // For 'b', 'c', 'd' coefficients (5 bits signed)
 
-/* Bit widths for packing */
-#define A_WIDTH 9
-#define B_WIDTH 5
-#define C_WIDTH 5
-#define D_WIDTH 5
-#define PB_INDEX_WIDTH 4
-#define PR_INDEX_WIDTH 4
-
-/* Bit positions for packing */
-#define A_LSB 23
-#define B_LSB 18
-#define C_LSB 13
-#define D_LSB 8
-#define PB_LSB 4
-#define PR_LSB 0
-
-/* Quantization and dequantization functions */
-static unsigned quantize_a(float a);
-static int quantize_bcd(float coefficient);
-static float dequantize_a(unsigned a_quant);
-static float dequantize_bcd(int bcd_quant);
-
-/* Chroma index mapping */
-static unsigned index_of_chroma(float chroma);
-static float chroma_of_index(unsigned index);
-
 /* Constants for chroma index mapping */
 #define CHROMA_MIN -0.3
 #define CHROMA_MAX 0.3
 #define CHROMA_STEPS 15
 
+/* Largest magnitude of a quantized b, c or d (5 bits signed) */
+#define BCD_LEVELS 15
+
 /* Quantizes and packs DCT coefficients into codewords */
 Codeword_Array *quantize_and_pack(DCT_Array *dct_array)
 {
@@ -56,6 +34,8 @@ Codeword_Array *quantize_and_pack(DCT_Array *dct_array)
     assert(codeword_array != NULL);
 
     codeword_array->count = num_codewords;
+    codeword_array->width = width;
+    codeword_array->height = height;
     codeword_array->words = malloc(num_codewords * sizeof(uint32_t));
     assert(codeword_array->words != NULL);
 
@@ -96,11 +76,9 @@ DCT_Array *unpack_and_dequantize(Codeword_Array *codeword_array)
 {
     assert(codeword_array != NULL);
 
-    int num_codewords = codeword_array->count;
-
-    /* Determine dimensions */
-    int width = sqrt(num_codewords);   // Assuming square image for simplicity
-    int height = width;
+    int width = codeword_array->width;
+    int height = codeword_array->height;
+    assert(codeword_array->count == width * height);
 
     /* Allocate memory for DCT_Array */
     DCT_Array *dct_array = malloc(sizeof(DCT_Array));
@@ -109,51 +87,41 @@ DCT_Array *unpack_and_dequantize(Codeword_Array *codeword_array)
     dct_array->width = width;
     dct_array->height = height;
 
-    dct_array->blocks = malloc(height * sizeof(DCT_Block *));
-    assert(dct_array->blocks != NULL);
-
-    for (int i = 0; i < height; i++) {
-        dct_array->blocks[i] = malloc(width * sizeof(DCT_Block));
-        assert(dct_array->blocks[i] != NULL);
-    }
+    dct_array->blocks = huge_alloc_rows(height, width * sizeof(DCT_Block));
 
     int index = 0;
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
             uint32_t codeword = codeword_array->words[index++];
-
-            /* Unpack the codeword */
-            unsigned a_quant = Bitpack_getu(codeword, A_WIDTH, A_LSB);
-            int b_quant = Bitpack_gets(codeword, B_WIDTH, B_LSB);
-            int c_quant = Bitpack_gets(codeword, C_WIDTH, C_LSB);
-            int d_quant = Bitpack_gets(codeword, D_WIDTH, D_LSB);
-            unsigned pb_index = Bitpack_getu(codeword, PB_INDEX_WIDTH, PB_LSB);
-            unsigned pr_index = Bitpack_getu(codeword, PR_INDEX_WIDTH, PR_LSB);
-
-            /* Dequantize coefficients */
-            float a = dequantize_a(a_quant);
-            float b = dequantize_bcd(b_quant);
-            float c = dequantize_bcd(c_quant);
-            float d = dequantize_bcd(d_quant);
-
-            /* Retrieve chroma values */
-            float pb_avg = chroma_of_index(pb_index);
-            float pr_avg = chroma_of_index(pr_index);
-
-            /* Store in DCT_Block */
-            DCT_Block *dct_block = &dct_array->blocks[y][x];
-            dct_block->a = a;
-            dct_block->b = b;
-            dct_block->c = c;
-            dct_block->d = d;
-            dct_block->pb_avg = pb_avg;
-            dct_block->pr_avg = pr_avg;
+            unpack_codeword(codeword, &dct_array->blocks[y][x]);
         }
     }
 
     return dct_array;
 }
 
+/* Unpacks and dequantizes a single codeword */
+void unpack_codeword(uint32_t codeword, DCT_Block *dct_block)
+{
+    assert(dct_block != NULL);
+
+    /* Unpack the codeword */
+    unsigned a_quant = Bitpack_getu(codeword, A_WIDTH, A_LSB);
+    int b_quant = Bitpack_gets(codeword, B_WIDTH, B_LSB);
+    int c_quant = Bitpack_gets(codeword, C_WIDTH, C_LSB);
+    int d_quant = Bitpack_gets(codeword, D_WIDTH, D_LSB);
+    unsigned pb_index = Bitpack_getu(codeword, PB_INDEX_WIDTH, PB_LSB);
+    unsigned pr_index = Bitpack_getu(codeword, PR_INDEX_WIDTH, PR_LSB);
+
+    /* Dequantize coefficients and retrieve chroma values */
+    dct_block->a = dequantize_a(a_quant);
+    dct_block->b = dequantize_bcd(b_quant);
+    dct_block->c = dequantize_bcd(c_quant);
+    dct_block->d = dequantize_bcd(d_quant);
+    dct_block->pb_avg = chroma_of_index(pb_index);
+    dct_block->pr_avg = chroma_of_index(pr_index);
+}
+
 /* Frees the memory allocated for the Codeword_Array */
 void free_codeword_array(Codeword_Array *codeword_array)
 {
@@ -165,10 +133,10 @@ void free_codeword_array(Codeword_Array *codeword_array)
     free(codeword_array);
 }
 
-/* Helper function implementations */
+/* Quantization helper implementations */
 
 /* Quantizes coefficient 'a' to an unsigned integer */
-static unsigned quantize_a(float a)
+unsigned quantize_a(float a)
 {
     /* Ensure 'a' is within [0,1] */
     if (a < 0.0) a = 0.0;
@@ -179,14 +147,14 @@ static unsigned quantize_a(float a)
 }
 
 /* Dequantizes coefficient 'a' from an unsigned integer */
-static float dequantize_a(unsigned a_quant)
+float dequantize_a(unsigned a_quant)
 {
     float a = (float)a_quant / A_SCALE_FACTOR;
     return a;
 }
 
 /* Quantizes coefficients 'b', 'c', 'd' to signed integers */
-static int quantize_bcd(float coefficient)
+int quantize_bcd(float coefficient)
 {
     /* Clamp coefficient to the range [-0.3, 0.3] */
     if (coefficient < -0.3) coefficient = -0.3;
@@ -197,14 +165,14 @@ static int quantize_bcd(float coefficient)
 }
 
 /* Dequantizes coefficients 'b', 'c', 'd' from signed integers */
-static float dequantize_bcd(int bcd_quant)
+float dequantize_bcd(int bcd_quant)
 {
     float coefficient = (float)bcd_quant / BCD_SCALE_FACTOR;
     return coefficient;
 }
 
 /* Maps chroma values to an index */
-static unsigned index_of_chroma(float chroma)
+unsigned index_of_chroma(float chroma)
 {
     /* Clamp chroma to the range [-0.3, 0.3] */
     if (chroma < CHROMA_MIN) chroma = CHROMA_MIN;
@@ -216,9 +184,46 @@ static unsigned index_of_chroma(float chroma)
 }
 
 /* Retrieves chroma value from an index */
-static float chroma_of_index(unsigned index)
+float chroma_of_index(unsigned index)
 {
     if (index > CHROMA_STEPS) index = CHROMA_STEPS;
     float chroma = CHROMA_MIN + ((float)index / CHROMA_STEPS) * (CHROMA_MAX - CHROMA_MIN);
     return chroma;
 }
+
+/* Quantizes a b, c or d coefficient over +/-range */
+int quantize_bcd_in_range(float coefficient, float range)
+{
+    assert(range > 0);
+
+    if (coefficient < -range) coefficient = -range;
+    if (coefficient > range) coefficient = range;
+
+    return (int)round(coefficient * BCD_LEVELS / range);
+}
+
+/* Dequantizes a b, c or d coefficient quantized over +/-range */
+float dequantize_bcd_in_range(int bcd_quant, float range)
+{
+    return (float)bcd_quant * range / BCD_LEVELS;
+}
+
+/* Maps a chroma value over +/-range to an index */
+unsigned index_of_chroma_in_range(float chroma, float range)
+{
+    assert(range > 0);
+
+    if (chroma < -range) chroma = -range;
+    if (chroma > range) chroma = range;
+
+    unsigned index = (unsigned)round((chroma + range) / (2 * range) * CHROMA_STEPS);
+    if (index > CHROMA_STEPS) index = CHROMA_STEPS;
+    return index;
+}
+
+/* Retrieves a chroma value over +/-range from an index */
+float chroma_of_index_in_range(unsigned index, float range)
+{
+    if (index > CHROMA_STEPS) index = CHROMA_STEPS;
+    return -range + ((float)index / CHROMA_STEPS) * 2 * range;
+}
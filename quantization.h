@@ -6,10 +6,28 @@
 #include "transform.h"  // For DCT_Array and DCT_Block
 #include <stdint.h>
 
+/* Bit widths for packing */
+#define A_WIDTH 9
+#define B_WIDTH 5
+#define C_WIDTH 5
+#define D_WIDTH 5
+#define PB_INDEX_WIDTH 4
+#define PR_INDEX_WIDTH 4
+
+/* Bit positions for packing */
+#define A_LSB 23
+#define B_LSB 18
+#define C_LSB 13
+#define D_LSB 8
+#define PB_LSB 4
+#define PR_LSB 0
+
 /* Structure to represent an array of codewords */
 typedef struct {
     int count;       // Number of codewords
-    uint32_t *words; // Array of 32-bit codewords
+    int width;       // Number of blocks horizontally
+    int height;      // Number of blocks vertically
+    uint32_t *words; // Array of 32-bit codewords, row-major
 } Codeword_Array;
 
 /* Function Prototypes */
@@ -28,6 +46,91 @@ Codeword_Array *quantize_and_pack(DCT_Array *dct_array);
  */
 DCT_Array *unpack_and_dequantize(Codeword_Array *codeword_array);
 
+/**
+ * Unpacks a single 32-bit codeword and dequantizes its coefficients.
+ * @param codeword The codeword.
+ * @param dct_block Pointer to the DCT_Block to fill in.
+ */
+void unpack_codeword(uint32_t codeword, DCT_Block *dct_block);
+
+/**
+ * Quantizes coefficient 'a', clamped to [0, 1], to an unsigned integer.
+ * @param a The coefficient.
+ * @return The quantized value, which fits in A_WIDTH bits.
+ */
+unsigned quantize_a(float a);
+
+/**
+ * Dequantizes coefficient 'a'.
+ * @param a_quant The quantized value.
+ * @return The coefficient.
+ */
+float dequantize_a(unsigned a_quant);
+
+/**
+ * Quantizes coefficient 'b', 'c' or 'd', clamped to [-0.3, 0.3], to a
+ * signed integer.
+ * @param coefficient The coefficient.
+ * @return The quantized value, which fits in B_WIDTH bits.
+ */
+int quantize_bcd(float coefficient);
+
+/**
+ * Dequantizes coefficient 'b', 'c' or 'd'.
+ * @param bcd_quant The quantized value.
+ * @return The coefficient.
+ */
+float dequantize_bcd(int bcd_quant);
+
+/**
+ * Maps an averaged chroma value to its 4-bit index.
+ * @param chroma The Pb or Pr value.
+ * @return The index.
+ */
+unsigned index_of_chroma(float chroma);
+
+/**
+ * Maps a 4-bit index back to a chroma value.
+ * @param index The index.
+ * @return The Pb or Pr value.
+ */
+float chroma_of_index(unsigned index);
+
+/**
+ * Quantizes a b, c or d coefficient with a range other than the default
+ * +/-0.3: values are clamped to +/-range and spread over the same 31
+ * levels.
+ * @param coefficient The coefficient.
+ * @param range The largest magnitude represented.
+ * @return The quantized value, from -15 to 15.
+ */
+int quantize_bcd_in_range(float coefficient, float range);
+
+/**
+ * Inverse of quantize_bcd_in_range.
+ * @param bcd_quant The quantized value.
+ * @param range The range it was quantized with.
+ * @return The coefficient.
+ */
+float dequantize_bcd_in_range(int bcd_quant, float range);
+
+/**
+ * Maps a chroma value to its 4-bit index with a range other than the
+ * default +/-0.3.
+ * @param chroma The Pb or Pr value.
+ * @param range The largest magnitude represented.
+ * @return The index.
+ */
+unsigned index_of_chroma_in_range(float chroma, float range);
+
+/**
+ * Inverse of index_of_chroma_in_range.
+ * @param index The index.
+ * @param range The range it was mapped with.
+ * @return The Pb or Pr value.
+ */
+float chroma_of_index_in_range(unsigned index, float range);
+
 /**
  * Frees the memory allocated for the Codeword_Array.
  * @param codeword_array The Codeword_Array to be freed.
@@ -0,0 +1,523 @@
+/* rate_control.c */
+
+#include "rate_control.h"
+#include "image_processing.h"
+#include "color_conversion.h"
+#include "chroma_processing.h"
+#include "quantization.h"
+#include "bitstream.h"
+#include "parallel.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+/* Stream layout:
+ *
+ *     "COMP40 Adaptive format 1\n"
+ *     "<width> <height> <tile side in blocks>\n"
+ *     one byte per tile, row-major: bit 7 set if the tile keeps b, c
+ *         and d; bits 3-2 the b, c, d range; bits 1-0 the chroma range
+ *     per block, row-major over the whole image: a (9 bits), Pb (4),
+ *         Pr (4), then b, c, d (5 each) if its tile keeps them, as one
+ *         big-endian bit stream padded to a whole byte
+ */
+#define ADAPTIVE_MAGIC_NUMBER "COMP40 Adaptive format 1\n"
+#define DETAIL_FLAG 0x80
+
+#define DC_BITS (A_WIDTH + PB_INDEX_WIDTH + PR_INDEX_WIDTH)
+#define DETAIL_BITS (B_WIDTH + C_WIDTH + D_WIDTH)
+
+/* Candidate ranges. Entry 0 is the fixed encoder's, so a tile that
+   needs nothing else is quantized exactly as quantize_and_pack would. */
+#define RANGE_COUNT 4
+static const float BCD_RANGES[RANGE_COUNT] = { 0.3, 0.5, 0.15, 0.075 };
+static const float CHROMA_RANGES[RANGE_COUNT] = { 0.3, 0.5, 0.15, 0.075 };
+
+/* Contribution of a Pb or Pr error to the mean squared RGB error,
+   from the YPbPr to RGB matrix: (0.344136^2 + 1.772^2) / 3 and
+   (1.402^2 + 0.714136^2) / 3 */
+#define PB_ERROR_WEIGHT 1.0861
+#define PR_ERROR_WEIGHT 0.8252
+
+/* Mean squared error per sample of ypbpr_pixel_to_rgb truncating to a
+   byte: uniform over [0, 1/255), so (1/255)^2 / 3 */
+#define TRUNCATION_ERROR (1.0 / (3.0 * 255 * 255))
+
+/* The model leaves out the RGB clamp, which moves saturated images by a
+   few hundredths of a dB either way, so PSNR targets are met with this
+   much to spare */
+#define PSNR_MARGIN 0.1
+
+/* Squared error of a tile, summed over its pixels, with and without
+   its b, c and d fields */
+typedef struct {
+    double full_error;
+    double dc_error;
+    int blocks;
+} Tile_Cost;
+
+/* Shared by the threads measuring tiles */
+typedef struct {
+    DCT_Array *dct_array;
+    Rate_Plan *plan;
+    Tile_Cost *costs;
+} Measure_Job;
+
+/* A tile's priority for giving up its b, c and d fields */
+typedef struct {
+    double error_per_bit;
+    int tile;
+} Drop_Order;
+
+/* Helper functions */
+static void measure_rows(void *closure, int index, int thread_count);
+static void measure_tile(DCT_Array *dct_array, int tile_x, int tile_y,
+                         Tile_Params *params, Tile_Cost *cost);
+static double squared(double value);
+static int compare_drop_order(const void *a, const void *b);
+static size_t header_length(int width, int height);
+static uint64_t payload_bits(const Rate_Plan *plan, const Tile_Cost *costs);
+static void tile_extent(int width, int height, int tile_blocks, int tile_x,
+                        int tile_y, int *x0, int *y0, int *x1, int *y1);
+static double psnr_of(double error, long long pixels);
+
+/* Chooses per-tile quantization to meet a target */
+Rate_Plan *plan_rate(DCT_Array *dct_array, double base_error,
+                     Rate_Target target, int thread_count)
+{
+    assert(dct_array != NULL);
+
+    Rate_Plan *plan = malloc(sizeof(Rate_Plan));
+    assert(plan != NULL);
+    plan->width = dct_array->width;
+    plan->height = dct_array->height;
+    plan->tiles_x = (plan->width + RATE_TILE_BLOCKS - 1) / RATE_TILE_BLOCKS;
+    plan->tiles_y = (plan->height + RATE_TILE_BLOCKS - 1) / RATE_TILE_BLOCKS;
+    int tile_count = plan->tiles_x * plan->tiles_y;
+    plan->tiles = malloc((tile_count + 1) * sizeof(Tile_Params));
+    Tile_Cost *costs = malloc((tile_count + 1) * sizeof(Tile_Cost));
+    assert(plan->tiles != NULL && costs != NULL);
+
+    /* 1. Measure every tile's error under each candidate, in parallel */
+    Measure_Job job = { dct_array, plan, costs };
+    parallel_run(thread_count, measure_rows, &job);
+
+    long long pixels = 4LL * plan->width * plan->height;
+    double error = base_error + pixels * TRUNCATION_ERROR;
+    for (int t = 0; t < tile_count; t++) {
+        error += costs[t].full_error;
+    }
+    size_t fixed_bytes = header_length(plan->width, plan->height) + tile_count;
+
+    /* 2. Order tiles by the error each saved bit costs */
+    Drop_Order *order = malloc((tile_count + 1) * sizeof(Drop_Order));
+    assert(order != NULL);
+    for (int t = 0; t < tile_count; t++) {
+        order[t].error_per_bit = (costs[t].dc_error - costs[t].full_error) /
+                                 ((double)costs[t].blocks * DETAIL_BITS);
+        order[t].tile = t;
+    }
+    qsort(order, tile_count, sizeof(Drop_Order), compare_drop_order);
+
+    /* 3. Drop detail until the target is met */
+    uint64_t bits = payload_bits(plan, costs);
+    bool met = true;
+    if (target.kind == RATE_TARGET_BYTES) {
+        double budget = (target.value - fixed_bytes) * 8;
+        for (int i = 0; i < tile_count && bits > budget; i++) {
+            int t = order[i].tile;
+            plan->tiles[t].detail = false;
+            bits -= (uint64_t)costs[t].blocks * DETAIL_BITS;
+            error += costs[t].dc_error - costs[t].full_error;
+        }
+        met = bits <= budget;
+        if (!met) {
+            fprintf(stderr, "Error: The image needs at least %llu bytes.\n",
+                    (unsigned long long)(fixed_bytes + (bits + 7) / 8));
+        }
+    } else {
+        double allowed = pixels * pow(10, -(target.value + PSNR_MARGIN) / 10);
+        met = error <= allowed;
+        if (!met) {
+            fprintf(stderr, "Error: The image reaches at most %.2f dB.\n",
+                    psnr_of(error, pixels) - PSNR_MARGIN);
+        }
+        for (int i = 0; i < tile_count && met; i++) {
+            int t = order[i].tile;
+            double increase = costs[t].dc_error - costs[t].full_error;
+            if (error + increase <= allowed) {
+                plan->tiles[t].detail = false;
+                bits -= (uint64_t)costs[t].blocks * DETAIL_BITS;
+                error += increase;
+            }
+        }
+    }
+
+    free(order);
+    free(costs);
+    if (!met) {
+        free_rate_plan(plan);
+        return NULL;
+    }
+
+    plan->bytes = fixed_bytes + (bits + 7) / 8;
+    plan->psnr = psnr_of(error, pixels);
+    return plan;
+}
+
+/* Measures the error of giving each block a single Pb and Pr */
+double chroma_averaging_error(YPbPr_image *ypbpr_image,
+                              Block_Array *block_array)
+{
+    assert(ypbpr_image != NULL && block_array != NULL);
+
+    double error = 0;
+    for (int y = 0; y < block_array->height * 2; y++) {
+        const Block *row = block_array->blocks[y / 2];
+        for (int x = 0; x < block_array->width * 2; x++) {
+            YPbPr_pixel pixel = ypbpr_image->pixels[y][x];
+            error += PB_ERROR_WEIGHT * squared(pixel.pb - row[x / 2].pb_avg) +
+                     PR_ERROR_WEIGHT * squared(pixel.pr - row[x / 2].pr_avg);
+        }
+    }
+    return error;
+}
+
+/* Frees a plan */
+void free_rate_plan(Rate_Plan *plan)
+{
+    if (plan == NULL) {
+        return;
+    }
+    free(plan->tiles);
+    free(plan);
+}
+
+/* Writes a compressed image quantized as planned */
+void write_adaptive_image(FILE *output, DCT_Array *dct_array,
+                          const Rate_Plan *plan)
+{
+    assert(output != NULL);
+    assert(dct_array != NULL && plan != NULL);
+    assert(dct_array->width == plan->width && dct_array->height == plan->height);
+
+    int tile_count = plan->tiles_x * plan->tiles_y;
+    size_t fixed_bytes = header_length(plan->width, plan->height) + tile_count;
+    Bit_Writer writer = { malloc(plan->bytes - fixed_bytes + 1), 0, 0, 0 };
+    assert(writer.bytes != NULL);
+
+    for (int y = 0; y < plan->height; y++) {
+        const Tile_Params *row_tiles = plan->tiles +
+                                       (y / RATE_TILE_BLOCKS) * plan->tiles_x;
+        for (int x = 0; x < plan->width; x++) {
+            const Tile_Params *params = &row_tiles[x / RATE_TILE_BLOCKS];
+            DCT_Block *dct_block = &dct_array->blocks[y][x];
+            float chroma_range = CHROMA_RANGES[params->chroma_range];
+
+            put_bits(&writer, quantize_a(dct_block->a), A_WIDTH);
+            put_bits(&writer, index_of_chroma_in_range(dct_block->pb_avg,
+                                                       chroma_range),
+                     PB_INDEX_WIDTH);
+            put_bits(&writer, index_of_chroma_in_range(dct_block->pr_avg,
+                                                       chroma_range),
+                     PR_INDEX_WIDTH);
+            if (params->detail) {
+                float range = BCD_RANGES[params->bcd_range];
+                put_bits(&writer, quantize_bcd_in_range(dct_block->b, range),
+                         B_WIDTH);
+                put_bits(&writer, quantize_bcd_in_range(dct_block->c, range),
+                         C_WIDTH);
+                put_bits(&writer, quantize_bcd_in_range(dct_block->d, range),
+                         D_WIDTH);
+            }
+        }
+    }
+    flush_bits(&writer);
+    assert(fixed_bytes + writer.length == plan->bytes);
+
+    fprintf(output, "%s%d %d %d\n", ADAPTIVE_MAGIC_NUMBER, plan->width * 2,
+            plan->height * 2, RATE_TILE_BLOCKS);
+    for (int t = 0; t < tile_count; t++) {
+        const Tile_Params *params = &plan->tiles[t];
+        fputc((params->detail ? DETAIL_FLAG : 0) | params->bcd_range << 2 |
+              params->chroma_range, output);
+    }
+    fwrite(writer.bytes, 1, writer.length, output);
+    free(writer.bytes);
+}
+
+/* Compresses a PPM image to meet a target size or quality */
+void compress40_adaptive(FILE *input, FILE *output, Rate_Target target)
+{
+    /* 1. Image Reader, Preprocessor and RGB to YPbPr Conversion */
+    Image *image = read_image(input);
+    if (image == NULL) {
+        fprintf(stderr, "Error: Failed to read image.\n");
+        exit(EXIT_FAILURE);
+    }
+    Image_View view = even_view(image_view(image), EDGE_DROP);
+    YPbPr_image *ypbpr_image = rgb_view_to_ypbpr(&view);
+    free_image(image);
+
+    /* 2. Blocks and DCT */
+    Block_Array *block_array = create_blocks(ypbpr_image);
+    double base_error = chroma_averaging_error(ypbpr_image, block_array);
+    free_ypbpr_image(ypbpr_image);
+    DCT_Array *dct_array = perform_dct(block_array);
+    free_block_array(block_array);
+
+    /* 3. Rate Control, Quantization and Writer */
+    Rate_Plan *plan = plan_rate(dct_array, base_error, target,
+                                parallel_default_threads());
+    if (plan == NULL) {
+        free_dct_array(dct_array);
+        exit(EXIT_FAILURE);
+    }
+    write_adaptive_image(output, dct_array, plan);
+    free_rate_plan(plan);
+    free_dct_array(dct_array);
+}
+
+/* Decompresses an adaptive stream to a PPM image */
+void decompress40_adaptive(FILE *input, FILE *output)
+{
+    char magic_number[256];
+    int width, height, tile_blocks;
+    if (fgets(magic_number, sizeof(magic_number), input) == NULL ||
+        strcmp(magic_number, ADAPTIVE_MAGIC_NUMBER) != 0 ||
+        fscanf(input, "%d %d %d", &width, &height, &tile_blocks) != 3 ||
+        width < 0 || height < 0 || tile_blocks <= 0 || fgetc(input) != '\n') {
+        fprintf(stderr, "Error: Invalid adaptive image format.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* 1. Tile table, which also gives the length of the fields */
+    int block_width = width / 2;
+    int block_height = height / 2;
+    int tiles_x = (block_width + tile_blocks - 1) / tile_blocks;
+    int tiles_y = (block_height + tile_blocks - 1) / tile_blocks;
+    int tile_count = tiles_x * tiles_y;
+    unsigned char *table = malloc(tile_count + 1);
+    assert(table != NULL);
+    if (fread(table, 1, tile_count, input) != (size_t)tile_count) {
+        fprintf(stderr, "Error: Unexpected end of file in the tile table.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t bits = 0;
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            int x0, y0, x1, y1;
+            tile_extent(block_width, block_height, tile_blocks, tx, ty,
+                        &x0, &y0, &x1, &y1);
+            int per_block = DC_BITS + (table[ty * tiles_x + tx] & DETAIL_FLAG
+                                       ? DETAIL_BITS : 0);
+            bits += (uint64_t)(x1 - x0) * (y1 - y0) * per_block;
+        }
+    }
+
+    /* 2. Fields; the reader may look a few bytes past the end */
+    size_t length = (bits + 7) / 8;
+    unsigned char *bytes = calloc(length + 8, 1);
+    assert(bytes != NULL);
+    if (fread(bytes, 1, length, input) != length) {
+        fprintf(stderr, "Error: Unexpected end of file while reading codewords.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* 3. Dequantize with each tile's ranges, IDCT and colour conversion */
+    Image image = { block_width * 2, block_height * 2, NULL };
+    image.pixels = malloc((image.height + 1) * sizeof(Pixel *));
+    assert(image.pixels != NULL);
+    for (int y = 0; y < image.height; y++) {
+        image.pixels[y] = malloc((image.width + 1) * sizeof(Pixel));
+        assert(image.pixels[y] != NULL);
+    }
+
+    Bit_Reader reader = { bytes, 0, 0 };
+    for (int y = 0; y < block_height; y++) {
+        Pixel *top = image.pixels[2 * y];
+        Pixel *bottom = image.pixels[2 * y + 1];
+        for (int x = 0; x < block_width; x++) {
+            unsigned params = table[(y / tile_blocks) * tiles_x + x / tile_blocks];
+            float chroma_range = CHROMA_RANGES[params & 0x3];
+            float range = BCD_RANGES[(params >> 2) & 0x3];
+
+            DCT_Block dct_block = { 0, 0, 0, 0, 0, 0 };
+            dct_block.a = dequantize_a(get_bits(&reader, A_WIDTH));
+            dct_block.pb_avg = chroma_of_index_in_range(
+                get_bits(&reader, PB_INDEX_WIDTH), chroma_range);
+            dct_block.pr_avg = chroma_of_index_in_range(
+                get_bits(&reader, PR_INDEX_WIDTH), chroma_range);
+            if (params & DETAIL_FLAG) {
+                float *coefficients[3] = { &dct_block.b, &dct_block.c,
+                                           &dct_block.d };
+                for (int i = 0; i < 3; i++) {
+                    /* Sign-extend the 5-bit field */
+                    int quantized = get_bits(&reader, B_WIDTH);
+                    quantized -= (quantized & (1 << (B_WIDTH - 1))) << 1;
+                    *coefficients[i] = dequantize_bcd_in_range(quantized, range);
+                }
+            }
+
+            Block block;
+            idct_block(&dct_block, &block);
+            float pb = block.pb_avg;
+            float pr = block.pr_avg;
+            top[2 * x] = ypbpr_pixel_to_rgb((YPbPr_pixel){ block.y1, pb, pr });
+            top[2 * x + 1] = ypbpr_pixel_to_rgb((YPbPr_pixel){ block.y2, pb, pr });
+            bottom[2 * x] = ypbpr_pixel_to_rgb((YPbPr_pixel){ block.y3, pb, pr });
+            bottom[2 * x + 1] = ypbpr_pixel_to_rgb((YPbPr_pixel){ block.y4, pb, pr });
+        }
+    }
+    free(bytes);
+    free(table);
+
+    write_image(output, &image);
+    for (int y = 0; y < image.height; y++) {
+        free(image.pixels[y]);
+    }
+    free(image.pixels);
+}
+
+/* Measures this thread's share of tile rows */
+static void measure_rows(void *closure, int index, int thread_count)
+{
+    Measure_Job *job = closure;
+    Rate_Plan *plan = job->plan;
+
+    long long start, end;
+    parallel_split(plan->tiles_y, index, thread_count, &start, &end);
+    for (int ty = start; ty < end; ty++) {
+        for (int tx = 0; tx < plan->tiles_x; tx++) {
+            int t = ty * plan->tiles_x + tx;
+            measure_tile(job->dct_array, tx, ty, &plan->tiles[t],
+                         &job->costs[t]);
+        }
+    }
+}
+
+/* Picks a tile's ranges and measures its error with and without detail.
+   Errors are summed over the tile's pixels in normalized RGB units. */
+static void measure_tile(DCT_Array *dct_array, int tile_x, int tile_y,
+                         Tile_Params *params, Tile_Cost *cost)
+{
+    int x0, y0, x1, y1;
+    tile_extent(dct_array->width, dct_array->height, RATE_TILE_BLOCKS,
+                tile_x, tile_y, &x0, &y0, &x1, &y1);
+
+    double a_error = 0;
+    double drop_error = 0;
+    double bcd_error[RANGE_COUNT] = { 0 };
+    double chroma_error[RANGE_COUNT] = { 0 };
+
+    /* Each coefficient's error is spread over the block's four pixels */
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            DCT_Block *block = &dct_array->blocks[y][x];
+            a_error += squared(block->a - dequantize_a(quantize_a(block->a)));
+            drop_error += squared(block->b) + squared(block->c) +
+                          squared(block->d);
+
+            for (int r = 0; r < RANGE_COUNT; r++) {
+                float range = BCD_RANGES[r];
+                bcd_error[r] +=
+                    squared(block->b - dequantize_bcd_in_range(
+                                quantize_bcd_in_range(block->b, range), range)) +
+                    squared(block->c - dequantize_bcd_in_range(
+                                quantize_bcd_in_range(block->c, range), range)) +
+                    squared(block->d - dequantize_bcd_in_range(
+                                quantize_bcd_in_range(block->d, range), range));
+
+                range = CHROMA_RANGES[r];
+                chroma_error[r] +=
+                    PB_ERROR_WEIGHT *
+                        squared(block->pb_avg - chroma_of_index_in_range(
+                                    index_of_chroma_in_range(block->pb_avg,
+                                                             range), range)) +
+                    PR_ERROR_WEIGHT *
+                        squared(block->pr_avg - chroma_of_index_in_range(
+                                    index_of_chroma_in_range(block->pr_avg,
+                                                             range), range));
+            }
+        }
+    }
+
+    /* Ties keep the earlier candidate, so entry 0 wins when it is enough */
+    int best_bcd = 0;
+    int best_chroma = 0;
+    for (int r = 1; r < RANGE_COUNT; r++) {
+        if (bcd_error[r] < bcd_error[best_bcd]) {
+            best_bcd = r;
+        }
+        if (chroma_error[r] < chroma_error[best_chroma]) {
+            best_chroma = r;
+        }
+    }
+
+    params->bcd_range = best_bcd;
+    params->chroma_range = best_chroma;
+    params->detail = true;
+
+    double base = a_error + chroma_error[best_chroma];
+    cost->full_error = 4 * (base + bcd_error[best_bcd]);
+    cost->dc_error = 4 * (base + drop_error);
+    cost->blocks = (x1 - x0) * (y1 - y0);
+}
+
+/* Returns value squared */
+static double squared(double value)
+{
+    return value * value;
+}
+
+/* Orders tiles by ascending error per saved bit, then by position */
+static int compare_drop_order(const void *a, const void *b)
+{
+    const Drop_Order *left = a;
+    const Drop_Order *right = b;
+    if (left->error_per_bit != right->error_per_bit) {
+        return left->error_per_bit < right->error_per_bit ? -1 : 1;
+    }
+    return left->tile - right->tile;
+}
+
+/* Returns the length of the text header */
+static size_t header_length(int width, int height)
+{
+    return strlen(ADAPTIVE_MAGIC_NUMBER) +
+           snprintf(NULL, 0, "%d %d %d\n", width * 2, height * 2,
+                    RATE_TILE_BLOCKS);
+}
+
+/* Returns the number of field bits the plan currently implies */
+static uint64_t payload_bits(const Rate_Plan *plan, const Tile_Cost *costs)
+{
+    uint64_t bits = 0;
+    for (int t = 0; t < plan->tiles_x * plan->tiles_y; t++) {
+        bits += (uint64_t)costs[t].blocks *
+                (DC_BITS + (plan->tiles[t].detail ? DETAIL_BITS : 0));
+    }
+    return bits;
+}
+
+/* Returns the blocks [x0, x1) x [y0, y1) a tile covers, clipped to the image */
+static void tile_extent(int width, int height, int tile_blocks, int tile_x,
+                        int tile_y, int *x0, int *y0, int *x1, int *y1)
+{
+    *x0 = tile_x * tile_blocks;
+    *y0 = tile_y * tile_blocks;
+    *x1 = *x0 + tile_blocks < width ? *x0 + tile_blocks : width;
+    *y1 = *y0 + tile_blocks < height ? *y0 + tile_blocks : height;
+}
+
+/* Converts a squared error summed over pixels into PSNR */
+static double psnr_of(double error, long long pixels)
+{
+    if (error <= 0 || pixels == 0) {
+        return INFINITY;
+    }
+    return 10 * log10(pixels / error);
+}
@@ -0,0 +1,106 @@
+/* rate_control.h */
+
+#ifndef RATE_CONTROL_H
+#define RATE_CONTROL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "transform.h"  // For DCT_Array
+#include "color_conversion.h"  // For YPbPr_image
+#include "chroma_processing.h"  // For Block_Array
+
+/* Side of a rate-control tile, in blocks (16 x 16 pixels) */
+#define RATE_TILE_BLOCKS 8
+
+/* What the encoder is asked to meet */
+typedef enum {
+    RATE_TARGET_BYTES,  // Largest acceptable stream, header included
+    RATE_TARGET_PSNR    // Smallest acceptable RGB PSNR, in dB
+} Rate_Target_Kind;
+
+typedef struct {
+    Rate_Target_Kind kind;
+    double value;
+} Rate_Target;
+
+/* Quantization chosen for one tile */
+typedef struct {
+    uint8_t bcd_range;     // Index into the b, c, d range table
+    uint8_t chroma_range;  // Index into the Pb, Pr range table
+    bool detail;           // false drops b, c and d for the whole tile
+} Tile_Params;
+
+/* Quantization chosen for every tile, and what it is predicted to give */
+typedef struct {
+    int width;              // In blocks
+    int height;
+    int tiles_x;
+    int tiles_y;
+    Tile_Params *tiles;     // Row-major
+    uint64_t bytes;         // Exact size of the stream
+    double psnr;            // Predicted RGB PSNR in dB
+} Rate_Plan;
+
+/* Function Prototypes */
+
+/**
+ * Chooses quantization for each tile so the stream meets a target.
+ * Per-tile error for every candidate range is measured from the DCT
+ * coefficients in one parallel pass. Each tile then takes the ranges
+ * with the least error, and tiles give up their b, c and d fields,
+ * cheapest distortion per saved bit first, until the target is met.
+ * @param dct_array The image's DCT coefficients.
+ * @param base_error Error the blocks carry before quantization (from
+ * averaging chroma over each block), as a squared normalized RGB error
+ * summed over pixels; see chroma_averaging_error.
+ * @param target The size or quality to meet.
+ * @param thread_count The number of threads for the measuring pass.
+ * @return The plan, or NULL (after printing an error) if no choice of
+ * parameters meets the target.
+ */
+Rate_Plan *plan_rate(DCT_Array *dct_array, double base_error,
+                     Rate_Target target, int thread_count);
+
+/**
+ * Measures the error create_blocks introduces by giving each 2x2 block
+ * a single Pb and Pr, in the units plan_rate uses.
+ * @param ypbpr_image The image before blocking.
+ * @param block_array The blocks made from it.
+ * @return The squared normalized RGB error summed over pixels.
+ */
+double chroma_averaging_error(YPbPr_image *ypbpr_image,
+                              Block_Array *block_array);
+
+/**
+ * Frees a plan.
+ * @param plan The plan.
+ */
+void free_rate_plan(Rate_Plan *plan);
+
+/**
+ * Writes a compressed image quantized as planned: a header, a table of
+ * one byte per tile with its parameters, then the bit-packed fields.
+ * @param output The output file pointer.
+ * @param dct_array The image's DCT coefficients.
+ * @param plan The plan from plan_rate.
+ */
+void write_adaptive_image(FILE *output, DCT_Array *dct_array,
+                          const Rate_Plan *plan);
+
+/**
+ * Compresses a PPM image to meet a target size or quality.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ * @param target The target.
+ */
+void compress40_adaptive(FILE *input, FILE *output, Rate_Target target);
+
+/**
+ * Decompresses an image written by compress40_adaptive to a PPM image.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ */
+void decompress40_adaptive(FILE *input, FILE *output);
+
+#endif /* RATE_CONTROL_H */
@@ -0,0 +1,199 @@
+/* reencode.c */
+
+#include "reencode.h"
+#include "compress40_edges.h"
+#include "tuning.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* Helper functions */
+static void mark_rects(const Dirty_Rect *rects, int rect_count, int width,
+                       int height, int *first, int *last);
+static void mark_differences(Image *image, Image *old_image, int width,
+                             int height, int *first, int *last);
+static void encode_band(Codeword_Array *codeword_array, Image *image,
+                        int row, int rows, int first, int last);
+
+/* Re-encodes only the blocks that may have changed */
+bool reencode_codewords(Codeword_Array *codeword_array, Image *image,
+                        Image *old_image, const Dirty_Rect *rects,
+                        int rect_count, int *reencoded_blocks)
+{
+    assert(codeword_array != NULL);
+    assert(image != NULL);
+    assert(rects != NULL || rect_count == 0);
+
+    int width = codeword_array->width;
+    int height = codeword_array->height;
+    if (image->width / 2 != width || image->height / 2 != height ||
+        (old_image != NULL && (old_image->width / 2 != width ||
+                               old_image->height / 2 != height))) {
+        fprintf(stderr, "Error: The edited image is not the size of the "
+                "compressed image.\n");
+        return false;
+    }
+
+    /* 1. For each block row, find the span of blocks to encode;
+          first > last means the row is clean */
+    int *first = malloc((height + 1) * sizeof(int));
+    int *last = malloc((height + 1) * sizeof(int));
+    assert(first != NULL && last != NULL);
+
+    if (rects != NULL) {
+        mark_rects(rects, rect_count, width, height, first, last);
+    } else if (old_image != NULL) {
+        mark_differences(image, old_image, width, height, first, last);
+    } else {
+        for (int row = 0; row < height; row++) {
+            first[row] = 0;
+            last[row] = width - 1;
+        }
+    }
+
+    /* 2. Encode each run of dirty rows as one band covering their spans */
+    int count = 0;
+    int row = 0;
+    while (row < height) {
+        if (first[row] > last[row]) {
+            row++;
+            continue;
+        }
+        int start = row;
+        int band_first = first[row];
+        int band_last = last[row];
+        while (row < height && first[row] <= last[row]) {
+            band_first = first[row] < band_first ? first[row] : band_first;
+            band_last = last[row] > band_last ? last[row] : band_last;
+            row++;
+        }
+        encode_band(codeword_array, image, start, row - start, band_first,
+                    band_last);
+        count += (row - start) * (band_last - band_first + 1);
+    }
+
+    free(first);
+    free(last);
+    if (reencoded_blocks != NULL) {
+        *reencoded_blocks = count;
+    }
+    return true;
+}
+
+/* Reads a previous compressed image and an edited PPM, and writes the update */
+bool reencode40(FILE *previous, FILE *input, FILE *old_input,
+                const Dirty_Rect *rects, int rect_count, FILE *output)
+{
+    Codeword_Array *codeword_array = read_codeword_array(previous);
+    if (codeword_array == NULL) {
+        return false;
+    }
+
+    Image *image = read_image(input);
+    Image *old_image = old_input != NULL ? read_image(old_input) : NULL;
+    if (image == NULL || (old_input != NULL && old_image == NULL)) {
+        fprintf(stderr, "Error: Failed to read image.\n");
+        free_image(image);
+        free_image(old_image);
+        free_codeword_array(codeword_array);
+        return false;
+    }
+
+    bool ok = reencode_codewords(codeword_array, image, old_image, rects,
+                                 rect_count, NULL);
+    if (ok) {
+        write_compressed_image(output, codeword_array,
+                               codeword_array->width * 2,
+                               codeword_array->height * 2);
+    }
+
+    free_image(image);
+    free_image(old_image);
+    free_codeword_array(codeword_array);
+    return ok;
+}
+
+/* Marks the blocks each rectangle touches, clipped to the image */
+static void mark_rects(const Dirty_Rect *rects, int rect_count, int width,
+                       int height, int *first, int *last)
+{
+    for (int row = 0; row < height; row++) {
+        first[row] = width;
+        last[row] = -1;
+    }
+
+    for (int r = 0; r < rect_count; r++) {
+        if (rects[r].width <= 0 || rects[r].height <= 0) {
+            continue;
+        }
+        int left = rects[r].x / 2;
+        int right = (rects[r].x + rects[r].width - 1) / 2;
+        int top = rects[r].y / 2;
+        int bottom = (rects[r].y + rects[r].height - 1) / 2;
+        left = left < 0 ? 0 : left;
+        top = top < 0 ? 0 : top;
+        right = right >= width ? width - 1 : right;
+        bottom = bottom >= height ? height - 1 : bottom;
+        if (left > right || top > bottom) {
+            continue;
+        }
+
+        for (int row = top; row <= bottom; row++) {
+            first[row] = left < first[row] ? left : first[row];
+            last[row] = right > last[row] ? right : last[row];
+        }
+    }
+}
+
+/* Marks, for each block row, the span of blocks whose pixels differ */
+static void mark_differences(Image *image, Image *old_image, int width,
+                             int height, int *first, int *last)
+{
+    size_t row_bytes = 2 * (size_t)width * sizeof(Pixel);
+    for (int row = 0; row < height; row++) {
+        first[row] = width;
+        last[row] = -1;
+
+        for (int y = 2 * row; y < 2 * row + 2; y++) {
+            const Pixel *new_row = image->pixels[y];
+            const Pixel *old_row = old_image->pixels[y];
+            if (memcmp(new_row, old_row, row_bytes) == 0) {
+                continue;
+            }
+
+            int x = 0;
+            while (memcmp(&new_row[x], &old_row[x], sizeof(Pixel)) == 0) {
+                x++;
+            }
+            int end = 2 * width - 1;
+            while (memcmp(&new_row[end], &old_row[end], sizeof(Pixel)) == 0) {
+                end--;
+            }
+            first[row] = x / 2 < first[row] ? x / 2 : first[row];
+            last[row] = end / 2 > last[row] ? end / 2 : last[row];
+        }
+    }
+}
+
+/* Runs the shared banded encode on a band of blocks and stores the
+   resulting codewords in place */
+static void encode_band(Codeword_Array *codeword_array, Image *image,
+                        int row, int rows, int first, int last)
+{
+    /* The band is a view onto the edited image's rows; no pixels move */
+    Image_View band = crop_view(image_view(image), 2 * first, 2 * row,
+                                2 * (last - first + 1), 2 * rows);
+
+    Codeword_Array *band_codewords =
+        compress40_encode(&band, tuning_profile()->compress_band_rows,
+                          tuning_threads());
+
+    int band_width = band_codewords->width;
+    for (int r = 0; r < rows; r++) {
+        memcpy(codeword_array->words + (row + r) * codeword_array->width + first,
+               band_codewords->words + r * band_width,
+               band_width * sizeof(uint32_t));
+    }
+    free_codeword_array(band_codewords);
+}
@@ -0,0 +1,56 @@
+/* reencode.h */
+
+#ifndef REENCODE_H
+#define REENCODE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "image_processing.h"  // For Image
+#include "quantization.h"  // For Codeword_Array
+
+/* A rectangle of pixels that an edit may have changed */
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} Dirty_Rect;
+
+/* Function Prototypes */
+
+/**
+ * Brings a compressed image up to date with edited pixels by encoding
+ * only the blocks that may have changed; every other codeword is kept.
+ * The changed area comes from rects if given, otherwise from comparing
+ * the rows of image with old_image, otherwise it is the whole image.
+ * Since blocks are encoded independently, the result is identical to
+ * compressing image from scratch.
+ * @param codeword_array The previous codewords, updated in place.
+ * @param image The edited image; odd trailing rows and columns are ignored.
+ * @param old_image The image codeword_array was made from, or NULL.
+ * @param rects The changed rectangles, in pixels, or NULL.
+ * @param rect_count The number of rectangles.
+ * @param reencoded_blocks Pointer to store how many blocks were
+ * encoded, or NULL.
+ * @return true on success, false (after printing an error) if the
+ * images do not match the size of codeword_array.
+ */
+bool reencode_codewords(Codeword_Array *codeword_array, Image *image,
+                        Image *old_image, const Dirty_Rect *rects,
+                        int rect_count, int *reencoded_blocks);
+
+/**
+ * Reads a previous compressed image and an edited PPM, and writes the
+ * updated compressed image.
+ * @param previous The previous compressed image.
+ * @param input The edited PPM image.
+ * @param old_input The PPM image previous was made from, or NULL.
+ * @param rects The changed rectangles, in pixels, or NULL.
+ * @param rect_count The number of rectangles.
+ * @param output The output file pointer.
+ * @return true on success, false (after printing an error) otherwise.
+ */
+bool reencode40(FILE *previous, FILE *input, FILE *old_input,
+                const Dirty_Rect *rects, int rect_count, FILE *output);
+
+#endif /* REENCODE_H */
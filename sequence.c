@@ -0,0 +1,386 @@
+/* sequence.c */
+
+#include "sequence.h"
+#include "compress40_edges.h"
+#include "tuning.h"
+#include "block_decode.h"
+#include "io.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* Container layout:
+ *
+ *     "COMP40 Sequence format 1\n"
+ *     "<width> <height>\n"
+ *     frames, each starting with a type byte:
+ *         'K'  every codeword, row-major
+ *         'D'  a bitmap with one bit per block (row-major, most
+ *              significant bit first), then the codewords of the set
+ *              blocks in row-major order
+ *
+ * Codewords are big-endian, as in the single-image format. The first
+ * frame is always a keyframe.
+ */
+#define SEQUENCE_MAGIC_NUMBER "COMP40 Sequence format 1\n"
+#define KEYFRAME 'K'
+#define DELTA_FRAME 'D'
+
+struct Sequence_Writer {
+    FILE *output;
+    int keyframe_interval;
+    int frame_count;        // Frames written so far
+    int width;              // In blocks, fixed by the first frame
+    int height;
+    uint32_t *previous;     // Codewords of the last frame written
+    unsigned char *bitmap;
+    unsigned char *buffer;  // Frame record staged for one fwrite
+};
+
+struct Sequence_Reader {
+    FILE *input;
+    int width;              // In blocks
+    int height;
+    int count;
+    bool failed;
+    uint32_t *words;        // Codewords of the current frame
+    unsigned char *bitmap;
+    unsigned char *bytes;   // Codewords as read from the file
+    Image frame;            // Decoded current frame
+};
+
+/* Helper functions */
+static size_t bitmap_length(int count);
+static unsigned char *put_codeword(unsigned char *bytes, uint32_t codeword);
+static bool read_fully(Sequence_Reader reader, void *bytes, size_t length);
+static void decode_dirty(Sequence_Reader reader, const unsigned char *bitmap);
+static Codeword_Array *encode_frame(FILE *input);
+
+/* Starts a sequence */
+Sequence_Writer sequence_writer_new(FILE *output, int keyframe_interval)
+{
+    assert(output != NULL);
+    assert(keyframe_interval >= 0);
+
+    Sequence_Writer writer = calloc(1, sizeof(*writer));
+    assert(writer != NULL);
+    writer->output = output;
+    writer->keyframe_interval = keyframe_interval;
+
+    return writer;
+}
+
+/* Appends a frame, as a delta against the previous one when that is smaller */
+bool sequence_writer_add(Sequence_Writer writer, Codeword_Array *codeword_array)
+{
+    assert(writer != NULL);
+    assert(codeword_array != NULL);
+
+    int count = codeword_array->count;
+    if (writer->frame_count == 0) {
+        writer->width = codeword_array->width;
+        writer->height = codeword_array->height;
+        writer->previous = malloc((count + 1) * sizeof(uint32_t));
+        writer->bitmap = malloc(bitmap_length(count) + 1);
+        writer->buffer = malloc(1 + bitmap_length(count) + 4 * (size_t)count);
+        assert(writer->previous != NULL && writer->bitmap != NULL &&
+               writer->buffer != NULL);
+        fprintf(writer->output, "%s%d %d\n", SEQUENCE_MAGIC_NUMBER,
+                writer->width * 2, writer->height * 2);
+    } else if (codeword_array->width != writer->width ||
+               codeword_array->height != writer->height) {
+        fprintf(stderr, "Error: Frame %d is %dx%d, not %dx%d.\n",
+                writer->frame_count, codeword_array->width * 2,
+                codeword_array->height * 2, writer->width * 2,
+                writer->height * 2);
+        return false;
+    }
+
+    /* Mark the blocks whose codeword changed and stage them */
+    const uint32_t *words = codeword_array->words;
+    bool keyframe = writer->frame_count == 0 ||
+                    (writer->keyframe_interval > 0 &&
+                     writer->frame_count % writer->keyframe_interval == 0);
+    size_t length = 1;
+    if (!keyframe) {
+        unsigned char *out = writer->buffer + 1 + bitmap_length(count);
+        memset(writer->bitmap, 0, bitmap_length(count));
+        for (int i = 0; i < count; i++) {
+            if (words[i] != writer->previous[i]) {
+                writer->bitmap[i / 8] |= 0x80 >> (i % 8);
+                out = put_codeword(out, words[i]);
+            }
+        }
+        length = out - writer->buffer;
+        memcpy(writer->buffer + 1, writer->bitmap, bitmap_length(count));
+
+        /* Almost every block changed: a keyframe is no larger */
+        keyframe = length >= 1 + 4 * (size_t)count;
+    }
+
+    if (keyframe) {
+        unsigned char *out = writer->buffer + 1;
+        for (int i = 0; i < count; i++) {
+            out = put_codeword(out, words[i]);
+        }
+        length = out - writer->buffer;
+    }
+
+    writer->buffer[0] = keyframe ? KEYFRAME : DELTA_FRAME;
+    fwrite(writer->buffer, 1, length, writer->output);
+    memcpy(writer->previous, words, count * sizeof(uint32_t));
+    writer->frame_count++;
+
+    return true;
+}
+
+/* Frees a writer */
+void sequence_writer_free(Sequence_Writer *writer)
+{
+    assert(writer != NULL && *writer != NULL);
+
+    free((*writer)->previous);
+    free((*writer)->bitmap);
+    free((*writer)->buffer);
+    free(*writer);
+    *writer = NULL;
+}
+
+/* Starts reading a sequence */
+Sequence_Reader sequence_reader_new(FILE *input)
+{
+    assert(input != NULL);
+
+    char magic_number[256];
+    if (fgets(magic_number, sizeof(magic_number), input) == NULL ||
+        strcmp(magic_number, SEQUENCE_MAGIC_NUMBER) != 0) {
+        fprintf(stderr, "Error: Invalid sequence format.\n");
+        return NULL;
+    }
+
+    int width, height;
+    if (fscanf(input, "%d %d", &width, &height) != 2 || width < 0 ||
+        height < 0 || width % 2 != 0 || height % 2 != 0 ||
+        fgetc(input) != '\n') {
+        fprintf(stderr, "Error: Could not read sequence dimensions.\n");
+        return NULL;
+    }
+
+    Sequence_Reader reader = calloc(1, sizeof(*reader));
+    assert(reader != NULL);
+    reader->input = input;
+    reader->width = width / 2;
+    reader->height = height / 2;
+    reader->count = reader->width * reader->height;
+
+    int count = reader->count;
+    reader->words = calloc(count + 1, sizeof(uint32_t));
+    reader->bitmap = malloc(bitmap_length(count) + 1);
+    reader->bytes = malloc(4 * (size_t)count + 1);
+    assert(reader->words != NULL && reader->bitmap != NULL &&
+           reader->bytes != NULL);
+
+    /* The frame buffer persists; only dirty blocks are rewritten */
+    reader->frame.width = width;
+    reader->frame.height = height;
+    reader->frame.pixels = malloc((height + 1) * sizeof(Pixel *));
+    assert(reader->frame.pixels != NULL);
+    for (int y = 0; y < height; y++) {
+        reader->frame.pixels[y] = calloc(width + 1, sizeof(Pixel));
+        assert(reader->frame.pixels[y] != NULL);
+    }
+
+    return reader;
+}
+
+/* Reads the next frame, decoding only the blocks it changes */
+const Image *sequence_reader_next(Sequence_Reader reader, int *changed_blocks)
+{
+    assert(reader != NULL);
+
+    if (reader->failed) {
+        return NULL;
+    }
+    int type = fgetc(reader->input);
+    if (type == EOF) {
+        return NULL;
+    }
+
+    int count = reader->count;
+    int changed = 0;
+    if (type == KEYFRAME) {
+        if (!read_fully(reader, reader->bytes, 4 * (size_t)count)) {
+            return NULL;
+        }
+        memset(reader->bitmap, 0xFF, bitmap_length(count));
+        changed = count;
+    } else if (type == DELTA_FRAME) {
+        if (!read_fully(reader, reader->bitmap, bitmap_length(count))) {
+            return NULL;
+        }
+        for (int i = 0; i < count; i++) {
+            changed += reader->bitmap[i / 8] >> (7 - i % 8) & 1;
+        }
+        if (!read_fully(reader, reader->bytes, 4 * (size_t)changed)) {
+            return NULL;
+        }
+    } else {
+        fprintf(stderr, "Error: Invalid sequence frame type.\n");
+        reader->failed = true;
+        return NULL;
+    }
+
+    /* Scatter the new codewords into place */
+    const unsigned char *in = reader->bytes;
+    for (int i = 0; i < count; i++) {
+        if (reader->bitmap[i / 8] & (0x80 >> (i % 8))) {
+            reader->words[i] = load_codeword(in);
+            in += 4;
+        }
+    }
+    decode_dirty(reader, reader->bitmap);
+
+    if (changed_blocks != NULL) {
+        *changed_blocks = changed;
+    }
+    return &reader->frame;
+}
+
+/* Frees a reader */
+void sequence_reader_free(Sequence_Reader *reader)
+{
+    assert(reader != NULL && *reader != NULL);
+
+    for (int y = 0; y < (*reader)->frame.height; y++) {
+        free((*reader)->frame.pixels[y]);
+    }
+    free((*reader)->frame.pixels);
+    free((*reader)->words);
+    free((*reader)->bitmap);
+    free((*reader)->bytes);
+    free(*reader);
+    *reader = NULL;
+}
+
+/* Compresses PPM frames into a sequence */
+bool sequence40(char *paths[], int count, FILE *output)
+{
+    Sequence_Writer writer = sequence_writer_new(output,
+                                                 DEFAULT_KEYFRAME_INTERVAL);
+    bool ok = true;
+    for (int i = 0; i < count && ok; i++) {
+        FILE *input = fopen(paths[i], "r");
+        if (input == NULL) {
+            fprintf(stderr, "Error: Could not open %s.\n", paths[i]);
+            ok = false;
+            break;
+        }
+        Codeword_Array *codeword_array = encode_frame(input);
+        fclose(input);
+        if (codeword_array == NULL) {
+            fprintf(stderr, "Error: Failed to read image %s.\n", paths[i]);
+            ok = false;
+            break;
+        }
+        ok = sequence_writer_add(writer, codeword_array);
+        free_codeword_array(codeword_array);
+    }
+    sequence_writer_free(&writer);
+
+    return ok;
+}
+
+/* Decompresses a sequence into consecutive PPM images */
+void unsequence40(FILE *input, FILE *output)
+{
+    Sequence_Reader reader = sequence_reader_new(input);
+    if (reader == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    const Image *frame;
+    while ((frame = sequence_reader_next(reader, NULL)) != NULL) {
+        write_image(output, (Image *)frame);
+    }
+
+    bool failed = reader->failed;
+    sequence_reader_free(&reader);
+    if (failed) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Returns the number of bytes in a bitmap of count blocks */
+static size_t bitmap_length(int count)
+{
+    return ((size_t)count + 7) / 8;
+}
+
+/* Stores a codeword big-endian and returns the byte after it */
+static unsigned char *put_codeword(unsigned char *bytes, uint32_t codeword)
+{
+    bytes[0] = codeword >> 24;
+    bytes[1] = codeword >> 16;
+    bytes[2] = codeword >> 8;
+    bytes[3] = codeword;
+    return bytes + 4;
+}
+
+/* Reads exactly length bytes of the current frame */
+static bool read_fully(Sequence_Reader reader, void *bytes, size_t length)
+{
+    if (fread(bytes, 1, length, reader->input) != length) {
+        fprintf(stderr, "Error: Unexpected end of file in a sequence frame.\n");
+        reader->failed = true;
+        return false;
+    }
+    return true;
+}
+
+/* Re-runs the IDCT and colour conversion on each run of dirty blocks */
+static void decode_dirty(Sequence_Reader reader, const unsigned char *bitmap)
+{
+    int width = reader->width;
+    for (int row = 0; row < reader->height; row++) {
+        Pixel *top = reader->frame.pixels[2 * row];
+        Pixel *bottom = reader->frame.pixels[2 * row + 1];
+        int col = 0;
+        while (col < width) {
+            int i = row * width + col;
+
+            /* Skip a whole byte of clean blocks at a time */
+            if (i % 8 == 0 && col + 8 <= width && bitmap[i / 8] == 0) {
+                col += 8;
+                continue;
+            }
+            if (!(bitmap[i / 8] & (0x80 >> (i % 8)))) {
+                col++;
+                continue;
+            }
+
+            int start = col;
+            while (col < width &&
+                   (bitmap[(i + col - start) / 8] & (0x80 >> ((i + col - start) % 8)))) {
+                col++;
+            }
+            decode_block_run(NULL, reader->words + i, col - start,
+                             top + 2 * start, bottom + 2 * start);
+        }
+    }
+}
+
+/* Compresses one PPM frame into codewords, or returns NULL if unreadable */
+static Codeword_Array *encode_frame(FILE *input)
+{
+    Image *image = read_image(input);
+    if (image == NULL) {
+        return NULL;
+    }
+    Image_View view = even_view(image_view(image), EDGE_DROP);
+    Codeword_Array *codeword_array =
+        compress40_encode(&view, tuning_profile()->compress_band_rows,
+                          tuning_threads());
+    free_image(image);
+
+    return codeword_array;
+}
@@ -0,0 +1,89 @@
+/* sequence.h */
+
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "image_processing.h"  // For Image
+#include "quantization.h"  // For Codeword_Array
+
+/* Frames between forced keyframes, so a reader can start part way in */
+#define DEFAULT_KEYFRAME_INTERVAL 300
+
+/* Writes a multi-frame container one frame at a time */
+typedef struct Sequence_Writer *Sequence_Writer;
+
+/* Reads a multi-frame container into a persistent frame buffer */
+typedef struct Sequence_Reader *Sequence_Reader;
+
+/* Function Prototypes */
+
+/**
+ * Starts a sequence. The header is written with the first frame, which
+ * fixes the size of every frame.
+ * @param output The output file pointer; it stays owned by the caller.
+ * @param keyframe_interval Frames between forced keyframes, or 0 to
+ * write keyframes only when a delta frame would not be smaller.
+ * @return The new writer.
+ */
+Sequence_Writer sequence_writer_new(FILE *output, int keyframe_interval);
+
+/**
+ * Appends a frame. Unless a keyframe is due, only the blocks whose
+ * codeword differs from the previous frame are written, after a bitmap
+ * marking which blocks they are.
+ * @param writer The writer.
+ * @param codeword_array The frame's codewords.
+ * @return true on success, false (after printing an error) if the frame
+ * is not the size of the first one.
+ */
+bool sequence_writer_add(Sequence_Writer writer, Codeword_Array *codeword_array);
+
+/**
+ * Frees a writer and sets *writer to NULL. The output is not closed.
+ * @param writer Pointer to the writer.
+ */
+void sequence_writer_free(Sequence_Writer *writer);
+
+/**
+ * Starts reading a sequence.
+ * @param input The input file pointer; it stays owned by the caller.
+ * @return The new reader, or NULL (after printing an error) if the
+ * header is invalid.
+ */
+Sequence_Reader sequence_reader_new(FILE *input);
+
+/**
+ * Reads the next frame. Only the blocks the frame changes are decoded;
+ * the rest of the frame buffer is left as it was.
+ * @param reader The reader.
+ * @param changed_blocks Pointer to store how many blocks changed, or NULL.
+ * @return The frame buffer, owned by the reader and valid until the next
+ * call, or NULL at the end of the sequence or on error.
+ */
+const Image *sequence_reader_next(Sequence_Reader reader, int *changed_blocks);
+
+/**
+ * Frees a reader and sets *reader to NULL. The input is not closed.
+ * @param reader Pointer to the reader.
+ */
+void sequence_reader_free(Sequence_Reader *reader);
+
+/**
+ * Compresses PPM frames into a sequence.
+ * @param paths The frame files, in order.
+ * @param count The number of frames.
+ * @param output The output file pointer.
+ * @return true on success, false (after printing an error) otherwise.
+ */
+bool sequence40(char *paths[], int count, FILE *output);
+
+/**
+ * Decompresses a sequence into consecutive PPM images.
+ * @param input The input file pointer.
+ * @param output The output file pointer.
+ */
+void unsequence40(FILE *input, FILE *output);
+
+#endif /* SEQUENCE_H */
@@ -1,6 +1,7 @@
 /* transform.c */
 
 #include "transform.h"
+#include "huge_alloc.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <math.h>
@@ -29,33 +30,12 @@ DCT_Array *perform_dct(Block_Array *block_array)
     dct_array->width = width;
     dct_array->height = height;
 
-    dct_array->blocks = malloc(height * sizeof(DCT_Block *));
-    assert(dct_array->blocks != NULL);
-
-    for (int i = 0; i < height; i++) {
-        dct_array->blocks[i] = malloc(width * sizeof(DCT_Block));
-        assert(dct_array->blocks[i] != NULL);
-    }
+    dct_array->blocks = huge_alloc_rows(height, width * sizeof(DCT_Block));
 
     /* Perform DCT on each block */
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
-            Block *block = &block_array->blocks[y][x];
-            DCT_Block *dct_block = &dct_array->blocks[y][x];
-
-            /* Calculate DCT coefficients */
-            float a = calculate_a(block->y1, block->y2, block->y3, block->y4);
-            float b = calculate_b(block->y1, block->y2, block->y3, block->y4);
-            float c = calculate_c(block->y1, block->y2, block->y3, block->y4);
-            float d = calculate_d(block->y1, block->y2, block->y3, block->y4);
-
-            /* Store the coefficients and chroma values */
-            dct_block->a = a;
-            dct_block->b = b;
-            dct_block->c = c;
-            dct_block->d = d;
-            dct_block->pb_avg = block->pb_avg;
-            dct_block->pr_avg = block->pr_avg;
+            dct_block(&block_array->blocks[y][x], &dct_array->blocks[y][x]);
         }
     }
 
@@ -77,38 +57,50 @@ Block_Array *perform_idct(DCT_Array *dct_array)
     block_array->width = width;
     block_array->height = height;
 
-    block_array->blocks = malloc(height * sizeof(Block *));
-    assert(block_array->blocks != NULL);
-
-    for (int i = 0; i < height; i++) {
-        block_array->blocks[i] = malloc(width * sizeof(Block));
-        assert(block_array->blocks[i] != NULL);
-    }
+    block_array->blocks = huge_alloc_rows(height, width * sizeof(Block));
 
     /* Perform IDCT on each block */
     for (int y = 0; y < height; y++) {
         for (int x = 0; x < width; x++) {
-            DCT_Block *dct_block = &dct_array->blocks[y][x];
-            Block *block = &block_array->blocks[y][x];
-
-            /* Calculate Y values from DCT coefficients */
-            float y1, y2, y3, y4;
-            calculate_y_values(dct_block->a, dct_block->b, dct_block->c, dct_block->d,
-                               &y1, &y2, &y3, &y4);
-
-            /* Store the Y values and chroma values */
-            block->y1 = y1;
-            block->y2 = y2;
-            block->y3 = y3;
-            block->y4 = y4;
-            block->pb_avg = dct_block->pb_avg;
-            block->pr_avg = dct_block->pr_avg;
+            idct_block(&dct_array->blocks[y][x], &block_array->blocks[y][x]);
         }
     }
 
     return block_array;
 }
 
+/* Performs the Discrete Cosine Transform on a single block */
+void dct_block(const Block *block, DCT_Block *dct_block)
+{
+    assert(block != NULL);
+    assert(dct_block != NULL);
+
+    /* Calculate DCT coefficients */
+    dct_block->a = calculate_a(block->y1, block->y2, block->y3, block->y4);
+    dct_block->b = calculate_b(block->y1, block->y2, block->y3, block->y4);
+    dct_block->c = calculate_c(block->y1, block->y2, block->y3, block->y4);
+    dct_block->d = calculate_d(block->y1, block->y2, block->y3, block->y4);
+
+    /* Carry the chroma values across */
+    dct_block->pb_avg = block->pb_avg;
+    dct_block->pr_avg = block->pr_avg;
+}
+
+/* Performs the Inverse Discrete Cosine Transform on a single block */
+void idct_block(const DCT_Block *dct_block, Block *block)
+{
+    assert(dct_block != NULL);
+    assert(block != NULL);
+
+    /* Calculate Y values from DCT coefficients */
+    calculate_y_values(dct_block->a, dct_block->b, dct_block->c, dct_block->d,
+                       &block->y1, &block->y2, &block->y3, &block->y4);
+
+    /* Carry the chroma values across */
+    block->pb_avg = dct_block->pb_avg;
+    block->pr_avg = dct_block->pr_avg;
+}
+
 /* Frees the memory allocated for the DCT_Array */
 void free_dct_array(DCT_Array *dct_array)
 {
@@ -116,10 +108,7 @@ void free_dct_array(DCT_Array *dct_array)
         return;
     }
 
-    for (int i = 0; i < dct_array->height; i++) {
-        free(dct_array->blocks[i]);
-    }
-    free(dct_array->blocks);
+    huge_free_rows(dct_array->blocks);
     free(dct_array);
 }
 
@@ -41,6 +41,20 @@ DCT_Array *perform_dct(Block_Array *block_array);
  */
 Block_Array *perform_idct(DCT_Array *dct_array);
 
+/**
+ * Performs the Discrete Cosine Transform on a single block.
+ * @param block The input block.
+ * @param dct_block Pointer to the DCT_Block to fill in.
+ */
+void dct_block(const Block *block, DCT_Block *dct_block);
+
+/**
+ * Performs the Inverse Discrete Cosine Transform on a single block.
+ * @param dct_block The input DCT coefficients.
+ * @param block Pointer to the Block to fill in.
+ */
+void idct_block(const DCT_Block *dct_block, Block *block);
+
 /**
  * Frees the memory allocated for the DCT_Array.
  * @param dct_array The DCT_Array to be freed.
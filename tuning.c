@@ -0,0 +1,144 @@
+/* tuning.c */
+
+#include "tuning.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+/* Name of the profile under HOME */
+#define PROFILE_NAME ".comp40_profile"
+
+/* Longest line read from a profile */
+#define MAX_LINE 256
+
+/* The profile, loaded once by whichever thread needs it first */
+static pthread_once_t profile_once = PTHREAD_ONCE_INIT;
+static Tuning_Profile profile = {
+    TUNING_DEFAULT_THREADS,
+    TUNING_DEFAULT_BAND_ROWS,
+    TUNING_DEFAULT_ROWS_PER_WRITE
+};
+static char profile_path[PATH_MAX];
+
+/* Helper functions */
+static void load_profile(void);
+static bool parse_line(const char *line, Tuning_Profile *loaded);
+
+/* Returns the profile */
+const Tuning_Profile *tuning_profile(void)
+{
+    pthread_once(&profile_once, load_profile);
+    return &profile;
+}
+
+/* Returns the thread count */
+int tuning_threads(void)
+{
+    const Tuning_Profile *current = tuning_profile();
+    if (getenv("COMP40_THREADS") == NULL && current->threads > 0) {
+        return current->threads;
+    }
+    return parallel_default_threads();
+}
+
+/* Returns the default profile path */
+const char *tuning_profile_path(void)
+{
+    const char *path = getenv("COMP40_PROFILE");
+    if (path != NULL && *path != '\0') {
+        return path;
+    }
+
+    const char *home = getenv("HOME");
+    if (home == NULL || *home == '\0') {
+        return NULL;
+    }
+    int length = snprintf(profile_path, sizeof(profile_path), "%s/%s",
+                          home, PROFILE_NAME);
+    return length < (int)sizeof(profile_path) ? profile_path : NULL;
+}
+
+/* Saves a profile */
+bool tuning_save(const Tuning_Profile *saved, const char *path,
+                 const char *notes)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not write %s.\n", path);
+        return false;
+    }
+
+    fprintf(file, "# comp40 machine profile, from 40image --calibrate\n"
+            "threads %d\n"
+            "compress_band_rows %d\n"
+            "decode_rows_per_write %d\n",
+            saved->threads, saved->compress_band_rows,
+            saved->decode_rows_per_write);
+    if (notes != NULL) {
+        fputs(notes, file);
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Error: Could not write %s.\n", path);
+        return false;
+    }
+    return true;
+}
+
+/* Reads the profile if there is one; a bad one leaves the defaults */
+static void load_profile(void)
+{
+    const char *path = tuning_profile_path();
+    FILE *file = path != NULL ? fopen(path, "r") : NULL;
+    if (file == NULL) {
+        return;
+    }
+
+    Tuning_Profile loaded = profile;
+    char line[MAX_LINE];
+    int number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        number++;
+        ok = parse_line(line, &loaded);
+    }
+    fclose(file);
+
+    if (!ok) {
+        fprintf(stderr, "Error: Bad line %d in profile %s; using the "
+                "defaults.\n", number, path);
+        return;
+    }
+    profile = loaded;
+}
+
+/* Applies one line of a profile. Keys this version does not know are
+   skipped, so a profile from a newer 40image still loads. */
+static bool parse_line(const char *line, Tuning_Profile *loaded)
+{
+    char key[64];
+    int value;
+    char extra;
+    int fields = sscanf(line, " %63s %d %c", key, &value, &extra);
+    if (fields <= 0 || key[0] == '#') {
+        return true;
+    }
+    if (fields != 2) {
+        return false;
+    }
+
+    if (strcmp(key, "threads") == 0) {
+        loaded->threads = value;
+        return value >= 0;
+    } else if (strcmp(key, "compress_band_rows") == 0) {
+        loaded->compress_band_rows = value;
+        return value > 0;
+    } else if (strcmp(key, "decode_rows_per_write") == 0) {
+        loaded->decode_rows_per_write = value;
+        return value > 0;
+    }
+    return true;
+}
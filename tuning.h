@@ -0,0 +1,60 @@
+/* tuning.h */
+
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <stdbool.h>
+
+/* How the codec splits its work on this machine. 40image --calibrate
+   measures the choices and saves the fastest in a profile; every later
+   run loads it the first time it is needed. The profile is the file
+   named by COMP40_PROFILE, or ~/.comp40_profile, and is a list of
+   "key value" lines. Keys it lacks, and every key when there is no
+   profile, keep their defaults. */
+typedef struct {
+    int threads;                // 0 means parallel_default_threads
+    int compress_band_rows;     // Rows each compressing thread converts,
+                                // transforms and packs at a time
+    int decode_rows_per_write;  // Block rows parallel_decode decodes
+                                // before each pwrite
+} Tuning_Profile;
+
+/* The profile used when there is no file */
+#define TUNING_DEFAULT_THREADS 0
+#define TUNING_DEFAULT_BAND_ROWS 64
+#define TUNING_DEFAULT_ROWS_PER_WRITE 16
+
+/* Function Prototypes */
+
+/**
+ * Returns the profile, loading it on the first call. A profile that
+ * cannot be parsed is reported and the defaults are used.
+ * @return The profile, valid for the rest of the run.
+ */
+const Tuning_Profile *tuning_profile(void);
+
+/**
+ * Returns the number of threads to compress and decompress with: the
+ * COMP40_THREADS environment variable if set, then the profile's, then
+ * the number of online CPUs.
+ * @return A thread count of at least 1.
+ */
+int tuning_threads(void);
+
+/**
+ * Returns where the profile is read from and saved to by default.
+ * @return The path, or NULL if neither COMP40_PROFILE nor HOME is set.
+ */
+const char *tuning_profile_path(void);
+
+/**
+ * Saves a profile.
+ * @param profile The profile.
+ * @param path The file to write.
+ * @param notes Comment lines to add after the settings, or NULL.
+ * @return true on success, false (after printing an error) otherwise.
+ */
+bool tuning_save(const Tuning_Profile *profile, const char *path,
+                 const char *notes);
+
+#endif /* TUNING_H */
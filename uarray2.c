@@ -18,11 +18,29 @@ UArray2_T UArray2_new(int width, int height, size_t size)
     array2->width = width;
     array2->height = height;
     array2->size = size;
-    array2->data = calloc(width * height, size);
+    array2->data = calloc((size_t)width * height, size);
     assert(array2->data != NULL);
     return array2;
 }
 
+int UArray2_width(UArray2_T array2)
+{
+    assert(array2 != NULL);
+    return array2->width;
+}
+
+int UArray2_height(UArray2_T array2)
+{
+    assert(array2 != NULL);
+    return array2->height;
+}
+
+size_t UArray2_size(UArray2_T array2)
+{
+    assert(array2 != NULL);
+    return array2->size;
+}
+
 void *UArray2_at(UArray2_T array2, int x, int y)
 {
     assert(array2 != NULL);
@@ -32,6 +50,29 @@ void *UArray2_at(UArray2_T array2, int x, int y)
     return data + ((y * array2->width + x) * array2->size);
 }
 
+void *UArray2_row(UArray2_T array2, int y)
+{
+    assert(array2 != NULL);
+    assert(y >= 0 && y < array2->height);
+    char *data = array2->data;
+    return data + (size_t)y * array2->width * array2->size;
+}
+
+void UArray2_map_row_major(UArray2_T array2, UArray2_applyfun apply,
+                           void *cl)
+{
+    assert(array2 != NULL && apply != NULL);
+
+    /* Walk the storage once, keeping the coordinates alongside */
+    char *elem = array2->data;
+    for (int row = 0; row < array2->height; row++) {
+        for (int col = 0; col < array2->width; col++) {
+            apply(col, row, array2, elem, cl);
+            elem += array2->size;
+        }
+    }
+}
+
 void UArray2_free(UArray2_T *array2)
 {
     assert(array2 != NULL && *array2 != NULL);
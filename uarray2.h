@@ -7,12 +7,30 @@
 
 typedef struct UArray2_T *UArray2_T;
 
+/* Called by the map functions for each element in turn */
+typedef void UArray2_applyfun(int col, int row, UArray2_T array2, void *elem,
+                              void *cl);
+
 /* Creates a new 2D array */
 UArray2_T UArray2_new(int width, int height, size_t size);
 
+/* Returns the width, height and element size */
+int UArray2_width(UArray2_T array2);
+int UArray2_height(UArray2_T array2);
+size_t UArray2_size(UArray2_T array2);
+
 /* Returns a pointer to the element at (x, y) */
 void *UArray2_at(UArray2_T array2, int x, int y);
 
+/* Returns a pointer to the first element of a row; the row's elements
+   follow it contiguously, so a loop over them needs no further checks */
+void *UArray2_row(UArray2_T array2, int y);
+
+/* Calls apply on every element in row-major order, which is the order
+   they are stored in */
+void UArray2_map_row_major(UArray2_T array2, UArray2_applyfun apply,
+                           void *cl);
+
 /* Frees the 2D array */
 void UArray2_free(UArray2_T *array2);
 
@@ -0,0 +1,144 @@
+/* uarray2b.c */
+
+#include "uarray2b.h"
+#include <assert.h>
+#include <math.h>
+
+/* Bytes in a block made by UArray2b_new_64K_block */
+#define BLOCK_BYTES (64 * 1024)
+
+struct UArray2b_T {
+    int width;
+    int height;
+    size_t size;
+    int blocksize;
+    int blocks_wide;    // Blocks per block row
+    size_t block_size;  // Bytes per block
+    char *data;
+};
+
+UArray2b_T UArray2b_new(int width, int height, size_t size, int blocksize)
+{
+    assert(width >= 0 && height >= 0 && size > 0 && blocksize > 0);
+    UArray2b_T array2b = malloc(sizeof(*array2b));
+    assert(array2b != NULL);
+    array2b->width = width;
+    array2b->height = height;
+    array2b->size = size;
+    array2b->blocksize = blocksize;
+    array2b->blocks_wide = (width + blocksize - 1) / blocksize;
+    array2b->block_size = (size_t)blocksize * blocksize * size;
+
+    int blocks_high = (height + blocksize - 1) / blocksize;
+    array2b->data = calloc((size_t)array2b->blocks_wide * blocks_high + 1,
+                           array2b->block_size);
+    assert(array2b->data != NULL);
+    return array2b;
+}
+
+UArray2b_T UArray2b_new_64K_block(int width, int height, size_t size)
+{
+    assert(size > 0);
+    int blocksize = (int)sqrt((double)BLOCK_BYTES / size);
+    return UArray2b_new(width, height, size, blocksize > 0 ? blocksize : 1);
+}
+
+int UArray2b_width(UArray2b_T array2b)
+{
+    assert(array2b != NULL);
+    return array2b->width;
+}
+
+int UArray2b_height(UArray2b_T array2b)
+{
+    assert(array2b != NULL);
+    return array2b->height;
+}
+
+size_t UArray2b_size(UArray2b_T array2b)
+{
+    assert(array2b != NULL);
+    return array2b->size;
+}
+
+int UArray2b_blocksize(UArray2b_T array2b)
+{
+    assert(array2b != NULL);
+    return array2b->blocksize;
+}
+
+void *UArray2b_at(UArray2b_T array2b, int col, int row)
+{
+    assert(array2b != NULL);
+    assert(col >= 0 && col < array2b->width);
+    assert(row >= 0 && row < array2b->height);
+    int blocksize = array2b->blocksize;
+    char *block = UArray2b_block(array2b, col / blocksize, row / blocksize);
+    return block + ((row % blocksize) * blocksize + col % blocksize) *
+                   array2b->size;
+}
+
+void *UArray2b_block(UArray2b_T array2b, int block_col, int block_row)
+{
+    assert(array2b != NULL);
+    assert(block_col >= 0 && block_col < array2b->blocks_wide);
+    assert(block_row >= 0 &&
+           block_row * array2b->blocksize < array2b->height);
+    return array2b->data +
+           ((size_t)block_row * array2b->blocks_wide + block_col) *
+           array2b->block_size;
+}
+
+void UArray2b_map(UArray2b_T array2b, UArray2b_applyfun apply, void *cl)
+{
+    assert(array2b != NULL && apply != NULL);
+
+    int blocksize = array2b->blocksize;
+    char *elem = array2b->data;
+    for (int top = 0; top < array2b->height; top += blocksize) {
+        for (int left = 0; left < array2b->width; left += blocksize) {
+            /* One block, straight through its storage */
+            for (int row = top; row < top + blocksize; row++) {
+                for (int col = left; col < left + blocksize; col++) {
+                    if (row < array2b->height && col < array2b->width) {
+                        apply(col, row, array2b, elem, cl);
+                    }
+                    elem += array2b->size;
+                }
+            }
+        }
+    }
+}
+
+void UArray2b_map_row_major(UArray2b_T array2b, UArray2b_applyfun apply,
+                            void *cl)
+{
+    assert(array2b != NULL && apply != NULL);
+
+    int blocksize = array2b->blocksize;
+    size_t row_bytes = blocksize * array2b->size;
+    for (int row = 0; row < array2b->height; row++) {
+        /* The row's segment in the first block of its block row */
+        char *segment = array2b->data +
+                        ((size_t)(row / blocksize) * array2b->blocks_wide) *
+                        array2b->block_size + (row % blocksize) * row_bytes;
+        for (int left = 0; left < array2b->width; left += blocksize) {
+            int right = left + blocksize < array2b->width
+                        ? left + blocksize : array2b->width;
+            char *elem = segment;
+            for (int col = left; col < right; col++) {
+                apply(col, row, array2b, elem, cl);
+                elem += array2b->size;
+            }
+            segment += array2b->block_size;
+        }
+    }
+}
+
+void UArray2b_free(UArray2b_T *array2b)
+{
+    assert(array2b != NULL && *array2b != NULL);
+    free((*array2b)->data);
+    free(*array2b);
+    *array2b = NULL;
+}
@@ -0,0 +1,51 @@
+/* uarray2b.h */
+
+#ifndef UARRAY2B_H
+#define UARRAY2B_H
+
+#include <stdlib.h>
+
+/* A 2D array stored in blocksize x blocksize blocks. Each block's
+   elements are contiguous, row-major within the block, and blocks are
+   stored row-major. Blocks on the right and bottom edges are allocated
+   whole, so every block has the same layout. */
+typedef struct UArray2b_T *UArray2b_T;
+
+/* Called by the map functions for each element in turn */
+typedef void UArray2b_applyfun(int col, int row, UArray2b_T array2b,
+                               void *elem, void *cl);
+
+/* Creates a new blocked 2D array */
+UArray2b_T UArray2b_new(int width, int height, size_t size, int blocksize);
+
+/* Creates a new blocked 2D array whose blocks are as large as fits in
+   64KB, and at least one element */
+UArray2b_T UArray2b_new_64K_block(int width, int height, size_t size);
+
+/* Returns the width, height, element size and block size */
+int UArray2b_width(UArray2b_T array2b);
+int UArray2b_height(UArray2b_T array2b);
+size_t UArray2b_size(UArray2b_T array2b);
+int UArray2b_blocksize(UArray2b_T array2b);
+
+/* Returns a pointer to the element at (col, row) */
+void *UArray2b_at(UArray2b_T array2b, int col, int row);
+
+/* Returns a pointer to the first element of the block at (block_col,
+   block_row), counted in blocks; its blocksize * blocksize elements
+   follow contiguously */
+void *UArray2b_block(UArray2b_T array2b, int block_col, int block_row);
+
+/* Calls apply on every element a block at a time, in the order they are
+   stored; padding elements past the edges are skipped */
+void UArray2b_map(UArray2b_T array2b, UArray2b_applyfun apply, void *cl);
+
+/* Calls apply on every element in row-major order; each row is walked
+   one contiguous block row segment at a time */
+void UArray2b_map_row_major(UArray2b_T array2b, UArray2b_applyfun apply,
+                            void *cl);
+
+/* Frees the blocked 2D array */
+void UArray2b_free(UArray2b_T *array2b);
+
+#endif /* UARRAY2B_H */